@@ -14,6 +14,11 @@
 #include "aws_iot_config.h"
 #include "aws_iot_mqtt_client_interface.h"
 #include <string.h>
+#include <time.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include "freertos/event_groups.h"
+#include "esp_bit_defs.h"
 #include <cJSON.h>
 #include <aws_iot_shadow_interface.h>
 #include <driver/adc.h>
@@ -21,16 +26,83 @@
 
 #include "iot_wifi_sensor.h"
 #include "volf_wifi_connect.h"
+#include "volf_tls_session.h"
+#include "volf_batch.h"
+#include "volf_delta.h"
+#include "volf_payload.h"
+#include "volf_wait.h"
+#include "volf_profile.h"
+#include "volf_energy.h"
+#include "volf_crash_log.h"
 
 #define uS_TO_S_FACTOR 1000000  /* Conversion factor for micro seconds to seconds */
 #define SLEEP_DURATION_KEY "slp_dur"
+#define CACHED_CONFIG_KEY "config"
 #define NVS_NAME_SENSOR_CONFIG "sensor.config"
 #define SHADOW_CONNECT_RETRIES 5
-#define MAX_SENSOR_PAYLOAD_SIZE 512
+#define SHADOW_GET_TIMEOUT_S 20
+#define SHADOW_UPDATE_TIMEOUT_S 10
+/* Wakes without an accepted shadow update, such as CBOR wakes, after which the shadow is fetched to check its version. */
+#define SHADOW_CHECK_WAKES 24
+/* Gives the client a chance to report its own timeout through the callback before the wait gives up. */
+#define SHADOW_WAIT_MARGIN_MS 1000
+#define MAX_SENSOR_PAYLOAD_SIZE 1024
+#define MAX_TELEMETRY_PAYLOAD_SIZE 3584
+#define MAX_ERROR_LOG_PAYLOAD_SIZE 3072
+#define MAX_CBOR_PAYLOAD_SIZE 2048
+#define MAX_TOPIC_SIZE 192
+#define TELEMETRY_TOPIC_FORMAT "volf/%s/telemetry"
+#define CRASH_LOG_TOPIC_FORMAT "volf/%s/crashlog"
+#define SHADOW_DELTA_TOPIC_FORMAT "$aws/things/%s/shadow/update/delta"
+#define SENSORS_READ_BIT BIT0
+#define SENSOR_TASK_CORE 1
+#define SENSOR_TASK_TIMEOUT_MS 30000
 #define MAX_THING_NAME_SIZE 128
 
 static struct sensor_config *desired_config;
 
+/* The last config received from the shadow, used to take readings before connecting on batching wakes. */
+RTC_DATA_ATTR static struct sensor_config cached_config;
+RTC_DATA_ATTR static bool cached_config_valid = false;
+
+/* The shadow document version the cached config matches. Each update accepted from this device adds one to it. */
+RTC_DATA_ATTR static uint32_t cached_shadow_version = 0;
+static bool shadow_version_gap = false;
+RTC_DATA_ATTR static uint32_t wakes_since_shadow_ack = 0;
+static bool shadow_config_received = false;
+static bool config_changed = false;
+/* How the shadow answered the sensor update of this wake, a timeout until it does. */
+static Shadow_Ack_Status_t sensor_ack_status = SHADOW_ACK_TIMEOUT;
+
+/**
+ * The cached config as stored in NVS so it also survives a restart. It is only used by the firmware version that
+ * wrote it, as the layout of sensor_config may change between versions.
+ */
+struct stored_config {
+    uint32_t firmware_version;
+    uint32_t shadow_version;
+    struct sensor_config config;
+};
+
+static struct sensor_reading wake_reading;
+static bool sampled_this_wake = false;
+/* The reading of this wake was added to the batch before connecting. */
+static bool batched_this_wake = false;
+
+/* Wakes since the last publish that went back to sleep without transmitting, and their total awake time. */
+RTC_DATA_ATTR static uint32_t skipped_transmits = 0;
+RTC_DATA_ATTR static uint32_t skipped_awake_ms = 0;
+
+/* The wake runs as overlapping stages, sensors on one core while the network comes up on the other. */
+static EventGroupHandle_t wake_events;
+static int64_t network_start_us = 0;
+static uint32_t network_time_ms = 0;
+static uint32_t sensor_time_ms = 0;
+
+/* The measured cost of recent wakes and the sleep duration picked from it, 0 when adaptive sleep is off. */
+RTC_DATA_ATTR static struct volf_energy_model energy_model;
+RTC_DATA_ATTR static uint32_t adaptive_sleep_duration = 0;
+
 extern const uint8_t aws_root_ca_pem_start[] asm("_binary_aws_root_ca_pem_start");
 extern const uint8_t aws_root_ca_pem_end[] asm("_binary_aws_root_ca_pem_end");
 extern const uint8_t certificate_pem_crt_start[] asm("_binary_certificate_pem_crt_start");
@@ -44,7 +116,8 @@ extern const uint8_t private_pem_key_end[] asm("_binary_private_pem_key_end");
 uint32_t port = AWS_IOT_MQTT_PORT;
 
 static struct sensor_config *init_sensor_config() {
-    struct sensor_config *config = malloc(sizeof(struct sensor_config));
+    // Zeroed so configs can be compared with memcmp.
+    struct sensor_config *config = calloc(1, sizeof(struct sensor_config));
     config->current_sensor = DEFAULT_CURRENT_SENSOR;
     config->moisture_sensor = DEFAULT_MOISTURE_SENSOR;
     config->temperature_sensor = DEFAULT_TEMPERATURE_SENSOR;
@@ -58,6 +131,29 @@ static struct sensor_config *init_sensor_config() {
     config->battery_high_voltage = DEFAULT_BATTERY_HIGH_VOLTAGE;
     config->sleep_duration = DEFAULT_SLEEP_DURATION;
     config->version = VERSION;
+    config->batch_size = DEFAULT_BATCH_SIZE;
+    config->batch_deadline = DEFAULT_BATCH_DEADLINE;
+    config->batch_moisture_delta = DEFAULT_BATCH_MOISTURE_DELTA;
+    config->batch_temperature_delta = DEFAULT_BATCH_TEMPERATURE_DELTA;
+    config->payload_encoding = DEFAULT_PAYLOAD_ENCODING;
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        config->field_precision[field] = reading_fields[field].default_precision;
+        config->deadbands[field] = 0;
+    }
+    config->max_staleness = DEFAULT_MAX_STALENESS;
+    config->wake_mode = DEFAULT_WAKE_MODE;
+    config->temperature_resolution = DEFAULT_TEMPERATURE_RESOLUTION;
+    config->adaptive_sleep = DEFAULT_ADAPTIVE_SLEEP;
+    config->min_sleep_duration = DEFAULT_MIN_SLEEP_DURATION;
+    config->max_sleep_duration = DEFAULT_MAX_SLEEP_DURATION;
+    config->target_life_days = DEFAULT_TARGET_LIFE_DAYS;
+    config->battery_capacity_mah = DEFAULT_BATTERY_CAPACITY_MAH;
+    config->critical_battery_percent = DEFAULT_CRITICAL_BATTERY_PERCENT;
+    for (int module = 0; module < NUM_LOG_MODULES; module++) {
+        config->log_levels[module] = MAX_LOG_LEVEL;
+    }
+    config->binary_log = DEFAULT_BINARY_LOG;
+    config->crash_log_size = DEFAULT_CRASH_LOG_SIZE;
     return config;
 }
 
@@ -95,140 +191,178 @@ static void store_sleep_duration(uint64_t sleep_duration) {
     nvs_close(nvs_handle);
 }
 
-static void go_to_sleep() {
-    uint64_t timeToSleep;
-    uint64_t timeToSleepInSeconds = read_sleep_duration();
-
-    LOGI("Going to sleep for %" PRId64 " seconds...", timeToSleepInSeconds);
-    hibernate_moisture_sensor();
-    hibernate_temperature_sensor();
-    timeToSleep = timeToSleepInSeconds * uS_TO_S_FACTOR;
-    esp_sleep_enable_timer_wakeup(timeToSleep);
-    esp_deep_sleep_start();
-}
-
-char *create_sensor_payload(struct sensor_config config) {
-    char *payload_str = NULL;
-    uint32_t battery_voltage;
-    uint32_t battery_pct;
-    uint32_t moisture_voltage;
-    uint32_t moisture_pct;
-    float temperature;
-    float humidity;
-    uint32_t ac_current;
+/**
+ * Loads the config stored by the last wake that received a config change. Deep sleep keeps the RTC copy, so NVS is
+ * only read after a restart.
+ */
+static void load_cached_config() {
+    nvs_handle_t nvs_handle;
+    struct stored_config stored;
+    size_t size = sizeof(stored);
+    esp_err_t err;
 
-    cJSON *payload = cJSON_CreateObject();
-    cJSON *state = cJSON_AddObjectToObject(payload, "state");
-    if (state == NULL) {
-        goto end;
+    if (cached_config_valid) {
+        return;
     }
 
-    cJSON *reported = cJSON_AddObjectToObject(state, "reported");
-    if (reported == NULL) {
-        goto end;
+    err = nvs_open(NVS_NAME_SENSOR_CONFIG, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        LOGI("No stored config (%s), the shadow will be fetched.", esp_err_to_name(err));
+        return;
     }
+    err = nvs_get_blob(nvs_handle, CACHED_CONFIG_KEY, &stored, &size);
+    nvs_close(nvs_handle);
 
-    if (cJSON_AddNumberToObject(reported, "version", VERSION) == NULL) {
-        goto end;
+    if (err != ESP_OK || size != sizeof(stored) || stored.firmware_version != VERSION) {
+        LOGI("No stored config for firmware version %d, the shadow will be fetched.", VERSION);
+        return;
     }
-    if (cJSON_AddNumberToObject(reported, "sleepDuration", config.sleep_duration) == NULL) {
-        goto end;
+
+    cached_config = stored.config;
+    cached_shadow_version = stored.shadow_version;
+    cached_config_valid = true;
+    LOGI("Loaded the stored config for shadow version %d.", cached_shadow_version);
+}
+
+static void store_cached_config(const struct sensor_config *config) {
+    nvs_handle_t nvs_handle;
+    struct stored_config stored;
+    esp_err_t err;
+
+    cached_config = *config;
+    cached_config_valid = true;
+
+    stored.firmware_version = VERSION;
+    stored.shadow_version = cached_shadow_version;
+    stored.config = *config;
+
+    err = nvs_open(NVS_NAME_SENSOR_CONFIG, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        LOGE("Error (%s) opening NVS handle for storing the config!", esp_err_to_name(err));
+        return;
     }
-    if (cJSON_AddBoolToObject(reported, "deepSleep", config.deep_sleep) == NULL) {
-        goto end;
+    err = nvs_set_blob(nvs_handle, CACHED_CONFIG_KEY, &stored, sizeof(stored));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
     }
+    volf_handle_error(CONTINUE, "store_cached_config", err);
+    nvs_close(nvs_handle);
+}
 
-    if (config.has_battery) {
-        battery_voltage = read_battery_voltage();
-        battery_pct = convert_battery_voltage_to_pct(battery_voltage, config.battery_low_voltage,
-                                                     config.battery_high_voltage);
+/**
+ * Adds the cost of this wake to the energy model, using the sensors of the cached config.
+ */
+static void record_wake_energy() {
+    int64_t now = esp_timer_get_time();
+    struct volf_energy_wake wake;
 
-        if (cJSON_AddNumberToObject(reported, "batteryVoltage", battery_voltage) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "batteryPercent", battery_pct) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "batteryLowVoltage", config.battery_low_voltage) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "batteryHighVoltage", config.battery_high_voltage) == NULL) {
-            goto end;
-        }
+    if (!cached_config_valid) {
+        return;
     }
+    wake.awake_ms = (uint32_t) (now / 1000);
+    wake.radio_ms = network_start_us != 0 ? (uint32_t) ((now - network_start_us) / 1000) : 0;
+    wake.sensor_ms = sensor_time_ms;
+    wake.moisture_sensor = cached_config.moisture_sensor;
+    wake.temperature_sensor = cached_config.temperature_sensor;
+    wake.sht40_sensor = cached_config.sht40_sensor;
+    wake.current_sensor = cached_config.current_sensor;
+    volf_energy_record_wake(&energy_model, &wake);
+}
 
-    if (config.moisture_sensor) {
-        moisture_voltage = read_soil_moisture_voltage();
+/** Seconds the next deep sleep lasts, the adaptive duration when the battery set one. */
+static uint32_t next_sleep_duration() {
+    return adaptive_sleep_duration != 0 ? adaptive_sleep_duration : (uint32_t) read_sleep_duration();
+}
 
-        moisture_pct = convert_moisture_voltage_to_pct(moisture_voltage, config.moisture_low_voltage,
-                                                       config.moisture_high_voltage);
+static void go_to_sleep() {
+    uint64_t timeToSleep;
+    uint64_t timeToSleepInSeconds = next_sleep_duration();
 
-        if (cJSON_AddNumberToObject(reported, "moistureVoltage", moisture_voltage) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "moisturePercent", moisture_pct) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "moistureLowVoltage", config.moisture_low_voltage) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "moistureHighVoltage", config.moisture_high_voltage) == NULL) {
-            goto end;
-        }
-    }
+    record_wake_energy();
+    volf_flush_errors();
 
-    if (config.temperature_sensor) {
-        temperature = read_temperature();
+    LOGI("Going to sleep for %" PRId64 " seconds...", timeToSleepInSeconds);
+    volf_profile_mark(PROFILE_SLEEP);
+    volf_profile_wake_end();
+    hibernate_moisture_sensor();
+    hibernate_temperature_sensor();
+    volf_log_flush();
+    timeToSleep = timeToSleepInSeconds * uS_TO_S_FACTOR;
+    esp_sleep_enable_timer_wakeup(timeToSleep);
+    esp_deep_sleep_start();
+}
+
+/** Handles RETRY errors, keeping the wake in the phase history that survives the restart. */
+static void restart() {
+    volf_profile_wake_end();
+    esp_restart();
+}
+
+static bool batching_enabled(const struct sensor_config *config) {
+    return config->deep_sleep && config->batch_size > 1;
+}
+
+/**
+ * Reads the number of decimal places to keep for each field in CBOR payloads, e.g. {"temperature": 1}.
+ */
+static void json_to_precision(cJSON *json, struct sensor_config *config) {
+    cJSON *json_tmp;
+    reading_field_t field;
 
-        if (cJSON_AddNumberToObject(reported, "temperature", temperature) == NULL) {
-            goto end;
+    cJSON_ArrayForEach(json_tmp, json) {
+        field = reading_field_by_name(json_tmp->string);
+        if (field == NUM_READING_FIELDS || !cJSON_IsNumber(json_tmp)) {
+            LOGW("Ignoring CBOR precision for unknown field %s", json_tmp->string);
+            continue;
         }
+        config->field_precision[field] = (int8_t) (json_tmp->valueint < 0 ? 0 :
+                                                   json_tmp->valueint > MAX_FIELD_PRECISION ? MAX_FIELD_PRECISION
+                                                                                            : json_tmp->valueint);
     }
+}
 
-    if (config.sht40_sensor) {
-        sht40_read_humidity_and_temperature(&humidity, &temperature);
+/**
+ * Reads the change needed before each field is published again, e.g. {"temperature": 0.5, "moisturePercent": 2}.
+ */
+static void json_to_deadbands(cJSON *json, struct sensor_config *config) {
+    cJSON *json_tmp;
+    reading_field_t field;
 
-        if (cJSON_AddNumberToObject(reported, "temperature", temperature) == NULL) {
-            goto end;
-        }
-        if (cJSON_AddNumberToObject(reported, "humidity", humidity) == NULL) {
-            goto end;
+    cJSON_ArrayForEach(json_tmp, json) {
+        field = reading_field_by_name(json_tmp->string);
+        if (field == NUM_READING_FIELDS || !cJSON_IsNumber(json_tmp) || json_tmp->valuedouble < 0) {
+            LOGW("Ignoring invalid deadband for field %s", json_tmp->string);
+            continue;
         }
+        config->deadbands[field] = (float) json_tmp->valuedouble;
     }
+}
 
-    if (config.current_sensor) {
-        if ((config.adc_channels & ADC_CHANNEL_MASK_0) != 0) {
-            ac_current = read_ac_current(ADC1_CHANNEL_0);
-            LOGI("Current = %d", ac_current);
-            if (cJSON_AddNumberToObject(reported, "acCurrent1", ac_current) == NULL) {
-                goto end;
-            }
-        }
-        if ((config.adc_channels & ADC_CHANNEL_MASK_3) != 0) {
-            ac_current = read_ac_current(ADC1_CHANNEL_3);
-            if (cJSON_AddNumberToObject(reported, "acCurrent2", ac_current) == NULL) {
-                goto end;
-            }
-        }
-        if ((config.adc_channels & ADC_CHANNEL_MASK_6) != 0) {
-            ac_current = read_ac_current(ADC1_CHANNEL_6);
-            if (cJSON_AddNumberToObject(reported, "acCurrent3", ac_current) == NULL) {
-                goto end;
-            }
-        }
-        if ((config.adc_channels & ADC_CHANNEL_MASK_7) != 0) {
-            ac_current = read_ac_current(ADC1_CHANNEL_7);
-            if (cJSON_AddNumberToObject(reported, "acCurrent4", ac_current) == NULL) {
-                goto end;
-            }
+/**
+ * Reads the level of each log module, e.g. {"wifi": "debug", "sensors": "warn"}.
+ */
+static void json_to_log_levels(cJSON *json, struct sensor_config *config) {
+    cJSON *json_tmp;
+    volf_log_module_t module;
+    int level;
+
+    cJSON_ArrayForEach(json_tmp, json) {
+        module = volf_log_module_by_name(json_tmp->string);
+        level = cJSON_IsString(json_tmp) ? volf_log_level_by_name(json_tmp->valuestring) : -1;
+        if (module == NUM_LOG_MODULES || level < 0) {
+            LOGW("Ignoring invalid log level for module %s", json_tmp->string);
+            continue;
         }
+        config->log_levels[module] = (uint8_t) level;
     }
-    payload_str = cJSON_Print(payload);
+}
 
-    LOGI("Final payload contents: %s", payload_str);
-    end:
-    cJSON_Delete(payload);
-    return payload_str;
+static void apply_log_config(const struct sensor_config *config) {
+    for (int module = 0; module < NUM_LOG_MODULES; module++) {
+        volf_log_set_level(module, config->log_levels[module]);
+    }
+    volf_log_set_binary(config->binary_log);
+    volf_crash_log_set_size(config->crash_log_size);
 }
 
 static void json_to_config(cJSON *json, struct sensor_config *config) {
@@ -291,18 +425,288 @@ static void json_to_config(cJSON *json, struct sensor_config *config) {
     if (json_tmp != NULL) {
         config->version = json_tmp->valueint;
     }
+    json_tmp = cJSON_GetObjectItem(json, "batchSize");
+    if (json_tmp != NULL) {
+        config->batch_size = json_tmp->valueint > MAX_BATCH_SIZE ? MAX_BATCH_SIZE : json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "batchDeadline");
+    if (json_tmp != NULL) {
+        config->batch_deadline = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "batchMoistureDelta");
+    if (json_tmp != NULL) {
+        config->batch_moisture_delta = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "batchTemperatureDelta");
+    if (json_tmp != NULL) {
+        config->batch_temperature_delta = (float) json_tmp->valuedouble;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "payloadEncoding");
+    if (cJSON_IsString(json_tmp)) {
+        config->payload_encoding = strcmp(json_tmp->valuestring, "cbor") == 0 ? PAYLOAD_ENCODING_CBOR
+                                                                               : PAYLOAD_ENCODING_JSON;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "cborPrecision");
+    if (json_tmp != NULL) {
+        json_to_precision(json_tmp, config);
+    }
+    json_tmp = cJSON_GetObjectItem(json, "deadbands");
+    if (json_tmp != NULL) {
+        json_to_deadbands(json_tmp, config);
+    }
+    json_tmp = cJSON_GetObjectItem(json, "maxStaleness");
+    if (json_tmp != NULL) {
+        config->max_staleness = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "temperatureResolution");
+    if (json_tmp != NULL) {
+        config->temperature_resolution = json_tmp->valueint < 9 ? 9 : json_tmp->valueint > 12 ? 12
+                                                                                                : json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "adaptiveSleep");
+    if (json_tmp != NULL) {
+        config->adaptive_sleep = cJSON_IsTrue(json_tmp);
+    }
+    json_tmp = cJSON_GetObjectItem(json, "minSleepDuration");
+    if (json_tmp != NULL) {
+        config->min_sleep_duration = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "maxSleepDuration");
+    if (json_tmp != NULL) {
+        config->max_sleep_duration = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "targetLifeDays");
+    if (json_tmp != NULL) {
+        config->target_life_days = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "batteryCapacityMah");
+    if (json_tmp != NULL) {
+        config->battery_capacity_mah = json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "criticalBatteryPercent");
+    if (json_tmp != NULL) {
+        config->critical_battery_percent = json_tmp->valueint < 0 ? 0 : json_tmp->valueint > 100 ? 100
+                                                                                                  : json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "logLevels");
+    if (json_tmp != NULL) {
+        json_to_log_levels(json_tmp, config);
+    }
+    json_tmp = cJSON_GetObjectItem(json, "binaryLog");
+    if (json_tmp != NULL) {
+        config->binary_log = cJSON_IsTrue(json_tmp);
+    }
+    json_tmp = cJSON_GetObjectItem(json, "crashLogSize");
+    if (json_tmp != NULL) {
+        config->crash_log_size = json_tmp->valueint < 0 ? 0 : json_tmp->valueint > MAX_CRASH_LOG_SIZE
+                                                              ? MAX_CRASH_LOG_SIZE : json_tmp->valueint;
+    }
+    json_tmp = cJSON_GetObjectItem(json, "wakeMode");
+    if (cJSON_IsString(json_tmp)) {
+        config->wake_mode = strcmp(json_tmp->valuestring, "sensorFirst") == 0 ? WAKE_MODE_SENSOR_FIRST
+                                                                                : WAKE_MODE_OVERLAPPED;
+    }
+}
+
+/**
+ * Stores the networks in the desired "wifiNetworks", [{"ssid": ..., "password": ...}, ...], for the next Wi-Fi
+ * connect. An empty array goes back to the networks built into the firmware.
+ */
+static void json_to_wifi_networks(cJSON *json) {
+    struct volf_wifi_credential credentials[VOLF_WIFI_MAX_CREDENTIALS];
+    size_t count = 0;
+    int index = 0;
+    cJSON *json_tmp;
+
+    if (!cJSON_IsArray(json)) {
+        return;
+    }
+    cJSON_ArrayForEach(json_tmp, json) {
+        cJSON *ssid = cJSON_GetObjectItem(json_tmp, "ssid");
+        cJSON *password = cJSON_GetObjectItem(json_tmp, "password");
+
+        if (count == VOLF_WIFI_MAX_CREDENTIALS || !cJSON_IsString(ssid) || !cJSON_IsString(password)
+            || strlen(ssid->valuestring) >= sizeof(credentials[count].ssid)
+            || strlen(password->valuestring) >= sizeof(credentials[count].password)) {
+            LOGW("Ignoring Wi-Fi network %d of the shadow.", index++);
+            continue;
+        }
+        strcpy(credentials[count].ssid, ssid->valuestring);
+        strcpy(credentials[count].password, password->valuestring);
+        count++;
+        index++;
+    }
+    volf_handle_error(CONTINUE, "volf_wifi_set_credentials", volf_wifi_set_credentials(credentials, count));
 }
 
 void get_sensor_shadow_callback(const char *thing_name, ShadowActions_t action, Shadow_Ack_Status_t status,
                                 const char *payload, void *context_data) {
-    desired_config = init_sensor_config();
+    struct sensor_config *config = init_sensor_config();
     LOGI("Received json payload for existing shadow:\n %s", payload);
     cJSON *root = cJSON_Parse(payload);
     cJSON *state = cJSON_GetObjectItem(root, "state");
-    json_to_config(cJSON_GetObjectItem(state, "desired"), desired_config);
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    json_to_config(cJSON_GetObjectItem(state, "desired"), config);
+    json_to_wifi_networks(cJSON_GetObjectItem(cJSON_GetObjectItem(state, "desired"), "wifiNetworks"));
+    if (cJSON_IsNumber(version)) {
+        cached_shadow_version = (uint32_t) version->valuedouble;
+    }
+    cJSON_Delete(root);
+
+    config_changed = !cached_config_valid || desired_config == NULL
+                     || memcmp(config, desired_config, sizeof(*config)) != 0;
+    free(desired_config);
+    desired_config = config;
+    wakes_since_shadow_ack = 0;
+    shadow_config_received = true;
+    volf_wait_signal(VOLF_WAIT_SHADOW_GET);
+}
+
+/**
+ * Checks the version of an accepted update against the cached one. Anything newer than the next version means the
+ * shadow was changed while this device wasn't subscribed to its deltas, so the cached config may be stale.
+ */
+static void track_shadow_version(const char *payload) {
+    cJSON *root = cJSON_Parse(payload);
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    uint32_t accepted_version;
+
+    if (cJSON_IsNumber(version)) {
+        accepted_version = (uint32_t) version->valuedouble;
+        if (accepted_version > cached_shadow_version + 1) {
+            LOGI("Shadow version jumped from %d to %d.", cached_shadow_version, accepted_version);
+            shadow_version_gap = true;
+        }
+        cached_shadow_version = accepted_version;
+        wakes_since_shadow_ack = 0;
+    }
     cJSON_Delete(root);
 }
 
+static void sensor_update_callback(const char *thing_name, ShadowActions_t action, Shadow_Ack_Status_t status,
+                                   const char *payload, void *context_data) {
+    if (status == SHADOW_ACK_ACCEPTED) {
+        volf_delta_acked();
+        track_shadow_version(payload);
+    } else {
+        LOGW("Sensor shadow update not accepted, status %d. Changed fields will be sent again.", status);
+    }
+    sensor_ack_status = status;
+    volf_wait_signal(VOLF_WAIT_SENSOR_UPDATE);
+}
+
+static void error_log_update_callback(const char *thing_name, ShadowActions_t action, Shadow_Ack_Status_t status,
+                                      const char *payload, void *context_data) {
+    if (status == SHADOW_ACK_ACCEPTED) {
+        track_shadow_version(payload);
+    }
+    volf_wait_signal(VOLF_WAIT_ERROR_LOG_UPDATE);
+}
+
+/**
+ * Applies the changed desired fields on top of the current config. Deltas are only published while connected, those
+ * sent while asleep show up as a version gap instead.
+ */
+static void shadow_delta_handler(AWS_IoT_Client *client, char *topic, uint16_t topic_len,
+                                 IoT_Publish_Message_Params *params, void *data) {
+    cJSON *root = cJSON_ParseWithLength(params->payload, params->payloadLen);
+    cJSON *state = cJSON_GetObjectItem(root, "state");
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    struct sensor_config merged;
+
+    if (state == NULL || !cJSON_IsNumber(version) || desired_config == NULL) {
+        LOGW("Ignoring shadow delta without state or version.");
+        cJSON_Delete(root);
+        return;
+    }
+
+    LOGI("Received shadow delta for version %d.", version->valueint);
+    // Desired keys the device never reports show up in every delta, only a different config needs storing.
+    merged = *desired_config;
+    json_to_config(state, &merged);
+    json_to_wifi_networks(cJSON_GetObjectItem(state, "wifiNetworks"));
+    cached_shadow_version = (uint32_t) version->valuedouble;
+    if (memcmp(&merged, desired_config, sizeof(merged)) != 0) {
+        *desired_config = merged;
+        config_changed = true;
+    }
+    cJSON_Delete(root);
+}
+
+static void subscribe_to_shadow_delta(AWS_IoT_Client *client, const char *thing_name) {
+    // The client keeps a pointer to the topic for as long as it is subscribed.
+    static char topic[MAX_TOPIC_SIZE];
+
+    snprintf(topic, sizeof(topic), SHADOW_DELTA_TOPIC_FORMAT, thing_name);
+    volf_handle_error(CONTINUE, "subscribe_to_shadow_delta",
+                      aws_iot_mqtt_subscribe(client, topic, (uint16_t) strlen(topic), QOS0, shadow_delta_handler,
+                                             NULL));
+}
+
+static void fetch_shadow_config(AWS_IoT_Client *client, const char *thing_name) {
+    int shadow_get_try = 0;
+    IoT_Error_t rc;
+
+    LOGI("Getting shadow...");
+    shadow_config_received = false;
+    volf_wait_start(VOLF_WAIT_SHADOW_GET);
+    do {
+        rc = aws_iot_shadow_get(client, thing_name, get_sensor_shadow_callback, NULL, SHADOW_GET_TIMEOUT_S, false);
+        shadow_get_try++;
+    } while (shadow_get_try <= SHADOW_CONNECT_RETRIES && rc != SUCCESS);
+    volf_handle_error(RETRY, "aws_iot_shadow_get", rc);
+
+    LOGI("Yielding for shadow...");
+    volf_wait_for(client, VOLF_WAIT_SHADOW_GET, SHADOW_GET_TIMEOUT_S * 1000 + SHADOW_WAIT_MARGIN_MS);
+
+    if (!shadow_config_received) {
+        volf_handle_error(RETRY, "aws_iot_shadow_get", 9999);
+    }
+}
+
+/**
+ * Starts the wake from the cached config, the shadow is only fetched when there is none.
+ */
+static void load_desired_config(AWS_IoT_Client *client, const char *thing_name) {
+    subscribe_to_shadow_delta(client, thing_name);
+    if (!cached_config_valid) {
+        fetch_shadow_config(client, thing_name);
+        return;
+    }
+
+    LOGI("Using the cached config for shadow version %d.", cached_shadow_version);
+    if (desired_config == NULL) {
+        desired_config = init_sensor_config();
+    }
+    *desired_config = cached_config;
+}
+
+/**
+ * Fetches the whole shadow if a version gap was seen during the publish window, or if no shadow update was accepted
+ * for SHADOW_CHECK_WAKES wakes so there was no version to check, and stores any config change, so the next wake
+ * starts from it.
+ */
+static void update_desired_config(AWS_IoT_Client *client, const char *thing_name) {
+    if (shadow_version_gap || wakes_since_shadow_ack >= SHADOW_CHECK_WAKES) {
+        if (!shadow_version_gap) {
+            LOGI("No shadow update accepted for %d wakes, checking the shadow version.", wakes_since_shadow_ack);
+        }
+        shadow_version_gap = false;
+        fetch_shadow_config(client, thing_name);
+    }
+    if (!config_changed) {
+        return;
+    }
+
+    config_changed = false;
+    LOGI("Storing the config for shadow version %d.", cached_shadow_version);
+    if (desired_config->sleep_duration != 0) {
+        store_sleep_duration(desired_config->sleep_duration);
+    }
+    store_cached_config(desired_config);
+    apply_log_config(desired_config);
+}
+
 void connect_to_aws(AWS_IoT_Client *client, char *thing_name) {
     int shadow_connect_try = 0;
     IoT_Error_t rc;
@@ -318,6 +722,7 @@ void connect_to_aws(AWS_IoT_Client *client, char *thing_name) {
 
     LOGI("Shadow Init");
     volf_handle_error(RETRY, "aws_iot_shadow_init", aws_iot_shadow_init(client, &sp));
+    volf_tls_session_install(client);
 
     ShadowConnectParameters_t scp = ShadowConnectParametersDefault;
     scp.pMyThingName = thing_name;
@@ -325,11 +730,13 @@ void connect_to_aws(AWS_IoT_Client *client, char *thing_name) {
     scp.mqttClientIdLen = (uint16_t) strlen(thing_name);
 
     LOGI("Shadow Connect");
+    volf_profile_begin(PROFILE_CONNECT);
     do {
         rc = aws_iot_shadow_connect(client, &scp);
         shadow_connect_try++;
     } while (shadow_connect_try <= SHADOW_CONNECT_RETRIES && rc != SUCCESS);
     volf_handle_error(RETRY, "aws_iot_shadow_connect", rc);
+    volf_profile_end(PROFILE_CONNECT);
 
     /**
      * Enable Auto Reconnect functionality. Minimum and Maximum time of Exponential backoff are set in aws_iot_config.h
@@ -341,152 +748,346 @@ void connect_to_aws(AWS_IoT_Client *client, char *thing_name) {
 }
 
 
-static char *convert_error_logs_to_json(struct volf_errors *errors) {
-    struct volf_error_log current_log;
-    struct volf_publish_attempt current_attempt;
-    char *json_logs = NULL;
+static void publish_error_logs(AWS_IoT_Client *client, const char *thing_name) {
+    static char log_payload[MAX_ERROR_LOG_PAYLOAD_SIZE];
+    struct volf_errors *errors;
+    IoT_Error_t err;
 
-    LOGI("Building json string for %d error logs.", errors->num_error_logs);
-    cJSON *payload = cJSON_CreateObject();
-    cJSON *state = cJSON_AddObjectToObject(payload, "state");
-    if (state == NULL) goto end_error_log_conversion;
+    errors = volf_get_errors();
+    if (create_error_log_payload(errors, log_payload, sizeof(log_payload)) == 0) {
+        LOGE("The error logs do not fit in %d bytes of json!", sizeof(log_payload));
+        volf_handle_error(CONTINUE, "create_error_log_payload", ESP_ERR_INVALID_SIZE);
+        return;
+    }
+    LOGI("Publishing log payload: \n%s", log_payload);
+    volf_wait_start(VOLF_WAIT_ERROR_LOG_UPDATE);
+    err = aws_iot_shadow_update(client, thing_name, log_payload, error_log_update_callback, NULL,
+                                SHADOW_UPDATE_TIMEOUT_S, false);
+    LOGI("Received rc from shadow update, %d", err);
+    if (err == SUCCESS) {
+        volf_wait_for(client, VOLF_WAIT_ERROR_LOG_UPDATE, SHADOW_UPDATE_TIMEOUT_S * 1000 + SHADOW_WAIT_MARGIN_MS);
+        LOGI("Successfully published logs. Clearing local copy.");
+        volf_clear_errors();
+    }
+}
 
-    cJSON *reported = cJSON_AddObjectToObject(state, "reported");
-    if (reported == NULL) goto end_error_log_conversion;
+/**
+ * Publishes the log captured during the last failed wake, compressed, on the crash log topic. A failure only costs the
+ * upload, the capture is kept for the next wake.
+ */
+static void publish_crash_log(AWS_IoT_Client *client, const char *thing_name) {
+    static uint8_t crash_log_payload[MAX_CRASH_LOG_PAYLOAD_SIZE];
+    char topic[MAX_TOPIC_SIZE];
+    IoT_Publish_Message_Params params;
+    size_t len;
+    IoT_Error_t err;
 
-    cJSON *error_logs = cJSON_AddArrayToObject(reported, "els");
-    if (error_logs == NULL) goto end_error_log_conversion;
+    len = volf_crash_log_get_payload(crash_log_payload, sizeof(crash_log_payload));
+    if (len == 0) {
+        volf_handle_error(CONTINUE, "volf_crash_log_get_payload", ESP_ERR_INVALID_SIZE);
+        volf_crash_log_clear();
+        return;
+    }
 
-    for (int i = 0; i < errors->num_error_logs; i++) {
-        current_log = errors->error_logs[i];
-        cJSON *error_log = cJSON_CreateObject();
-        if (error_log == NULL) goto end_error_log_conversion;
-        cJSON_AddItemToArray(error_logs, error_log);
+    snprintf(topic, sizeof(topic), CRASH_LOG_TOPIC_FORMAT, thing_name);
+    params.qos = QOS1;
+    params.isRetained = 0;
+    params.payload = crash_log_payload;
+    params.payloadLen = len;
+    err = aws_iot_mqtt_publish(client, topic, (uint16_t) strlen(topic), &params);
+    volf_handle_error(CONTINUE, "publish_crash_log", err);
+    if (err == SUCCESS) {
+        LOGI("Published %d bytes of crash log.", len);
+        volf_crash_log_clear();
+    }
+}
+
+/**
+ * Publishes the CBOR encoded reading on the telemetry topic. The shadow only accepts JSON, so CBOR payloads bypass it
+ * and the backend decodes them, writing the sensor fields into the shadow and keeping the rest as telemetry.
+ */
+static bool publish_sensor_reading_cbor(AWS_IoT_Client *client, const char *thing_name,
+                                        const struct sensor_config *config, const struct sensor_reading *reading) {
+    static uint8_t cbor_payload[MAX_CBOR_PAYLOAD_SIZE];
+    char topic[MAX_TOPIC_SIZE];
+    IoT_Publish_Message_Params params;
+    size_t len;
+
+    len = create_sensor_payload_cbor(config, reading, cbor_payload, sizeof(cbor_payload));
+    if (len == 0) {
+        return false;
+    }
 
-        cJSON *publish_attempts = cJSON_AddArrayToObject(error_log, "pas");
-        if (publish_attempts == NULL) goto end_error_log_conversion;
+    snprintf(topic, sizeof(topic), TELEMETRY_TOPIC_FORMAT, thing_name);
+    params.qos = QOS1;
+    params.isRetained = 0;
+    params.payload = cbor_payload;
+    params.payloadLen = len;
+    // A QoS 1 publish only returns once the broker acknowledged it.
+    volf_handle_error(RETRY, "aws_iot_mqtt_publish",
+                      aws_iot_mqtt_publish(client, topic, (uint16_t) strlen(topic), &params));
+    volf_delta_acked();
+    return true;
+}
 
-        for (int j = 0; j < current_log.num_publish_attempts; j++) {
-            current_attempt = current_log.publish_attempts[j];
-            cJSON *publish_attempt = cJSON_CreateObject();
-            if (publish_attempt == NULL) goto end_error_log_conversion;
-            cJSON_AddItemToArray(publish_attempts, publish_attempt);
+/**
+ * Publishes the telemetry fields, batched samples and phase timings on the telemetry topic. Left in the shadow they
+ * would grow its update acknowledgements and full documents past the MQTT receive buffer and JSON token limit.
+ */
+static bool publish_telemetry(AWS_IoT_Client *client, const char *thing_name, const struct sensor_reading *reading) {
+    static char telemetry_payload[MAX_TELEMETRY_PAYLOAD_SIZE];
+    char topic[MAX_TOPIC_SIZE];
+    IoT_Publish_Message_Params params;
+    size_t len;
+
+    len = create_telemetry_payload(reading, telemetry_payload, sizeof(telemetry_payload));
+    if (len == 0) {
+        volf_handle_error(CONTINUE, "create_telemetry_payload", ESP_ERR_INVALID_SIZE);
+        return false;
+    }
 
-            if (cJSON_AddNumberToObject(publish_attempt, "r", current_attempt.runtime) == NULL)
-                goto end_error_log_conversion;
+    snprintf(topic, sizeof(topic), TELEMETRY_TOPIC_FORMAT, thing_name);
+    params.qos = QOS1;
+    params.isRetained = 0;
+    params.payload = telemetry_payload;
+    params.payloadLen = len;
+    // A QoS 1 publish only returns once the broker acknowledged it.
+    volf_handle_error(RETRY, "aws_iot_mqtt_publish",
+                      aws_iot_mqtt_publish(client, topic, (uint16_t) strlen(topic), &params));
+    return true;
+}
 
-            if (cJSON_AddStringToObject(publish_attempt, "rc", current_attempt.retry_context) == NULL)
-                goto end_error_log_conversion;
+static bool has_shadow_fields(const struct sensor_reading *reading) {
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (reading_has(reading, field) && !reading_is_telemetry(field)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-            if (cJSON_AddStringToObject(publish_attempt, "ac", current_attempt.abort_context) == NULL)
-                goto end_error_log_conversion;
+static bool publish_sensor_reading(AWS_IoT_Client *client, const char *thing_name,
+                                   const struct sensor_config *config, const struct sensor_reading *reading) {
+    static char sensor_payload[MAX_SENSOR_PAYLOAD_SIZE];
 
-            cJSON *continue_contexts = cJSON_AddArrayToObject(publish_attempt, "cc");
-            if (continue_contexts == NULL) goto end_error_log_conversion;
+    if (reading->present == 0 && volf_batch_count() == 0) {
+        LOGI("No field changed beyond its deadband, nothing to publish.");
+        return true;
+    }
 
-            for (int k = 0; k < current_attempt.num_continue_contexts; k++) {
-                cJSON *continue_context = cJSON_CreateString(current_attempt.continue_contexts[k]);
-                if (continue_context == NULL) goto end_error_log_conversion;
-                cJSON_AddItemToArray(continue_contexts, continue_context);
-            }
+    if (config->payload_encoding == PAYLOAD_ENCODING_CBOR) {
+        if (publish_sensor_reading_cbor(client, thing_name, config, reading)) {
+            return true;
         }
+        LOGW("Unable to encode the reading as CBOR, publishing it as JSON instead.");
     }
 
-    json_logs = cJSON_PrintUnformatted(payload);
-    if (json_logs == NULL) {
-        LOGE("Failed to print error log json payload.");
+    if (!publish_telemetry(client, thing_name, reading)) {
+        return false;
+    }
+    if (!has_shadow_fields(reading)) {
+        volf_delta_acked();
+        return true;
+    }
+    if (create_sensor_payload(reading, sensor_payload, sizeof(sensor_payload)) == 0) {
+        volf_handle_error(CONTINUE, "create_sensor_payload", ESP_ERR_INVALID_SIZE);
+        return false;
     }
-    end_error_log_conversion:
-    cJSON_Delete(payload);
-    return json_logs;
+    sensor_ack_status = SHADOW_ACK_TIMEOUT;
+    volf_wait_start(VOLF_WAIT_SENSOR_UPDATE);
+    volf_handle_error(RETRY, "aws_iot_shadow_update",
+                      aws_iot_shadow_update(client, thing_name, sensor_payload, sensor_update_callback, NULL,
+                                            SHADOW_UPDATE_TIMEOUT_S, false));
+    volf_wait_for(client, VOLF_WAIT_SENSOR_UPDATE, SHADOW_UPDATE_TIMEOUT_S * 1000 + SHADOW_WAIT_MARGIN_MS);
+    // A rejected or unanswered update keeps the batch, to be sent again on the next wake that publishes.
+    return sensor_ack_status == SHADOW_ACK_ACCEPTED;
 }
 
-static void publish_error_logs(AWS_IoT_Client *client, const char *thing_name) {
-    char *log_payload;
-    struct volf_errors *errors;
-    IoT_Error_t err;
+/**
+ * True if both configs read the same sensors the same way, so a reading taken with one is valid for the other.
+ */
+static bool same_sensors(const struct sensor_config *a, const struct sensor_config *b) {
+    return a->current_sensor == b->current_sensor && a->moisture_sensor == b->moisture_sensor
+           && a->temperature_sensor == b->temperature_sensor && a->sht40_sensor == b->sht40_sensor
+           && a->has_battery == b->has_battery && a->adc_channels == b->adc_channels
+           && a->moisture_low_voltage == b->moisture_low_voltage
+           && a->moisture_high_voltage == b->moisture_high_voltage
+           && a->battery_low_voltage == b->battery_low_voltage && a->battery_high_voltage == b->battery_high_voltage
+           && a->temperature_resolution == b->temperature_resolution;
+}
 
-    errors = volf_get_errors();
-    log_payload = convert_error_logs_to_json(errors);
-    if (log_payload == NULL) {
-        LOGE("An error occurred while converting the logs to json!");
+static void read_wake_sensors(const struct sensor_config *config) {
+    int64_t start = esp_timer_get_time();
+
+    reading_init(&wake_reading);
+    read_sensors(config, &wake_reading);
+    sensor_time_ms = (uint32_t) ((esp_timer_get_time() - start) / 1000);
+    LOGI("Sensors read in %d ms.", sensor_time_ms);
+}
+
+static void sensor_task(void *param) {
+    read_wake_sensors(&cached_config);
+    xEventGroupSetBits(wake_events, SENSORS_READ_BIT);
+    vTaskDelete(NULL);
+}
+
+/**
+ * Starts reading the sensors with the cached config while the network connects. Without a cached config the sensors
+ * can only be read once the shadow has been fetched.
+ */
+static void start_sensor_stage() {
+    wake_events = xEventGroupCreate();
+    if (sampled_this_wake || !cached_config_valid) {
+        xEventGroupSetBits(wake_events, SENSORS_READ_BIT);
         return;
     }
-    LOGI("Publishing log payload: \n%s", log_payload);
-    err = aws_iot_shadow_update(client, thing_name, log_payload, NULL, NULL, 10, false);
-    LOGI("Received rc from shadow update, %d", err);
-    volf_handle_error(CONTINUE, "aws_iot_shadow_yield_3", aws_iot_shadow_yield(client, 5000));
-    if (err == SUCCESS) {
-        LOGI("Successfully published logs. Clearing local copy.");
-        volf_clear_errors();
+
+    sampled_this_wake = true;
+    if (xTaskCreatePinnedToCore(&sensor_task, "sensor_task", 4096, NULL, 5, NULL, SENSOR_TASK_CORE) != pdPASS) {
+        volf_handle_error(CONTINUE, "sensor_task", ESP_ERR_NO_MEM);
+        sampled_this_wake = false;
+        xEventGroupSetBits(wake_events, SENSORS_READ_BIT);
+    }
+}
+
+static void wait_for_sensor_stage() {
+    EventBits_t bits = xEventGroupWaitBits(wake_events, SENSORS_READ_BIT, pdFALSE, pdTRUE,
+                                           SENSOR_TASK_TIMEOUT_MS / portTICK_RATE_MS);
+    if ((bits & SENSORS_READ_BIT) == 0) {
+        volf_handle_error(RETRY, "sensor_task", ESP_ERR_TIMEOUT);
+    }
+}
+
+/**
+ * Reports the shadow response latencies. The sensor update of this wake is still to come, so it is the previous one.
+ * Few wakes get the shadow, the latency of a get is only reported by the first reading after it.
+ */
+static void set_wait_times(struct sensor_reading *reading) {
+    if (volf_wait_get_time_ms(VOLF_WAIT_SHADOW_GET) != 0) {
+        reading_set(reading, READING_SHADOW_GET_MS, volf_wait_get_time_ms(VOLF_WAIT_SHADOW_GET));
+        volf_wait_clear_time(VOLF_WAIT_SHADOW_GET);
+    }
+    if (volf_wait_get_time_ms(VOLF_WAIT_SENSOR_UPDATE) != 0) {
+        reading_set(reading, READING_SHADOW_UPDATE_MS, volf_wait_get_time_ms(VOLF_WAIT_SENSOR_UPDATE));
+    }
+}
+
+/**
+ * Picks the sleep duration from the energy model when adaptive sleep is on and the battery was read, reporting it in
+ * place of the configured one along with the predicted runtime left.
+ */
+static void update_adaptive_sleep(const struct sensor_config *config, struct sensor_reading *reading) {
+    struct volf_energy_budget budget;
+
+    if (!config->adaptive_sleep || !config->deep_sleep || !reading_has(reading, READING_BATTERY_PERCENT)) {
+        adaptive_sleep_duration = 0;
+        return;
     }
+
+    budget.capacity_mah = config->battery_capacity_mah;
+    budget.battery_percent = reading->values[READING_BATTERY_PERCENT];
+    budget.target_life_days = config->target_life_days;
+    budget.min_sleep_duration = config->min_sleep_duration;
+    budget.max_sleep_duration = config->max_sleep_duration;
+    budget.critical_battery_percent = config->critical_battery_percent;
+
+    adaptive_sleep_duration = volf_energy_sleep_duration(&energy_model, &budget);
+    reading_set(reading, READING_SLEEP_DURATION, adaptive_sleep_duration);
+    reading_set(reading, READING_RUNTIME_HOURS,
+                volf_energy_runtime_hours(&energy_model, &budget, adaptive_sleep_duration));
+    LOGI("Battery at %.0f%%, sleeping for %d seconds.", budget.battery_percent, adaptive_sleep_duration);
 }
 
 _Noreturn void read_and_report_task(void *param) {
-    int shadow_get_try = 0;
-    IoT_Error_t rc;
-    char *sensor_payload;
     char thing_name[MAX_THING_NAME_SIZE];
     AWS_IoT_Client client;
     char *node_address = volf_addr_str(volf_get_addr());
-    int yields_for_shadow = 30;
 
     snprintf(thing_name, MAX_THING_NAME_SIZE, "Sensor_%s", node_address);
+    volf_wait_init();
 
     while (true) {
+        // Counted here as update_desired_config() runs twice on a wake that connects.
+        wakes_since_shadow_ack++;
         if (client.clientStatus.clientState < CLIENT_STATE_CONNECTED_IDLE || client.clientStatus.clientState > CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN) {
             connect_to_aws(&client, thing_name);
+            volf_profile_begin(PROFILE_SHADOW);
+            load_desired_config(&client, thing_name);
+            volf_profile_end(PROFILE_SHADOW);
 
-            LOGI("Getting shadow...");
-            do {
-                rc = aws_iot_shadow_get(&client, thing_name, get_sensor_shadow_callback, NULL, 20, false);
-                shadow_get_try++;
-            } while (shadow_get_try <= SHADOW_CONNECT_RETRIES && rc != SUCCESS);
-            volf_handle_error(RETRY, "aws_iot_shadow_get", rc);
-
-            LOGI("Yielding for shadow...");
-
-            while (desired_config == NULL && yields_for_shadow > 0) {
-                volf_handle_error(CONTINUE, "aws_iot_shadow_yield_1", aws_iot_shadow_yield(&client, 1000));
-                yields_for_shadow--;
+            if (network_time_ms == 0) {
+                network_time_ms = (uint32_t) ((esp_timer_get_time() - network_start_us) / 1000);
             }
 
-            if (desired_config == NULL) {
-                volf_handle_error(RETRY, "aws_iot_shadow_get", 9999);
-            }
-
-            if (desired_config->sleep_duration != 0) {
-                store_sleep_duration(desired_config->sleep_duration);
+            wait_for_sensor_stage();
+            if (sampled_this_wake && !same_sensors(&cached_config, desired_config)) {
+                LOGI("Sensor config changed in the shadow, reading the sensors again.");
+                sampled_this_wake = false;
             }
+            update_desired_config(&client, thing_name);
         } else {
             LOGI("Already connected to AWS. Reading sensor data...");
         }
 
-        sensor_payload = create_sensor_payload(*desired_config);
-
-        volf_handle_error(RETRY, "aws_iot_shadow_update",
-                          aws_iot_shadow_update(&client, thing_name, sensor_payload, NULL, NULL, 10, false));
-
-        volf_handle_error(CONTINUE, "aws_iot_shadow_yield_2", aws_iot_shadow_yield(&client, 1000));
+        if (!sampled_this_wake) {
+            read_wake_sensors(desired_config);
+            if (batching_enabled(desired_config) && batched_this_wake) {
+                // Read again for a changed sensor config, the wake still adds a single reading.
+                volf_batch_replace_newest(&wake_reading);
+            } else if (batching_enabled(desired_config)) {
+                volf_batch_add(&wake_reading);
+            }
+        }
+        sampled_this_wake = false;
+        batched_this_wake = false;
+
+        reading_add_config(desired_config, &wake_reading);
+        reading_set(&wake_reading, READING_WIFI_CONNECT_MS, volf_wifi_get_connect_time_ms());
+        reading_set(&wake_reading, READING_FAST_CONNECT, volf_wifi_used_fast_connect());
+        reading_set(&wake_reading, READING_TLS_HANDSHAKE_MS, volf_tls_get_handshake_time_ms());
+        reading_set(&wake_reading, READING_TLS_RESUMED, volf_tls_session_resumed());
+        reading_set(&wake_reading, READING_SENSOR_MS, sensor_time_ms);
+        reading_set(&wake_reading, READING_NETWORK_MS, network_time_ms);
+        reading_set(&wake_reading, READING_AWAKE_MS, (uint32_t) (esp_timer_get_time() / 1000));
+        reading_set(&wake_reading, READING_SKIPPED_TRANSMITS, skipped_transmits);
+        reading_set(&wake_reading, READING_SKIPPED_AWAKE_MS, skipped_awake_ms);
+        set_wait_times(&wake_reading);
+        update_adaptive_sleep(desired_config, &wake_reading);
+        volf_delta_filter(desired_config, &wake_reading);
+
+        volf_profile_begin(PROFILE_PUBLISH);
+        if (publish_sensor_reading(&client, thing_name, desired_config, &wake_reading)) {
+            volf_batch_sent();
+            volf_profile_sent();
+            skipped_transmits = 0;
+            skipped_awake_ms = 0;
+        }
+        volf_profile_end(PROFILE_PUBLISH);
+        volf_profile_set_link(volf_wifi_get_rssi(), volf_wifi_get_reconnect_count());
 
         if (volf_errors_available()) {
             publish_error_logs(&client, thing_name);
         }
+        if (volf_crash_log_pending()) {
+            publish_crash_log(&client, thing_name);
+        }
+
+        update_desired_config(&client, thing_name);
 
         if (desired_config->version > VERSION) {
             install_ota_update(node_address, desired_config->version);
         }
 
-        if (sensor_payload != NULL) {
-            free(sensor_payload);
-        }
-
         if (desired_config->deep_sleep) {
             LOGI("Successfully published sensor reading. Going to sleep...");
             go_to_sleep();
         } else {
             LOGI("Successfully published sensor reading. Resting for %d seconds.", desired_config->sleep_duration);
+            volf_profile_mark(PROFILE_SLEEP);
+            volf_profile_wake_end();
+            volf_flush_errors();
             vTaskDelay((desired_config->sleep_duration * 1000) / portTICK_RATE_MS);
+            volf_profile_wake_start();
         }
     }
 }
@@ -508,6 +1109,44 @@ static void verify_ota_update() {
     }
 }
 
+/** Sensor first mode reads the sensors before connecting and only connects to send a changed reading. */
+static bool sensor_first_enabled(const struct sensor_config *config) {
+    return config->deep_sleep && config->wake_mode == WAKE_MODE_SENSOR_FIRST;
+}
+
+static void skip_transmit() {
+    skipped_transmits++;
+    skipped_awake_ms += (uint32_t) (esp_timer_get_time() / 1000);
+    LOGI("Skipped %d transmits, awake for %d ms in total. Going back to sleep.", skipped_transmits,
+         skipped_awake_ms);
+    go_to_sleep();
+}
+
+/**
+ * Reads the sensors with the radio still off when batching or in sensor first mode, and goes back to sleep without
+ * starting Wi-Fi if the reporting policy says the reading doesn't need to be sent yet.
+ */
+static void sample_before_connecting() {
+    if (!cached_config_valid || (!batching_enabled(&cached_config) && !sensor_first_enabled(&cached_config))) {
+        return;
+    }
+
+    read_wake_sensors(&cached_config);
+    sampled_this_wake = true;
+
+    if (batching_enabled(&cached_config)) {
+        volf_batch_add(&wake_reading);
+        batched_this_wake = true;
+        if (!volf_batch_should_flush(&cached_config, next_sleep_duration())) {
+            LOGI("Batched reading %d of %d.", volf_batch_count(), cached_config.batch_size);
+            skip_transmit();
+        }
+    } else if (!volf_delta_has_changes(&cached_config, &wake_reading) && !volf_errors_available()) {
+        LOGI("No reading changed beyond its deadband.");
+        skip_transmit();
+    }
+}
+
 static void init_wifi() {
     LOGI("Initializing WIFI...");
     volf_handle_error(RETRY, "esp_netif_init", esp_netif_init());
@@ -518,9 +1157,12 @@ static void init_wifi() {
 }
 
 void app_main(void) {
+    volf_log_init();
+    volf_profile_wake_start();
     LOGI("Starting main, firmware version is %d\n", VERSION);
 
     /* Initialize NVS — it is used to store PHY calibration data and whether an update is available*/
+    volf_profile_begin(PROFILE_NVS_INIT);
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         err = nvs_flash_erase();
@@ -531,14 +1173,24 @@ void app_main(void) {
     if (err != ESP_OK) {
         LOGE("Unable to initialize flash! err=%s", esp_err_to_name(err));
     }
+    volf_profile_end(PROFILE_NVS_INIT);
 
     volf_error_init();
-    volf_register_error_handler(RETRY, esp_restart);
+    volf_register_error_handler(RETRY, restart);
     volf_register_error_handler(ABORT, go_to_sleep);
 
+    load_cached_config();
+    if (cached_config_valid) {
+        apply_log_config(&cached_config);
+    }
+    sample_before_connecting();
+
+    start_sensor_stage();
+
+    network_start_us = esp_timer_get_time();
     init_wifi();
 
     verify_ota_update();
 
-    xTaskCreatePinnedToCore(&read_and_report_task, "read_and_report_task", 18432, NULL, 5, NULL, 1);
+    xTaskCreatePinnedToCore(&read_and_report_task, "read_and_report_task", 22528, NULL, 5, NULL, 1);
 }
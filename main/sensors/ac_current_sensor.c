@@ -3,76 +3,161 @@
 
 #include <freertos/FreeRTOS.h>
 #include <driver/adc.h>
-#include <driver/rtc_io.h>
+#include <driver/i2s.h>
 #include <freertos/task.h>
-#include "esp_adc_cal.h"
 #include "esp_log.h"
+#include "volf_adc.h"
+#include "volf_error.h"
+#include "volf_rms.h"
 #include "volf_sensors.h"
 
 #define CURRENT_SENSOR_ADC_ATTENUATION ADC_ATTEN_DB_11
 #define CURRENT_SENSOR_ADC_UNIT ADC_UNIT_1
-#define CURRENT_SENSOR_BIT_WIDTH ADC_WIDTH_BIT_12
+#define CURRENT_SENSOR_BIT_WIDTH VOLF_ADC_WIDTH
 #define AC_DETECTION_RANGE 20
-#define V_REF 1100  // ADC reference voltage
 
-static bool adc_chars_initialized = false;
-
-
-static esp_adc_cal_characteristics_t *init_adc_for_current() {
-    esp_adc_cal_characteristics_t *adc_chars;
-
-    // Characterize ADC at particular attenuation
-    adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t));
-    esp_adc_cal_characterize(CURRENT_SENSOR_ADC_UNIT, CURRENT_SENSOR_ADC_ATTENUATION, CURRENT_SENSOR_BIT_WIDTH, V_REF,
-                             adc_chars);
-
-    // Configure ADC bit width
-    //adc_set_data_width(CURRENT_SENSOR_ADC_UNIT, CURRENT_SENSOR_BIT_WIDTH);
-    adc1_config_width(CURRENT_SENSOR_BIT_WIDTH);
-    adc1_config_channel_atten(ADC1_CHANNEL_0, CURRENT_SENSOR_ADC_ATTENUATION);
-    adc1_config_channel_atten(ADC1_CHANNEL_3, CURRENT_SENSOR_ADC_ATTENUATION);
-    adc1_config_channel_atten(ADC1_CHANNEL_6, CURRENT_SENSOR_ADC_ATTENUATION);
-    adc1_config_channel_atten(ADC1_CHANNEL_7, CURRENT_SENSOR_ADC_ATTENUATION);
-
-    return adc_chars;
+/**
+ * The ADC is sampled continuously by the I2S peripheral, which scans all configured channels and writes the samples
+ * into two DMA buffers, one filling while the other is processed. The total rate is split between the channels.
+ */
+#define AC_SAMPLE_I2S_NUM I2S_NUM_0
+#define AC_SAMPLE_RATE_HZ 20000
+#define AC_DMA_BUFFER_COUNT 2
+#define AC_DMA_BUFFER_SAMPLES 1000
+#define AC_READ_TIMEOUT_MS 100
+#define MAINS_FREQUENCY_HZ 60
+#define MAINS_CYCLES 6
+/* Each 16 bit sample holds the channel number in the top 4 bits and the 12 bit conversion result. */
+#define SAMPLE_CHANNEL(sample) (((sample) >> 12) & 0x0F)
+#define SAMPLE_VALUE(sample) ((sample) & 0x0FFF)
+
+static const adc1_channel_t current_channels[] = {ADC1_CHANNEL_0, ADC1_CHANNEL_3, ADC1_CHANNEL_6, ADC1_CHANNEL_7};
+#define NUM_CURRENT_CHANNELS (sizeof(current_channels) / sizeof(current_channels[0]))
+
+static uint16_t dma_samples[AC_DMA_BUFFER_SAMPLES];
+
+static esp_err_t start_sampling(const adc_digi_pattern_table_t *pattern, uint32_t pattern_len) {
+    esp_err_t rc;
+    i2s_config_t i2s_config = {
+            .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+            .sample_rate = AC_SAMPLE_RATE_HZ,
+            .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+            .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+            .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+            .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+            .dma_buf_count = AC_DMA_BUFFER_COUNT,
+            .dma_buf_len = AC_DMA_BUFFER_SAMPLES,
+            .use_apll = false,
+    };
+    adc_digi_config_t digi_config = {
+            .conv_limit_en = false,
+            .conv_limit_num = 0,
+            .adc1_pattern_len = pattern_len,
+            .adc2_pattern_len = 0,
+            .adc1_pattern = (adc_digi_pattern_table_t *) pattern,
+            .adc2_pattern = NULL,
+            .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+            .format = ADC_DIGI_FORMAT_12BIT,
+    };
+
+    volf_adc_begin_continuous();
+    if ((rc = i2s_driver_install(AC_SAMPLE_I2S_NUM, &i2s_config, 0, NULL)) != ESP_OK) {
+        volf_adc_end_continuous();
+        return rc;
+    }
+    // The I2S driver configures a single channel, the pattern table then extends the scan to all of them.
+    if ((rc = i2s_set_adc_mode(CURRENT_SENSOR_ADC_UNIT, pattern[0].channel)) != ESP_OK
+        || (rc = adc_digi_controller_config(&digi_config)) != ESP_OK
+        || (rc = i2s_adc_enable(AC_SAMPLE_I2S_NUM)) != ESP_OK) {
+        i2s_driver_uninstall(AC_SAMPLE_I2S_NUM);
+        volf_adc_end_continuous();
+    }
+    return rc;
 }
 
-uint32_t read_ac_current(adc1_channel_t channel) {
-    uint32_t virtual_voltage_value;
-    uint32_t reading;
-    uint32_t raw_voltage;
-    uint32_t voltage = 0;
-
-
-
-    for (int i = 0; i < 15; i++)
-    {
-        esp_adc_cal_characteristics_t *adc_chars = init_adc_for_current();
-        reading = adc1_get_raw(channel);
-//        LOGI("Received reading value of %d", reading);
-
-        raw_voltage = esp_adc_cal_raw_to_voltage(reading, adc_chars);
-
+static void stop_sampling() {
+    i2s_adc_disable(AC_SAMPLE_I2S_NUM);
+    i2s_driver_uninstall(AC_SAMPLE_I2S_NUM);
+    volf_adc_end_continuous();
+}
 
-        //esp_adc_cal_get_voltage((adc_channel_t) channel, adc_chars, &reading);
-        voltage += raw_voltage;
+/** Converts the RMS voltage at the ADC, already without the sensor's DC offset, to the RMS current. */
+static uint32_t convert_to_current(uint32_t millivolts) {
+    /*The circuit is amplified by 2 times, so it is divided by 2.*/
+    return millivolts * AC_DETECTION_RANGE / 2;
+}
 
-        free(adc_chars);
-        vTaskDelay(1 / portTICK_RATE_MS);
+void read_ac_currents(uint8_t adc_channels, uint32_t currents[ADC1_CHANNEL_MAX]) {
+    adc_digi_pattern_table_t pattern[NUM_CURRENT_CHANNELS];
+    struct volf_rms rms[ADC1_CHANNEL_MAX];
+    uint32_t pattern_len = 0;
+    uint32_t window;
+    uint32_t max_reads;
+    uint32_t channel;
+    size_t bytes_read;
+    bool done = false;
+    esp_err_t rc;
+
+    for (int i = 0; i < ADC1_CHANNEL_MAX; i++) {
+        currents[i] = 0;
+    }
+    for (int i = 0; i < NUM_CURRENT_CHANNELS; i++) {
+        if ((adc_channels & (1 << current_channels[i])) == 0) {
+            continue;
+        }
+        rc = volf_adc_reserve(current_channels[i], CURRENT_SENSOR_ADC_ATTENUATION, "ac_current");
+        if (rc != ESP_OK) {
+            volf_handle_error(CONTINUE, "ac_current_adc_reserve", rc);
+            continue;
+        }
+        pattern[pattern_len].atten = CURRENT_SENSOR_ADC_ATTENUATION;
+        pattern[pattern_len].bit_width = CURRENT_SENSOR_BIT_WIDTH;
+        pattern[pattern_len].channel = current_channels[i];
+        pattern_len++;
+    }
+    if (pattern_len == 0) {
+        return;
     }
 
-    voltage = voltage / 15;
-
-    voltage = voltage * 736;
-
-//    LOGI("Peak voltage: %d", voltage);
+    window = volf_rms_window(AC_SAMPLE_RATE_HZ / pattern_len, MAINS_FREQUENCY_HZ, MAINS_CYCLES);
+    for (int i = 0; i < ADC1_CHANNEL_MAX; i++) {
+        volf_rms_init(&rms[i], window);
+    }
+    // Enough DMA buffers for twice the window, in case the scan doesn't split evenly between the channels.
+    max_reads = 2 * window * pattern_len / AC_DMA_BUFFER_SAMPLES + 2;
 
-    /*The circuit is amplified by 2 times, so it is divided by 2.*/
-    virtual_voltage_value = voltage / 1024 / 2;
+    if (start_sampling(pattern, pattern_len) != ESP_OK) {
+        volf_handle_error(CONTINUE, "ac_current_start_sampling", ESP_FAIL);
+        return;
+    }
 
-//    LOGI("Virtual voltage after adjustment: %d", virtual_voltage_value);
+    // The first buffer holds samples converted before the pattern was applied, discard it.
+    i2s_read(AC_SAMPLE_I2S_NUM, dma_samples, sizeof(dma_samples), &bytes_read, AC_READ_TIMEOUT_MS / portTICK_RATE_MS);
+
+    for (uint32_t read = 0; read < max_reads && !done; read++) {
+        if (i2s_read(AC_SAMPLE_I2S_NUM, dma_samples, sizeof(dma_samples), &bytes_read,
+                     AC_READ_TIMEOUT_MS / portTICK_RATE_MS) != ESP_OK || bytes_read == 0) {
+            volf_handle_error(CONTINUE, "ac_current_i2s_read", ESP_ERR_TIMEOUT);
+            break;
+        }
+        for (size_t i = 0; i < bytes_read / sizeof(uint16_t); i++) {
+            channel = SAMPLE_CHANNEL(dma_samples[i]);
+            if (channel < ADC1_CHANNEL_MAX) {
+                volf_rms_add(&rms[channel],
+                             volf_adc_raw_to_mv(CURRENT_SENSOR_ADC_ATTENUATION, SAMPLE_VALUE(dma_samples[i])));
+            }
+        }
+
+        done = true;
+        for (int i = 0; i < pattern_len; i++) {
+            done = done && volf_rms_full(&rms[pattern[i].channel]);
+        }
+    }
+    stop_sampling();
 
-    return virtual_voltage_value * AC_DETECTION_RANGE;
+    for (int i = 0; i < pattern_len; i++) {
+        channel = pattern[i].channel;
+        currents[channel] = convert_to_current(volf_rms_result(&rms[channel]));
+        LOGI("Current on channel %d = %d from %d samples", channel, currents[channel], rms[channel].count);
+    }
 }
-
-
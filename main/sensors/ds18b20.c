@@ -1,11 +1,16 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#define LOG_MODULE LOG_MODULE_SENSORS
+
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp32/rom/ets_sys.h"
+#include "volf_log.h"
 #include "ds18b20.h"
+#include "onewire_rmt.h"
 
 // OneWire commands
 #define GETTEMP			0x44  // Tells device to take a temperature reading and put it on the scratchpad
@@ -40,6 +45,8 @@ uint8_t DS_GPIO;
 uint8_t init=0;
 uint8_t bitResolution=12;
 uint8_t devices=0;
+// Hardware timed transactions through the RMT peripheral, the bit banged functions are only used if it's unavailable.
+bool use_rmt=false;
 
 DeviceAddress ROM_NO;
 uint8_t LastDiscrepancy;
@@ -48,6 +55,11 @@ bool LastDeviceFlag;
 
 /// Sends one bit to bus
 void ds18b20_write(char bit){
+    uint8_t data = bit & 1;
+    if (use_rmt) {
+        onewire_rmt_transfer(false, NULL, &data, NULL, 1);
+        return;
+    }
     if (bit & 1) {
         gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
         noInterrupts();
@@ -70,6 +82,11 @@ void ds18b20_write(char bit){
 // Reads one bit from bus
 unsigned char ds18b20_read(void){
     unsigned char value = 0;
+    uint8_t data = 1;
+    if (use_rmt) {
+        onewire_rmt_transfer(false, NULL, &data, &value, 1);
+        return value;
+    }
     gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
     noInterrupts();
     gpio_set_level(DS_GPIO, 0);
@@ -85,6 +102,10 @@ unsigned char ds18b20_read(void){
 void ds18b20_write_byte(char data){
     unsigned char i;
     unsigned char x;
+    if (use_rmt) {
+        onewire_rmt_transfer(false, NULL, (uint8_t *) &data, NULL, 8);
+        return;
+    }
     for(i=0;i<8;i++){
         x = data>>i;
         x &= 0x01;
@@ -96,6 +117,11 @@ void ds18b20_write_byte(char data){
 unsigned char ds18b20_read_byte(void){
     unsigned char i;
     unsigned char data = 0;
+    uint8_t ones = 0xFF;
+    if (use_rmt) {
+        onewire_rmt_transfer(false, NULL, &ones, &data, 8);
+        return data;
+    }
     for (i=0;i<8;i++)
     {
         if(ds18b20_read()) data|=0x01<<i;
@@ -106,6 +132,11 @@ unsigned char ds18b20_read_byte(void){
 // Sends reset pulse
 unsigned char ds18b20_reset(void){
     unsigned char presence;
+    bool detected = false;
+    if (use_rmt) {
+        onewire_rmt_transfer(true, &detected, NULL, NULL, 0);
+        return detected;
+    }
     gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
     noInterrupts();
     gpio_set_level(DS_GPIO, 0);
@@ -153,10 +184,27 @@ bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAdd
             success = true;
         }
     }
+    // The conversion wait follows the resolution, so it must reflect what the devices were set to.
+    if (success) {
+        bitResolution = newResolution;
+    }
     return success;
 }
 
 void ds18b20_writeScratchPad(const DeviceAddress *deviceAddress, const uint8_t *scratchPad) {
+    uint8_t tx[13];
+    if (use_rmt) {
+        // Reset, select, command and data in a single transaction.
+        tx[0] = SELECTDEVICE;
+        memcpy(tx + 1, deviceAddress, sizeof(DeviceAddress));
+        tx[9] = WRITESCRATCH;
+        tx[10] = scratchPad[HIGH_ALARM_TEMP];
+        tx[11] = scratchPad[LOW_ALARM_TEMP];
+        tx[12] = scratchPad[CONFIGURATION];
+        onewire_rmt_transfer(true, NULL, tx, NULL, sizeof(tx) * 8);
+        ds18b20_reset();
+        return;
+    }
     ds18b20_reset();
     ds18b20_select(deviceAddress);
     ds18b20_write_byte(WRITESCRATCH);
@@ -167,6 +215,21 @@ void ds18b20_writeScratchPad(const DeviceAddress *deviceAddress, const uint8_t *
 }
 
 bool ds18b20_readScratchPad(const DeviceAddress *deviceAddress, uint8_t* scratchPad) {
+    uint8_t tx[19];
+    uint8_t rx[19];
+    bool presence = false;
+    if (use_rmt) {
+        // Reset, select, command and the 9 scratchpad bytes read back in a single transaction.
+        tx[0] = SELECTDEVICE;
+        memcpy(tx + 1, deviceAddress, sizeof(DeviceAddress));
+        tx[9] = READSCRATCH;
+        memset(tx + 10, 0xFF, 9);
+        if (onewire_rmt_transfer(true, &presence, tx, rx, sizeof(tx) * 8) != ESP_OK || !presence) {
+            return false;
+        }
+        memcpy(scratchPad, rx + 10, 9);
+        return ds18b20_reset() == 1;
+    }
     // send the reset command and fail fast
     int b = ds18b20_reset();
     if (b == 0) return false;
@@ -196,9 +259,14 @@ void ds18b20_select(const DeviceAddress *address){
 }
 
 void ds18b20_requestTemperatures(){
-    ds18b20_reset();
-    ds18b20_write_byte(SKIPROM);
-    ds18b20_write_byte(GETTEMP);
+    uint8_t tx[] = {SKIPROM, GETTEMP};
+    if (use_rmt) {
+        onewire_rmt_transfer(true, NULL, tx, NULL, sizeof(tx) * 8);
+    } else {
+        ds18b20_reset();
+        ds18b20_write_byte(SKIPROM);
+        ds18b20_write_byte(GETTEMP);
+    }
     unsigned long start = esp_timer_get_time() / 1000ULL;
     while (!isConversionComplete() && ((esp_timer_get_time() / 1000ULL) - start < millisToWaitForConversion())) vPortYield();
 }
@@ -263,12 +331,12 @@ float ds18b20_getTempC(const DeviceAddress *deviceAddress) {
     if (ds18b20_isConnected(deviceAddress, scratchPad)){
         int16_t rawTemp = calculateTemperature(deviceAddress, scratchPad);
         if (rawTemp <= DEVICE_DISCONNECTED_RAW)
-            return DEVICE_DISCONNECTED_F;
+            return DEVICE_DISCONNECTED_C;
         // C = RAW/128
         // F = (C*1.8)+32 = (RAW/128*1.8)+32 = (RAW*0.0140625)+32
         return (float) rawTemp/128.0f;
     }
-    return DEVICE_DISCONNECTED_F;
+    return DEVICE_DISCONNECTED_C;
 }
 
 // reads scratchpad and returns fixed-point temperature, scaling factor 2^-7
@@ -305,8 +373,14 @@ float ds18b20_get_temp(void) {
 }
 
 void ds18b20_init(int GPIO) {
+    esp_err_t rc;
     DS_GPIO = GPIO;
     gpio_pad_select_gpio(DS_GPIO);
+    rc = onewire_rmt_init(DS_GPIO);
+    use_rmt = rc == ESP_OK;
+    if (!use_rmt) {
+        LOGW("Unable to use RMT for 1-Wire (%d), falling back to bit banging.", rc);
+    }
     init = 1;
 }
 
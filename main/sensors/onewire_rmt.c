@@ -0,0 +1,184 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_SENSORS
+
+#include <string.h>
+#include <driver/rmt.h>
+#include "freertos/ringbuf.h"
+#include "esp32/rom/gpio.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/io_mux_reg.h"
+#include "volf_log.h"
+#include "onewire_rmt.h"
+#include "onewire_symbols.h"
+
+#define ONEWIRE_TX_CHANNEL RMT_CHANNEL_0
+#define ONEWIRE_RX_CHANNEL RMT_CHANNEL_2
+#define ONEWIRE_TX_MEM_BLOCKS 2
+#define ONEWIRE_RX_MEM_BLOCKS 4
+/* 1 us ticks from the 80 MHz APB clock, so item durations are the timings in microseconds. */
+#define ONEWIRE_CLK_DIV 80
+/* Longer than any high level within a transaction, so reception ends with the transaction. */
+#define ONEWIRE_RX_IDLE_US (ONEWIRE_RESET_RELEASE_US + 100)
+#define ONEWIRE_RX_FILTER_TICKS 30
+#define ONEWIRE_RX_BUFFER_SIZE 1024
+#define ONEWIRE_MAX_TRANSFER_BITS (ONEWIRE_MAX_TRANSFER_BYTES * 8)
+#define ONEWIRE_TRANSFER_TIMEOUT_MS 100
+
+static bool installed = false;
+static RingbufHandle_t rx_ring = NULL;
+static uint32_t tx_items[ONEWIRE_MAX_TRANSFER_BITS + 1];
+
+/* The transaction in flight, needed to decode what was received. */
+static bool pending = false;
+static bool pending_reset;
+static size_t pending_bits;
+
+esp_err_t onewire_rmt_init(gpio_num_t gpio) {
+    esp_err_t rc;
+    rmt_config_t tx_config = {
+            .rmt_mode = RMT_MODE_TX,
+            .channel = ONEWIRE_TX_CHANNEL,
+            .gpio_num = gpio,
+            .clk_div = ONEWIRE_CLK_DIV,
+            .mem_block_num = ONEWIRE_TX_MEM_BLOCKS,
+            .tx_config = {
+                    .carrier_en = false,
+                    .loop_en = false,
+                    .idle_level = RMT_IDLE_LEVEL_HIGH,
+                    .idle_output_en = true,
+            },
+    };
+    rmt_config_t rx_config = {
+            .rmt_mode = RMT_MODE_RX,
+            .channel = ONEWIRE_RX_CHANNEL,
+            .gpio_num = gpio,
+            .clk_div = ONEWIRE_CLK_DIV,
+            .mem_block_num = ONEWIRE_RX_MEM_BLOCKS,
+            .rx_config = {
+                    .filter_en = true,
+                    .filter_ticks_thresh = ONEWIRE_RX_FILTER_TICKS,
+                    .idle_threshold = ONEWIRE_RX_IDLE_US,
+            },
+    };
+
+    if (installed) {
+        return ESP_OK;
+    }
+
+    if ((rc = rmt_config(&tx_config)) != ESP_OK || (rc = rmt_config(&rx_config)) != ESP_OK) {
+        return rc;
+    }
+    if ((rc = rmt_driver_install(ONEWIRE_TX_CHANNEL, 0, 0)) != ESP_OK) {
+        return rc;
+    }
+    if ((rc = rmt_driver_install(ONEWIRE_RX_CHANNEL, ONEWIRE_RX_BUFFER_SIZE, 0)) != ESP_OK
+        || (rc = rmt_get_ringbuf_handle(ONEWIRE_RX_CHANNEL, &rx_ring)) != ESP_OK) {
+        rmt_driver_uninstall(ONEWIRE_TX_CHANNEL);
+        return rc;
+    }
+
+    // rmt_config() sets the pin up as a push pull output for TX only. Make it open drain and route it to both channels.
+    PIN_FUNC_SELECT(GPIO_PIN_MUX_REG[gpio], PIN_FUNC_GPIO);
+    gpio_set_direction(gpio, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_matrix_out(gpio, RMT_SIG_OUT0_IDX + ONEWIRE_TX_CHANNEL, false, false);
+    gpio_matrix_in(gpio, RMT_SIG_IN0_IDX + ONEWIRE_RX_CHANNEL, false);
+
+    installed = true;
+    return ESP_OK;
+}
+
+void onewire_rmt_deinit() {
+    if (installed) {
+        rmt_driver_uninstall(ONEWIRE_RX_CHANNEL);
+        rmt_driver_uninstall(ONEWIRE_TX_CHANNEL);
+        rx_ring = NULL;
+        installed = false;
+        pending = false;
+    }
+}
+
+esp_err_t onewire_rmt_start(bool reset, const uint8_t *tx, size_t num_bits) {
+    size_t num_items = 0;
+    size_t size;
+    void *stale;
+    esp_err_t rc;
+
+    if (!installed || pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (num_bits > ONEWIRE_MAX_TRANSFER_BITS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (reset) {
+        num_items += onewire_encode_reset(tx_items);
+    }
+    num_items += onewire_encode_bits(tx, num_bits, tx_items + num_items);
+
+    // Drop anything left from a transaction that timed out.
+    while ((stale = xRingbufferReceive(rx_ring, &size, 0)) != NULL) {
+        vRingbufferReturnItem(rx_ring, stale);
+    }
+
+    if ((rc = rmt_rx_start(ONEWIRE_RX_CHANNEL, true)) != ESP_OK) {
+        return rc;
+    }
+    if ((rc = rmt_write_items(ONEWIRE_TX_CHANNEL, (const rmt_item32_t *) tx_items, num_items, false)) != ESP_OK) {
+        rmt_rx_stop(ONEWIRE_RX_CHANNEL);
+        return rc;
+    }
+
+    pending = true;
+    pending_reset = reset;
+    pending_bits = num_bits;
+    return ESP_OK;
+}
+
+esp_err_t onewire_rmt_finish(bool *presence, uint8_t *rx, TickType_t timeout) {
+    struct onewire_decoder decoder;
+    uint8_t sampled[ONEWIRE_MAX_TRANSFER_BYTES];
+    bool detected = false;
+    bool complete;
+    uint32_t *rx_items;
+    size_t size;
+
+    if (!pending) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pending = false;
+
+    rmt_wait_tx_done(ONEWIRE_TX_CHANNEL, timeout);
+    rx_items = xRingbufferReceive(rx_ring, &size, timeout);
+    rmt_rx_stop(ONEWIRE_RX_CHANNEL);
+    if (rx_items == NULL) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    onewire_decoder_init(&decoder, rx_items, size / sizeof(uint32_t));
+    complete = (!pending_reset || onewire_decode_reset(&decoder, &detected))
+               && onewire_decode_bits(&decoder, sampled, pending_bits);
+    vRingbufferReturnItem(rx_ring, rx_items);
+
+    if (presence != NULL) {
+        *presence = detected;
+    }
+    if (!complete) {
+        LOGW("1-Wire transaction received fewer slots than sent.");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (rx != NULL) {
+        memcpy(rx, sampled, (pending_bits + 7) / 8);
+    }
+    return ESP_OK;
+}
+
+esp_err_t onewire_rmt_transfer(bool reset, bool *presence, const uint8_t *tx, uint8_t *rx, size_t num_bits) {
+    esp_err_t rc = onewire_rmt_start(reset, tx, num_bits);
+
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    return onewire_rmt_finish(presence, rx, ONEWIRE_TRANSFER_TIMEOUT_MS / portTICK_RATE_MS);
+}
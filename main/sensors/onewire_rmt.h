@@ -0,0 +1,38 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ONEWIRE_RMT_H
+#define ONEWIRE_RMT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <driver/gpio.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define ONEWIRE_MAX_TRANSFER_BYTES 24
+
+/**
+ * 1-Wire bus driven by the RMT peripheral. A whole transaction, an optional reset followed by up to
+ * ONEWIRE_MAX_TRANSFER_BYTES of slots, is timed by the hardware while the calling task blocks, so no core is held with
+ * interrupts masked. One RMT channel transmits and another receives on the same open drain pin.
+ */
+esp_err_t onewire_rmt_init(gpio_num_t gpio);
+void onewire_rmt_deinit();
+
+/**
+ * Queues a transaction and returns without waiting for it. Every bit of tx is sent as a write slot, bytes least
+ * significant bit first. Bits are read by writing 1s, so send 0xFF for every byte to read.
+ */
+esp_err_t onewire_rmt_start(bool reset, const uint8_t *tx, size_t num_bits);
+
+/**
+ * Waits for the transaction queued by onewire_rmt_start() to complete. presence is set if a reset was requested and a
+ * device answered. rx receives the level sampled in every slot. Either may be NULL.
+ */
+esp_err_t onewire_rmt_finish(bool *presence, uint8_t *rx, TickType_t timeout);
+
+/** Runs a transaction to completion, see onewire_rmt_start() and onewire_rmt_finish(). */
+esp_err_t onewire_rmt_transfer(bool reset, bool *presence, const uint8_t *tx, uint8_t *rx, size_t num_bits);
+
+#endif //ONEWIRE_RMT_H
@@ -0,0 +1,99 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "onewire_symbols.h"
+
+#define ITEM_DURATION_MASK 0x7FFF
+#define ITEM_LEVEL_BIT 15
+
+size_t onewire_encode_reset(uint32_t *items) {
+    items[0] = ONEWIRE_ITEM(ONEWIRE_RESET_LOW_US, ONEWIRE_RESET_RELEASE_US);
+    return 1;
+}
+
+size_t onewire_encode_bits(const uint8_t *data, size_t num_bits, uint32_t *items) {
+    for (size_t i = 0; i < num_bits; i++) {
+        if ((data[i / 8] >> (i % 8)) & 1) {
+            items[i] = ONEWIRE_ITEM(ONEWIRE_WRITE_1_LOW_US, ONEWIRE_WRITE_1_RELEASE_US);
+        } else {
+            items[i] = ONEWIRE_ITEM(ONEWIRE_WRITE_0_LOW_US, ONEWIRE_WRITE_0_RELEASE_US);
+        }
+    }
+    return num_bits;
+}
+
+void onewire_decoder_init(struct onewire_decoder *decoder, const uint32_t *items, size_t num_items) {
+    decoder->items = items;
+    decoder->num_items = num_items;
+    decoder->pulse = 0;
+}
+
+/* Each item holds two pulses, the first in the low half word. A zero duration marks the end of the received data. */
+static bool next_pulse(struct onewire_decoder *decoder, bool *level, uint32_t *duration) {
+    uint32_t half;
+
+    if (decoder->pulse / 2 >= decoder->num_items) {
+        return false;
+    }
+    half = decoder->items[decoder->pulse / 2] >> ((decoder->pulse % 2) * 16);
+    *duration = half & ITEM_DURATION_MASK;
+    *level = (half >> ITEM_LEVEL_BIT) & 1;
+    if (*duration == 0 && *level == 0) {
+        return false;
+    }
+    decoder->pulse++;
+    return true;
+}
+
+/* Skips to the next low pulse, which is where every reset and slot starts. */
+static bool next_low_pulse(struct onewire_decoder *decoder, uint32_t *duration) {
+    bool level;
+
+    do {
+        if (!next_pulse(decoder, &level, duration)) {
+            return false;
+        }
+    } while (level);
+    return true;
+}
+
+bool onewire_decode_reset(struct onewire_decoder *decoder, bool *presence) {
+    uint32_t duration;
+    bool level;
+    size_t before_presence;
+
+    *presence = false;
+    if (!next_low_pulse(decoder, &duration)) {
+        return false;
+    }
+
+    // The release after the reset is either a single long high, or a short high, the presence pulse and a high.
+    before_presence = decoder->pulse;
+    if (!next_pulse(decoder, &level, &duration)) {
+        // Received data ends while the bus is released, no device.
+        return true;
+    }
+    if (duration < ONEWIRE_RESET_RELEASE_US && next_pulse(decoder, &level, &duration) && !level
+        && duration >= ONEWIRE_PRESENCE_MIN_LOW_US) {
+        *presence = true;
+        return true;
+    }
+    decoder->pulse = before_presence;
+    return true;
+}
+
+bool onewire_decode_bits(struct onewire_decoder *decoder, uint8_t *data, size_t num_bits) {
+    uint32_t duration;
+
+    memset(data, 0, (num_bits + 7) / 8);
+    for (size_t i = 0; i < num_bits; i++) {
+        if (!next_low_pulse(decoder, &duration)) {
+            return false;
+        }
+        if (duration < ONEWIRE_READ_0_MIN_LOW_US) {
+            data[i / 8] |= 1 << (i % 8);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ONEWIRE_SYMBOLS_H
+#define ONEWIRE_SYMBOLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Encodes 1-Wire reset pulses and time slots as RMT items and decodes what was received on the bus. Each item is a
+ * uint32_t in the RMT layout: bits 0-14 the duration of the first half, bit 15 its level, bits 16-30 the duration of
+ * the second half, bit 31 its level. Durations are in microseconds.
+ */
+
+/* Standard speed timings in microseconds. */
+#define ONEWIRE_RESET_LOW_US 480
+#define ONEWIRE_RESET_RELEASE_US 410
+#define ONEWIRE_WRITE_1_LOW_US 6
+#define ONEWIRE_WRITE_1_RELEASE_US 64
+#define ONEWIRE_WRITE_0_LOW_US 60
+#define ONEWIRE_WRITE_0_RELEASE_US 10
+/* A slot is read as 0 if the bus stayed low for at least this long, a device holding it low after the master did. */
+#define ONEWIRE_READ_0_MIN_LOW_US 15
+/* Presence pulses are 60-240 us long, anything shorter is noise. */
+#define ONEWIRE_PRESENCE_MIN_LOW_US 40
+
+#define ONEWIRE_ITEM(low_us, release_us) \
+    ((uint32_t) (low_us) | ((uint32_t) (release_us) << 16) | ((uint32_t) 1 << 31))
+
+/** Writes the item for a reset pulse and presence window. Returns the number of items written, always 1. */
+size_t onewire_encode_reset(uint32_t *items);
+
+/**
+ * Writes one write slot per bit, least significant bit of each byte first. Reading a bit is done with a write slot
+ * for a 1, so reading bytes is encoding 0xFF. Returns the number of items written, num_bits.
+ */
+size_t onewire_encode_bits(const uint8_t *data, size_t num_bits, uint32_t *items);
+
+/** Walks the pulses received on the bus, two per RMT item. */
+struct onewire_decoder {
+    const uint32_t *items;
+    size_t num_items;
+    size_t pulse;
+};
+
+void onewire_decoder_init(struct onewire_decoder *decoder, const uint32_t *items, size_t num_items);
+
+/** Consumes a reset pulse, setting presence if a device answered it. Returns false if the pulses ran out. */
+bool onewire_decode_reset(struct onewire_decoder *decoder, bool *presence);
+
+/**
+ * Consumes num_bits slots and stores the level sampled in each, least significant bit first, in data. Returns false
+ * if the pulses ran out.
+ */
+bool onewire_decode_bits(struct onewire_decoder *decoder, uint8_t *data, size_t num_bits);
+
+#endif //ONEWIRE_SYMBOLS_H
@@ -0,0 +1,175 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_SENSORS
+
+#include <string.h>
+#include <time.h>
+#include "iot_wifi_sensor.h"
+#include "volf_sensors.h"
+#include "ds18b20.h"
+#include "volf_profile.h"
+
+const struct reading_field_info reading_fields[NUM_READING_FIELDS] = {
+        [READING_VERSION] = {"version", 1, FIELD_TYPE_NUMBER, false, 0},
+        [READING_SLEEP_DURATION] = {"sleepDuration", 2, FIELD_TYPE_NUMBER, false, 0},
+        [READING_DEEP_SLEEP] = {"deepSleep", 3, FIELD_TYPE_BOOL, false, 0},
+        [READING_WIFI_CONNECT_MS] = {"wifiConnectMs", 4, FIELD_TYPE_NUMBER, false, 0},
+        [READING_FAST_CONNECT] = {"fastConnect", 5, FIELD_TYPE_BOOL, false, 0},
+        [READING_TLS_HANDSHAKE_MS] = {"tlsHandshakeMs", 6, FIELD_TYPE_NUMBER, false, 0},
+        [READING_TLS_RESUMED] = {"tlsResumed", 7, FIELD_TYPE_BOOL, false, 0},
+        [READING_BATTERY_VOLTAGE] = {"batteryVoltage", 8, FIELD_TYPE_NUMBER, true, 0},
+        [READING_BATTERY_PERCENT] = {"batteryPercent", 9, FIELD_TYPE_NUMBER, true, 0},
+        [READING_BATTERY_LOW_VOLTAGE] = {"batteryLowVoltage", 10, FIELD_TYPE_NUMBER, false, 0},
+        [READING_BATTERY_HIGH_VOLTAGE] = {"batteryHighVoltage", 11, FIELD_TYPE_NUMBER, false, 0},
+        [READING_MOISTURE_VOLTAGE] = {"moistureVoltage", 12, FIELD_TYPE_NUMBER, true, 0},
+        [READING_MOISTURE_PERCENT] = {"moisturePercent", 13, FIELD_TYPE_NUMBER, true, 0},
+        [READING_MOISTURE_LOW_VOLTAGE] = {"moistureLowVoltage", 14, FIELD_TYPE_NUMBER, false, 0},
+        [READING_MOISTURE_HIGH_VOLTAGE] = {"moistureHighVoltage", 15, FIELD_TYPE_NUMBER, false, 0},
+        [READING_TEMPERATURE] = {"temperature", 16, FIELD_TYPE_NUMBER, true, 1},
+        [READING_HUMIDITY] = {"humidity", 17, FIELD_TYPE_NUMBER, true, 1},
+        [READING_AC_CURRENT_1] = {"acCurrent1", 18, FIELD_TYPE_NUMBER, true, 0},
+        [READING_AC_CURRENT_2] = {"acCurrent2", 19, FIELD_TYPE_NUMBER, true, 0},
+        [READING_AC_CURRENT_3] = {"acCurrent3", 20, FIELD_TYPE_NUMBER, true, 0},
+        [READING_AC_CURRENT_4] = {"acCurrent4", 21, FIELD_TYPE_NUMBER, true, 0},
+        [READING_SENSOR_MS] = {"sensorMs", 22, FIELD_TYPE_NUMBER, false, 0},
+        [READING_NETWORK_MS] = {"networkMs", 23, FIELD_TYPE_NUMBER, false, 0},
+        [READING_AWAKE_MS] = {"awakeMs", 24, FIELD_TYPE_NUMBER, false, 0},
+        [READING_SKIPPED_TRANSMITS] = {"skippedTransmits", 25, FIELD_TYPE_NUMBER, false, 0},
+        [READING_SKIPPED_AWAKE_MS] = {"skippedAwakeMs", 26, FIELD_TYPE_NUMBER, false, 0},
+        [READING_TEMPERATURE_2] = {"temperature2", 27, FIELD_TYPE_NUMBER, true, 1},
+        [READING_TEMPERATURE_3] = {"temperature3", 28, FIELD_TYPE_NUMBER, true, 1},
+        [READING_TEMPERATURE_4] = {"temperature4", 29, FIELD_TYPE_NUMBER, true, 1},
+        [READING_SHADOW_GET_MS] = {"shadowGetMs", 30, FIELD_TYPE_NUMBER, false, 0},
+        [READING_SHADOW_UPDATE_MS] = {"shadowUpdateMs", 31, FIELD_TYPE_NUMBER, false, 0},
+        [READING_RUNTIME_HOURS] = {"runtimeHours", 32, FIELD_TYPE_NUMBER, false, 0},
+};
+
+static const reading_field_t temperature_fields[MAX_TEMPERATURE_PROBES] = {
+        READING_TEMPERATURE, READING_TEMPERATURE_2, READING_TEMPERATURE_3, READING_TEMPERATURE_4
+};
+
+void reading_init(struct sensor_reading *reading) {
+    memset(reading, 0, sizeof(struct sensor_reading));
+    reading->timestamp = (uint32_t) time(NULL);
+}
+
+void reading_set(struct sensor_reading *reading, reading_field_t field, float value) {
+    reading->values[field] = value;
+    reading->present |= 1u << field;
+}
+
+bool reading_is_telemetry(reading_field_t field) {
+    switch (field) {
+        case READING_WIFI_CONNECT_MS:
+        case READING_FAST_CONNECT:
+        case READING_TLS_HANDSHAKE_MS:
+        case READING_TLS_RESUMED:
+        case READING_SENSOR_MS:
+        case READING_NETWORK_MS:
+        case READING_AWAKE_MS:
+        case READING_SKIPPED_TRANSMITS:
+        case READING_SKIPPED_AWAKE_MS:
+        case READING_SHADOW_GET_MS:
+        case READING_SHADOW_UPDATE_MS:
+        case READING_RUNTIME_HOURS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool reading_has(const struct sensor_reading *reading, reading_field_t field) {
+    return (reading->present & (1u << field)) != 0;
+}
+
+reading_field_t reading_field_by_name(const char *name) {
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (strcmp(reading_fields[field].name, name) == 0) {
+            return field;
+        }
+    }
+    return NUM_READING_FIELDS;
+}
+
+void reading_add_config(const struct sensor_config *config, struct sensor_reading *reading) {
+    reading_set(reading, READING_VERSION, VERSION);
+    reading_set(reading, READING_SLEEP_DURATION, config->sleep_duration);
+    reading_set(reading, READING_DEEP_SLEEP, config->deep_sleep);
+
+    if (config->has_battery) {
+        reading_set(reading, READING_BATTERY_LOW_VOLTAGE, config->battery_low_voltage);
+        reading_set(reading, READING_BATTERY_HIGH_VOLTAGE, config->battery_high_voltage);
+    }
+    if (config->moisture_sensor) {
+        reading_set(reading, READING_MOISTURE_LOW_VOLTAGE, config->moisture_low_voltage);
+        reading_set(reading, READING_MOISTURE_HIGH_VOLTAGE, config->moisture_high_voltage);
+    }
+}
+
+void read_sensors(const struct sensor_config *config, struct sensor_reading *reading) {
+    uint32_t battery_voltage;
+    uint32_t moisture_voltage;
+    float temperature;
+    float temperatures[MAX_TEMPERATURE_PROBES];
+    uint8_t num_probes;
+    float humidity;
+    uint32_t ac_currents[ADC1_CHANNEL_MAX];
+
+    if (config->has_battery) {
+        volf_profile_begin(PROFILE_READ_BATTERY);
+        battery_voltage = read_battery_voltage();
+        reading_set(reading, READING_BATTERY_VOLTAGE, battery_voltage);
+        reading_set(reading, READING_BATTERY_PERCENT,
+                    convert_battery_voltage_to_pct(battery_voltage, config->battery_low_voltage,
+                                                   config->battery_high_voltage));
+        volf_profile_end(PROFILE_READ_BATTERY);
+    }
+
+    if (config->moisture_sensor) {
+        volf_profile_begin(PROFILE_READ_MOISTURE);
+        moisture_voltage = read_soil_moisture_voltage();
+        reading_set(reading, READING_MOISTURE_VOLTAGE, moisture_voltage);
+        reading_set(reading, READING_MOISTURE_PERCENT,
+                    convert_moisture_voltage_to_pct(moisture_voltage, config->moisture_low_voltage,
+                                                    config->moisture_high_voltage));
+        volf_profile_end(PROFILE_READ_MOISTURE);
+    }
+
+    if (config->temperature_sensor) {
+        volf_profile_begin(PROFILE_READ_TEMPERATURE);
+        num_probes = read_temperatures(config->temperature_resolution, temperatures);
+        for (int i = 0; i < num_probes; i++) {
+            if (temperatures[i] != (float) DEVICE_DISCONNECTED_F) {
+                reading_set(reading, temperature_fields[i], temperatures[i]);
+            }
+        }
+        volf_profile_end(PROFILE_READ_TEMPERATURE);
+    }
+
+    if (config->sht40_sensor) {
+        volf_profile_begin(PROFILE_READ_SHT40);
+        sht40_read_humidity_and_temperature(&humidity, &temperature);
+        reading_set(reading, READING_TEMPERATURE, temperature);
+        reading_set(reading, READING_HUMIDITY, humidity);
+        volf_profile_end(PROFILE_READ_SHT40);
+    }
+
+    if (config->current_sensor) {
+        volf_profile_begin(PROFILE_READ_CURRENT);
+        read_ac_currents(config->adc_channels, ac_currents);
+        volf_profile_end(PROFILE_READ_CURRENT);
+        if ((config->adc_channels & ADC_CHANNEL_MASK_0) != 0) {
+            reading_set(reading, READING_AC_CURRENT_1, ac_currents[ADC1_CHANNEL_0]);
+        }
+        if ((config->adc_channels & ADC_CHANNEL_MASK_3) != 0) {
+            reading_set(reading, READING_AC_CURRENT_2, ac_currents[ADC1_CHANNEL_3]);
+        }
+        if ((config->adc_channels & ADC_CHANNEL_MASK_6) != 0) {
+            reading_set(reading, READING_AC_CURRENT_3, ac_currents[ADC1_CHANNEL_6]);
+        }
+        if ((config->adc_channels & ADC_CHANNEL_MASK_7) != 0) {
+            reading_set(reading, READING_AC_CURRENT_4, ac_currents[ADC1_CHANNEL_7]);
+        }
+    }
+}
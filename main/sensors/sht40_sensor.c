@@ -1,5 +1,7 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
+#define LOG_MODULE LOG_MODULE_SENSORS
+
 #include <sht4x.h>
 #include <string.h>
 #include <volf_log.h>
@@ -5,36 +5,22 @@
 #include <driver/adc.h>
 #include <driver/rtc_io.h>
 #include <freertos/task.h>
-#include "esp_adc_cal.h"
 #include "esp_log.h"
+#include "volf_adc.h"
+#include "volf_error.h"
 #include "volf_sensors.h"
 
 #define SENSOR_ADC_CHANNEL ADC1_CHANNEL_7
 #define SENSOR_ADC_ATTENUATION ADC_ATTEN_DB_11
-#define SENSOR_ADB_WIDTH_BIT ADC_WIDTH_BIT_12
-#define SENSOR_ADC_UNIT ADC_UNIT_1
 #define SENSOR_POWER_GPIO GPIO_NUM_25
 #define SENSOR_DATA_GPIO GPIO_NUM_35
 
-static esp_adc_cal_characteristics_t *adc_chars = NULL;
-
 static void power_off_moisture_sensor() {
     LOGI("Powering down sensor");
     gpio_set_level(SENSOR_POWER_GPIO, 0);
 }
 
 static void init_moisture_sensor() {
-    LOGI("Initializing ADC for reading sensor data.");
-    // Characterize ADC at particular attenuation
-    adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t));
-
-    esp_adc_cal_characterize(SENSOR_ADC_UNIT, SENSOR_ADC_ATTENUATION, SENSOR_ADB_WIDTH_BIT, 0,
-                             adc_chars);
-
-    // Configure ADC channel
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(SENSOR_ADC_CHANNEL, SENSOR_ADC_ATTENUATION);
-
     LOGI("Initializing sensor power.");
     gpio_pad_select_gpio(SENSOR_POWER_GPIO);
     gpio_set_direction(SENSOR_POWER_GPIO, GPIO_MODE_OUTPUT);
@@ -46,10 +32,6 @@ static void init_moisture_sensor() {
 
 static void shutdown_sensor() {
     power_off_moisture_sensor();
-    if (adc_chars != NULL) {
-        free(adc_chars);
-        adc_chars = NULL;
-    }
 }
 
 
@@ -62,15 +44,20 @@ uint32_t read_soil_moisture_voltage() {
     uint32_t reading_total = 0;
     uint32_t final_reading = 0;
     uint32_t total_reads = 10;
+    esp_err_t rc = volf_adc_reserve(SENSOR_ADC_CHANNEL, SENSOR_ADC_ATTENUATION, "moisture");
+    if (rc != ESP_OK) {
+        volf_handle_error(CONTINUE, "moisture_adc_reserve", rc);
+        return 0;
+    }
     init_moisture_sensor();
 
     for (int i = 0; i < total_reads; i++) {
-        reading_total += adc1_get_raw(SENSOR_ADC_CHANNEL);
+        reading_total += volf_adc_read_raw(SENSOR_ADC_CHANNEL);
         vTaskDelay(10 / portTICK_RATE_MS);
     }
     final_reading = reading_total / total_reads;
 
-    uint32_t voltage = esp_adc_cal_raw_to_voltage(final_reading, adc_chars);
+    uint32_t voltage = volf_adc_raw_to_mv(SENSOR_ADC_ATTENUATION, final_reading);
 
     LOGI("Soil Moisture raw Reading: %d\n", final_reading);
     LOGI("Soil Moisture voltage: %d\n", voltage);
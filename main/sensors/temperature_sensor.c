@@ -1,14 +1,37 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <driver/rtc_io.h>
 #include <freertos/task.h>
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "nvs.h"
 #include "volf_sensors.h"
 #include "ds18b20.h"
 
 #define SENSOR_POWER_GPIO GPIO_NUM_25
 #define SENSOR_DATA_GPIO GPIO_NUM_14
+#define PROBE_CACHE_MAGIC 0x44533138
+#define NVS_NAME_TEMPERATURE "temperature"
+#define PROBE_ROMS_KEY "probe_roms"
+#define READ_ATTEMPTS 2
+#define READ_RETRY_DELAY_MS 200
+
+/**
+ * ROM ids of the probes found on the bus. Searching the bus takes a read of every bit of every id, so it only happens
+ * on a cold boot, when probes may have been added or swapped with the power off, when neither RTC memory nor NVS hold
+ * the ids, or when a cached probe stopped responding.
+ */
+struct probe_cache {
+    uint32_t magic;
+    uint8_t count;
+    DeviceAddress roms[MAX_TEMPERATURE_PROBES];
+};
+
+RTC_DATA_ATTR static struct probe_cache probes;
+static bool bus_searched = false;
 
 static void init_temperature_sensor() {
     LOGI("Initializing temperature sensor power.");
@@ -29,19 +52,139 @@ void hibernate_temperature_sensor() {
     power_off_temperature_sensor();
 }
 
-float read_temperature() {
-    float temp_c;
-    float temp_f;
+static bool read_stored_probe_roms(struct probe_cache *cache) {
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(*cache);
+    esp_err_t err;
+
+    err = nvs_open(NVS_NAME_TEMPERATURE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return false;
+    }
+    err = nvs_get_blob(nvs_handle, PROBE_ROMS_KEY, cache, &size);
+    nvs_close(nvs_handle);
+
+    if (err != ESP_OK || size != sizeof(*cache) || cache->magic != PROBE_CACHE_MAGIC
+        || cache->count > MAX_TEMPERATURE_PROBES) {
+        memset(cache, 0, sizeof(*cache));
+        return false;
+    }
+    return true;
+}
+
+static bool load_probe_roms() {
+    if (probes.magic == PROBE_CACHE_MAGIC) {
+        return true;
+    }
+    if (!read_stored_probe_roms(&probes)) {
+        return false;
+    }
+    LOGI("Loaded %d temperature probe ids from NVS.", probes.count);
+    return true;
+}
+
+static void store_probe_roms() {
+    nvs_handle_t nvs_handle;
+
+    esp_err_t err = nvs_open(NVS_NAME_TEMPERATURE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        LOGE("Error (%s) opening NVS handle for storing temperature probe ids!\n", esp_err_to_name(err));
+        return;
+    }
+    if (probes.magic == PROBE_CACHE_MAGIC) {
+        nvs_set_blob(nvs_handle, PROBE_ROMS_KEY, &probes, sizeof(probes));
+    } else {
+        nvs_erase_key(nvs_handle, PROBE_ROMS_KEY);
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+static void forget_probe_roms() {
+    memset(&probes, 0, sizeof(probes));
+    store_probe_roms();
+}
+
+static void search_probe_roms() {
+    struct probe_cache stored;
+    DeviceAddress rom;
+
+    bus_searched = true;
+    memset(&probes, 0, sizeof(probes));
+    reset_search();
+    while (probes.count < MAX_TEMPERATURE_PROBES && search(rom, true)) {
+        if (ds18b20_crc8(rom, 7) != rom[7]) {
+            LOGW("Ignoring temperature probe with an invalid ROM id CRC.");
+            continue;
+        }
+        memcpy(probes.roms[probes.count], rom, sizeof(DeviceAddress));
+        probes.count++;
+    }
+    LOGI("Found %d temperature probes on the bus.", probes.count);
+
+    if (probes.count > 0) {
+        probes.magic = PROBE_CACHE_MAGIC;
+    }
+    // Only written when the probes changed, most cold boots find the ones already stored.
+    read_stored_probe_roms(&stored);
+    if (stored.count != probes.count
+        || memcmp(stored.roms, probes.roms, probes.count * sizeof(DeviceAddress)) != 0) {
+        LOGI("The temperature probes changed, storing their ids.");
+        store_probe_roms();
+    }
+}
+
+/**
+ * Starts the conversion on every probe at once and reads each probe's scratchpad, checking its CRC. The wait follows
+ * the configured resolution rather than the fixed worst case. Returns false if any probe didn't respond.
+ */
+static bool convert_and_read(uint8_t resolution, float temps_c[MAX_TEMPERATURE_PROBES]) {
+    bool all_read = true;
+
+    ds18b20_setResolution((const DeviceAddress *) probes.roms, probes.count, resolution);
+    ds18b20_requestTemperatures();
+
+    for (int i = 0; i < probes.count; i++) {
+        temps_c[i] = ds18b20_getTempC((const DeviceAddress *) probes.roms[i]);
+        if (temps_c[i] == DEVICE_DISCONNECTED_C) {
+            all_read = false;
+        }
+    }
+    return all_read;
+}
+
+uint8_t read_temperatures(uint8_t resolution, float temps[MAX_TEMPERATURE_PROBES]) {
+    float temps_c[MAX_TEMPERATURE_PROBES];
+    bool all_read = false;
+    uint8_t count;
 
     init_temperature_sensor();
-    temp_c = ds18b20_get_temp();
-    if (temp_c == 0) {
-        vTaskDelay(200 / portTICK_RATE_MS);
-        temp_c = ds18b20_get_temp();
+    if ((!bus_searched && esp_reset_reason() != ESP_RST_DEEPSLEEP) || !load_probe_roms()) {
+        search_probe_roms();
+    }
+    count = probes.count;
+
+    for (int attempt = 0; attempt < READ_ATTEMPTS && count > 0 && !all_read; attempt++) {
+        if (attempt > 0) {
+            vTaskDelay(READ_RETRY_DELAY_MS / portTICK_RATE_MS);
+        }
+        all_read = convert_and_read(resolution, temps_c);
     }
     power_off_temperature_sensor();
-    temp_f = (temp_c * 1.8f) + 32.0f;
-    LOGI("Read temp of %.2f C and %.2f F", temp_c, temp_f);
 
-    return temp_f;
-}
\ No newline at end of file
+    if (count > 0 && !all_read) {
+        // A probe may have been replaced or removed, search the bus again on the next read.
+        LOGW("Not every temperature probe responded, forgetting the cached probe ids.");
+        forget_probe_roms();
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (temps_c[i] == DEVICE_DISCONNECTED_C) {
+            temps[i] = DEVICE_DISCONNECTED_F;
+            continue;
+        }
+        temps[i] = (temps_c[i] * 1.8f) + 32.0f;
+        LOGI("Read temp of %.2f C and %.2f F from probe %d", temps_c[i], temps[i], i);
+    }
+    return count;
+}
@@ -1,6 +1,9 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#ifndef VOLF_SENSORS_H
+#define VOLF_SENSORS_H
+
 #include <driver/adc.h>
 
 #include "volf_log.h"
@@ -31,9 +34,98 @@
 #define DEFAULT_BATTERY_LOW_VOLTAGE 1450
 #define DEFAULT_BATTERY_HIGH_VOLTAGE 2110
 #define DEFAULT_SLEEP_DURATION 3600
+#define DEFAULT_BATCH_SIZE 1
+#define DEFAULT_BATCH_DEADLINE 3600
+#define DEFAULT_BATCH_MOISTURE_DELTA 10
+#define DEFAULT_BATCH_TEMPERATURE_DELTA 5.0f
+#define DEFAULT_PAYLOAD_ENCODING PAYLOAD_ENCODING_JSON
+#define MAX_FIELD_PRECISION 6
+#define DEFAULT_MAX_STALENESS 86400
+#define DEFAULT_WAKE_MODE WAKE_MODE_OVERLAPPED
+#define DEFAULT_TEMPERATURE_RESOLUTION 12
+#define DEFAULT_ADAPTIVE_SLEEP false
+#define DEFAULT_MIN_SLEEP_DURATION 600
+#define DEFAULT_MAX_SLEEP_DURATION 21600
+#define DEFAULT_TARGET_LIFE_DAYS 14
+#define DEFAULT_BATTERY_CAPACITY_MAH 2000
+#define DEFAULT_CRITICAL_BATTERY_PERCENT 10
+#define DEFAULT_BINARY_LOG false
+#define DEFAULT_CRASH_LOG_SIZE 1024
+#define MAX_TEMPERATURE_PROBES 4
 
 #define VALID_ADC_CHANNELS ADC_CHANNEL_MASK_0 & ADC_CHANNEL_MASK_3 & ADC_CHANNEL_MASK_6 & ADC_CHANNEL_MASK_7
 
+/**
+ * Every value that can be reported for a wake. Readings keep their values in an array indexed by this enum so they
+ * can be stored, compared and serialized generically.
+ */
+typedef enum {
+    READING_VERSION = 0,
+    READING_SLEEP_DURATION,
+    READING_DEEP_SLEEP,
+    READING_WIFI_CONNECT_MS,
+    READING_FAST_CONNECT,
+    READING_TLS_HANDSHAKE_MS,
+    READING_TLS_RESUMED,
+    READING_BATTERY_VOLTAGE,
+    READING_BATTERY_PERCENT,
+    READING_BATTERY_LOW_VOLTAGE,
+    READING_BATTERY_HIGH_VOLTAGE,
+    READING_MOISTURE_VOLTAGE,
+    READING_MOISTURE_PERCENT,
+    READING_MOISTURE_LOW_VOLTAGE,
+    READING_MOISTURE_HIGH_VOLTAGE,
+    READING_TEMPERATURE,
+    READING_HUMIDITY,
+    READING_AC_CURRENT_1,
+    READING_AC_CURRENT_2,
+    READING_AC_CURRENT_3,
+    READING_AC_CURRENT_4,
+    READING_SENSOR_MS,
+    READING_NETWORK_MS,
+    READING_AWAKE_MS,
+    READING_SKIPPED_TRANSMITS,
+    READING_SKIPPED_AWAKE_MS,
+    READING_TEMPERATURE_2,
+    READING_TEMPERATURE_3,
+    READING_TEMPERATURE_4,
+    READING_SHADOW_GET_MS,
+    READING_SHADOW_UPDATE_MS,
+    READING_RUNTIME_HOURS,
+    NUM_READING_FIELDS
+} reading_field_t;
+
+typedef enum {
+    FIELD_TYPE_NUMBER,
+    FIELD_TYPE_BOOL
+} reading_field_type_t;
+
+/**
+ * Overlapped wakes read the sensors while the network connects. Sensor first wakes read them with the radio off and
+ * only connect if the reading needs to be reported.
+ */
+typedef enum {
+    WAKE_MODE_OVERLAPPED = 0,
+    WAKE_MODE_SENSOR_FIRST = 1
+} wake_mode_t;
+
+typedef enum {
+    PAYLOAD_ENCODING_JSON = 0,
+    PAYLOAD_ENCODING_CBOR = 1
+} payload_encoding_t;
+
+struct reading_field_info {
+    const char *name;
+    /* Key used in the CBOR encoding. Must never change once assigned, tools/cbor_decoder depends on it. */
+    uint8_t id;
+    reading_field_type_t type;
+    /* True for values measured by a sensor, false for config echoes and connection stats. */
+    bool sampled;
+    int8_t default_precision;
+};
+
+extern const struct reading_field_info reading_fields[NUM_READING_FIELDS];
+
 struct sensor_config {
     bool current_sensor;
     bool moisture_sensor;
@@ -48,8 +140,65 @@ struct sensor_config {
     uint32_t battery_high_voltage;
     uint32_t sleep_duration;
     uint32_t version;
+    uint8_t batch_size;
+    uint32_t batch_deadline;
+    uint32_t batch_moisture_delta;
+    float batch_temperature_delta;
+    payload_encoding_t payload_encoding;
+    /* Decimal places kept for each field in the CBOR encoding, clamped to 0 up to MAX_FIELD_PRECISION. */
+    int8_t field_precision[NUM_READING_FIELDS];
+    /* A field is only published when it moved more than its deadband since the last acknowledged value... */
+    float deadbands[NUM_READING_FIELDS];
+    /* ...or hasn't been published for this many seconds. 0 publishes every field on every wake. */
+    uint32_t max_staleness;
+    wake_mode_t wake_mode;
+    /* DS18B20 resolution in bits, 9 to 12. Each bit less halves the conversion time. */
+    uint8_t temperature_resolution;
+    /* With a battery, sleep between min and max duration so the remaining charge lasts target_life_days. */
+    bool adaptive_sleep;
+    uint32_t min_sleep_duration;
+    uint32_t max_sleep_duration;
+    uint32_t target_life_days;
+    uint32_t battery_capacity_mah;
+    /* At or below this charge the node always sleeps for max_sleep_duration. */
+    uint8_t critical_battery_percent;
+    /* Level of each log module, messages above it are dropped before being formatted. */
+    uint8_t log_levels[NUM_LOG_MODULES];
+    /* Log binary entries, decoded on the host by tools/log_decoder, instead of formatted text. */
+    bool binary_log;
+    /* Bytes of log output kept in RTC memory for upload after a failed wake, 0 turns the capture off. */
+    uint16_t crash_log_size;
+};
+
+struct sensor_reading {
+    /* Seconds since boot of the RTC clock, which keeps counting through deep sleep. */
+    uint32_t timestamp;
+    /* Bit mask of the fields that hold a value. */
+    uint32_t present;
+    float values[NUM_READING_FIELDS];
 };
 
+_Static_assert(NUM_READING_FIELDS <= 32, "present bitmask too small");
+
+void reading_init(struct sensor_reading *reading);
+void reading_set(struct sensor_reading *reading, reading_field_t field, float value);
+bool reading_has(const struct sensor_reading *reading, reading_field_t field);
+
+/** Reads every sensor enabled in the config into the reading. */
+void read_sensors(const struct sensor_config *config, struct sensor_reading *reading);
+
+/** Adds the config values echoed back in the reported state. */
+void reading_add_config(const struct sensor_config *config, struct sensor_reading *reading);
+
+/**
+ * True for the connection stats and timings, which differ on every wake. They are published on the telemetry topic
+ * instead of the shadow and never cause a publish on their own.
+ */
+bool reading_is_telemetry(reading_field_t field);
+
+/** Returns the field with the given JSON name, or NUM_READING_FIELDS if there is none. */
+reading_field_t reading_field_by_name(const char *name);
+
 void hibernate_moisture_sensor();
 void hibernate_temperature_sensor();
 
@@ -58,11 +207,19 @@ uint32_t read_soil_moisture_voltage();
 
 uint32_t convert_moisture_voltage_to_pct(uint32_t voltage, uint32_t low_voltage, uint32_t high_voltage);
 
-/** Temperature Sensor */
-float read_temperature();
+/**
+ * DS18B20 Temperature Sensors. Reads every probe on the bus, up to MAX_TEMPERATURE_PROBES, at the given resolution in
+ * bits. Returns the number of probes, with temperatures in F or DEVICE_DISCONNECTED_F for a probe that didn't respond.
+ */
+uint8_t read_temperatures(uint8_t resolution, float temps[MAX_TEMPERATURE_PROBES]);
 
-/** A/C Current Sensor */
-uint32_t read_ac_current(adc1_channel_t channel);
+/**
+ * A/C Current Sensor. Samples every channel in the ADC channel mask in one pass and writes the current for each into
+ * currents, indexed by channel.
+ */
+void read_ac_currents(uint8_t adc_channels, uint32_t currents[ADC1_CHANNEL_MAX]);
 
 /** SHT40 Humidity and Temperature Sensor */
-void sht40_read_humidity_and_temperature(float *humidity, float* temperature);
\ No newline at end of file
+void sht40_read_humidity_and_temperature(float *humidity, float* temperature);
+
+#endif //VOLF_SENSORS_H
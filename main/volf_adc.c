@@ -0,0 +1,135 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_SENSORS
+
+#include <string.h>
+#include "esp_attr.h"
+#include "volf_adc.h"
+#include "volf_log.h"
+#include "iot_wifi_sensor.h"
+
+#define ADC_CAL_MAGIC 0x41444331
+#define DEFAULT_VREF 1100
+#define LUT_SHIFT 6
+#define LUT_STEP (1 << LUT_SHIFT)
+#define LUT_SIZE (((VOLF_ADC_MAX_RAW + 1) >> LUT_SHIFT) + 1)
+
+/**
+ * Characterization and lookup table for each attenuation. Kept in RTC memory, which survives deep sleep but not a
+ * restart. The characteristics point at curve tables in flash, so they are only valid for the firmware version that
+ * created them.
+ */
+struct adc_calibration {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t characterized;
+    esp_adc_cal_characteristics_t chars[ADC_ATTEN_MAX];
+    /* Millivolts at every LUT_STEP raw values, the last entry at VOLF_ADC_MAX_RAW. */
+    uint16_t lut[ADC_ATTEN_MAX][LUT_SIZE];
+};
+
+struct adc_reservation {
+    const char *owner;
+    adc_atten_t atten;
+};
+
+RTC_DATA_ATTR static struct adc_calibration calibration;
+
+static struct adc_reservation reservations[ADC1_CHANNEL_MAX];
+static bool width_configured = false;
+static uint8_t configured_channels = 0;
+
+static void characterize(adc_atten_t atten) {
+    uint32_t raw;
+
+    if (calibration.magic != ADC_CAL_MAGIC || calibration.version != VERSION) {
+        memset(&calibration, 0, sizeof(calibration));
+        calibration.magic = ADC_CAL_MAGIC;
+        calibration.version = VERSION;
+    }
+    if ((calibration.characterized & (1 << atten)) != 0) {
+        return;
+    }
+
+    LOGI("Characterizing ADC1 at attenuation %d.", atten);
+    esp_adc_cal_characterize(ADC_UNIT_1, atten, VOLF_ADC_WIDTH, DEFAULT_VREF, &calibration.chars[atten]);
+    for (int i = 0; i < LUT_SIZE; i++) {
+        raw = i == LUT_SIZE - 1 ? VOLF_ADC_MAX_RAW : (uint32_t) i << LUT_SHIFT;
+        calibration.lut[atten][i] = (uint16_t) esp_adc_cal_raw_to_voltage(raw, &calibration.chars[atten]);
+    }
+    calibration.characterized |= 1 << atten;
+}
+
+esp_err_t volf_adc_reserve(adc1_channel_t channel, adc_atten_t atten, const char *owner) {
+    if (channel >= ADC1_CHANNEL_MAX || atten >= ADC_ATTEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (reservations[channel].owner != NULL && strcmp(reservations[channel].owner, owner) != 0) {
+        LOGE("ADC1 channel %d requested by %s is already used by %s.", channel, owner, reservations[channel].owner);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    characterize(atten);
+    if (reservations[channel].owner == NULL || reservations[channel].atten != atten) {
+        configured_channels &= ~(1 << channel);
+    }
+    reservations[channel].owner = owner;
+    reservations[channel].atten = atten;
+    return ESP_OK;
+}
+
+int volf_adc_read_raw(adc1_channel_t channel) {
+    if (channel >= ADC1_CHANNEL_MAX || reservations[channel].owner == NULL) {
+        LOGE("ADC1 channel %d read without a reservation.", channel);
+        return -1;
+    }
+    if (!width_configured) {
+        adc1_config_width(VOLF_ADC_WIDTH);
+        width_configured = true;
+    }
+    if ((configured_channels & (1 << channel)) == 0) {
+        adc1_config_channel_atten(channel, reservations[channel].atten);
+        configured_channels |= 1 << channel;
+    }
+    return adc1_get_raw(channel);
+}
+
+uint32_t volf_adc_read_mv(adc1_channel_t channel) {
+    int raw = volf_adc_read_raw(channel);
+
+    if (raw < 0) {
+        return 0;
+    }
+    return volf_adc_raw_to_mv(reservations[channel].atten, raw);
+}
+
+uint32_t volf_adc_raw_to_mv(adc_atten_t atten, uint32_t raw) {
+    uint32_t index;
+    uint32_t low;
+    uint32_t high;
+    uint32_t span;
+
+    if (raw > VOLF_ADC_MAX_RAW) {
+        raw = VOLF_ADC_MAX_RAW;
+    }
+    index = raw >> LUT_SHIFT;
+    if (index >= LUT_SIZE - 1) {
+        return calibration.lut[atten][LUT_SIZE - 1];
+    }
+    low = calibration.lut[atten][index];
+    high = calibration.lut[atten][index + 1];
+    // The last segment ends at VOLF_ADC_MAX_RAW rather than a full step.
+    span = index + 1 == LUT_SIZE - 1 ? VOLF_ADC_MAX_RAW - (index << LUT_SHIFT) : LUT_STEP;
+    return low + ((high - low) * (raw - (index << LUT_SHIFT)) + span / 2) / span;
+}
+
+void volf_adc_begin_continuous() {
+    width_configured = false;
+    configured_channels = 0;
+}
+
+void volf_adc_end_continuous() {
+    width_configured = false;
+    configured_channels = 0;
+}
@@ -0,0 +1,43 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_ADC_H
+#define VOLF_ADC_H
+
+#include <stdint.h>
+#include <driver/adc.h>
+#include "esp_adc_cal.h"
+#include "esp_err.h"
+
+#define VOLF_ADC_WIDTH ADC_WIDTH_BIT_12
+#define VOLF_ADC_MAX_RAW 4095
+
+/**
+ * Owns the configuration of ADC1 for all sensors. Each attenuation is characterized once and kept in RTC memory along
+ * with a raw to millivolt lookup table, so neither the eFuse reads nor the characterization repeat on every wake.
+ */
+
+/**
+ * Reserves the channel for the owner at the given attenuation. A channel stays with its first owner, other owners get
+ * ESP_ERR_INVALID_STATE so two sensors configured on the same pin are reported instead of silently reading each
+ * other's signal.
+ */
+esp_err_t volf_adc_reserve(adc1_channel_t channel, adc_atten_t atten, const char *owner);
+
+/** One shot read of a reserved channel. Returns -1 if the channel isn't reserved. */
+int volf_adc_read_raw(adc1_channel_t channel);
+
+/** One shot read of a reserved channel converted to millivolts. */
+uint32_t volf_adc_read_mv(adc1_channel_t channel);
+
+/** Converts a raw reading using the lookup table for the attenuation. Cheap enough for per sample use. */
+uint32_t volf_adc_raw_to_mv(adc_atten_t atten, uint32_t raw);
+
+/**
+ * Must surround any use of ADC1 by the digital controller (I2S continuous sampling), which changes the one shot
+ * configuration. The channels are reconfigured on the next one shot read.
+ */
+void volf_adc_begin_continuous();
+void volf_adc_end_continuous();
+
+#endif //VOLF_ADC_H
@@ -0,0 +1,138 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "volf_ap_select.h"
+
+/* Penalty for an AP that never connects, scaled down by the share of attempts that did. */
+#define FAILURE_PENALTY_DB 30.0f
+/* Slow connects keep the radio on longer, each CONNECT_MS_PER_DB costs a dB up to MAX_CONNECT_PENALTY_DB. */
+#define CONNECT_MS_PER_DB 200.0f
+#define MAX_CONNECT_PENALTY_DB 10.0f
+/* Assumed for APs without a connect time, so known fast APs win over unknown ones of the same strength. */
+#define TYPICAL_CONNECT_MS 2000
+/* Attempts and successes are halved once attempts reach this, so old results fade out. */
+#define ATTEMPT_WINDOW 16
+
+static const struct volf_ap_stats *find_stats(const struct volf_ap_history *history, const uint8_t *bssid) {
+    for (int i = 0; i < VOLF_AP_HISTORY_SIZE; i++) {
+        const struct volf_ap_stats *stats = &history->aps[i];
+        if (stats->last_used != 0 && memcmp(stats->bssid, bssid, sizeof(stats->bssid)) == 0) {
+            return stats;
+        }
+    }
+    return NULL;
+}
+
+float volf_ap_score(const struct volf_ap_history *history, const struct volf_ap_candidate *ap) {
+    const struct volf_ap_stats *stats = find_stats(history, ap->bssid);
+    uint32_t connect_ms = TYPICAL_CONNECT_MS;
+    float success_rate = 1.0f;
+    float connect_penalty;
+
+    if (stats != NULL) {
+        // An AP with no failures keeps the full score, each failure moves it towards the full penalty.
+        success_rate = (stats->successes + 1.0f) / (stats->attempts + 1.0f);
+        if (stats->connect_ms != 0) {
+            connect_ms = stats->connect_ms;
+        }
+    }
+    connect_penalty = connect_ms / CONNECT_MS_PER_DB;
+    if (connect_penalty > MAX_CONNECT_PENALTY_DB) {
+        connect_penalty = MAX_CONNECT_PENALTY_DB;
+    }
+    return ap->rssi - (1.0f - success_rate) * FAILURE_PENALTY_DB - connect_penalty;
+}
+
+size_t volf_ap_rank(const struct volf_ap_history *history, struct volf_ap_candidate *candidates, size_t count) {
+    float scores[VOLF_AP_MAX_CANDIDATES];
+    size_t kept = 0;
+
+    if (count > VOLF_AP_MAX_CANDIDATES) {
+        count = VOLF_AP_MAX_CANDIDATES;
+    }
+    // Insertion sort, there are only a handful of candidates.
+    for (size_t i = 0; i < count; i++) {
+        struct volf_ap_candidate candidate = candidates[i];
+        float score = volf_ap_score(history, &candidate);
+        bool repeat = false;
+        size_t pos;
+
+        for (size_t j = 0; j < kept; j++) {
+            if (memcmp(candidates[j].bssid, candidate.bssid, sizeof(candidate.bssid)) == 0) {
+                repeat = true;
+                break;
+            }
+        }
+        if (repeat) {
+            continue;
+        }
+        for (pos = kept; pos > 0 && scores[pos - 1] < score; pos--) {
+            candidates[pos] = candidates[pos - 1];
+            scores[pos] = scores[pos - 1];
+        }
+        candidates[pos] = candidate;
+        scores[pos] = score;
+        kept++;
+    }
+    return kept;
+}
+
+void volf_ap_record(struct volf_ap_history *history, const struct volf_ap_candidate *ap, bool connected,
+                    uint32_t connect_ms) {
+    struct volf_ap_stats *stats = (struct volf_ap_stats *) find_stats(history, ap->bssid);
+
+    if (stats == NULL) {
+        stats = &history->aps[0];
+        for (int i = 1; i < VOLF_AP_HISTORY_SIZE; i++) {
+            if (history->aps[i].last_used < stats->last_used) {
+                stats = &history->aps[i];
+            }
+        }
+        memset(stats, 0, sizeof(*stats));
+        memcpy(stats->bssid, ap->bssid, sizeof(stats->bssid));
+    }
+
+    if (stats->attempts >= ATTEMPT_WINDOW) {
+        stats->attempts /= 2;
+        stats->successes /= 2;
+    }
+    stats->attempts++;
+    if (connected) {
+        stats->successes++;
+    }
+    if (connected && connect_ms != 0) {
+        if (connect_ms > UINT16_MAX) {
+            connect_ms = UINT16_MAX;
+        }
+        stats->connect_ms = stats->connect_ms == 0 ? connect_ms : (3 * stats->connect_ms + connect_ms) / 4;
+    }
+    stats->channel = ap->channel;
+    stats->last_used = ++history->seq;
+}
+
+uint8_t volf_ap_last_channel(const struct volf_ap_history *history) {
+    const struct volf_ap_stats *last = NULL;
+
+    for (int i = 0; i < VOLF_AP_HISTORY_SIZE; i++) {
+        const struct volf_ap_stats *stats = &history->aps[i];
+        if (stats->last_used != 0 && stats->successes > 0 && (last == NULL || stats->last_used > last->last_used)) {
+            last = stats;
+        }
+    }
+    return last != NULL ? last->channel : 0;
+}
+
+bool volf_ap_should_rescan(const struct volf_ap_history *history, const struct volf_ap_candidate *ap) {
+    if (ap->rssi >= VOLF_AP_WEAK_RSSI) {
+        return false;
+    }
+    for (int i = 0; i < VOLF_AP_HISTORY_SIZE; i++) {
+        const struct volf_ap_stats *stats = &history->aps[i];
+        if (stats->last_used != 0 && stats->successes > 0
+            && memcmp(stats->bssid, ap->bssid, sizeof(stats->bssid)) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
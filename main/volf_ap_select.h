@@ -0,0 +1,69 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_AP_SELECT_H
+#define VOLF_AP_SELECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Ranks the access points found by a scan using their signal strength and how well connecting through them went on
+ * earlier wakes.
+ */
+
+#define VOLF_AP_HISTORY_SIZE 8
+#define VOLF_AP_MAX_CANDIDATES 16
+/* Below this signal strength a node looks for a stronger AP instead of reusing the one it knows. */
+#define VOLF_AP_WEAK_RSSI (-75)
+
+/** An access point broadcasting one of the known SSIDs. */
+struct volf_ap_candidate {
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    /* Index of the credential for the SSID the AP broadcasts. */
+    uint8_t credential;
+};
+
+/** How connecting through an AP went, over its most recent attempts. */
+struct volf_ap_stats {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t attempts;
+    uint8_t successes;
+    /* Smoothed time from starting to associate until an IP address was available, 0 if not known. */
+    uint16_t connect_ms;
+    /* Value of the history's sequence when the AP was last tried, 0 for an unused slot. */
+    uint32_t last_used;
+};
+
+/** Kept by the caller across restarts. Zero initialized means nothing is known yet. */
+struct volf_ap_history {
+    uint32_t seq;
+    struct volf_ap_stats aps[VOLF_AP_HISTORY_SIZE];
+};
+
+/** Score of an AP in dB, the signal strength less penalties for failed attempts and slow connects. Higher is better. */
+float volf_ap_score(const struct volf_ap_history *history, const struct volf_ap_candidate *ap);
+
+/**
+ * Sorts the candidates best first, dropping repeats of the same BSSID. Returns the number of candidates kept.
+ */
+size_t volf_ap_rank(const struct volf_ap_history *history, struct volf_ap_candidate *candidates, size_t count);
+
+/**
+ * Records an attempt to connect through the AP, replacing the AP tried longest ago when the history is full.
+ * connect_ms of 0 leaves the connect time unchanged, for connects that don't compare with a full one.
+ */
+void volf_ap_record(struct volf_ap_history *history, const struct volf_ap_candidate *ap, bool connected,
+                    uint32_t connect_ms);
+
+/** Channel of the AP last connected through, 0 if there is none, to scan that channel alone first. */
+uint8_t volf_ap_last_channel(const struct volf_ap_history *history);
+
+/** True if the AP is weak and another AP has worked before, so a scan may find a better one. */
+bool volf_ap_should_rescan(const struct volf_ap_history *history, const struct volf_ap_candidate *ap);
+
+#endif //VOLF_AP_SELECT_H
@@ -0,0 +1,127 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_REPORT
+
+#include <math.h>
+#include <time.h>
+#include "esp_attr.h"
+#include "volf_batch.h"
+#include "volf_log.h"
+#include "iot_wifi_sensor.h"
+
+#define BATCH_MAGIC 0x42415443
+
+/**
+ * The batch is kept in RTC memory that isn't initialized at boot, so readings survive both deep sleep and the restart
+ * done for a RETRY. The magic and firmware version guard against garbage after a power cycle or an update.
+ */
+struct batch_state {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t start;
+    uint8_t count;
+    bool last_sent_valid;
+    struct sensor_reading last_sent;
+    struct sensor_reading readings[MAX_BATCH_SIZE];
+};
+
+RTC_NOINIT_ATTR static struct batch_state batch;
+
+static void batch_init_if_needed() {
+    if (batch.magic != BATCH_MAGIC || batch.version != VERSION || batch.start >= MAX_BATCH_SIZE
+        || batch.count > MAX_BATCH_SIZE) {
+        LOGI("Initializing reading batch.");
+        batch.magic = BATCH_MAGIC;
+        batch.version = VERSION;
+        batch.start = 0;
+        batch.count = 0;
+        batch.last_sent_valid = false;
+    }
+}
+
+void volf_batch_add(const struct sensor_reading *reading) {
+    batch_init_if_needed();
+
+    if (batch.count == MAX_BATCH_SIZE) {
+        LOGW("Reading batch full, dropping the oldest reading.");
+        batch.start = (batch.start + 1) % MAX_BATCH_SIZE;
+        batch.count--;
+    }
+    batch.readings[(batch.start + batch.count) % MAX_BATCH_SIZE] = *reading;
+    batch.count++;
+}
+
+void volf_batch_replace_newest(const struct sensor_reading *reading) {
+    batch_init_if_needed();
+
+    if (batch.count == 0) {
+        volf_batch_add(reading);
+        return;
+    }
+    batch.readings[(batch.start + batch.count - 1) % MAX_BATCH_SIZE] = *reading;
+}
+
+uint8_t volf_batch_count() {
+    batch_init_if_needed();
+    return batch.count;
+}
+
+const struct sensor_reading *volf_batch_get(uint8_t index) {
+    batch_init_if_needed();
+    if (index >= batch.count) {
+        return NULL;
+    }
+    return &batch.readings[(batch.start + index) % MAX_BATCH_SIZE];
+}
+
+static bool moved_beyond(const struct sensor_reading *from, const struct sensor_reading *to, reading_field_t field,
+                         float threshold) {
+    if (!reading_has(from, field) || !reading_has(to, field)) {
+        return false;
+    }
+    return fabsf(to->values[field] - from->values[field]) >= threshold;
+}
+
+bool volf_batch_should_flush(const struct sensor_config *config, uint32_t sleep_duration) {
+    const struct sensor_reading *oldest;
+    const struct sensor_reading *newest;
+    const struct sensor_reading *reference;
+    uint32_t now = (uint32_t) time(NULL);
+
+    batch_init_if_needed();
+    if (batch.count == 0) {
+        return false;
+    }
+
+    if (batch.count >= config->batch_size) {
+        LOGI("Reading batch full with %d readings.", batch.count);
+        return true;
+    }
+
+    oldest = volf_batch_get(0);
+    newest = volf_batch_get(batch.count - 1);
+    if (now + sleep_duration > oldest->timestamp + config->batch_deadline) {
+        LOGI("Reading batch deadline reached.");
+        return true;
+    }
+
+    reference = batch.last_sent_valid ? &batch.last_sent : oldest;
+    if (moved_beyond(reference, newest, READING_MOISTURE_PERCENT, (float) config->batch_moisture_delta)
+        || moved_beyond(reference, newest, READING_TEMPERATURE, config->batch_temperature_delta)) {
+        LOGI("Reading crossed the batch threshold.");
+        return true;
+    }
+
+    return false;
+}
+
+void volf_batch_sent() {
+    batch_init_if_needed();
+    if (batch.count > 0) {
+        batch.last_sent = *volf_batch_get(batch.count - 1);
+        batch.last_sent_valid = true;
+    }
+    batch.start = 0;
+    batch.count = 0;
+}
@@ -0,0 +1,35 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_BATCH_H
+#define VOLF_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sensors/volf_sensors.h"
+
+#define MAX_BATCH_SIZE 12
+
+/** Adds a reading to the batch, dropping the oldest one if the batch is already full. */
+void volf_batch_add(const struct sensor_reading *reading);
+
+/** Replaces the newest reading in the batch, or adds the reading if the batch is empty. */
+void volf_batch_replace_newest(const struct sensor_reading *reading);
+
+/** Number of readings waiting to be sent. */
+uint8_t volf_batch_count();
+
+/** Returns the batched reading at the index, 0 being the oldest. */
+const struct sensor_reading *volf_batch_get(uint8_t index);
+
+/**
+ * True if the batch should be sent now: it is full, waiting for the next wake would miss the deadline, or the newest
+ * reading moved beyond the configured thresholds since the last reading sent. sleep_duration is the number of seconds
+ * until the next wake.
+ */
+bool volf_batch_should_flush(const struct sensor_config *config, uint32_t sleep_duration);
+
+/** Clears the batch after it has been published, remembering the newest reading for the threshold checks. */
+void volf_batch_sent();
+
+#endif //VOLF_BATCH_H
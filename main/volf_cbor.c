@@ -0,0 +1,89 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "volf_cbor.h"
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NEGINT 1
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+static void write_byte(struct volf_cbor_writer *writer, uint8_t byte) {
+    if (writer->len >= writer->size) {
+        writer->overflow = true;
+        return;
+    }
+    writer->buf[writer->len++] = byte;
+}
+
+static void write_head(struct volf_cbor_writer *writer, uint8_t major, uint64_t value) {
+    int num_bytes;
+
+    major <<= 5;
+    if (value < 24) {
+        write_byte(writer, major | value);
+        return;
+    } else if (value <= UINT8_MAX) {
+        write_byte(writer, major | 24);
+        num_bytes = 1;
+    } else if (value <= UINT16_MAX) {
+        write_byte(writer, major | 25);
+        num_bytes = 2;
+    } else if (value <= UINT32_MAX) {
+        write_byte(writer, major | 26);
+        num_bytes = 4;
+    } else {
+        write_byte(writer, major | 27);
+        num_bytes = 8;
+    }
+
+    for (int i = num_bytes - 1; i >= 0; i--) {
+        write_byte(writer, (value >> (i * 8)) & 0xFF);
+    }
+}
+
+void volf_cbor_init(struct volf_cbor_writer *writer, uint8_t *buf, size_t size) {
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = 0;
+    writer->overflow = false;
+}
+
+void volf_cbor_map(struct volf_cbor_writer *writer, size_t num_pairs) {
+    write_head(writer, CBOR_MAJOR_MAP, num_pairs);
+}
+
+void volf_cbor_array(struct volf_cbor_writer *writer, size_t num_items) {
+    write_head(writer, CBOR_MAJOR_ARRAY, num_items);
+}
+
+void volf_cbor_uint(struct volf_cbor_writer *writer, uint64_t value) {
+    write_head(writer, CBOR_MAJOR_UINT, value);
+}
+
+void volf_cbor_int(struct volf_cbor_writer *writer, int64_t value) {
+    if (value >= 0) {
+        write_head(writer, CBOR_MAJOR_UINT, (uint64_t) value);
+    } else {
+        write_head(writer, CBOR_MAJOR_NEGINT, (uint64_t) (-1 - value));
+    }
+}
+
+void volf_cbor_bool(struct volf_cbor_writer *writer, bool value) {
+    write_byte(writer, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void volf_cbor_decimal(struct volf_cbor_writer *writer, int64_t mantissa, int8_t exponent) {
+    if (exponent == 0) {
+        volf_cbor_int(writer, mantissa);
+        return;
+    }
+    write_head(writer, CBOR_MAJOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+    volf_cbor_array(writer, 2);
+    volf_cbor_int(writer, exponent);
+    volf_cbor_int(writer, mantissa);
+}
@@ -0,0 +1,32 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_CBOR_H
+#define VOLF_CBOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal CBOR (RFC 8949) encoder writing into a caller provided buffer. Only the types needed for telemetry are
+ * supported. Once the buffer is full further writes are dropped and overflow is set.
+ */
+struct volf_cbor_writer {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+};
+
+void volf_cbor_init(struct volf_cbor_writer *writer, uint8_t *buf, size_t size);
+void volf_cbor_map(struct volf_cbor_writer *writer, size_t num_pairs);
+void volf_cbor_array(struct volf_cbor_writer *writer, size_t num_items);
+void volf_cbor_uint(struct volf_cbor_writer *writer, uint64_t value);
+void volf_cbor_int(struct volf_cbor_writer *writer, int64_t value);
+void volf_cbor_bool(struct volf_cbor_writer *writer, bool value);
+
+/** Encodes mantissa * 10^exponent as a decimal fraction (tag 4), or as a plain integer when the exponent is 0. */
+void volf_cbor_decimal(struct volf_cbor_writer *writer, int64_t mantissa, int8_t exponent);
+
+#endif //VOLF_CBOR_H
@@ -0,0 +1,172 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_ERRORS
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "iot_wifi_sensor.h"
+#include "volf_crash_log.h"
+
+#define CRASH_LOG_MAGIC 0x434C4F47
+#define RECORD_HEADER_SIZE 2
+#define RECORD_BINARY 0x1
+
+/**
+ * Records are stored oldest first from tail and wrap around the end of data. Kept in RTC memory that isn't initialized
+ * at boot, the magic and firmware version guard against garbage after a power cycle or an update.
+ */
+struct crash_log {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t size;
+    uint16_t tail;
+    uint16_t used;
+    /* This wake ended in RETRY or ABORT. */
+    bool failed;
+    /* The capture of a failed wake is waiting to be uploaded, nothing is added until then. */
+    bool pending;
+    uint8_t data[MAX_CRASH_LOG_SIZE];
+};
+
+RTC_NOINIT_ATTR static struct crash_log crash_log;
+
+static uint16_t configured_size = 0;
+static SemaphoreHandle_t lock = NULL;
+
+static void crash_log_lock() {
+    if (lock != NULL) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+    }
+}
+
+static void crash_log_unlock() {
+    if (lock != NULL) {
+        xSemaphoreGive(lock);
+    }
+}
+
+static void reset(uint16_t size) {
+    crash_log.magic = CRASH_LOG_MAGIC;
+    crash_log.version = VERSION;
+    crash_log.size = size;
+    crash_log.tail = 0;
+    crash_log.used = 0;
+    crash_log.failed = false;
+    crash_log.pending = false;
+}
+
+static bool valid() {
+    return crash_log.magic == CRASH_LOG_MAGIC && crash_log.version == VERSION && crash_log.size <= MAX_CRASH_LOG_SIZE
+           && crash_log.used <= crash_log.size && (crash_log.size == 0 || crash_log.tail < crash_log.size);
+}
+
+static bool crashed(esp_reset_reason_t reason) {
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT
+           || reason == ESP_RST_WDT;
+}
+
+void volf_crash_log_init() {
+    if (lock == NULL) {
+        lock = xSemaphoreCreateMutex();
+    }
+    if (!valid()) {
+        reset(0);
+        return;
+    }
+    if (crash_log.failed || crashed(esp_reset_reason())) {
+        crash_log.pending = crash_log.pending || crash_log.used > 0;
+    }
+    crash_log.failed = false;
+}
+
+void volf_crash_log_set_size(uint16_t size) {
+    configured_size = size < MAX_CRASH_LOG_SIZE ? size : MAX_CRASH_LOG_SIZE;
+    crash_log_lock();
+    if (!crash_log.pending && crash_log.size != configured_size) {
+        reset(configured_size);
+    }
+    crash_log_unlock();
+}
+
+static void write_bytes(uint16_t pos, const uint8_t *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crash_log.data[(pos + i) % crash_log.size] = bytes[i];
+    }
+}
+
+void volf_crash_log_append(const uint8_t *entry, size_t len, bool binary) {
+    uint8_t header[RECORD_HEADER_SIZE] = {binary ? RECORD_BINARY : 0, (uint8_t) len};
+    size_t record_size = RECORD_HEADER_SIZE + len;
+    uint16_t oldest_size;
+
+    crash_log_lock();
+    if (crash_log.pending || len > UINT8_MAX || record_size > crash_log.size) {
+        crash_log_unlock();
+        return;
+    }
+    while (crash_log.size - crash_log.used < record_size) {
+        oldest_size = RECORD_HEADER_SIZE + crash_log.data[(crash_log.tail + 1) % crash_log.size];
+        crash_log.tail = (crash_log.tail + oldest_size) % crash_log.size;
+        crash_log.used -= oldest_size;
+    }
+    write_bytes((crash_log.tail + crash_log.used) % crash_log.size, header, sizeof(header));
+    write_bytes((crash_log.tail + crash_log.used + RECORD_HEADER_SIZE) % crash_log.size, entry, len);
+    crash_log.used += record_size;
+    crash_log_unlock();
+}
+
+void volf_crash_log_mark_failed() {
+    crash_log.failed = true;
+}
+
+bool volf_crash_log_pending() {
+    return crash_log.pending;
+}
+
+static void reverse(uint8_t *bytes, size_t len) {
+    uint8_t tmp;
+
+    for (size_t i = 0; i < len / 2; i++) {
+        tmp = bytes[i];
+        bytes[i] = bytes[len - 1 - i];
+        bytes[len - 1 - i] = tmp;
+    }
+}
+
+/**
+ * Rotates the data in place so the oldest record starts at 0, the capture is cleared after the upload anyway.
+ */
+static void make_contiguous() {
+    reverse(crash_log.data, crash_log.tail);
+    reverse(crash_log.data + crash_log.tail, crash_log.size - crash_log.tail);
+    reverse(crash_log.data, crash_log.size);
+    crash_log.tail = 0;
+}
+
+size_t volf_crash_log_get_payload(uint8_t *buf, size_t size) {
+    size_t len = 0;
+
+    if (size <= CRASH_LOG_PAYLOAD_HEADER_SIZE) {
+        return 0;
+    }
+    crash_log_lock();
+    make_contiguous();
+    memcpy(buf, CRASH_LOG_PAYLOAD_MAGIC, strlen(CRASH_LOG_PAYLOAD_MAGIC));
+    buf[4] = (uint8_t) crash_log.used;
+    buf[5] = (uint8_t) (crash_log.used >> 8);
+    len = volf_lz_compress(crash_log.data, crash_log.used, buf + CRASH_LOG_PAYLOAD_HEADER_SIZE,
+                           size - CRASH_LOG_PAYLOAD_HEADER_SIZE);
+    crash_log_unlock();
+    LOGI("Compressed %d bytes of crash log to %d bytes.", crash_log.used, len);
+    return len == 0 ? 0 : CRASH_LOG_PAYLOAD_HEADER_SIZE + len;
+}
+
+void volf_crash_log_clear() {
+    crash_log_lock();
+    reset(configured_size);
+    crash_log_unlock();
+}
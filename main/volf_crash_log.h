@@ -0,0 +1,53 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_CRASH_LOG_H
+#define VOLF_CRASH_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "volf_lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The end of the log output is kept in RTC memory, so it survives deep sleep, the restart done for a RETRY and
+ * panics. When a wake ends in RETRY, ABORT or a panic, the capture is frozen and uploaded by the next wake that
+ * connects. The uploaded payload is CRASH_LOG_PAYLOAD_MAGIC, the uncompressed size as 2 bytes little endian and the
+ * records compressed with volf_lz. Each record is a flags byte, a length byte and a log entry, tools/log_decoder
+ * turns the payload back into text.
+ */
+#define MAX_CRASH_LOG_SIZE 1024
+#define CRASH_LOG_PAYLOAD_MAGIC "VCL1"
+#define CRASH_LOG_PAYLOAD_HEADER_SIZE 6
+#define MAX_CRASH_LOG_PAYLOAD_SIZE (CRASH_LOG_PAYLOAD_HEADER_SIZE + VOLF_LZ_BOUND(MAX_CRASH_LOG_SIZE))
+
+/** Checks the capture kept from the previous wake and freezes it if that wake failed. */
+void volf_crash_log_init();
+
+/** Sets the size of the capture from the config, 0 turns it off. A frozen capture keeps its size until uploaded. */
+void volf_crash_log_set_size(uint16_t size);
+
+/** Adds a log entry, dropping the oldest entries to make room. Called by the log drain. */
+void volf_crash_log_append(const uint8_t *entry, size_t len, bool binary);
+
+/** Marks this wake as failed, so its capture is uploaded by the next wake. */
+void volf_crash_log_mark_failed();
+
+/** True if the capture of a failed wake is waiting to be uploaded. */
+bool volf_crash_log_pending();
+
+/** Writes the upload payload to buf, returns its size or 0 if it doesn't fit. */
+size_t volf_crash_log_get_payload(uint8_t *buf, size_t size);
+
+/** Discards the uploaded capture and starts capturing again. */
+void volf_crash_log_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //VOLF_CRASH_LOG_H
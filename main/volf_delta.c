@@ -0,0 +1,80 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_REPORT
+
+#include <math.h>
+#include "esp_attr.h"
+#include "volf_delta.h"
+#include "volf_log.h"
+
+/**
+ * The reported state the shadow acknowledged and when each field was last sent. Kept in RTC memory so it survives
+ * deep sleep. A restart clears it, which just means every field gets published once.
+ */
+RTC_DATA_ATTR static struct sensor_reading acked;
+RTC_DATA_ATTR static uint32_t acked_time[NUM_READING_FIELDS];
+
+/* The fields of this wake's publish, waiting for the acknowledgement. */
+static struct sensor_reading pending;
+
+static bool needs_publish(const struct sensor_config *config, const struct sensor_reading *reading,
+                          reading_field_t field) {
+    if (!reading_has(&acked, field)) {
+        return true;
+    }
+    if (reading->timestamp - acked_time[field] >= config->max_staleness) {
+        return true;
+    }
+    if (reading_is_telemetry(field)) {
+        return false;
+    }
+    if (reading_fields[field].type == FIELD_TYPE_BOOL) {
+        return (reading->values[field] != 0) != (acked.values[field] != 0);
+    }
+    return fabsf(reading->values[field] - acked.values[field]) > config->deadbands[field];
+}
+
+void volf_delta_filter(const struct sensor_config *config, struct sensor_reading *reading) {
+    uint32_t all_fields = reading->present;
+    bool publishing;
+
+    pending = *reading;
+    if (config->max_staleness == 0) {
+        return;
+    }
+
+    publishing = volf_delta_has_changes(config, reading);
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (publishing && reading_is_telemetry(field)) {
+            continue;
+        }
+        if (reading_has(reading, field) && !needs_publish(config, reading, field)) {
+            reading->present &= ~(1u << field);
+        }
+    }
+    pending.present = reading->present;
+    LOGI("Publishing %d of %d fields.", __builtin_popcount(reading->present), __builtin_popcount(all_fields));
+}
+
+bool volf_delta_has_changes(const struct sensor_config *config, const struct sensor_reading *reading) {
+    if (config->max_staleness == 0) {
+        return reading->present != 0;
+    }
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (reading_has(reading, field) && needs_publish(config, reading, field)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void volf_delta_acked() {
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (reading_has(&pending, field)) {
+            reading_set(&acked, field, pending.values[field]);
+            acked_time[field] = pending.timestamp;
+        }
+    }
+    pending.present = 0;
+}
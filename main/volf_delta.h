@@ -0,0 +1,24 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_DELTA_H
+#define VOLF_DELTA_H
+
+#include <stdbool.h>
+#include "sensors/volf_sensors.h"
+
+/**
+ * Removes the fields from the reading that don't need to be published: those within the configured deadband of the
+ * last acknowledged value and sent more recently than the max staleness. Connection stats and timings never cause a
+ * publish on their own, they are kept whenever another field is published. The fields left are remembered until the
+ * publish is acknowledged. Does nothing when max_staleness is 0.
+ */
+void volf_delta_filter(const struct sensor_config *config, struct sensor_reading *reading);
+
+/** True if any field of the reading would be kept by volf_delta_filter(). */
+bool volf_delta_has_changes(const struct sensor_config *config, const struct sensor_reading *reading);
+
+/** Records the fields kept by the last volf_delta_filter() as the acknowledged reported state. */
+void volf_delta_acked();
+
+#endif //VOLF_DELTA_H
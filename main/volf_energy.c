@@ -0,0 +1,118 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "volf_energy.h"
+
+/* Rough draw in mA of an ESP32 module and the sensors, tune these for the board. */
+#define ACTIVE_MA 40.0f
+#define RADIO_MA 100.0f
+#define MOISTURE_SENSOR_MA 5.0f
+#define TEMPERATURE_SENSOR_MA 1.5f
+#define SHT40_SENSOR_MA 0.5f
+#define CURRENT_SENSOR_MA 3.0f
+/* Deep sleep draw of the whole board, regulator included, in uA. */
+#define SLEEP_UA 50.0f
+
+/* Used until the first wake has been measured: a connect and publish with the sensors taking a second. */
+#define DEFAULT_AWAKE_MS 3000
+#define DEFAULT_RADIO_MS 2500
+#define DEFAULT_SENSOR_MS 1000
+
+/* Weight of the newest wake in the smoothed cost. */
+#define SMOOTHING 0.25f
+
+#define MS_PER_HOUR 3600000.0f
+#define SECONDS_PER_HOUR 3600.0f
+
+float volf_energy_wake_charge(const struct volf_energy_wake *wake) {
+    float sensor_ma = 0;
+
+    if (wake->moisture_sensor) {
+        sensor_ma += MOISTURE_SENSOR_MA;
+    }
+    if (wake->temperature_sensor) {
+        sensor_ma += TEMPERATURE_SENSOR_MA;
+    }
+    if (wake->sht40_sensor) {
+        sensor_ma += SHT40_SENSOR_MA;
+    }
+    if (wake->current_sensor) {
+        sensor_ma += CURRENT_SENSOR_MA;
+    }
+
+    // mA * ms / 3600000 is mAh, times 1000 for uAh.
+    return 1000.0f * (ACTIVE_MA * wake->awake_ms + RADIO_MA * wake->radio_ms + sensor_ma * wake->sensor_ms)
+           / MS_PER_HOUR;
+}
+
+void volf_energy_record_wake(struct volf_energy_model *model, const struct volf_energy_wake *wake) {
+    float charge = volf_energy_wake_charge(wake);
+
+    if (!model->valid) {
+        model->valid = true;
+        model->wake_uah = charge;
+        model->awake_ms = wake->awake_ms;
+        return;
+    }
+    model->wake_uah += SMOOTHING * (charge - model->wake_uah);
+    model->awake_ms = (uint32_t) ((float) model->awake_ms + SMOOTHING * ((float) wake->awake_ms - model->awake_ms));
+}
+
+static void wake_cost(const struct volf_energy_model *model, float *wake_uah, float *awake_s) {
+    struct volf_energy_wake typical = {DEFAULT_AWAKE_MS, DEFAULT_RADIO_MS, DEFAULT_SENSOR_MS, true, true, false, false};
+
+    if (model->valid) {
+        *wake_uah = model->wake_uah;
+        *awake_s = model->awake_ms / 1000.0f;
+    } else {
+        *wake_uah = volf_energy_wake_charge(&typical);
+        *awake_s = DEFAULT_AWAKE_MS / 1000.0f;
+    }
+}
+
+static float remaining_uah(const struct volf_energy_budget *budget) {
+    float percent = budget->battery_percent < 0 ? 0 : budget->battery_percent > 100 ? 100 : budget->battery_percent;
+
+    return budget->capacity_mah * 10.0f * percent;
+}
+
+static uint32_t clamp_duration(const struct volf_energy_budget *budget, float duration) {
+    if (duration <= budget->min_sleep_duration) {
+        return budget->min_sleep_duration;
+    }
+    if (duration >= budget->max_sleep_duration) {
+        return budget->max_sleep_duration;
+    }
+    return (uint32_t) (duration + 0.5f);
+}
+
+uint32_t volf_energy_sleep_duration(const struct volf_energy_model *model, const struct volf_energy_budget *budget) {
+    float wake_uah;
+    float awake_s;
+    float budget_ua;
+    uint32_t target_days = budget->target_life_days > 0 ? budget->target_life_days : 1;
+
+    if (budget->battery_percent <= budget->critical_battery_percent) {
+        return budget->max_sleep_duration;
+    }
+
+    wake_cost(model, &wake_uah, &awake_s);
+    budget_ua = remaining_uah(budget) / (target_days * 24.0f);
+    if (budget_ua <= SLEEP_UA) {
+        return budget->max_sleep_duration;
+    }
+
+    // The average over a cycle, (wake_uah * 3600 + SLEEP_UA * T) / (T + awake_s), must not exceed budget_ua.
+    return clamp_duration(budget, (wake_uah * SECONDS_PER_HOUR - budget_ua * awake_s) / (budget_ua - SLEEP_UA));
+}
+
+float volf_energy_runtime_hours(const struct volf_energy_model *model, const struct volf_energy_budget *budget,
+                                uint32_t sleep_duration) {
+    float wake_uah;
+    float awake_s;
+    float average_ua;
+
+    wake_cost(model, &wake_uah, &awake_s);
+    average_ua = (wake_uah * SECONDS_PER_HOUR + SLEEP_UA * sleep_duration) / (sleep_duration + awake_s);
+    return remaining_uah(budget) / average_ua;
+}
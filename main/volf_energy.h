@@ -0,0 +1,60 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_ENERGY_H
+#define VOLF_ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Estimates the charge each wake takes from the battery and picks the sleep interval that makes the remaining charge
+ * last the target number of days.
+ */
+
+/** What a single wake did, measured while it ran. */
+struct volf_energy_wake {
+    uint32_t awake_ms;
+    /* Part of the wake with Wi-Fi on, 0 if the wake went back to sleep without transmitting. */
+    uint32_t radio_ms;
+    /* Part of the wake spent reading the sensors, powering the ones enabled. */
+    uint32_t sensor_ms;
+    bool moisture_sensor;
+    bool temperature_sensor;
+    bool sht40_sensor;
+    bool current_sensor;
+};
+
+/** Smoothed cost of a wake, kept by the caller across deep sleep. Zero initialized means no wake recorded yet. */
+struct volf_energy_model {
+    bool valid;
+    float wake_uah;
+    uint32_t awake_ms;
+};
+
+struct volf_energy_budget {
+    uint32_t capacity_mah;
+    float battery_percent;
+    uint32_t target_life_days;
+    uint32_t min_sleep_duration;
+    uint32_t max_sleep_duration;
+    float critical_battery_percent;
+};
+
+/** Charge used by the wake in microamp hours. */
+float volf_energy_wake_charge(const struct volf_energy_wake *wake);
+
+/** Folds the wake into the smoothed cost, the first wake recorded replaces the default estimate. */
+void volf_energy_record_wake(struct volf_energy_model *model, const struct volf_energy_wake *wake);
+
+/**
+ * Sleep duration in seconds that keeps the average current low enough for the remaining charge to last the target
+ * life, within the min and max durations. At or below the critical battery percentage it is always the max.
+ */
+uint32_t volf_energy_sleep_duration(const struct volf_energy_model *model, const struct volf_energy_budget *budget);
+
+/** Hours the remaining charge lasts when sleeping for sleep_duration seconds between wakes. */
+float volf_energy_runtime_hours(const struct volf_energy_model *model, const struct volf_energy_budget *budget,
+                                uint32_t sleep_duration);
+
+#endif //VOLF_ENERGY_H
@@ -1,46 +1,50 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#define LOG_MODULE LOG_MODULE_ERRORS
+
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/timers.h>
+#include <stdio.h>
 #include <string.h>
+#include "esp_attr.h"
+#include "iot_wifi_sensor.h"
+#include "volf_crash_log.h"
 #include "volf_error.h"
+#include "volf_journal.h"
 #include "volf_log.h"
 #include "volf_misc.h"
 
-#include "nvs.h"
-
 /**
- * Acronym definitions:
+ * Errors are kept in an append-only journal, see volf_journal.h. Each wake is a publish attempt of the current error
+ * log. A RETRY restarts into the next attempt, and after MAX_PUBLISH_ATTEMPTS the log is closed with an ABORT and a
+ * new one started. The counters are rebuilt from the journal at boot, so nothing but the records is stored.
  *
- * ELC: Error Log Count
- * PAC: Publish Attempt Count
- * CC: Continue Count
- * PAR: Publish Attempt Runtime
+ * Records are first staged in RTC memory that survives both the restart done for a RETRY and deep sleep, and only
+ * written to the journal by volf_flush_errors() before sleeping, or when the stage is full. That keeps flash writes
+ * out of the error path and makes a wake with many errors a single write.
  *
- * EC: Error Continue
- * ER: Error Retry
- * EA: Error Abort
+ * Errors are handled from the sensor task, the Wi-Fi and IP event handlers and the reporting task at the same time.
+ * The stage is only touched inside stage_lock, held just long enough to copy records in or out, while flush_lock keeps
+ * a single task writing to the journal.
  */
 
-#define ERROR_LOG_COUNT_KEY "ELC"
-#define MAX_KEY_SIZE 12
-#define NVS_NAME_ERRORS "volf.errors"
-
-/* AT_<ELC> */
-char *PUBLISH_ATTEMPT_COUNT_KEY_TEMPLATE = "PAC_%d";
-
-/* PAR_<ELC>_<PAC> */
-char *PUBLISH_ATTEMPT_RUNTIME_KEY_TEMPLATE = "PAR_%d_%d";
+#define STAGE_MAGIC 0x45525253
+#define MAX_STAGED_RECORDS 12
 
-/* EC_<ELC>_<PAC>_<CC> */
-char *ERROR_CONTINUE_KEY_TEMPLATE = "EC_%d_%d_%d";
+struct error_stage {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t count;
+    struct volf_journal_record records[MAX_STAGED_RECORDS];
+};
 
-/* ER_<ELC>_<PAC> */
-char *ERROR_RETRY_KEY_TEMPLATE = "ER_%d_%d";
-
-/* EA_<ELC>_<PAC> */
-char *ERROR_ABORT_KEY_TEMPLATE = "EA_%d_%d";
+RTC_NOINIT_ATTR static struct error_stage stage;
+static portMUX_TYPE stage_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t flush_lock = NULL;
+/* Counts clears, so a flush doesn't drop records staged after a clear that happened while it was writing. */
+static uint32_t stage_clears = 0;
 
 static uint8_t error_log_count = 0;
 static uint8_t publish_attempt_count = 0;
@@ -53,8 +57,7 @@ static volf_error_handler_t *continue_handler = NULL;
 static bool initialized = false;
 static struct volf_errors loaded_errors;
 
-static void volf_read_errors();
-static void volf_build_error_context_key(volf_error_t error, char *error_context_key);
+static void volf_read_error_record(const struct volf_journal_record *record);
 
 void volf_register_error_handler(volf_error_t error, volf_error_handler_t handler) {
     switch (error) {
@@ -73,45 +76,33 @@ void volf_register_error_handler(volf_error_t error, volf_error_handler_t handle
 }
 
 /**
- * Initialize the error log state. This reads the
+ * Initialize the error log state. This reads the journal once, loading the errors of the previous attempts and
+ * starting the next attempt of the current error log.
  */
 void volf_error_init() {
-    nvs_handle_t my_handle;
-    char publish_attempt_key[MAX_KEY_SIZE];
-
-    esp_err_t err = nvs_open(NVS_NAME_ERRORS, NVS_READWRITE, &my_handle);
-    if (err != ESP_OK) {
-        LOGE("Error (%s) opening NVS handle for error log initialization!\n", esp_err_to_name(err));
-        return;
+    if (flush_lock == NULL) {
+        flush_lock = xSemaphoreCreateMutex();
     }
+    memset(&loaded_errors, 0, sizeof(loaded_errors));
+    error_log_count = 1;
+    publish_attempt_count = 0;
+    continue_count = 0;
 
-    err = nvs_get_u8(my_handle, ERROR_LOG_COUNT_KEY, &error_log_count);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        return;
-    }
-
-    if (err != 0) {
-        LOGE("Error (%s) reading error log count!\n", esp_err_to_name(err));
-        nvs_erase_all(my_handle);
-    } else {
-        LOGI("Found log error count: %d", error_log_count);
-
-        if (error_log_count > 0) {
-            volf_read_errors();
+    volf_journal_load(volf_read_error_record);
 
-            snprintf(publish_attempt_key, MAX_KEY_SIZE, PUBLISH_ATTEMPT_COUNT_KEY_TEMPLATE, error_log_count);
-            err = nvs_get_u8(my_handle, publish_attempt_key, &publish_attempt_count);
-            if (err != 0 && err != ESP_ERR_NVS_NOT_FOUND) {
-                LOGE("Error (%s) reading error log count!\n", esp_err_to_name(err));
-            }
-            LOGI("Found publish attempt count %d", publish_attempt_count);
-        } else {
-            error_log_count = 1;
-        }
-        publish_attempt_count++;
+    if (stage.magic != STAGE_MAGIC || stage.version != VERSION || stage.count > MAX_STAGED_RECORDS) {
+        stage.magic = STAGE_MAGIC;
+        stage.version = VERSION;
+        stage.count = 0;
+    }
+    // Anything staged was recorded before the last restart, so it comes after everything in the journal.
+    for (uint8_t i = 0; i < stage.count; i++) {
+        volf_read_error_record(&stage.records[i]);
     }
-    nvs_close(my_handle);
 
+    publish_attempt_count++;
+    LOGI("Found %d error logs, starting publish attempt %d of log %d", loaded_errors.num_error_logs,
+         publish_attempt_count, error_log_count);
     initialized = true;
 }
 
@@ -122,168 +113,157 @@ bool volf_errors_available() {
     return loaded_errors.num_error_logs != 0;
 }
 
-void volf_clear_and_close(const nvs_handle_t *nvs_handle) {
-    nvs_handle_t nvs_errors_handle;
+void volf_flush_errors() {
+    struct volf_journal_record records[MAX_STAGED_RECORDS];
+    uint8_t count;
+    uint32_t clears;
+    esp_err_t err;
 
-    LOGI("Clearing all errors as it looks like there may have been a corruption.");
-    if (nvs_handle != NULL) {
-        nvs_errors_handle = *nvs_handle;
-    } else {
-        esp_err_t err = nvs_open(NVS_NAME_ERRORS, NVS_READWRITE, &nvs_errors_handle);
-        if (err != ESP_OK) {
-            LOGW("Error (%s) opening NVS handle to delete all error logs!\n", esp_err_to_name(err));
-            return;
-        }
+    if (!initialized) {
+        return;
     }
 
-    nvs_erase_all(nvs_errors_handle);
-    nvs_close(nvs_errors_handle);
-
-    error_log_count = 0;
-    publish_attempt_count = 0;
-    continue_count = 0;
-}
-
-void volf_clear_errors() {
-    volf_clear_and_close(NULL);
-}
-
-static esp_err_t volf_store_runtime(nvs_handle_t nvs_handle) {
-    uint32_t publish_attempt_runtime;
-    char publish_attempt_runtime_key[MAX_KEY_SIZE];
-    esp_err_t err;
+    xSemaphoreTake(flush_lock, portMAX_DELAY);
+    portENTER_CRITICAL(&stage_lock);
+    count = stage.count;
+    clears = stage_clears;
+    memcpy(records, stage.records, count * sizeof(records[0]));
+    portEXIT_CRITICAL(&stage_lock);
 
-    publish_attempt_runtime = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    snprintf(publish_attempt_runtime_key, MAX_KEY_SIZE, PUBLISH_ATTEMPT_RUNTIME_KEY_TEMPLATE, error_log_count,
-             publish_attempt_count);
+    if (count > 0) {
+        LOGI("Writing %d staged error records to the journal.", count);
+        err = volf_journal_append(records, count);
+        if (err != ESP_OK) {
+            LOGE("Error (%s) appending to the error journal!", esp_err_to_name(err));
+        }
 
-    err = nvs_set_u32(nvs_handle, publish_attempt_runtime_key, publish_attempt_runtime);
-    if (err != 0 && err != ESP_ERR_NVS_NOT_FOUND) {
-        LOGI("Error (%s) setting key %s to value %d\n", esp_err_to_name(err), publish_attempt_runtime_key,
-             publish_attempt_runtime);
-        return err;
-    } else {
-        return ESP_OK;
+        // The written records stay staged until now, so a restart while writing doesn't lose them. Records staged
+        // meanwhile move to the front for the next flush.
+        portENTER_CRITICAL(&stage_lock);
+        if (stage_clears == clears) {
+            stage.count -= count;
+            memmove(stage.records, stage.records + count, stage.count * sizeof(stage.records[0]));
+        }
+        portEXIT_CRITICAL(&stage_lock);
     }
+    xSemaphoreGive(flush_lock);
 }
 
-static void volf_build_error_context_key(volf_error_t error, char *error_context_key) {
-    switch (error) {
-        case RETRY:
-            snprintf(error_context_key, MAX_KEY_SIZE, ERROR_RETRY_KEY_TEMPLATE, error_log_count, publish_attempt_count);
-            break;
-        case ABORT:
-            snprintf(error_context_key, MAX_KEY_SIZE, ERROR_ABORT_KEY_TEMPLATE, error_log_count, publish_attempt_count);
-            break;
-        case CONTINUE:
-            continue_count++;
-            snprintf(error_context_key, MAX_KEY_SIZE, ERROR_CONTINUE_KEY_TEMPLATE, error_log_count,
-                     publish_attempt_count, continue_count);
-            break;
-        default:
-            LOGW("Cannot store error context for unknown error number %d", error);
+static void volf_append_record(journal_record_type_t type, volf_error_t error, const char *context) {
+    struct volf_journal_record record;
+    bool staged = false;
+
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.error = error;
+    record.log = error_log_count;
+    record.attempt = publish_attempt_count;
+    record.runtime = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (context != NULL) {
+        strlcpy(record.context, context, sizeof(record.context));
     }
-}
 
-static esp_err_t volf_store_error_log_counts(nvs_handle_t nvs_handle) {
-    char publish_attempt_count_key[MAX_KEY_SIZE];
-
-    esp_err_t err = nvs_set_u8(nvs_handle, ERROR_LOG_COUNT_KEY, error_log_count);
-    if (err != 0) {
-        LOGE("Error (%s) setting error log count!\n", esp_err_to_name(err));
-        return err;
+    while (!staged) {
+        portENTER_CRITICAL(&stage_lock);
+        if (stage.count < MAX_STAGED_RECORDS) {
+            stage.records[stage.count++] = record;
+            staged = true;
+        }
+        portEXIT_CRITICAL(&stage_lock);
+        if (!staged) {
+            volf_flush_errors();
+        }
     }
+}
 
-    snprintf(publish_attempt_count_key, MAX_KEY_SIZE, PUBLISH_ATTEMPT_COUNT_KEY_TEMPLATE, error_log_count);
-    err = nvs_set_u8(nvs_handle, publish_attempt_count_key, publish_attempt_count);
-    if (err != 0) {
-        LOGE("Error (%s) setting publish attempt count!\n", esp_err_to_name(err));
-    }
-    return err;
+void volf_clear_errors() {
+    LOGI("Clearing all errors.");
+    // Staged records are cleared too, the clear record only has to cover the journal.
+    portENTER_CRITICAL(&stage_lock);
+    stage.count = 0;
+    stage_clears++;
+    portEXIT_CRITICAL(&stage_lock);
+    volf_append_record(JOURNAL_RECORD_CLEAR, CONTINUE, NULL);
+    memset(&loaded_errors, 0, sizeof(loaded_errors));
+    error_log_count = 1;
+    publish_attempt_count = 1;
+    continue_count = 0;
 }
 
 static void volf_store_error_context(volf_error_t error, char *context, int associated_rc) {
-    nvs_handle_t nvs_handle;
-    char error_context_key[MAX_KEY_SIZE];
-    char *context_and_rc;
-    uint32_t max_context_and_rc_len = strlen(context) + 10;
-
-    esp_err_t err = nvs_open(NVS_NAME_ERRORS, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        LOGE("Error (%s) opening NVS handle for error log update!\n", esp_err_to_name(err));
+    char context_and_rc[JOURNAL_CONTEXT_SIZE];
+
+    if (error == CONTINUE && ++continue_count > MAX_CONTINUE_CONTEXTS) {
+        LOGW("Max continue contexts stored, not storing %s.", context);
         return;
     }
 
-    context_and_rc = malloc(max_context_and_rc_len * sizeof(char));
-    snprintf(context_and_rc, max_context_and_rc_len, "%s(%d)", context, associated_rc);
+    snprintf(context_and_rc, sizeof(context_and_rc), "%s(%d)", context, associated_rc);
+    LOGI("Storing error context: \"%s\" for log %d attempt %d.", context_and_rc, error_log_count,
+         publish_attempt_count);
+    volf_append_record(JOURNAL_RECORD_CONTEXT, error, context_and_rc);
+}
 
-    err = volf_store_error_log_counts(nvs_handle);
-    if (err != ESP_OK) {
-        volf_clear_and_close(&nvs_handle);
-        return;
-    }
+/**
+ * Adds a context record to the errors loaded at boot. Records past the limits of struct volf_errors are ignored.
+ */
+static void volf_read_error_context(const struct volf_journal_record *record) {
+    struct volf_error_log *log;
+    struct volf_publish_attempt *attempt;
 
-    volf_build_error_context_key(error, error_context_key);
-    LOGI("Storing error context: \"%s\" for key \"%s\".", context_and_rc, error_context_key);
-    err = nvs_set_str(nvs_handle, error_context_key, context_and_rc);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        LOGE("Error (%s) setting key %s to value %s\n", esp_err_to_name(err), error_context_key, context_and_rc);
-        volf_clear_and_close(&nvs_handle);
+    if (record->log < 1 || record->log > MAX_ERROR_LOGS || record->attempt < 1
+        || record->attempt > MAX_PUBLISH_ATTEMPTS) {
+        LOGW("Ignoring error record for log %d attempt %d.", record->log, record->attempt);
         return;
     }
-    free(context_and_rc);
 
-    if (error != CONTINUE) {
-        err = volf_store_runtime(nvs_handle);
-        if (err != ESP_OK) {
-            volf_clear_and_close(&nvs_handle);
-            return;
-        }
+    log = &loaded_errors.error_logs[record->log - 1];
+    attempt = &log->publish_attempts[record->attempt - 1];
+    if (loaded_errors.num_error_logs < record->log) {
+        loaded_errors.num_error_logs = record->log;
     }
-
-    nvs_close(nvs_handle);
-}
-
-static void volf_read_publish_attempt(nvs_handle_t nvs_handle, struct volf_publish_attempt *attempt, uint8_t log_num,
-                                      uint8_t attempt_num) {
-    int8_t continue_num;
-    char nvs_key[MAX_KEY_SIZE];
-    size_t nvs_str_length = MAX_ERROR_CONTEXT_SIZE;
-    esp_err_t rc;
-
-    snprintf(nvs_key, MAX_KEY_SIZE, PUBLISH_ATTEMPT_RUNTIME_KEY_TEMPLATE, log_num, attempt_num);
-    LOGI("Reading publish attempt key %s", nvs_key);
-    nvs_get_u32(nvs_handle, nvs_key, &attempt->runtime);
-
-    snprintf(nvs_key, MAX_KEY_SIZE, ERROR_RETRY_KEY_TEMPLATE, log_num, attempt_num);
-    LOGI("Reading publish attempt key %s", nvs_key);
-    rc = nvs_get_str(nvs_handle, nvs_key, attempt->retry_context, &nvs_str_length);
-    if (rc != ESP_OK) {
-        LOGI("Received error (%s) when reading value for key %s", esp_err_to_name(rc), nvs_key);
+    if (log->num_publish_attempts < record->attempt) {
+        log->num_publish_attempts = record->attempt;
     }
 
-    nvs_str_length = MAX_ERROR_CONTEXT_SIZE;
-    snprintf(nvs_key, MAX_KEY_SIZE, ERROR_ABORT_KEY_TEMPLATE, log_num, attempt_num);
-    LOGI("Reading publish attempt key %s", nvs_key);
-    rc = nvs_get_str(nvs_handle, nvs_key, attempt->abort_context, &nvs_str_length);
-    if (rc != ESP_OK) {
-        LOGI("Received error (%s) when reading value for key %s", esp_err_to_name(rc), nvs_key);
+    switch (record->error) {
+        case RETRY:
+            strlcpy(attempt->retry_context, record->context, MAX_ERROR_CONTEXT_SIZE);
+            attempt->runtime = record->runtime;
+            break;
+        case ABORT:
+            strlcpy(attempt->abort_context, record->context, MAX_ERROR_CONTEXT_SIZE);
+            attempt->runtime = record->runtime;
+            break;
+        case CONTINUE:
+            if (attempt->num_continue_contexts < MAX_CONTINUE_CONTEXTS) {
+                strlcpy(attempt->continue_contexts[attempt->num_continue_contexts++], record->context,
+                        MAX_ERROR_CONTEXT_SIZE);
+            }
+            break;
+        default:
+            LOGW("Ignoring error record for unknown error type %d", record->error);
     }
+}
 
-    continue_num = 1;
-    while (continue_num != -1 && continue_num <= MAX_CONTINUE_CONTEXTS) {
-        snprintf(nvs_key, MAX_KEY_SIZE, ERROR_CONTINUE_KEY_TEMPLATE, log_num, attempt_num, continue_num);
-
-        LOGI("Reading continue error key %s", nvs_key);
-        nvs_str_length = MAX_ERROR_CONTEXT_SIZE;
-        rc = nvs_get_str(nvs_handle, nvs_key, attempt->continue_contexts[continue_num - 1], &nvs_str_length);
-        LOGI("Received rc from reading continue error: %s", esp_err_to_name(rc));
-        if (rc != ESP_OK) {
-            attempt->num_continue_contexts = continue_num - 1;
-            continue_num = -1;
-        } else {
-            continue_num++;
-        }
+static void volf_read_error_record(const struct volf_journal_record *record) {
+    switch (record->type) {
+        case JOURNAL_RECORD_CONTEXT:
+            volf_read_error_context(record);
+            error_log_count = record->log;
+            publish_attempt_count = record->attempt;
+            break;
+        case JOURNAL_RECORD_NEW_LOG:
+            error_log_count = record->log;
+            publish_attempt_count = 0;
+            break;
+        case JOURNAL_RECORD_CLEAR:
+            memset(&loaded_errors, 0, sizeof(loaded_errors));
+            error_log_count = 1;
+            publish_attempt_count = 0;
+            break;
+        default:
+            LOGW("Ignoring journal record of unknown type %d", record->type);
     }
 }
 
@@ -295,82 +275,16 @@ struct volf_errors *volf_get_errors() {
     }
 }
 
-static void volf_read_errors() {
-    nvs_handle_t nvs_handle;
-    esp_err_t rc;
-    uint8_t logged_publish_attempts;
-    struct volf_publish_attempt *current_attempt;
-    uint8_t error_log_index = 0;
-    char nvs_key[MAX_KEY_SIZE];
-
-    loaded_errors.num_error_logs = 0;
-
-    rc = nvs_open(NVS_NAME_ERRORS, NVS_READONLY, &nvs_handle);
-    if (rc != ESP_OK) {
-        LOGE("Error (%s) opening NVS handle for error log read!\n", esp_err_to_name(rc));
-    }
-
-    LOGI("Reading %d error logs", error_log_count);
-    for (int error_log_num = 1; error_log_num <= error_log_count; error_log_num++) {
-        LOGI("Error log %d", error_log_num);
-        snprintf(nvs_key, MAX_KEY_SIZE, PUBLISH_ATTEMPT_COUNT_KEY_TEMPLATE, error_log_num);
-        rc = nvs_get_u8(nvs_handle, nvs_key, &logged_publish_attempts);
-        if (rc != 0) {
-            if (rc == ESP_ERR_NVS_NOT_FOUND) {
-                LOGW("Could not find attempt count for error log %d", error_log_num);
-            } else {
-                LOGE("Error (%s) when reading attempt count for error log %d", esp_err_to_name(rc), error_log_num);
-            }
-            continue;
-        }
-        LOGI("Publish attempts %d", logged_publish_attempts);
-
-        if (logged_publish_attempts > MAX_PUBLISH_ATTEMPTS) {
-            LOGE("Found too many publish attempts. Clearing all logs...");
-            volf_clear_and_close(&nvs_handle);
-            return;
-        }
-
-        for (int publish_attempt_num = 1; publish_attempt_num <= logged_publish_attempts; publish_attempt_num++) {
-            current_attempt = &loaded_errors.error_logs[error_log_index].publish_attempts[publish_attempt_num - 1];
-            volf_read_publish_attempt(nvs_handle, current_attempt, error_log_num, publish_attempt_num);
-            LOGI("Publish attempt %d", publish_attempt_num);
-            LOGI("Retry context = %s, Abort context = %s, Num continue contexts = %d, runtime = %d",
-                 current_attempt->retry_context, current_attempt->abort_context, current_attempt->num_continue_contexts,
-                 current_attempt->runtime);
-        }
-        loaded_errors.error_logs[error_log_index].num_publish_attempts = logged_publish_attempts;
-        loaded_errors.num_error_logs++;
-        error_log_index++;
-    }
-
-    nvs_close(nvs_handle);
-}
-
 static void volf_increment_error_log_count() {
-    nvs_handle_t nvs_handle;
-    esp_err_t rc;
-
     if (error_log_count + 1 > MAX_ERROR_LOGS) {
         LOGW("Warning: Max error logs stored.");
-        volf_clear_and_close(NULL);
+        volf_clear_errors();
         return;
     }
 
-    rc = nvs_open(NVS_NAME_ERRORS, NVS_READWRITE, &nvs_handle);
-    if (rc != ESP_OK) {
-        LOGE("Error (%s) opening NVS handle for incrementing error log count!\n", esp_err_to_name(rc));
-    } else {
-        rc = nvs_set_u8(nvs_handle, ERROR_LOG_COUNT_KEY, error_log_count + 1);
-        if (rc != ESP_OK) {
-            LOGE("Error (%s) incrementing error log count! Current log count: %d\n", esp_err_to_name(rc),
-                 error_log_count);
-            volf_clear_and_close(&nvs_handle);
-            return;
-        }
-    }
-
-    nvs_close(nvs_handle);
+    error_log_count++;
+    publish_attempt_count = 0;
+    volf_append_record(JOURNAL_RECORD_NEW_LOG, ABORT, NULL);
 }
 
 void volf_handle_error(volf_error_t error, char *context, int associated_rc) {
@@ -391,6 +305,10 @@ void volf_handle_error(volf_error_t error, char *context, int associated_rc) {
         error = ABORT;
     }
 
+    if (error != CONTINUE) {
+        volf_crash_log_mark_failed();
+    }
+
     switch (error) {
         case RETRY:
             if (retry_handler != NULL) {
@@ -411,4 +329,4 @@ void volf_handle_error(volf_error_t error, char *context, int associated_rc) {
         default:
             LOGW("Cannot notify handler for unknown error type: %d", error);
     }
-}
\ No newline at end of file
+}
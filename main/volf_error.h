@@ -48,6 +48,9 @@ void volf_clear_errors();
 void volf_error_init();
 void volf_handle_error(volf_error_t error, char *context, int associated_rc);
 
+/** Writes the errors staged in RTC memory to flash. Call once per wake, right before sleeping. */
+void volf_flush_errors();
+
 #ifdef __cplusplus
 }
 #endif
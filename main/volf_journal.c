@@ -0,0 +1,259 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_ERRORS
+
+#include <string.h>
+#include "esp_partition.h"
+#include "nvs.h"
+#include "volf_journal.h"
+#include "volf_log.h"
+
+#define JOURNAL_PARTITION_LABEL "errlog"
+#define RECORDS_PER_SECTOR (SPI_FLASH_SEC_SIZE / JOURNAL_RECORD_SIZE)
+#define MAX_JOURNAL_SECTORS 16
+#define READ_CHUNK_RECORDS 8
+#define ERASED_SEQ 0xFFFFFFFF
+
+/* Without the partition the journal is one NVS blob, rewritten as a whole on each append. */
+#define NVS_NAME_JOURNAL "volf.journal"
+#define NVS_JOURNAL_KEY "records"
+#define MAX_NVS_RECORDS 32
+
+_Static_assert(sizeof(struct volf_journal_record) == JOURNAL_RECORD_SIZE, "journal records must be 64 bytes");
+
+static const esp_partition_t *partition = NULL;
+static bool loaded = false;
+static uint32_t next_seq = 1;
+
+/* Partition state. The sectors form a ring, the oldest one is erased when the newest fills up. */
+static uint32_t num_sectors = 0;
+static uint32_t head_sector = 0;
+static uint32_t head_index = 0;
+static bool head_needs_erase = false;
+
+/* NVS state. */
+static struct volf_journal_record nvs_records[MAX_NVS_RECORDS];
+static size_t nvs_count = 0;
+
+/** CRC-16/CCITT-FALSE. */
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t record_crc(const struct volf_journal_record *record) {
+    return crc16((const uint8_t *) record, offsetof(struct volf_journal_record, crc));
+}
+
+static bool record_valid(const struct volf_journal_record *record) {
+    return record->seq != ERASED_SEQ && record->crc == record_crc(record);
+}
+
+static bool record_erased(const struct volf_journal_record *record) {
+    const uint8_t *bytes = (const uint8_t *) record;
+
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void visit(volf_journal_visitor_t *visitor, const struct volf_journal_record *record) {
+    if (record->seq >= next_seq) {
+        next_seq = record->seq + 1;
+    }
+    visitor(record);
+}
+
+static uint32_t sector_offset(uint32_t sector) {
+    return sector * SPI_FLASH_SEC_SIZE;
+}
+
+/**
+ * Reads one sector in chunks, visiting its valid records. Returns the index of the first free slot, or
+ * RECORDS_PER_SECTOR if the sector is full.
+ */
+static uint32_t load_sector(uint32_t sector, volf_journal_visitor_t *visitor) {
+    struct volf_journal_record chunk[READ_CHUNK_RECORDS];
+    uint32_t free_index = RECORDS_PER_SECTOR;
+
+    for (uint32_t index = 0; index < RECORDS_PER_SECTOR; index += READ_CHUNK_RECORDS) {
+        if (esp_partition_read(partition, sector_offset(sector) + index * JOURNAL_RECORD_SIZE, chunk,
+                               sizeof(chunk)) != ESP_OK) {
+            LOGE("Unable to read error journal sector %d.", sector);
+            return RECORDS_PER_SECTOR;
+        }
+        for (uint32_t i = 0; i < READ_CHUNK_RECORDS; i++) {
+            if (record_valid(&chunk[i])) {
+                visit(visitor, &chunk[i]);
+            } else if (record_erased(&chunk[i])) {
+                return index + i;
+            }
+        }
+    }
+    return free_index;
+}
+
+static void load_partition(volf_journal_visitor_t *visitor) {
+    struct volf_journal_record first[MAX_JOURNAL_SECTORS];
+    uint32_t order[MAX_JOURNAL_SECTORS];
+    uint32_t num_used = 0;
+    uint32_t sector;
+
+    num_sectors = partition->size / SPI_FLASH_SEC_SIZE;
+    if (num_sectors > MAX_JOURNAL_SECTORS) {
+        num_sectors = MAX_JOURNAL_SECTORS;
+    }
+
+    // Sectors are filled in sequence order, so sorting them by their first record gives the write order.
+    for (sector = 0; sector < num_sectors; sector++) {
+        if (esp_partition_read(partition, sector_offset(sector), &first[sector], JOURNAL_RECORD_SIZE) != ESP_OK
+            || !record_valid(&first[sector])) {
+            continue;
+        }
+        uint32_t pos = num_used++;
+        while (pos > 0 && first[order[pos - 1]].seq > first[sector].seq) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = sector;
+    }
+
+    if (num_used == 0) {
+        head_sector = 0;
+        head_index = 0;
+        head_needs_erase = !record_erased(&first[0]);
+        return;
+    }
+
+    for (uint32_t i = 0; i < num_used; i++) {
+        head_sector = order[i];
+        head_index = load_sector(order[i], visitor);
+    }
+    head_needs_erase = false;
+}
+
+static void load_nvs(volf_journal_visitor_t *visitor) {
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(nvs_records);
+    esp_err_t err;
+
+    nvs_count = 0;
+    err = nvs_open(NVS_NAME_JOURNAL, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return;
+    }
+    err = nvs_get_blob(nvs_handle, NVS_JOURNAL_KEY, nvs_records, &size);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    for (size_t i = 0; i < size / JOURNAL_RECORD_SIZE; i++) {
+        if (record_valid(&nvs_records[i])) {
+            visit(visitor, &nvs_records[i]);
+            nvs_records[nvs_count++] = nvs_records[i];
+        }
+    }
+}
+
+static void ignore_record(const struct volf_journal_record *record) {
+}
+
+void volf_journal_load(volf_journal_visitor_t *visitor) {
+    loaded = true;
+    next_seq = 1;
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                         JOURNAL_PARTITION_LABEL);
+    if (partition != NULL && partition->size >= SPI_FLASH_SEC_SIZE) {
+        load_partition(visitor);
+    } else {
+        LOGI("No %s partition, keeping the error journal in NVS.", JOURNAL_PARTITION_LABEL);
+        partition = NULL;
+        load_nvs(visitor);
+    }
+}
+
+static esp_err_t advance_head() {
+    head_sector = (head_sector + 1) % num_sectors;
+    head_index = 0;
+    return esp_partition_erase_range(partition, sector_offset(head_sector), SPI_FLASH_SEC_SIZE);
+}
+
+static esp_err_t append_partition(const struct volf_journal_record *records, size_t count) {
+    uint32_t batch;
+    esp_err_t err;
+
+    if (head_needs_erase) {
+        err = esp_partition_erase_range(partition, sector_offset(head_sector), SPI_FLASH_SEC_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        head_needs_erase = false;
+    }
+
+    while (count > 0) {
+        if (head_index == RECORDS_PER_SECTOR && (err = advance_head()) != ESP_OK) {
+            return err;
+        }
+        batch = RECORDS_PER_SECTOR - head_index < count ? RECORDS_PER_SECTOR - head_index : count;
+        err = esp_partition_write(partition, sector_offset(head_sector) + head_index * JOURNAL_RECORD_SIZE, records,
+                                  batch * JOURNAL_RECORD_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        head_index += batch;
+        records += batch;
+        count -= batch;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t append_nvs(const struct volf_journal_record *records, size_t count) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].type == JOURNAL_RECORD_CLEAR) {
+            nvs_count = 0;
+        }
+        if (nvs_count == MAX_NVS_RECORDS) {
+            LOGW("Error journal full, dropping a record.");
+            continue;
+        }
+        nvs_records[nvs_count++] = records[i];
+    }
+
+    err = nvs_open(NVS_NAME_JOURNAL, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_JOURNAL_KEY, nvs_records, nvs_count * JOURNAL_RECORD_SIZE);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+esp_err_t volf_journal_append(struct volf_journal_record *records, size_t count) {
+    if (!loaded) {
+        volf_journal_load(ignore_record);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        records[i].seq = next_seq++;
+        records[i].crc = record_crc(&records[i]);
+    }
+    return partition != NULL ? append_partition(records, count) : append_nvs(records, count);
+}
@@ -0,0 +1,49 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_JOURNAL_H
+#define VOLF_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define JOURNAL_RECORD_SIZE 64
+#define JOURNAL_CONTEXT_SIZE 50
+
+typedef enum {
+    /* An error context reported to volf_handle_error(). */
+    JOURNAL_RECORD_CONTEXT = 1,
+    /* The previous error log ended with an abort, the following contexts belong to the next one. */
+    JOURNAL_RECORD_NEW_LOG = 2,
+    /* Everything before this record was published and is no longer needed. */
+    JOURNAL_RECORD_CLEAR = 3
+} journal_record_type_t;
+
+/**
+ * A fixed size journal entry. The sequence number orders the records and the CRC covers everything before it, so a
+ * record torn by a reset in the middle of a write is skipped on load.
+ */
+struct volf_journal_record {
+    uint32_t seq;
+    uint8_t type;
+    uint8_t error;
+    uint8_t log;
+    uint8_t attempt;
+    uint32_t runtime;
+    char context[JOURNAL_CONTEXT_SIZE];
+    uint16_t crc;
+};
+
+typedef void volf_journal_visitor_t(const struct volf_journal_record *record);
+
+/**
+ * Reads the journal once from start to end, passing each valid record to the visitor in the order they were written.
+ * Records live in the "errlog" data partition when the partition table has one, and in a single NVS blob otherwise.
+ */
+void volf_journal_load(volf_journal_visitor_t *visitor);
+
+/** Appends the records with a single write, filling in their sequence numbers and CRCs. */
+esp_err_t volf_journal_append(struct volf_journal_record *records, size_t count);
+
+#endif //VOLF_JOURNAL_H
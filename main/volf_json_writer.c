@@ -0,0 +1,157 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "volf_json_writer.h"
+
+#define MAX_NUMBER_SIZE 24
+#define MAX_EXACT_INTEGER 1e15
+
+static void write_char(struct volf_json_writer *writer, char c) {
+    // Always keep room for the terminating NUL.
+    if (writer->len + 1 >= writer->size) {
+        writer->overflow = true;
+        return;
+    }
+    writer->buf[writer->len++] = c;
+}
+
+static void write_raw(struct volf_json_writer *writer, const char *str, size_t len) {
+    if (writer->len + len >= writer->size) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buf + writer->len, str, len);
+    writer->len += len;
+}
+
+static void begin_value(struct volf_json_writer *writer) {
+    if (writer->need_comma) {
+        write_char(writer, ',');
+    }
+    writer->need_comma = true;
+}
+
+static void write_escaped(struct volf_json_writer *writer, const char *str) {
+    char escape[7];
+
+    write_char(writer, '"');
+    for (; *str != '\0'; str++) {
+        switch (*str) {
+            case '"':
+                write_raw(writer, "\\\"", 2);
+                break;
+            case '\\':
+                write_raw(writer, "\\\\", 2);
+                break;
+            case '\n':
+                write_raw(writer, "\\n", 2);
+                break;
+            case '\r':
+                write_raw(writer, "\\r", 2);
+                break;
+            case '\t':
+                write_raw(writer, "\\t", 2);
+                break;
+            default:
+                if ((unsigned char) *str < 0x20) {
+                    snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char) *str);
+                    write_raw(writer, escape, 6);
+                } else {
+                    write_char(writer, *str);
+                }
+        }
+    }
+    write_char(writer, '"');
+}
+
+void volf_json_init(struct volf_json_writer *writer, char *buf, size_t size) {
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = 0;
+    writer->overflow = size == 0;
+    writer->need_comma = false;
+}
+
+void volf_json_object_start(struct volf_json_writer *writer) {
+    begin_value(writer);
+    write_char(writer, '{');
+    writer->need_comma = false;
+}
+
+void volf_json_object_end(struct volf_json_writer *writer) {
+    write_char(writer, '}');
+    writer->need_comma = true;
+}
+
+void volf_json_array_start(struct volf_json_writer *writer) {
+    begin_value(writer);
+    write_char(writer, '[');
+    writer->need_comma = false;
+}
+
+void volf_json_array_end(struct volf_json_writer *writer) {
+    write_char(writer, ']');
+    writer->need_comma = true;
+}
+
+void volf_json_key(struct volf_json_writer *writer, const char *key) {
+    begin_value(writer);
+    write_escaped(writer, key);
+    write_char(writer, ':');
+    writer->need_comma = false;
+}
+
+void volf_json_string(struct volf_json_writer *writer, const char *value) {
+    begin_value(writer);
+    write_escaped(writer, value);
+}
+
+void volf_json_bool(struct volf_json_writer *writer, bool value) {
+    begin_value(writer);
+    if (value) {
+        write_raw(writer, "true", 4);
+    } else {
+        write_raw(writer, "false", 5);
+    }
+}
+
+void volf_json_uint(struct volf_json_writer *writer, uint32_t value) {
+    char number[MAX_NUMBER_SIZE];
+    int len;
+
+    begin_value(writer);
+    len = snprintf(number, sizeof(number), "%u", value);
+    write_raw(writer, number, len);
+}
+
+void volf_json_number(struct volf_json_writer *writer, double value) {
+    char number[MAX_NUMBER_SIZE];
+    int len;
+
+    begin_value(writer);
+    if (isnan(value) || isinf(value)) {
+        // JSON has no representation for these, cJSON writes null as well.
+        write_raw(writer, "null", 4);
+        return;
+    }
+    if (value == floor(value) && fabs(value) < MAX_EXACT_INTEGER) {
+        len = snprintf(number, sizeof(number), "%.0f", value);
+    } else {
+        len = snprintf(number, sizeof(number), "%.7g", value);
+    }
+    write_raw(writer, number, len);
+}
+
+size_t volf_json_finish(struct volf_json_writer *writer) {
+    if (writer->overflow) {
+        if (writer->size > 0) {
+            writer->buf[0] = '\0';
+        }
+        return 0;
+    }
+    writer->buf[writer->len] = '\0';
+    return writer->len;
+}
@@ -0,0 +1,42 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_JSON_WRITER_H
+#define VOLF_JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming JSON writer serializing straight into a caller provided buffer, without any heap allocation. Commas are
+ * inserted automatically. Once the buffer is full further writes are dropped and overflow is set, so callers only
+ * need to check the result of volf_json_finish().
+ */
+struct volf_json_writer {
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+    bool need_comma;
+};
+
+void volf_json_init(struct volf_json_writer *writer, char *buf, size_t size);
+void volf_json_object_start(struct volf_json_writer *writer);
+void volf_json_object_end(struct volf_json_writer *writer);
+void volf_json_array_start(struct volf_json_writer *writer);
+void volf_json_array_end(struct volf_json_writer *writer);
+
+/** Writes an object key, which must be followed by exactly one value. */
+void volf_json_key(struct volf_json_writer *writer, const char *key);
+void volf_json_string(struct volf_json_writer *writer, const char *value);
+void volf_json_bool(struct volf_json_writer *writer, bool value);
+void volf_json_uint(struct volf_json_writer *writer, uint32_t value);
+
+/** Writes whole numbers without a fraction and everything else with 7 significant digits, the precision of a float. */
+void volf_json_number(struct volf_json_writer *writer, double value);
+
+/** NUL terminates the document and returns its length, or 0 if it didn't fit in the buffer. */
+size_t volf_json_finish(struct volf_json_writer *writer);
+
+#endif //VOLF_JSON_WRITER_H
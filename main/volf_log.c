@@ -1,36 +1,359 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdio.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/portmacro.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "esp_system.h"
+#include "mbedtls/base64.h"
 #include "volf_log.h"
+#include "volf_crash_log.h"
 
-#define MAX_RUNTIME_SIZE 12
+#define LOG_RING_SIZE 4096
+#define MAX_LOG_LINE_SIZE 192
+#define DRAIN_INTERVAL_MS 20
+#define DRAIN_TASK_PRIORITY 1
+#define DRAIN_TASK_CORE 0
 
-static void get_runtime(char *runtime_str) {
-    uint32_t runtime = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    sprintf(runtime_str, "%d", runtime);
+/*
+ * Each entry starts with a header word holding its size, a multiple of 4 including the header, and flags. Entries
+ * never wrap around the end of the ring, a padding entry fills the gap instead. The drain zeroes each entry it has
+ * written out, so a header that hasn't been committed yet always reads as 0.
+ */
+#define ENTRY_HEADER_SIZE sizeof(uint32_t)
+#define ENTRY_SIZE_MASK 0xFFFF
+#define ENTRY_COMMITTED (1 << 16)
+#define ENTRY_PADDING (1 << 17)
+#define ENTRY_BINARY (1 << 18)
+
+#define BINARY_LOG_MARKER "#VL:"
+#define MAX_BINARY_STRING_SIZE 64
+#define BINARY_LINE_SIZE ((MAX_LOG_LINE_SIZE + 2) / 3 * 4 + 1)
+
+static const char *module_names[NUM_LOG_MODULES] = {
+        [LOG_MODULE_MAIN] = "main",
+        [LOG_MODULE_WIFI] = "wifi",
+        [LOG_MODULE_TLS] = "tls",
+        [LOG_MODULE_SENSORS] = "sensors",
+        [LOG_MODULE_REPORT] = "report",
+        [LOG_MODULE_ERRORS] = "errors",
+        [LOG_MODULE_OTA] = "ota",
+};
+
+static const char *level_names[] = {
+        [ESP_LOG_NONE] = "none",
+        [ESP_LOG_ERROR] = "error",
+        [ESP_LOG_WARN] = "warn",
+        [ESP_LOG_INFO] = "info",
+        [ESP_LOG_DEBUG] = "debug",
+        [ESP_LOG_VERBOSE] = "verbose",
+};
+
+static esp_log_level_t module_levels[NUM_LOG_MODULES] = {[0 ... NUM_LOG_MODULES - 1] = MAX_LOG_LEVEL};
+
+static uint8_t ring[LOG_RING_SIZE] __attribute__((aligned(4)));
+/* Free running byte counts, the position in the ring is the count modulo LOG_RING_SIZE. */
+static atomic_uint_fast32_t reserved = 0;
+static atomic_uint_fast32_t drained = 0;
+static atomic_uint_fast32_t dropped = 0;
+
+static SemaphoreHandle_t drain_lock = NULL;
+static bool binary_log = false;
+
+static uint32_t *header_at(uint32_t count) {
+    return (uint32_t *) &ring[count % LOG_RING_SIZE];
+}
+
+/**
+ * Reserves size bytes plus any padding needed to keep the entry contiguous. Returns false if the ring is full.
+ */
+static bool reserve(uint32_t size, uint32_t *start, uint32_t *padding) {
+    uint_fast32_t head = atomic_load_explicit(&reserved, memory_order_relaxed);
+    uint32_t to_end;
+
+    do {
+        to_end = LOG_RING_SIZE - head % LOG_RING_SIZE;
+        *padding = to_end < size ? to_end : 0;
+        if (head + *padding + size - atomic_load_explicit(&drained, memory_order_acquire) > LOG_RING_SIZE) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&reserved, &head, head + *padding + size,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+    *start = head;
+    return true;
+}
+
+static void commit(uint32_t start, uint32_t header) {
+    atomic_store_explicit((_Atomic uint32_t *) header_at(start), header, memory_order_release);
+}
+
+/**
+ * Formats the message as text, "(runtime) " followed by the formatted format string.
+ */
+static int encode_text(uint8_t *buf, size_t size, uint32_t runtime, const char *format, va_list args) {
+    int prefix_len;
+    int len;
+
+    prefix_len = snprintf((char *) buf, size, "(%u) ", runtime);
+    len = vsnprintf((char *) buf + prefix_len, size - prefix_len, format, args);
+    if (len < 0) {
+        return len;
+    }
+    len += prefix_len;
+    if (len >= (int) size) {
+        len = size - 1;
+        buf[len - 1] = '\n';
+    }
+    return len;
+}
+
+static bool append(uint8_t *buf, size_t size, size_t *len, const void *value, size_t value_size) {
+    if (*len + value_size > size) {
+        return false;
+    }
+    memcpy(buf + *len, value, value_size);
+    *len += value_size;
+    return true;
+}
+
+/**
+ * Records the address of the format string, the runtime and the raw arguments, little endian in the order of the
+ * conversions. The format string stays in flash and is looked up in the ELF by tools/log_decoder. Integers take 4
+ * bytes, 8 with ll or j, floating point values 8 bytes and strings a length byte followed by the characters. Arguments
+ * that don't fit are left off and shown as ? by the decoder.
+ */
+static int encode_binary(uint8_t *buf, size_t size, uint32_t runtime, const char *format, va_list args) {
+    const char *p = format;
+    size_t len = 0;
+    uint32_t address = (uint32_t) (uintptr_t) format;
+    uint8_t longs;
+    int32_t int_value;
+    int64_t long_value;
+    double double_value;
+    const char *string_value;
+    uint8_t string_len;
+    bool fits = true;
+
+    append(buf, size, &len, &address, sizeof(address));
+    append(buf, size, &len, &runtime, sizeof(runtime));
+
+    while (fits && (p = strchr(p, '%')) != NULL) {
+        p++;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        for (; *p != '\0' && strchr("-+ #0123456789.*", *p) != NULL; p++) {
+            if (*p == '*') {
+                int_value = va_arg(args, int32_t);
+                fits = append(buf, size, &len, &int_value, sizeof(int_value));
+            }
+        }
+        for (longs = 0; *p != '\0' && strchr("hljztL", *p) != NULL; p++) {
+            longs += *p == 'l' ? 1 : *p == 'j' ? 2 : 0;
+        }
+        switch (*p) {
+            case '\0':
+                return len;
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+            case 'p':
+                if (longs >= 2) {
+                    long_value = va_arg(args, int64_t);
+                    fits = fits && append(buf, size, &len, &long_value, sizeof(long_value));
+                } else {
+                    int_value = va_arg(args, int32_t);
+                    fits = fits && append(buf, size, &len, &int_value, sizeof(int_value));
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                double_value = va_arg(args, double);
+                fits = fits && append(buf, size, &len, &double_value, sizeof(double_value));
+                break;
+            case 's':
+                string_value = va_arg(args, const char *);
+                if (string_value == NULL) {
+                    string_value = "(null)";
+                }
+                string_len = (uint8_t) strnlen(string_value, MAX_BINARY_STRING_SIZE);
+                fits = fits && append(buf, size, &len, &string_len, sizeof(string_len))
+                       && append(buf, size, &len, string_value, string_len);
+                break;
+            default:
+                break;
+        }
+        p++;
+    }
+    return len;
+}
+
+void volf_log_set_binary(bool binary) {
+    binary_log = binary;
 }
 
 void volf_log_write(esp_log_level_t level,
-                    const char *tag,
+                    volf_log_module_t module,
                     const char *format,
                     ...) {
     va_list args;
-    char runtime_str[MAX_RUNTIME_SIZE];
-    char *new_format;
+    uint8_t entry[MAX_LOG_LINE_SIZE];
+    uint32_t runtime;
+    uint32_t flags = binary_log ? ENTRY_BINARY : 0;
+    int len;
+    uint32_t size;
+    uint32_t start;
+    uint32_t padding;
+
+    if (level > module_levels[module]) {
+        return;
+    }
+
+    runtime = xTaskGetTickCount() * portTICK_PERIOD_MS;
 
     va_start(args, format);
-    get_runtime(runtime_str);
+    if (binary_log) {
+        len = encode_binary(entry, sizeof(entry), runtime, format, args);
+    } else {
+        len = encode_text(entry, sizeof(entry), runtime, format, args);
+    }
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
 
-    new_format = malloc((strlen(runtime_str) + strlen(format) + 4) * sizeof(char));
-    sprintf(new_format, "(%s) %s", runtime_str, format);
+    size = (ENTRY_HEADER_SIZE + len + 3) & ~3u;
+    if (!reserve(size, &start, &padding)) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    if (padding > 0) {
+        commit(start, padding | ENTRY_PADDING | ENTRY_COMMITTED);
+        start += padding;
+    }
+    memcpy(&ring[start % LOG_RING_SIZE + ENTRY_HEADER_SIZE], entry, len);
+    commit(start, (ENTRY_HEADER_SIZE + len) | flags | ENTRY_COMMITTED);
+}
 
-    esp_log_writev(level, tag, new_format, args);
+/**
+ * Binary entries go out as one line each, the marker followed by the entry in base64, so they can be picked out of
+ * a capture that also holds text from the ROM, the IDF and text entries.
+ */
+static void write_binary(const uint8_t *entry, size_t len) {
+    unsigned char line[BINARY_LINE_SIZE];
+    size_t line_len;
 
-    va_end(args);
-    free(new_format);
+    if (mbedtls_base64_encode(line, sizeof(line), &line_len, entry, len) != 0) {
+        return;
+    }
+    fputs(BINARY_LOG_MARKER, stdout);
+    fwrite(line, 1, line_len, stdout);
+    fputc('\n', stdout);
+}
+
+/**
+ * Writes out committed entries in order, stopping at the first one still being written. Each entry is also added to
+ * the crash log.
+ */
+static void drain() {
+    uint32_t tail = atomic_load_explicit(&drained, memory_order_relaxed);
+    uint8_t *entry;
+    uint32_t header;
+    uint32_t size;
+    uint32_t lost;
+
+    while (tail != atomic_load_explicit(&reserved, memory_order_acquire)) {
+        header = atomic_load_explicit((_Atomic uint32_t *) header_at(tail), memory_order_acquire);
+        if ((header & ENTRY_COMMITTED) == 0) {
+            break;
+        }
+        size = header & ENTRY_SIZE_MASK;
+        entry = &ring[tail % LOG_RING_SIZE + ENTRY_HEADER_SIZE];
+        if ((header & ENTRY_PADDING) == 0) {
+            if ((header & ENTRY_BINARY) != 0) {
+                write_binary(entry, size - ENTRY_HEADER_SIZE);
+            } else {
+                fwrite(entry, 1, size - ENTRY_HEADER_SIZE, stdout);
+            }
+            volf_crash_log_append(entry, size - ENTRY_HEADER_SIZE, (header & ENTRY_BINARY) != 0);
+            size = (size + 3) & ~3u;
+        }
+        memset(&ring[tail % LOG_RING_SIZE], 0, size);
+        tail += size;
+        atomic_store_explicit(&drained, tail, memory_order_release);
+    }
+
+    lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0) {
+        printf("(%u) " LOG_NAME ": %u log messages dropped, the log buffer was full.\n",
+               xTaskGetTickCount() * portTICK_PERIOD_MS, lost);
+    }
+    fflush(stdout);
+}
+
+void volf_log_flush() {
+    if (drain_lock == NULL) {
+        drain();
+        return;
+    }
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+    drain();
+    xSemaphoreGive(drain_lock);
+}
+
+static void drain_task(void *param) {
+    while (true) {
+        volf_log_flush();
+        vTaskDelay(DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+    }
+}
+
+void volf_log_init() {
+    if (drain_lock != NULL) {
+        return;
+    }
+    volf_crash_log_init();
+    drain_lock = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(&drain_task, "log_drain", 2560, NULL, DRAIN_TASK_PRIORITY, NULL, DRAIN_TASK_CORE);
+    esp_register_shutdown_handler(&volf_log_flush);
+}
+
+void volf_log_set_level(volf_log_module_t module, esp_log_level_t level) {
+    if (module < NUM_LOG_MODULES) {
+        module_levels[module] = level;
+    }
+}
+
+volf_log_module_t volf_log_module_by_name(const char *name) {
+    for (int module = 0; module < NUM_LOG_MODULES; module++) {
+        if (strcmp(module_names[module], name) == 0) {
+            return module;
+        }
+    }
+    return NUM_LOG_MODULES;
+}
+
+int volf_log_level_by_name(const char *name) {
+    for (int level = ESP_LOG_NONE; level <= ESP_LOG_VERBOSE; level++) {
+        if (strcmp(level_names[level], name) == 0) {
+            return level;
+        }
+    }
+    return -1;
 }
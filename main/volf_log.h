@@ -10,16 +10,59 @@
 #define MAX_LOG_LEVEL ESP_LOG_DEBUG
 #define LOG_NAME "mn"
 
+/**
+ * Each source file logs as one module, whose level can be changed at runtime. A file picks its module by defining
+ * LOG_MODULE before its first include, files that don't log as LOG_MODULE_MAIN.
+ */
+typedef enum {
+    LOG_MODULE_MAIN,
+    LOG_MODULE_WIFI,
+    LOG_MODULE_TLS,
+    LOG_MODULE_SENSORS,
+    LOG_MODULE_REPORT,
+    LOG_MODULE_ERRORS,
+    LOG_MODULE_OTA,
+    NUM_LOG_MODULES
+} volf_log_module_t;
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MODULE_MAIN
+#endif
+
 #define FORMAT_LOG_MSG(format, letter) "(" #letter ") " LOG_NAME ": " format
 
+/**
+ * Formats the message into a lock free ring buffer without allocating, from any task. The buffer is written to the
+ * UART by a low priority task, so a call never waits on the UART. Messages that don't fit are dropped and counted.
+ */
 void volf_log_write(esp_log_level_t level,
+                    volf_log_module_t module,
                     const char *format,
-                    const char *tag,
                     ...);
 
+/** Starts the task draining the ring buffer. Messages logged before are kept until it runs. */
+void volf_log_init();
+
+/** Writes out everything in the ring buffer from the calling task. Called before sleeping or restarting. */
+void volf_log_flush();
+
+void volf_log_set_level(volf_log_module_t module, esp_log_level_t level);
+
+/**
+ * Switches between text and binary logging. A binary entry holds the address of the format string, the runtime and
+ * the raw arguments instead of the formatted text, tools/log_decoder turns it back into text using the firmware ELF.
+ */
+void volf_log_set_binary(bool binary);
+
+/** Returns the module with the given name, e.g. "wifi", or NUM_LOG_MODULES if there is none. */
+volf_log_module_t volf_log_module_by_name(const char *name);
+
+/** Returns the level with the given name, "none", "error", "warn", "info", "debug" or "verbose", or -1. */
+int volf_log_level_by_name(const char *name);
+
 #define LOGL__(level, format, ...) do { \
     if (MAX_LOG_LEVEL >= level) {       \
-        volf_log_write(level, LOG_NAME, format, ##__VA_ARGS__); \
+        volf_log_write(level, LOG_MODULE, format, ##__VA_ARGS__); \
     }\
 } while(0)
 
@@ -34,7 +77,7 @@ void volf_log_write(esp_log_level_t level,
 #define LOGE_(format, ...) LOGE__((FORMAT_LOG_MSG(format, E)), ##__VA_ARGS__)
 
 #define LOGD(format, ... ) LOGD_(format "\n", ##__VA_ARGS__)
-#define LOGI(format, ... ) LOGE_(format "\n", ##__VA_ARGS__)
+#define LOGI(format, ... ) LOGI_(format "\n", ##__VA_ARGS__)
 #define LOGW(format, ... ) LOGW_(format "\n", ##__VA_ARGS__)
 #define LOGE(format, ... ) LOGE_(format "\n", ##__VA_ARGS__)
 
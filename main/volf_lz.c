@@ -0,0 +1,179 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "volf_lz.h"
+
+#define MIN_MATCH 4
+#define HASH_BITS 10
+#define MAX_OFFSET 65535
+#define RUN_MASK 15
+/* The format requires the last 5 bytes to be literals and the last match to start at least 12 bytes from the end. */
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/** Writes the part of a length that doesn't fit in the token, returns the new output position or NULL if full. */
+static uint8_t *write_length(uint8_t *op, const uint8_t *op_end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= op_end) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= op_end) {
+        return NULL;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/**
+ * Writes the literals followed by a match, or only the literals if match_len is 0, which ends the block.
+ */
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *literals, size_t literal_len,
+                               size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    size_t match_code = match_len > 0 ? match_len - MIN_MATCH : 0;
+
+    if (token >= op_end) {
+        return NULL;
+    }
+    *token = (uint8_t) ((literal_len < RUN_MASK ? literal_len : RUN_MASK) << 4);
+    if (literal_len >= RUN_MASK && (op = write_length(op, op_end, literal_len - RUN_MASK)) == NULL) {
+        return NULL;
+    }
+    if (op + literal_len > op_end) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len == 0) {
+        return op;
+    }
+
+    if (op + 2 > op_end) {
+        return NULL;
+    }
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+    *token |= (uint8_t) (match_code < RUN_MASK ? match_code : RUN_MASK);
+    if (match_code >= RUN_MASK && (op = write_length(op, op_end, match_code - RUN_MASK)) == NULL) {
+        return NULL;
+    }
+    return op;
+}
+
+size_t volf_lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size) {
+    uint16_t table[1 << HASH_BITS];
+    const uint8_t *dst_end = dst + dst_size;
+    uint8_t *op = dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t ref;
+    size_t match_len;
+    uint32_t h;
+
+    if (src_len > VOLF_LZ_MAX_INPUT_SIZE) {
+        return 0;
+    }
+    memset(table, 0, sizeof(table));
+
+    while (src_len > MATCH_FIND_LIMIT && ip < src_len - MATCH_FIND_LIMIT) {
+        h = hash(read32(src + ip));
+        ref = table[h];
+        table[h] = (uint16_t) ip;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != read32(src + ip)) {
+            ip++;
+            continue;
+        }
+
+        match_len = MIN_MATCH;
+        while (ip + match_len < src_len - LAST_LITERALS && src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+        op = write_sequence(op, dst_end, src + anchor, ip - anchor, ip - ref, match_len);
+        if (op == NULL) {
+            return 0;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, dst_end, src + anchor, src_len - anchor, 0, 0);
+    return op == NULL ? 0 : (size_t) (op - dst);
+}
+
+/** Reads the part of a length that didn't fit in the token, returns false if the input ends first. */
+static bool read_length(const uint8_t *src, size_t src_len, size_t *ip, size_t *len) {
+    uint8_t byte;
+
+    do {
+        if (*ip >= src_len) {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool volf_lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size, size_t *dst_len) {
+    size_t ip = 0;
+    size_t op = 0;
+    size_t len;
+    size_t offset;
+    uint8_t token;
+
+    while (ip < src_len) {
+        token = src[ip++];
+
+        len = token >> 4;
+        if (len == RUN_MASK && !read_length(src, src_len, &ip, &len)) {
+            return false;
+        }
+        if (len > src_len - ip || len > dst_size - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, len);
+        ip += len;
+        op += len;
+        if (ip == src_len) {
+            break;
+        }
+
+        if (src_len - ip < 2) {
+            return false;
+        }
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return false;
+        }
+        len = token & RUN_MASK;
+        if (len == RUN_MASK && !read_length(src, src_len, &ip, &len)) {
+            return false;
+        }
+        len += MIN_MATCH;
+        if (len > dst_size - op) {
+            return false;
+        }
+        // Byte by byte, the match may overlap the bytes it produces.
+        for (; len > 0; len--, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+
+    *dst_len = op;
+    return true;
+}
@@ -0,0 +1,33 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_LZ_H
+#define VOLF_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Small LZ77 compression in the LZ4 block format, so the output can also be read with any LZ4 block decoder.
+ */
+
+/** Largest input volf_lz_compress() accepts, match positions are kept in 16 bits. */
+#define VOLF_LZ_MAX_INPUT_SIZE 65535
+
+/** Space needed to compress size bytes that don't compress at all. */
+#define VOLF_LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+/**
+ * Compresses src into dst. Returns the compressed size, or 0 if the input is too large or dst too small. Uses about
+ * 2 KB of stack.
+ */
+size_t volf_lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size);
+
+/**
+ * Decompresses src into dst, setting dst_len to the decompressed size. Returns false if src is corrupt or doesn't fit
+ * in dst.
+ */
+bool volf_lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_size, size_t *dst_len);
+
+#endif //VOLF_LZ_H
@@ -0,0 +1,136 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_OTA
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "esp_timer.h"
+#include "volf_ota_pipe.h"
+#include "volf_log.h"
+
+#define WRITER_TASK_STACK_SIZE 4096
+#define WRITER_TASK_PRIORITY 5
+#define WRITER_TASK_CORE 0
+
+/** A filled buffer handed to the writer, a length of 0 ends the download. */
+struct pipe_block {
+    uint8_t *buf;
+    size_t len;
+};
+
+struct pipe {
+    volf_ota_sink_t *sink;
+    void *context;
+    QueueHandle_t free_bufs;
+    QueueHandle_t full_bufs;
+    SemaphoreHandle_t writer_done;
+    volatile volf_ota_pipe_result_t result;
+    int64_t sink_us;
+};
+
+static void writer_task(void *param) {
+    struct pipe *pipe = param;
+    struct pipe_block block;
+    int64_t start;
+
+    while (xQueueReceive(pipe->full_bufs, &block, portMAX_DELAY) == pdTRUE && block.len > 0) {
+        // After the sink is done or failed, buffers are only handed back so the receiver never blocks.
+        if (pipe->result == OTA_PIPE_MORE) {
+            start = esp_timer_get_time();
+            pipe->result = pipe->sink(pipe->context, block.buf, block.len);
+            pipe->sink_us += esp_timer_get_time() - start;
+        }
+        xQueueSend(pipe->free_bufs, &block.buf, portMAX_DELAY);
+    }
+    xSemaphoreGive(pipe->writer_done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * Fills buf from the response body, returns the number of bytes read, 0 at the end of the body.
+ */
+static size_t fill(esp_http_client_handle_t client, uint8_t *buf) {
+    size_t len = 0;
+    int read;
+
+    while (len < OTA_PIPE_BUF_SIZE) {
+        read = esp_http_client_read(client, (char *) buf + len, OTA_PIPE_BUF_SIZE - len);
+        if (read <= 0) {
+            break;
+        }
+        len += read;
+    }
+    return len;
+}
+
+/**
+ * Receives into free buffers until the body ends or the sink stops taking data, then waits for the writer.
+ */
+static esp_err_t run(struct pipe *pipe, uint8_t *pool, esp_http_client_handle_t client,
+                     struct volf_ota_pipe_stats *stats) {
+    struct pipe_block block;
+    int64_t start = esp_timer_get_time();
+    int64_t wait_start;
+    int64_t stall_us = 0;
+
+    for (int i = 0; i < OTA_PIPE_BUF_COUNT; i++) {
+        block.buf = pool + i * OTA_PIPE_BUF_SIZE;
+        xQueueSend(pipe->free_bufs, &block.buf, 0);
+    }
+    if (xTaskCreatePinnedToCore(&writer_task, "ota_writer", WRITER_TASK_STACK_SIZE, pipe, WRITER_TASK_PRIORITY, NULL,
+                                WRITER_TASK_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    do {
+        wait_start = esp_timer_get_time();
+        xQueueReceive(pipe->free_bufs, &block.buf, portMAX_DELAY);
+        stall_us += esp_timer_get_time() - wait_start;
+        block.len = pipe->result == OTA_PIPE_MORE ? fill(client, block.buf) : 0;
+        stats->bytes += block.len;
+        xQueueSend(pipe->full_bufs, &block, portMAX_DELAY);
+    } while (block.len > 0);
+    xSemaphoreTake(pipe->writer_done, portMAX_DELAY);
+
+    stats->duration_ms = (uint32_t) ((esp_timer_get_time() - start) / 1000);
+    stats->sink_ms = (uint32_t) (pipe->sink_us / 1000);
+    stats->stall_ms = (uint32_t) (stall_us / 1000);
+    LOGI("OTA received %d KB in %d ms, %d KB/s, flash %d ms, receive stalled %d ms.", stats->bytes / 1024,
+         stats->duration_ms, stats->duration_ms > 0 ? (uint32_t) ((uint64_t) stats->bytes * 1000 / 1024
+                                                                   / stats->duration_ms) : 0,
+         stats->sink_ms, stats->stall_ms);
+
+    return pipe->result == OTA_PIPE_DONE ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t volf_ota_pipe_run(esp_http_client_handle_t client, volf_ota_sink_t *sink, void *context,
+                            struct volf_ota_pipe_stats *stats) {
+    struct pipe pipe = {.sink = sink, .context = context, .result = OTA_PIPE_MORE, .sink_us = 0};
+    uint8_t *pool = malloc(OTA_PIPE_BUF_SIZE * OTA_PIPE_BUF_COUNT);
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    memset(stats, 0, sizeof(*stats));
+    pipe.free_bufs = xQueueCreate(OTA_PIPE_BUF_COUNT, sizeof(uint8_t *));
+    pipe.full_bufs = xQueueCreate(OTA_PIPE_BUF_COUNT + 1, sizeof(struct pipe_block));
+    pipe.writer_done = xSemaphoreCreateBinary();
+    if (pool != NULL && pipe.free_bufs != NULL && pipe.full_bufs != NULL && pipe.writer_done != NULL) {
+        err = run(&pipe, pool, client, stats);
+    }
+
+    if (pipe.writer_done != NULL) {
+        vSemaphoreDelete(pipe.writer_done);
+    }
+    if (pipe.full_bufs != NULL) {
+        vQueueDelete(pipe.full_bufs);
+    }
+    if (pipe.free_bufs != NULL) {
+        vQueueDelete(pipe.free_bufs);
+    }
+    free(pool);
+    return err;
+}
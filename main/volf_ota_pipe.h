@@ -0,0 +1,41 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_OTA_PIPE_H
+#define VOLF_OTA_PIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+#define OTA_PIPE_BUF_SIZE 4096
+#define OTA_PIPE_BUF_COUNT 4
+
+typedef enum {
+    OTA_PIPE_MORE,
+    OTA_PIPE_DONE,
+    OTA_PIPE_ERROR
+} volf_ota_pipe_result_t;
+
+/** Consumes the next part of the download, e.g. writes it to flash. Runs on the writer task. */
+typedef volf_ota_pipe_result_t volf_ota_sink_t(void *context, const uint8_t *data, size_t len);
+
+struct volf_ota_pipe_stats {
+    uint32_t bytes;
+    uint32_t duration_ms;
+    /* Time the writer spent in the sink, mostly erasing and writing flash. */
+    uint32_t sink_ms;
+    /* Time the receiver waited for a free buffer, the flash holding up the network. */
+    uint32_t stall_ms;
+};
+
+/**
+ * Reads the response body of the opened client into a pool of buffers, while a writer task passes the filled buffers
+ * to the sink, so receiving and writing flash overlap. Returns once the sink is done, the sink failed or the body
+ * ended. ESP_FAIL means the sink failed or the body ended before the sink was done, the sink's context tells which.
+ */
+esp_err_t volf_ota_pipe_run(esp_http_client_handle_t client, volf_ota_sink_t *sink, void *context,
+                            struct volf_ota_pipe_stats *stats);
+
+#endif //VOLF_OTA_PIPE_H
@@ -1,15 +1,24 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#define LOG_MODULE LOG_MODULE_OTA
+
+#include <stdlib.h>
+#include <string.h>
 #include "volf_ota_update.h"
 #include "volf_error.h"
 
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
 #include "esp_http_client.h"
-#include "esp_https_ota.h"
+#include "esp_image_format.h"
+#include "esp_spi_flash.h"
 #include "volf_wifi_connect.h"
+#include "volf_patch.h"
+#include "volf_ota_pipe.h"
+#include "iot_wifi_sensor.h"
 
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -18,18 +27,31 @@
 #include "volf_misc.h"
 
 #define HASH_LEN 32
+#define NVS_NAME_OTA "volf.ota"
+#define OTA_PROGRESS_KEY "progress"
+#define MAX_ETAG_SIZE 64
+#define MAX_CONTENT_RANGE_SIZE 64
+/* Progress is saved at most this often, each save is an NVS write. */
+#define PROGRESS_SAVE_INTERVAL (16 * SPI_FLASH_SEC_SIZE)
+#define HTTP_PARTIAL_CONTENT 206
+#define HTTP_OK 200
+#define HTTP_NOT_FOUND 404
+#define FULL_IMAGE_URL_FORMAT "https://otaupdates.home:13800/%s/iot_wifi_sensor_v%d.bin"
+#define FULL_PATCH_URL_FORMAT "https://otaupdates.home:13800/%s/iot_wifi_sensor_v%d.vdlt"
+#define DELTA_PATCH_URL_FORMAT "https://otaupdates.home:13800/%s/iot_wifi_sensor_v%d_from_v%d.vdlt"
 
 extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
 static char ota_update_url[256];
 
-#define DEFAULT_OTA_BUF_SIZE 1024
-
-static char *get_ota_update_url(char *node_addr, uint32_t desired_version) {
+/**
+ * The formats take the node address, the desired version and, for a delta, the running version.
+ */
+static char *get_ota_update_url(const char *format, char *node_addr, uint32_t desired_version) {
     LOGI("Generating update URL...");
 
-    sprintf(ota_update_url, "https://otaupdates.home:13800/%s/iot_wifi_sensor_v%d.bin", node_addr, desired_version);
+    snprintf(ota_update_url, sizeof(ota_update_url), format, node_addr, desired_version, VERSION);
 
     LOGI("Generated OTA update url: %s", ota_update_url);
     return ota_update_url;
@@ -44,7 +66,7 @@ static void print_sha256(const uint8_t *image_hash, const char *label) {
     LOGI("%s %s", label, hash_print);
 }
 
-static void get_sha256_of_partitions(void) {
+static void get_sha256_of_partitions(uint8_t *running_sha_256) {
     uint8_t sha_256[HASH_LEN] = {0};
     esp_partition_t partition;
 
@@ -56,33 +78,511 @@ static void get_sha256_of_partitions(void) {
     print_sha256(sha_256, "SHA-256 for bootloader: ");
 
     // get sha256 digest for running partition
-    esp_partition_get_sha256(esp_ota_get_running_partition(), sha_256);
-    print_sha256(sha_256, "SHA-256 for current firmware: ");
+    esp_partition_get_sha256(esp_ota_get_running_partition(), running_sha_256);
+    print_sha256(running_sha_256, "SHA-256 for current firmware: ");
+}
+
+/**
+ * How far the download of an image got, kept in NVS so a restart or deep sleep resumes it instead of starting over.
+ * The offset is always at a sector boundary, the sector it points to may hold a partial write and is erased again.
+ */
+struct ota_progress {
+    uint32_t version;
+    uint32_t partition_address;
+    uint32_t image_size;
+    uint32_t offset;
+    char etag[MAX_ETAG_SIZE];
+};
+
+/** Response headers needed to resume, captured by the HTTP client's event handler. */
+struct ota_response {
+    char etag[MAX_ETAG_SIZE];
+    char content_range[MAX_CONTENT_RANGE_SIZE];
+};
+
+static void load_progress(struct ota_progress *progress) {
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(*progress);
+    esp_err_t err;
+
+    memset(progress, 0, sizeof(*progress));
+    err = nvs_open(NVS_NAME_OTA, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return;
+    }
+    err = nvs_get_blob(nvs_handle, OTA_PROGRESS_KEY, progress, &size);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK || size != sizeof(*progress)) {
+        memset(progress, 0, sizeof(*progress));
+    }
+}
+
+static void save_progress(const struct ota_progress *progress) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    err = nvs_open(NVS_NAME_OTA, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        volf_handle_error(CONTINUE, "save_progress", err);
+        return;
+    }
+    err = nvs_set_blob(nvs_handle, OTA_PROGRESS_KEY, progress, sizeof(*progress));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    volf_handle_error(CONTINUE, "save_progress", err);
+    nvs_close(nvs_handle);
+}
+
+static void clear_progress() {
+    nvs_handle_t nvs_handle;
+
+    if (nvs_open(NVS_NAME_OTA, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    nvs_erase_key(nvs_handle, OTA_PROGRESS_KEY);
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+static void start_progress(struct ota_progress *progress, uint32_t version, const esp_partition_t *partition) {
+    memset(progress, 0, sizeof(*progress));
+    progress->version = version;
+    progress->partition_address = partition->address;
+}
+
+static esp_err_t http_event_handler(esp_http_client_event_t *event) {
+    struct ota_response *response = event->user_data;
+
+    if (event->event_id != HTTP_EVENT_ON_HEADER) {
+        return ESP_OK;
+    }
+    if (strcasecmp(event->header_key, "ETag") == 0) {
+        strlcpy(response->etag, event->header_value, sizeof(response->etag));
+    } else if (strcasecmp(event->header_key, "Content-Range") == 0) {
+        strlcpy(response->content_range, event->header_value, sizeof(response->content_range));
+    }
+    return ESP_OK;
+}
+
+/**
+ * Checks the response to a range request continues the image already partly written. The server must send the
+ * requested range of an image with the same ETag and size, anything else starts the download over.
+ */
+static bool resume_accepted(const struct ota_progress *progress, const struct ota_response *response, int status) {
+    uint32_t start;
+    uint32_t total;
+
+    if (status != HTTP_PARTIAL_CONTENT) {
+        LOGW("The server didn't accept the range request (status %d).", status);
+        return false;
+    }
+    if (sscanf(response->content_range, "bytes %u-%*u/%u", &start, &total) != 2 || start != progress->offset
+        || total != progress->image_size) {
+        LOGW("Unexpected content range '%s' resuming at %d of %d bytes.", response->content_range, progress->offset,
+             progress->image_size);
+        return false;
+    }
+    if (strcmp(response->etag, progress->etag) != 0) {
+        LOGW("The image changed on the server, ETag %s was %s.", response->etag, progress->etag);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Erases the sectors a write reaches into, unless already erased for this download.
+ */
+static esp_err_t prepare_sectors(const esp_partition_t *partition, uint32_t end, uint32_t *erased_end) {
+    esp_err_t err;
+
+    while (*erased_end < end) {
+        err = esp_partition_erase_range(partition, *erased_end, SPI_FLASH_SEC_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        *erased_end += SPI_FLASH_SEC_SIZE;
+    }
+    return ESP_OK;
+}
+
+/** Writing a full image from progress->offset, done on the pipe's writer task. */
+struct image_writer {
+    const esp_partition_t *partition;
+    struct ota_progress *progress;
+    uint32_t offset;
+    uint32_t erased_end;
+    esp_err_t err;
+};
+
+/**
+ * Writes the next part of the image, saving the progress as whole sectors are written.
+ */
+static volf_ota_pipe_result_t write_image_part(void *context, const uint8_t *data, size_t len) {
+    struct image_writer *writer = context;
+    struct ota_progress *progress = writer->progress;
+
+    if (len > progress->image_size - writer->offset) {
+        len = progress->image_size - writer->offset;
+    }
+    if (writer->offset == 0 && data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        LOGE("The download is not a firmware image, first byte 0x%02x.", data[0]);
+        writer->err = ESP_ERR_OTA_VALIDATE_FAILED;
+        return OTA_PIPE_ERROR;
+    }
+
+    writer->err = prepare_sectors(writer->partition, writer->offset + len, &writer->erased_end);
+    if (writer->err == ESP_OK) {
+        writer->err = esp_partition_write(writer->partition, writer->offset, data, len);
+    }
+    if (writer->err != ESP_OK) {
+        return OTA_PIPE_ERROR;
+    }
+    writer->offset += len;
+
+    if (writer->offset - progress->offset >= PROGRESS_SAVE_INTERVAL) {
+        progress->offset = writer->offset - writer->offset % SPI_FLASH_SEC_SIZE;
+        save_progress(progress);
+        LOGI("Downloaded %d of %d bytes.", progress->offset, progress->image_size);
+    }
+    return writer->offset == progress->image_size ? OTA_PIPE_DONE : OTA_PIPE_MORE;
+}
+
+static esp_err_t write_image(esp_http_client_handle_t client, const esp_partition_t *partition,
+                             struct ota_progress *progress) {
+    struct image_writer writer = {
+            .partition = partition,
+            .progress = progress,
+            .offset = progress->offset,
+            .erased_end = progress->offset,
+            .err = ESP_OK,
+    };
+    struct volf_ota_pipe_stats stats;
+    esp_err_t err;
+
+    err = volf_ota_pipe_run(client, write_image_part, &writer, &stats);
+    if (writer.err != ESP_OK) {
+        return writer.err;
+    }
+    if (err != ESP_OK) {
+        LOGE("Download interrupted at %d of %d bytes.", writer.offset, progress->image_size);
+    }
+    return err;
+}
+
+/**
+ * Makes the downloaded image the boot partition, which verifies it first. The progress is cleared either way, an image
+ * that fails verification is downloaded again from the start.
+ */
+static esp_err_t finish_download(const esp_partition_t *partition) {
+    esp_err_t err;
+
+    err = esp_ota_set_boot_partition(partition);
+    clear_progress();
+    if (err != ESP_OK) {
+        LOGE("The downloaded image failed verification, the next attempt starts over.");
+    }
+    return err;
+}
+
+/**
+ * Downloads the image into the next update partition, resuming a download the previous wake didn't finish. Setting
+ * the boot partition verifies the whole image, including its SHA-256 digest, before it is accepted.
+ */
+static esp_err_t download_update(const char *url, uint32_t desired_version) {
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    struct ota_progress progress;
+    struct ota_response response;
+    esp_http_client_handle_t client;
+    char range[32];
+    int content_length;
+    int status;
+    esp_err_t err;
+
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    load_progress(&progress);
+    if (progress.version != desired_version || progress.partition_address != partition->address
+        || progress.offset > progress.image_size) {
+        start_progress(&progress, desired_version, partition);
+    }
+    if (progress.image_size > 0 && progress.offset == progress.image_size) {
+        // An image ending at a sector boundary was saved as complete, nothing is left to ask the server for.
+        LOGI("The image was already downloaded, verifying it.");
+        return finish_download(partition);
+    }
+
+    memset(&response, 0, sizeof(response));
+    esp_http_client_config_t config = {
+            .url = url,
+            .cert_pem = (char *) server_cert_pem_start,
+            .timeout_ms = 20000,
+            .skip_cert_common_name_check = true,
+            .event_handler = http_event_handler,
+            .user_data = &response,
+    };
+    client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_FAIL;
+    }
+    if (progress.offset > 0) {
+        LOGI("Resuming the download at %d of %d bytes.", progress.offset, progress.image_size);
+        snprintf(range, sizeof(range), "bytes=%u-", progress.offset);
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        esp_http_client_cleanup(client);
+        return err;
+    }
+    content_length = esp_http_client_fetch_headers(client);
+    status = esp_http_client_get_status_code(client);
+
+    if (progress.offset > 0 && !resume_accepted(&progress, &response, status)) {
+        start_progress(&progress, desired_version, partition);
+        save_progress(&progress);
+        if (status != HTTP_OK) {
+            // The body isn't the whole image, the next attempt asks for it from the start.
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    } else if (progress.offset == 0 && status != HTTP_OK) {
+        LOGE("Firmware download failed with status %d.", status);
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+    if (err == ESP_OK && progress.offset == 0) {
+        if (content_length <= 0 || (uint32_t) content_length > partition->size) {
+            LOGE("Firmware image of %d bytes doesn't fit in %d.", content_length, partition->size);
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            progress.image_size = content_length;
+            strlcpy(progress.etag, response.etag, sizeof(progress.etag));
+            save_progress(&progress);
+        }
+    }
+
+    if (err == ESP_OK) {
+        err = write_image(client, partition, &progress);
+    }
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return finish_download(partition);
+}
+
+struct patch_context {
+    uint32_t version;
+    const esp_partition_t *source;
+    const esp_partition_t *target;
+    const uint8_t *source_sha256;
+    uint32_t erased_end;
+    bool source_mismatch;
+    struct volf_patch *patch;
+};
+
+static bool check_patch_header(void *context, const struct volf_patch_header *header) {
+    struct patch_context *patch_context = context;
+
+    if (header->target_size > patch_context->target->size) {
+        LOGE("Firmware image of %d bytes doesn't fit in %d.", header->target_size, patch_context->target->size);
+        return false;
+    }
+    if (header->type == VOLF_PATCH_DELTA && (header->source_size > patch_context->source->size
+                                             || memcmp(header->source_sha256, patch_context->source_sha256,
+                                                       HASH_LEN) != 0)) {
+        LOGW("The patch is for different firmware than the running one.");
+        patch_context->source_mismatch = true;
+        return false;
+    }
+    // The patch overwrites any partly downloaded full image.
+    clear_progress();
+    return true;
+}
+
+static bool read_patch_source(void *context, uint32_t offset, uint8_t *buf, size_t len) {
+    struct patch_context *patch_context = context;
+
+    return esp_partition_read(patch_context->source, offset, buf, len) == ESP_OK;
+}
+
+static bool write_patch_target(void *context, uint32_t offset, const uint8_t *buf, size_t len) {
+    struct patch_context *patch_context = context;
+
+    return prepare_sectors(patch_context->target, offset + len, &patch_context->erased_end) == ESP_OK
+           && esp_partition_write(patch_context->target, offset, buf, len) == ESP_OK;
+}
+
+static const struct volf_patch_io patch_io = {
+        .check_header = check_patch_header,
+        .read_source = read_patch_source,
+        .write_target = write_patch_target,
+};
+
+static volf_ota_pipe_result_t apply_patch_part(void *context, const uint8_t *data, size_t len) {
+    struct patch_context *patch_context = context;
+
+    switch (volf_patch_feed(patch_context->patch, data, len)) {
+        case VOLF_PATCH_DONE:
+            return OTA_PIPE_DONE;
+        case VOLF_PATCH_ERROR:
+            return OTA_PIPE_ERROR;
+        default:
+            return OTA_PIPE_MORE;
+    }
+}
+
+/**
+ * Applies the patch as it streams in, the running partition is the source and the next update partition the target.
+ * The written image must have the SHA-256 the patch was made for. A patch that fails is not tried again, the progress
+ * of the full image is started instead.
+ */
+static esp_err_t apply_patch(esp_http_client_handle_t client, struct patch_context *context) {
+    struct volf_patch *patch;
+    struct volf_ota_pipe_stats stats;
+    struct ota_progress progress;
+    volf_patch_result_t result;
+    uint8_t sha_256[HASH_LEN];
+    esp_err_t err = ESP_OK;
+
+    patch = malloc(sizeof(struct volf_patch));
+    if (patch == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    volf_patch_init(patch, &patch_io, context);
+    context->patch = patch;
+    volf_ota_pipe_run(client, apply_patch_part, context, &stats);
+    result = patch->result;
+
+    if (result == VOLF_PATCH_ERROR) {
+        err = context->source_mismatch ? ESP_ERR_INVALID_VERSION : ESP_ERR_OTA_VALIDATE_FAILED;
+    } else if (result == VOLF_PATCH_MORE) {
+        LOGE("Patch download interrupted after %d bytes of firmware.", patch->target_offset);
+        err = ESP_FAIL;
+    } else {
+        err = esp_partition_get_sha256(context->target, sha_256);
+        if (err == ESP_OK) {
+            print_sha256(sha_256, "SHA-256 for downloaded firmware: ");
+            if (memcmp(sha_256, patch->header.target_sha256, HASH_LEN) != 0) {
+                LOGE("The patched firmware doesn't have the expected SHA-256.");
+                err = ESP_ERR_OTA_VALIDATE_FAILED;
+            }
+        }
+    }
+    if (err != ESP_OK) {
+        // A patch can't be resumed and a corrupt one fails the same way again, the full image can be resumed.
+        // Starting its progress makes this and the next attempts download it.
+        LOGW("Falling back to the full image.");
+        start_progress(&progress, context->version, context->target);
+        save_progress(&progress);
+    }
+    free(patch);
+    return err;
+}
+
+/**
+ * Downloads and applies a patch, a delta from the running firmware or a compressed full image. Returns
+ * ESP_ERR_NOT_FOUND if the server has no such patch and ESP_ERR_INVALID_VERSION if it is a delta from different
+ * firmware.
+ */
+static esp_err_t download_patch(const char *url, uint32_t desired_version, const uint8_t *running_sha_256) {
+    struct patch_context context = {
+            .version = desired_version,
+            .source = esp_ota_get_running_partition(),
+            .target = esp_ota_get_next_update_partition(NULL),
+            .source_sha256 = running_sha_256,
+            .erased_end = 0,
+            .source_mismatch = false,
+            .patch = NULL,
+    };
+    esp_http_client_handle_t client;
+    int status;
+    esp_err_t err;
+
+    if (context.target == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_http_client_config_t config = {
+            .url = url,
+            .cert_pem = (char *) server_cert_pem_start,
+            .timeout_ms = 20000,
+            .skip_cert_common_name_check = true,
+    };
+    client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_FAIL;
+    }
+    err = esp_http_client_open(client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        status = esp_http_client_get_status_code(client);
+        if (status == HTTP_NOT_FOUND) {
+            err = ESP_ERR_NOT_FOUND;
+        } else if (status != HTTP_OK) {
+            LOGE("Patch download failed with status %d.", status);
+            err = ESP_ERR_INVALID_RESPONSE;
+        } else {
+            err = apply_patch(client, &context);
+        }
+        esp_http_client_close(client);
+    }
+    esp_http_client_cleanup(client);
+
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(context.target);
+    }
+    return err;
+}
+
+/**
+ * True if a download of the full image of the version was started, or a patch for it interrupted, on an earlier
+ * attempt. Only the full image can be resumed, so the patches are skipped.
+ */
+static bool full_image_in_progress(uint32_t desired_version) {
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    struct ota_progress progress;
+
+    load_progress(&progress);
+    return partition != NULL && progress.version == desired_version
+           && progress.partition_address == partition->address;
 }
 
 void install_ota_update(char *node_address, uint32_t desired_version) {
-    char *update_url;
+    uint8_t running_sha_256[HASH_LEN] = {0};
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret;
 
     LOGI("Starting OTA update");
 
-    get_sha256_of_partitions();
+    get_sha256_of_partitions(running_sha_256);
     /* Ensure to disable any WiFi power save mode, this allows best throughput
      * and hence timings for overall OTA operation.
      */
     esp_wifi_set_ps(WIFI_PS_NONE);
 
-    update_url = get_ota_update_url(node_address, desired_version);
-    esp_http_client_config_t config = {
-            .url = update_url,
-            .cert_pem = (char *) server_cert_pem_start,
-            .timeout_ms = 20000,
-            .skip_cert_common_name_check = true
-    };
-
-    esp_err_t ret = esp_https_ota(&config);
+    ret = ESP_ERR_NOT_FOUND;
+    if (!full_image_in_progress(desired_version)) {
+        ret = download_patch(get_ota_update_url(DELTA_PATCH_URL_FORMAT, node_address, desired_version),
+                             desired_version, running_sha_256);
+        if (ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_INVALID_VERSION) {
+            LOGI("No delta from version %d, trying the compressed image.", VERSION);
+            ret = download_patch(get_ota_update_url(FULL_PATCH_URL_FORMAT, node_address, desired_version),
+                                 desired_version, running_sha_256);
+        }
+    }
+    if (ret == ESP_ERR_NOT_FOUND || (ret != ESP_OK && full_image_in_progress(desired_version))) {
+        LOGI("Downloading the full image.");
+        ret = download_update(get_ota_update_url(FULL_IMAGE_URL_FORMAT, node_address, desired_version),
+                              desired_version);
+    }
+    LOGI("OTA update took %d ms.", (uint32_t) ((esp_timer_get_time() - start) / 1000));
     if (ret != ESP_OK) {
-        LOGE("Firmware upgrade failed. Restarting to try again...");
-        volf_handle_error(RETRY, "esp_https_ota", ret);
+        LOGE("Firmware upgrade failed. Restarting to resume it...");
+        volf_handle_error(RETRY, "install_ota_update", ret);
     } else {
         LOGI("Firmware upgrade succeeded. Setting boot state to verify ota update.");
         LOGI("Restarting to load new firmware.");
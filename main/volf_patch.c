@@ -0,0 +1,180 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "volf_patch.h"
+
+#define OP_COPY 1
+#define OP_INSERT 2
+#define COPY_OP_SIZE 9
+#define INSERT_OP_SIZE 3
+#define CHUNK_HEADER_SIZE 4
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+void volf_patch_init(struct volf_patch *patch, const struct volf_patch_io *io, void *context) {
+    memset(&patch->header, 0, sizeof(patch->header));
+    patch->io = io;
+    patch->context = context;
+    patch->result = VOLF_PATCH_MORE;
+    patch->pending = 0;
+    patch->needed = VOLF_PATCH_HEADER_SIZE;
+    patch->in_chunk = false;
+    patch->chunk_raw_len = 0;
+    patch->target_offset = 0;
+}
+
+static bool parse_header(struct volf_patch *patch) {
+    const uint8_t *p = patch->buf;
+    struct volf_patch_header *header = &patch->header;
+
+    if (memcmp(p, VOLF_PATCH_MAGIC, strlen(VOLF_PATCH_MAGIC)) != 0 || p[4] != VOLF_PATCH_FORMAT_VERSION) {
+        return false;
+    }
+    header->format_version = p[4];
+    header->type = p[5];
+    header->chunk_size = get16(p + 6);
+    header->source_size = get32(p + 8);
+    memcpy(header->source_sha256, p + 12, VOLF_PATCH_HASH_SIZE);
+    header->target_size = get32(p + 44);
+    memcpy(header->target_sha256, p + 48, VOLF_PATCH_HASH_SIZE);
+
+    if ((header->type != VOLF_PATCH_FULL && header->type != VOLF_PATCH_DELTA) || header->chunk_size == 0
+        || header->chunk_size > VOLF_PATCH_MAX_CHUNK_SIZE || header->target_size == 0) {
+        return false;
+    }
+    return patch->io->check_header == NULL || patch->io->check_header(patch->context, header);
+}
+
+static bool write_target(struct volf_patch *patch, const uint8_t *buf, size_t len) {
+    if (len > patch->header.target_size - patch->target_offset) {
+        return false;
+    }
+    if (!patch->io->write_target(patch->context, patch->target_offset, buf, len)) {
+        return false;
+    }
+    patch->target_offset += len;
+    return true;
+}
+
+static bool copy_source(struct volf_patch *patch, uint32_t offset, uint32_t len) {
+    size_t part;
+
+    if (patch->header.type != VOLF_PATCH_DELTA || offset > patch->header.source_size
+        || len > patch->header.source_size - offset) {
+        return false;
+    }
+    while (len > 0) {
+        part = len < sizeof(patch->copy_buf) ? len : sizeof(patch->copy_buf);
+        if (!patch->io->read_source(patch->context, offset, patch->copy_buf, part)
+            || !write_target(patch, patch->copy_buf, part)) {
+            return false;
+        }
+        offset += part;
+        len -= part;
+    }
+    return true;
+}
+
+/**
+ * Decompresses the chunk in buf and applies its operations.
+ */
+static bool apply_chunk(struct volf_patch *patch) {
+    size_t raw_len;
+    size_t pos = 0;
+    uint16_t insert_len;
+
+    if (!volf_lz_decompress(patch->buf, patch->pending, patch->raw, sizeof(patch->raw), &raw_len)
+        || raw_len != patch->chunk_raw_len) {
+        return false;
+    }
+
+    while (pos < raw_len) {
+        switch (patch->raw[pos]) {
+            case OP_COPY:
+                if (raw_len - pos < COPY_OP_SIZE
+                    || !copy_source(patch, get32(patch->raw + pos + 1), get32(patch->raw + pos + 5))) {
+                    return false;
+                }
+                pos += COPY_OP_SIZE;
+                break;
+            case OP_INSERT:
+                if (raw_len - pos < INSERT_OP_SIZE) {
+                    return false;
+                }
+                insert_len = get16(patch->raw + pos + 1);
+                pos += INSERT_OP_SIZE;
+                if (raw_len - pos < insert_len || !write_target(patch, patch->raw + pos, insert_len)) {
+                    return false;
+                }
+                pos += insert_len;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Handles the bytes collected in buf, the header, a chunk header or a chunk, and sets how many are needed next.
+ */
+static volf_patch_result_t process(struct volf_patch *patch) {
+    uint16_t compressed_len;
+
+    if (patch->header.format_version == 0) {
+        if (!parse_header(patch)) {
+            return VOLF_PATCH_ERROR;
+        }
+        patch->needed = CHUNK_HEADER_SIZE;
+    } else if (!patch->in_chunk) {
+        patch->chunk_raw_len = get16(patch->buf);
+        compressed_len = get16(patch->buf + 2);
+        if (patch->chunk_raw_len == 0 || patch->chunk_raw_len > patch->header.chunk_size
+            || compressed_len == 0 || compressed_len > sizeof(patch->buf)) {
+            return VOLF_PATCH_ERROR;
+        }
+        patch->in_chunk = true;
+        patch->needed = compressed_len;
+    } else {
+        if (!apply_chunk(patch)) {
+            return VOLF_PATCH_ERROR;
+        }
+        patch->in_chunk = false;
+        patch->needed = CHUNK_HEADER_SIZE;
+        if (patch->target_offset == patch->header.target_size) {
+            return VOLF_PATCH_DONE;
+        }
+    }
+    patch->pending = 0;
+    return VOLF_PATCH_MORE;
+}
+
+volf_patch_result_t volf_patch_feed(struct volf_patch *patch, const uint8_t *data, size_t len) {
+    size_t part;
+
+    while (len > 0 && patch->result == VOLF_PATCH_MORE) {
+        part = patch->needed - patch->pending;
+        if (part > len) {
+            part = len;
+        }
+        memcpy(patch->buf + patch->pending, data, part);
+        patch->pending += part;
+        data += part;
+        len -= part;
+        if (patch->pending == patch->needed) {
+            patch->result = process(patch);
+        }
+    }
+    // Anything after the last chunk means the patch isn't the one its header describes.
+    if (len > 0 && patch->result == VOLF_PATCH_DONE) {
+        patch->result = VOLF_PATCH_ERROR;
+    }
+    return patch->result;
+}
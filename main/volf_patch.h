@@ -0,0 +1,80 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_PATCH_H
+#define VOLF_PATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "volf_lz.h"
+
+/**
+ * Applies firmware patches as they are downloaded, written by tools/delta_ota.
+ *
+ * A patch is a header followed by chunks. Each chunk is its uncompressed and compressed size, 2 bytes little endian
+ * each, followed by a volf_lz block holding whole operations. COPY (1) is a 4 byte source offset and a 4 byte length,
+ * INSERT (2) a 2 byte length followed by the bytes. The target is written in order, so a patch only needs one
+ * decompressed chunk in memory. A full image is a patch with no source, made of INSERT operations only.
+ */
+#define VOLF_PATCH_MAGIC "VDLT"
+#define VOLF_PATCH_FORMAT_VERSION 1
+#define VOLF_PATCH_HEADER_SIZE 80
+#define VOLF_PATCH_MAX_CHUNK_SIZE 4096
+#define VOLF_PATCH_HASH_SIZE 32
+#define VOLF_PATCH_COPY_BUF_SIZE 256
+
+typedef enum {
+    VOLF_PATCH_FULL = 0,
+    VOLF_PATCH_DELTA = 1
+} volf_patch_type_t;
+
+typedef enum {
+    VOLF_PATCH_MORE,
+    VOLF_PATCH_DONE,
+    VOLF_PATCH_ERROR
+} volf_patch_result_t;
+
+struct volf_patch_header {
+    uint8_t format_version;
+    volf_patch_type_t type;
+    uint16_t chunk_size;
+    uint32_t source_size;
+    uint8_t source_sha256[VOLF_PATCH_HASH_SIZE];
+    uint32_t target_size;
+    uint8_t target_sha256[VOLF_PATCH_HASH_SIZE];
+};
+
+/** Callbacks to the firmware, each returns false to stop the patch with an error. */
+struct volf_patch_io {
+    /** Called once the header is read, to check the source and that the target fits. */
+    bool (*check_header)(void *context, const struct volf_patch_header *header);
+    bool (*read_source)(void *context, uint32_t offset, uint8_t *buf, size_t len);
+    bool (*write_target)(void *context, uint32_t offset, const uint8_t *buf, size_t len);
+};
+
+/** About 8.5 KB, allocate it rather than putting it on a task stack. */
+struct volf_patch {
+    const struct volf_patch_io *io;
+    void *context;
+    struct volf_patch_header header;
+    volf_patch_result_t result;
+    size_t pending;
+    size_t needed;
+    bool in_chunk;
+    uint16_t chunk_raw_len;
+    uint32_t target_offset;
+    uint8_t buf[VOLF_LZ_BOUND(VOLF_PATCH_MAX_CHUNK_SIZE)];
+    uint8_t raw[VOLF_PATCH_MAX_CHUNK_SIZE];
+    uint8_t copy_buf[VOLF_PATCH_COPY_BUF_SIZE];
+};
+
+void volf_patch_init(struct volf_patch *patch, const struct volf_patch_io *io, void *context);
+
+/**
+ * Applies the next len bytes of the patch. Returns VOLF_PATCH_MORE until the whole target is written, then
+ * VOLF_PATCH_DONE. VOLF_PATCH_ERROR is final, a corrupt patch or a failed callback.
+ */
+volf_patch_result_t volf_patch_feed(struct volf_patch *patch, const uint8_t *data, size_t len);
+
+#endif //VOLF_PATCH_H
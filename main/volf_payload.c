@@ -0,0 +1,278 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_REPORT
+
+#include <math.h>
+#include <time.h>
+#include "volf_batch.h"
+#include "volf_cbor.h"
+#include "volf_json_writer.h"
+#include "volf_log.h"
+#include "volf_payload.h"
+#include "volf_profile.h"
+
+/** Which fields of a reading go into a JSON document. */
+typedef enum {
+    JSON_FIELDS_SHADOW,
+    JSON_FIELDS_TELEMETRY,
+    JSON_FIELDS_SAMPLED
+} json_fields_t;
+
+static bool include_json_field(const struct sensor_reading *reading, reading_field_t field, json_fields_t fields) {
+    if (!reading_has(reading, field)) {
+        return false;
+    }
+    switch (fields) {
+        case JSON_FIELDS_SHADOW:
+            return !reading_is_telemetry(field);
+        case JSON_FIELDS_TELEMETRY:
+            return reading_is_telemetry(field);
+        default:
+            return reading_fields[field].sampled;
+    }
+}
+
+static void add_reading_to_json(struct volf_json_writer *writer, const struct sensor_reading *reading,
+                                json_fields_t fields) {
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (!include_json_field(reading, field, fields)) {
+            continue;
+        }
+        volf_json_key(writer, reading_fields[field].name);
+        if (reading_fields[field].type == FIELD_TYPE_BOOL) {
+            volf_json_bool(writer, reading->values[field] != 0);
+        } else {
+            volf_json_number(writer, reading->values[field]);
+        }
+    }
+}
+
+/**
+ * Each finished wake is a flat array: wake number, RSSI, reconnects, then the start and duration of every phase in
+ * microseconds, in profile_phase_t order.
+ */
+static void add_phases_to_json(struct volf_json_writer *writer) {
+    const struct volf_profile_wake *wake;
+
+    volf_json_key(writer, "phases");
+    volf_json_array_start(writer);
+    for (uint8_t i = 0; i < volf_profile_count(); i++) {
+        wake = volf_profile_get(i);
+        volf_json_array_start(writer);
+        volf_json_uint(writer, wake->wake);
+        volf_json_number(writer, wake->rssi);
+        volf_json_uint(writer, wake->reconnects);
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            volf_json_uint(writer, wake->start_us[phase]);
+            volf_json_uint(writer, wake->duration_us[phase]);
+        }
+        volf_json_array_end(writer);
+    }
+    volf_json_array_end(writer);
+}
+
+size_t create_sensor_payload(const struct sensor_reading *reading, char *buf, size_t size) {
+    struct volf_json_writer writer;
+    size_t len;
+
+    volf_json_init(&writer, buf, size);
+    volf_json_object_start(&writer);
+    volf_json_key(&writer, "state");
+    volf_json_object_start(&writer);
+    volf_json_key(&writer, "reported");
+    volf_json_object_start(&writer);
+    add_reading_to_json(&writer, reading, JSON_FIELDS_SHADOW);
+    volf_json_object_end(&writer);
+    volf_json_object_end(&writer);
+    volf_json_object_end(&writer);
+
+    len = volf_json_finish(&writer);
+    if (len == 0) {
+        LOGE("Sensor payload does not fit in %d bytes.", size);
+        return 0;
+    }
+    LOGI("Final payload contents: %s", buf);
+    return len;
+}
+
+size_t create_telemetry_payload(const struct sensor_reading *reading, char *buf, size_t size) {
+    struct volf_json_writer writer;
+    const struct sensor_reading *batched;
+    uint32_t now = (uint32_t) time(NULL);
+    size_t len;
+
+    volf_json_init(&writer, buf, size);
+    volf_json_object_start(&writer);
+    add_reading_to_json(&writer, reading, JSON_FIELDS_TELEMETRY);
+
+    if (volf_batch_count() > 0) {
+        volf_json_key(&writer, "samples");
+        volf_json_array_start(&writer);
+        for (uint8_t i = 0; i < volf_batch_count(); i++) {
+            batched = volf_batch_get(i);
+            volf_json_object_start(&writer);
+            volf_json_key(&writer, "age");
+            volf_json_uint(&writer, now - batched->timestamp);
+            add_reading_to_json(&writer, batched, JSON_FIELDS_SAMPLED);
+            volf_json_object_end(&writer);
+        }
+        volf_json_array_end(&writer);
+    }
+
+    if (volf_profile_count() > 0) {
+        add_phases_to_json(&writer);
+    }
+    volf_json_object_end(&writer);
+
+    len = volf_json_finish(&writer);
+    if (len == 0) {
+        LOGE("Telemetry payload does not fit in %d bytes.", size);
+        return 0;
+    }
+    LOGI("Telemetry payload contents: %s", buf);
+    return len;
+}
+
+size_t create_error_log_payload(const struct volf_errors *errors, char *buf, size_t size) {
+    struct volf_json_writer writer;
+    const struct volf_error_log *current_log;
+    const struct volf_publish_attempt *current_attempt;
+
+    LOGI("Building json string for %d error logs.", errors->num_error_logs);
+    volf_json_init(&writer, buf, size);
+    volf_json_object_start(&writer);
+    volf_json_key(&writer, "state");
+    volf_json_object_start(&writer);
+    volf_json_key(&writer, "reported");
+    volf_json_object_start(&writer);
+    volf_json_key(&writer, "els");
+    volf_json_array_start(&writer);
+
+    for (int i = 0; i < errors->num_error_logs; i++) {
+        current_log = &errors->error_logs[i];
+        volf_json_object_start(&writer);
+        volf_json_key(&writer, "pas");
+        volf_json_array_start(&writer);
+
+        for (int j = 0; j < current_log->num_publish_attempts; j++) {
+            current_attempt = &current_log->publish_attempts[j];
+            volf_json_object_start(&writer);
+            volf_json_key(&writer, "r");
+            volf_json_uint(&writer, current_attempt->runtime);
+            volf_json_key(&writer, "rc");
+            volf_json_string(&writer, current_attempt->retry_context);
+            volf_json_key(&writer, "ac");
+            volf_json_string(&writer, current_attempt->abort_context);
+            volf_json_key(&writer, "cc");
+            volf_json_array_start(&writer);
+            for (int k = 0; k < current_attempt->num_continue_contexts; k++) {
+                volf_json_string(&writer, current_attempt->continue_contexts[k]);
+            }
+            volf_json_array_end(&writer);
+            volf_json_object_end(&writer);
+        }
+        volf_json_array_end(&writer);
+        volf_json_object_end(&writer);
+    }
+
+    volf_json_array_end(&writer);
+    volf_json_object_end(&writer);
+    volf_json_object_end(&writer);
+    volf_json_object_end(&writer);
+    return volf_json_finish(&writer);
+}
+
+static bool include_field(const struct sensor_reading *reading, reading_field_t field, bool sampled_only) {
+    return reading_has(reading, field) && (!sampled_only || reading_fields[field].sampled);
+}
+
+static size_t count_fields(const struct sensor_reading *reading, bool sampled_only) {
+    size_t count = 0;
+
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (include_field(reading, field, sampled_only)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void add_reading_to_cbor(struct volf_cbor_writer *writer, const struct sensor_config *config,
+                                const struct sensor_reading *reading, bool sampled_only) {
+    int8_t precision;
+    double scaled;
+
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (!include_field(reading, field, sampled_only)) {
+            continue;
+        }
+        volf_cbor_uint(writer, reading_fields[field].id);
+        if (reading_fields[field].type == FIELD_TYPE_BOOL) {
+            volf_cbor_bool(writer, reading->values[field] != 0);
+            continue;
+        }
+
+        precision = config->field_precision[field];
+        scaled = reading->values[field];
+        for (int8_t i = 0; i < precision; i++) {
+            scaled *= 10;
+        }
+        volf_cbor_decimal(writer, llround(scaled), (int8_t) -precision);
+    }
+}
+
+static void add_phases_to_cbor(struct volf_cbor_writer *writer) {
+    const struct volf_profile_wake *wake;
+
+    volf_cbor_uint(writer, CBOR_PHASES_KEY);
+    volf_cbor_array(writer, volf_profile_count());
+    for (uint8_t i = 0; i < volf_profile_count(); i++) {
+        wake = volf_profile_get(i);
+        volf_cbor_array(writer, 3 + 2 * NUM_PROFILE_PHASES);
+        volf_cbor_uint(writer, wake->wake);
+        volf_cbor_int(writer, wake->rssi);
+        volf_cbor_uint(writer, wake->reconnects);
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            volf_cbor_uint(writer, wake->start_us[phase]);
+            volf_cbor_uint(writer, wake->duration_us[phase]);
+        }
+    }
+}
+
+size_t create_sensor_payload_cbor(const struct sensor_config *config, const struct sensor_reading *reading,
+                                  uint8_t *buf, size_t size) {
+    struct volf_cbor_writer writer;
+    const struct sensor_reading *batched;
+    uint32_t now = (uint32_t) time(NULL);
+    uint8_t batch_count = volf_batch_count();
+    uint8_t profile_count = volf_profile_count();
+
+    volf_cbor_init(&writer, buf, size);
+    volf_cbor_map(&writer, count_fields(reading, false) + (batch_count > 0 ? 1 : 0) + (profile_count > 0 ? 1 : 0));
+    add_reading_to_cbor(&writer, config, reading, false);
+
+    if (batch_count > 0) {
+        volf_cbor_uint(&writer, CBOR_SAMPLES_KEY);
+        volf_cbor_array(&writer, batch_count);
+        for (uint8_t i = 0; i < batch_count; i++) {
+            batched = volf_batch_get(i);
+            volf_cbor_map(&writer, count_fields(batched, true) + 1);
+            volf_cbor_uint(&writer, CBOR_SAMPLE_AGE_KEY);
+            volf_cbor_uint(&writer, now - batched->timestamp);
+            add_reading_to_cbor(&writer, config, batched, true);
+        }
+    }
+
+    if (profile_count > 0) {
+        add_phases_to_cbor(&writer);
+    }
+
+    if (writer.overflow) {
+        LOGE("CBOR payload does not fit in %d bytes.", size);
+        return 0;
+    }
+    LOGI("Encoded %d fields and %d samples as %d bytes of CBOR.", count_fields(reading, false), batch_count,
+         writer.len);
+    return writer.len;
+}
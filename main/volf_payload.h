@@ -0,0 +1,46 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_PAYLOAD_H
+#define VOLF_PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sensors/volf_sensors.h"
+#include "volf_error.h"
+
+#define CBOR_SAMPLES_KEY 0
+#define CBOR_SAMPLE_AGE_KEY 0
+/* Kept clear of the field ids, which grow from 1. */
+#define CBOR_PHASES_KEY 255
+
+/**
+ * Writes the shadow document reporting the reading taken this wake into buf, without its telemetry fields. Returns the
+ * length of the document, or 0 if it didn't fit in the buffer.
+ */
+size_t create_sensor_payload(const struct sensor_reading *reading, char *buf, size_t size);
+
+/**
+ * Writes the JSON published on the telemetry topic, which keeps the shadow documents small: the telemetry fields of the
+ * reading, any batched readings waiting to be sent as a "samples" array, each with its age in seconds relative to now,
+ * and the phase timings of the wakes since the last publish as a "phases" array. Returns the length of the document,
+ * or 0 if it didn't fit in the buffer.
+ */
+size_t create_telemetry_payload(const struct sensor_reading *reading, char *buf, size_t size);
+
+/**
+ * Writes the shadow document reporting the error logs into buf, with each log's publish attempts under "pas" and the
+ * runtime, retry, abort and continue contexts of an attempt under "r", "rc", "ac" and "cc". Returns the length of the
+ * document, or 0 if it didn't fit in the buffer.
+ */
+size_t create_error_log_payload(const struct volf_errors *errors, char *buf, size_t size);
+
+/**
+ * Encodes the content of both create_sensor_payload() and create_telemetry_payload() as CBOR, using the field ids
+ * from reading_fields as keys and quantizing each number to the precision configured for it. Samples go under key CBOR_SAMPLES_KEY with the age under
+ * CBOR_SAMPLE_AGE_KEY, phase timings under CBOR_PHASES_KEY. Returns the encoded length, or 0 if the buffer was too small.
+ */
+size_t create_sensor_payload_cbor(const struct sensor_config *config, const struct sensor_reading *reading,
+                                  uint8_t *buf, size_t size);
+
+#endif //VOLF_PAYLOAD_H
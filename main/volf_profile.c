@@ -0,0 +1,89 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_REPORT
+
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "volf_profile.h"
+#include "volf_log.h"
+#include "iot_wifi_sensor.h"
+
+#define PROFILE_MAGIC 0x50524F46
+
+/**
+ * Like the reading batch, the history is kept in RTC memory that isn't initialized at boot so that the wakes ending
+ * in a RETRY restart are kept too, those are the ones most worth looking at. The RETRY handler in main.c ends the wake
+ * before restarting.
+ */
+struct profile_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t wakes;
+    uint8_t unsent;
+    struct volf_profile_wake history[PROFILE_HISTORY_SIZE];
+};
+
+RTC_NOINIT_ATTR static struct profile_state profile;
+
+static struct volf_profile_wake current;
+static bool booted = false;
+
+static uint32_t now_us() {
+    return (uint32_t) esp_timer_get_time();
+}
+
+void volf_profile_wake_start() {
+    if (profile.magic != PROFILE_MAGIC || profile.version != VERSION || profile.unsent > PROFILE_HISTORY_SIZE) {
+        LOGI("Initializing phase history.");
+        memset(&profile, 0, sizeof(profile));
+        profile.magic = PROFILE_MAGIC;
+        profile.version = VERSION;
+    }
+
+    memset(&current, 0, sizeof(current));
+    current.wake = profile.wakes;
+    if (!booted) {
+        booted = true;
+        current.duration_us[PROFILE_BOOT] = now_us();
+    }
+}
+
+void volf_profile_begin(profile_phase_t phase) {
+    current.start_us[phase] = now_us();
+}
+
+void volf_profile_end(profile_phase_t phase) {
+    current.duration_us[phase] = now_us() - current.start_us[phase];
+}
+
+void volf_profile_mark(profile_phase_t phase) {
+    current.start_us[phase] = now_us();
+    current.duration_us[phase] = 0;
+}
+
+void volf_profile_set_link(int8_t rssi, uint16_t reconnects) {
+    current.rssi = rssi;
+    current.reconnects = reconnects;
+}
+
+void volf_profile_wake_end() {
+    profile.history[profile.wakes % PROFILE_HISTORY_SIZE] = current;
+    profile.wakes++;
+    if (profile.unsent < PROFILE_HISTORY_SIZE) {
+        profile.unsent++;
+    }
+}
+
+uint8_t volf_profile_count() {
+    return profile.unsent;
+}
+
+const struct volf_profile_wake *volf_profile_get(uint8_t index) {
+    return &profile.history[(profile.wakes - profile.unsent + index) % PROFILE_HISTORY_SIZE];
+}
+
+void volf_profile_sent() {
+    profile.unsent = 0;
+}
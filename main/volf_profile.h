@@ -0,0 +1,68 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_PROFILE_H
+#define VOLF_PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_HISTORY_SIZE 6
+
+/**
+ * The phases of a wake that are timed. The order is the upload format, tools/phase_percentiles depends on it, so new
+ * phases must only ever be added at the end.
+ */
+typedef enum {
+    PROFILE_BOOT,
+    PROFILE_NVS_INIT,
+    PROFILE_WIFI_ASSOCIATE,
+    PROFILE_IP_ACQUIRE,
+    PROFILE_CONNECT,
+    PROFILE_SHADOW,
+    PROFILE_READ_BATTERY,
+    PROFILE_READ_MOISTURE,
+    PROFILE_READ_TEMPERATURE,
+    PROFILE_READ_SHT40,
+    PROFILE_READ_CURRENT,
+    PROFILE_PUBLISH,
+    PROFILE_SLEEP,
+    NUM_PROFILE_PHASES
+} profile_phase_t;
+
+/**
+ * The timings of one wake, in microseconds since boot. A phase that didn't run this wake has both values 0, a phase
+ * that is a single point in time, like entering sleep, has a duration of 0.
+ */
+struct volf_profile_wake {
+    uint32_t wake;
+    int8_t rssi;
+    uint16_t reconnects;
+    uint32_t start_us[NUM_PROFILE_PHASES];
+    uint32_t duration_us[NUM_PROFILE_PHASES];
+};
+
+/** Starts the timings of a new wake, recording the time from boot to this call as PROFILE_BOOT on the first one. */
+void volf_profile_wake_start();
+
+void volf_profile_begin(profile_phase_t phase);
+void volf_profile_end(profile_phase_t phase);
+
+/** Records a phase that is a single point in time. */
+void volf_profile_mark(profile_phase_t phase);
+
+/** Records the signal strength of the access point and the number of Wi-Fi reconnects during this wake. */
+void volf_profile_set_link(int8_t rssi, uint16_t reconnects);
+
+/** Adds the wake to the history kept in RTC memory. Call right before sleeping. */
+void volf_profile_wake_end();
+
+/** Number of finished wakes waiting to be published. */
+uint8_t volf_profile_count();
+
+/** Returns the finished wake at the index, 0 being the oldest. */
+const struct volf_profile_wake *volf_profile_get(uint8_t index);
+
+/** Clears the wakes waiting to be published after they were sent. */
+void volf_profile_sent();
+
+#endif //VOLF_PROFILE_H
@@ -0,0 +1,74 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "volf_rms.h"
+
+static uint32_t isqrt(uint64_t value) {
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    // Round to nearest, value now holds the remainder of the floor square root.
+    if (value > result) {
+        result++;
+    }
+    return (uint32_t) result;
+}
+
+void volf_rms_init(struct volf_rms *rms, uint32_t limit) {
+    rms->count = 0;
+    rms->limit = limit;
+    rms->sum = 0;
+    rms->sum_squares = 0;
+}
+
+void volf_rms_add(struct volf_rms *rms, uint32_t sample) {
+    if (rms->count >= rms->limit) {
+        return;
+    }
+    rms->count++;
+    rms->sum += sample;
+    rms->sum_squares += (uint64_t) sample * sample;
+}
+
+int volf_rms_full(const struct volf_rms *rms) {
+    return rms->count >= rms->limit;
+}
+
+uint32_t volf_rms_result(const struct volf_rms *rms) {
+    uint64_t mean;
+    uint64_t remainder;
+    uint64_t deviation_squares;
+
+    if (rms->count == 0) {
+        return 0;
+    }
+    // The squared deviations from the mean sum to sum_squares - sum^2 / count. sum^2 overflows, so sum / count is
+    // split into its quotient and remainder.
+    mean = rms->sum / rms->count;
+    remainder = rms->sum % rms->count;
+    deviation_squares = rms->sum_squares - rms->sum * mean - rms->sum * remainder / rms->count;
+    return isqrt((deviation_squares + rms->count / 2) / rms->count);
+}
+
+uint32_t volf_rms_mean(const struct volf_rms *rms) {
+    if (rms->count == 0) {
+        return 0;
+    }
+    return (uint32_t) ((rms->sum + rms->count / 2) / rms->count);
+}
+
+uint32_t volf_rms_window(uint32_t sample_rate_hz, uint32_t mains_hz, uint32_t cycles) {
+    return (uint32_t) ((uint64_t) sample_rate_hz * cycles / mains_hz);
+}
@@ -0,0 +1,42 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_RMS_H
+#define VOLF_RMS_H
+
+#include <stdint.h>
+
+/**
+ * Running root mean square of a stream of samples, measured over windows of whole mains cycles.
+ */
+struct volf_rms {
+    uint32_t count;
+    uint32_t limit;
+    uint64_t sum;
+    uint64_t sum_squares;
+};
+
+/** Starts a new window that accepts at most limit samples, further samples are ignored. */
+void volf_rms_init(struct volf_rms *rms, uint32_t limit);
+
+void volf_rms_add(struct volf_rms *rms, uint32_t sample);
+
+/** True once the window holds limit samples. */
+int volf_rms_full(const struct volf_rms *rms);
+
+/**
+ * Root mean square of the samples in the window after subtracting their mean, the AC part of a signal riding on a DC
+ * offset. Rounded to the nearest integer, or 0 for an empty window.
+ */
+uint32_t volf_rms_result(const struct volf_rms *rms);
+
+/** Mean of the samples in the window, or 0 for an empty window. */
+uint32_t volf_rms_mean(const struct volf_rms *rms);
+
+/**
+ * Samples needed per channel to cover the mains cycles when sampling at the given per channel rate, rounded down. The
+ * rate needn't be a multiple of the mains frequency, only the whole window is kept to whole cycles.
+ */
+uint32_t volf_rms_window(uint32_t sample_rate_hz, uint32_t mains_hz, uint32_t cycles);
+
+#endif //VOLF_RMS_H
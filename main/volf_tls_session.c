@@ -0,0 +1,273 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_TLS
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/error.h"
+#include "network_interface.h"
+#include "volf_tls_session.h"
+#include "volf_log.h"
+
+#define TLS_SESSION_MAGIC 0x544C5331
+#define MAX_TICKET_SIZE 512
+#define TLS_READ_TIMEOUT_MS 10
+#define ALPN_PROTOCOL_NAME "x-amzn-mqtt-ca"
+#define ALPN_PORT 443
+
+/**
+ * The parts of an mbedTLS session needed to resume it, either by session ID or by session ticket. Kept in RTC memory
+ * so it survives deep sleep. A restart clears it, forcing a full handshake.
+ */
+struct saved_tls_session {
+    uint32_t magic;
+    int ciphersuite;
+    int compression;
+    uint8_t id_len;
+    unsigned char id[32];
+    unsigned char master[48];
+    uint16_t ticket_len;
+    uint32_t ticket_lifetime;
+    unsigned char ticket[MAX_TICKET_SIZE];
+};
+
+RTC_DATA_ATTR static struct saved_tls_session s_saved_session;
+
+static uint32_t s_handshake_time_ms = 0;
+static bool s_session_resumed = false;
+
+static const char *alpn_protocols[] = {ALPN_PROTOCOL_NAME, NULL};
+
+void volf_tls_session_clear(void) {
+    memset(&s_saved_session, 0, sizeof(s_saved_session));
+}
+
+uint32_t volf_tls_get_handshake_time_ms(void) {
+    return s_handshake_time_ms;
+}
+
+bool volf_tls_session_resumed(void) {
+    return s_session_resumed;
+}
+
+static bool saved_session_valid(void) {
+    return s_saved_session.magic == TLS_SESSION_MAGIC;
+}
+
+static void save_session(mbedtls_ssl_context *ssl) {
+    mbedtls_ssl_session session;
+
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(ssl, &session) != 0) {
+        LOGW("Unable to read the TLS session, it will not be resumed.");
+        volf_tls_session_clear();
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+
+    if (session.ticket_len > MAX_TICKET_SIZE || session.id_len > sizeof(s_saved_session.id)) {
+        LOGW("TLS session ticket too large to save (%d bytes).", session.ticket_len);
+        volf_tls_session_clear();
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+
+    s_saved_session.ciphersuite = session.ciphersuite;
+    s_saved_session.compression = session.compression;
+    s_saved_session.id_len = session.id_len;
+    memcpy(s_saved_session.id, session.id, session.id_len);
+    memcpy(s_saved_session.master, session.master, sizeof(s_saved_session.master));
+    s_saved_session.ticket_len = session.ticket_len;
+    s_saved_session.ticket_lifetime = session.ticket_lifetime;
+    if (session.ticket_len > 0) {
+        memcpy(s_saved_session.ticket, session.ticket, session.ticket_len);
+    }
+    s_saved_session.magic = TLS_SESSION_MAGIC;
+
+    mbedtls_ssl_session_free(&session);
+}
+
+static int apply_saved_session(mbedtls_ssl_context *ssl) {
+    mbedtls_ssl_session session;
+    int ret;
+
+    mbedtls_ssl_session_init(&session);
+    session.ciphersuite = s_saved_session.ciphersuite;
+    session.compression = s_saved_session.compression;
+    session.id_len = s_saved_session.id_len;
+    memcpy(session.id, s_saved_session.id, s_saved_session.id_len);
+    memcpy(session.master, s_saved_session.master, sizeof(session.master));
+    if (s_saved_session.ticket_len > 0) {
+        session.ticket = malloc(s_saved_session.ticket_len);
+        if (session.ticket == NULL) {
+            return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        }
+        memcpy(session.ticket, s_saved_session.ticket, s_saved_session.ticket_len);
+        session.ticket_len = s_saved_session.ticket_len;
+        session.ticket_lifetime = s_saved_session.ticket_lifetime;
+    }
+
+    ret = mbedtls_ssl_set_session(ssl, &session);
+    mbedtls_ssl_session_free(&session);
+    return ret;
+}
+
+static void tls_free(TLSDataParams *tls) {
+    mbedtls_net_free(&tls->server_fd);
+    mbedtls_x509_crt_free(&tls->clicert);
+    mbedtls_x509_crt_free(&tls->cacert);
+    mbedtls_pk_free(&tls->pkey);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+}
+
+/**
+ * Mirrors iot_tls_connect() from the platform port, adding the saved session to the SSL context before the handshake
+ * and saving the negotiated session afterwards. The resulting TLSDataParams are used unchanged by the port's read,
+ * write, disconnect and destroy functions.
+ */
+static IoT_Error_t tls_connect(Network *network, bool resume) {
+    TLSConnectParams *params = &network->tlsConnectParams;
+    TLSDataParams *tls = &network->tlsDataParams;
+    char port_str[6];
+    int64_t handshake_start;
+    int ret;
+
+    mbedtls_net_init(&tls->server_fd);
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    mbedtls_x509_crt_init(&tls->cacert);
+    mbedtls_x509_crt_init(&tls->clicert);
+    mbedtls_pk_init(&tls->pkey);
+    mbedtls_entropy_init(&tls->entropy);
+
+    if (mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy,
+                              (const unsigned char *) LOG_NAME, strlen(LOG_NAME)) != 0) {
+        return NETWORK_MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+    }
+
+    if (mbedtls_x509_crt_parse(&tls->cacert, (const unsigned char *) params->pRootCALocation,
+                               strlen(params->pRootCALocation) + 1) < 0) {
+        return NETWORK_X509_ROOT_CRT_PARSE_ERROR;
+    }
+    if (mbedtls_x509_crt_parse(&tls->clicert, (const unsigned char *) params->pDeviceCertLocation,
+                               strlen(params->pDeviceCertLocation) + 1) != 0) {
+        return NETWORK_X509_DEVICE_CRT_PARSE_ERROR;
+    }
+    if (mbedtls_pk_parse_key(&tls->pkey, (const unsigned char *) params->pDevicePrivateKeyLocation,
+                             strlen(params->pDevicePrivateKeyLocation) + 1, NULL, 0) != 0) {
+        return NETWORK_PK_PRIVATE_KEY_PARSE_ERROR;
+    }
+
+    snprintf(port_str, sizeof(port_str), "%d", params->DestinationPort);
+    ret = mbedtls_net_connect(&tls->server_fd, params->pDestinationURL, port_str, MBEDTLS_NET_PROTO_TCP);
+    if (ret != 0) {
+        switch (ret) {
+            case MBEDTLS_ERR_NET_SOCKET_FAILED:
+                return NETWORK_ERR_NET_SOCKET_FAILED;
+            case MBEDTLS_ERR_NET_UNKNOWN_HOST:
+                return NETWORK_ERR_NET_UNKNOWN_HOST;
+            default:
+                return NETWORK_ERR_NET_CONNECT_FAILED;
+        }
+    }
+    mbedtls_net_set_block(&tls->server_fd);
+
+    if (mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return SSL_CONNECTION_ERROR;
+    }
+    mbedtls_ssl_conf_authmode(&tls->conf, params->ServerVerificationFlag ? MBEDTLS_SSL_VERIFY_REQUIRED
+                                                                         : MBEDTLS_SSL_VERIFY_OPTIONAL);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &tls->cacert, NULL);
+    if (mbedtls_ssl_conf_own_cert(&tls->conf, &tls->clicert, &tls->pkey) != 0) {
+        return SSL_CONNECTION_ERROR;
+    }
+    mbedtls_ssl_conf_session_tickets(&tls->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    mbedtls_ssl_conf_read_timeout(&tls->conf, params->timeout_ms);
+
+    if (params->DestinationPort == ALPN_PORT && mbedtls_ssl_conf_alpn_protocols(&tls->conf, alpn_protocols) != 0) {
+        return SSL_CONNECTION_ERROR;
+    }
+
+    if (mbedtls_ssl_setup(&tls->ssl, &tls->conf) != 0) {
+        return SSL_CONNECTION_ERROR;
+    }
+    if (mbedtls_ssl_set_hostname(&tls->ssl, params->pDestinationURL) != 0) {
+        return SSL_CONNECTION_ERROR;
+    }
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->server_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+
+    if (resume && apply_saved_session(&tls->ssl) != 0) {
+        LOGW("Unable to apply the saved TLS session, performing a full handshake.");
+        resume = false;
+    }
+
+    handshake_start = esp_timer_get_time();
+    while ((ret = mbedtls_ssl_handshake(&tls->ssl)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            LOGE("TLS handshake failed, mbedtls error -0x%x", -ret);
+            return SSL_CONNECTION_ERROR;
+        }
+    }
+    s_handshake_time_ms = (uint32_t) ((esp_timer_get_time() - handshake_start) / 1000);
+
+    if (mbedtls_ssl_get_verify_result(&tls->ssl) != 0 && params->ServerVerificationFlag) {
+        LOGE("Server certificate verification failed.");
+        return SSL_CONNECTION_ERROR;
+    }
+
+    // A resumed session keeps the master secret, a full handshake always derives a new one.
+    s_session_resumed = resume && memcmp(tls->ssl.session->master, s_saved_session.master,
+                                         sizeof(s_saved_session.master)) == 0;
+    LOGI("TLS handshake took %d ms, session %s.", s_handshake_time_ms, s_session_resumed ? "resumed" : "not resumed");
+
+    save_session(&tls->ssl);
+    mbedtls_ssl_conf_read_timeout(&tls->conf, TLS_READ_TIMEOUT_MS);
+
+    return SUCCESS;
+}
+
+static IoT_Error_t tls_connect_with_resume(Network *network, TLSConnectParams *params) {
+    IoT_Error_t rc;
+    bool resume = saved_session_valid();
+
+    if (network == NULL) {
+        return NULL_VALUE_ERROR;
+    }
+    if (params != NULL) {
+        network->tlsConnectParams = *params;
+    }
+
+    s_session_resumed = false;
+    rc = tls_connect(network, resume);
+    if (rc != SUCCESS) {
+        tls_free(&network->tlsDataParams);
+        // Only a failed handshake may be the server turning down the session, without a connection it's kept.
+        if (resume && rc == SSL_CONNECTION_ERROR) {
+            LOGW("TLS connect with a saved session failed (%d), retrying with a full handshake.", rc);
+            volf_tls_session_clear();
+            rc = tls_connect(network, false);
+            if (rc != SUCCESS) {
+                tls_free(&network->tlsDataParams);
+            }
+        }
+    }
+    return rc;
+}
+
+void volf_tls_session_install(AWS_IoT_Client *client) {
+    client->networkStack.connect = tls_connect_with_resume;
+}
@@ -0,0 +1,35 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_TLS_SESSION_H
+#define VOLF_TLS_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "aws_iot_mqtt_client_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Replaces the connect function of the client's network stack with one that resumes the TLS session saved from the
+ * previous wake, falling back to a full handshake if the server doesn't accept it. Must be called after
+ * aws_iot_shadow_init() and before aws_iot_shadow_connect().
+ */
+void volf_tls_session_install(AWS_IoT_Client *client);
+
+/** Discards the saved session so the next connect performs a full handshake. */
+void volf_tls_session_clear(void);
+
+/** Duration of the last TLS handshake in milliseconds. */
+uint32_t volf_tls_get_handshake_time_ms(void);
+
+/** True if the last TLS handshake resumed the saved session. */
+bool volf_tls_session_resumed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //VOLF_TLS_SESSION_H
@@ -0,0 +1,77 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#define LOG_MODULE LOG_MODULE_REPORT
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "aws_iot_shadow_interface.h"
+#include "volf_wait.h"
+#include "volf_error.h"
+#include "volf_log.h"
+
+/* Responses are only read while yielding, so this is how late a wait may notice one. */
+#define WAIT_SLICE_MS 50
+
+static const char *wait_names[NUM_VOLF_WAITS] = {
+        [VOLF_WAIT_SHADOW_GET] = "shadow get",
+        [VOLF_WAIT_SENSOR_UPDATE] = "sensor update",
+        [VOLF_WAIT_ERROR_LOG_UPDATE] = "error log update",
+};
+
+static EventGroupHandle_t wait_events = NULL;
+static int64_t wait_start_us[NUM_VOLF_WAITS];
+
+RTC_DATA_ATTR static uint32_t wait_time_ms[NUM_VOLF_WAITS];
+
+void volf_wait_init() {
+    if (wait_events == NULL) {
+        wait_events = xEventGroupCreate();
+    }
+}
+
+void volf_wait_start(volf_wait_t wait) {
+    xEventGroupClearBits(wait_events, 1 << wait);
+    wait_start_us[wait] = esp_timer_get_time();
+}
+
+void volf_wait_signal(volf_wait_t wait) {
+    xEventGroupSetBits(wait_events, 1 << wait);
+}
+
+static bool signalled(volf_wait_t wait) {
+    return (xEventGroupGetBits(wait_events) & (1 << wait)) != 0;
+}
+
+bool volf_wait_for(AWS_IoT_Client *client, volf_wait_t wait, uint32_t timeout_ms) {
+    int64_t deadline_us = wait_start_us[wait] + (int64_t) timeout_ms * 1000;
+    IoT_Error_t rc;
+    bool done;
+
+    while (!signalled(wait) && esp_timer_get_time() < deadline_us) {
+        rc = aws_iot_shadow_yield(client, WAIT_SLICE_MS);
+        if (rc != SUCCESS) {
+            volf_handle_error(CONTINUE, "volf_wait_for", rc);
+            break;
+        }
+    }
+
+    done = signalled(wait);
+    wait_time_ms[wait] = (uint32_t) ((esp_timer_get_time() - wait_start_us[wait]) / 1000);
+    if (done) {
+        LOGI("Waited %d ms for the %s response.", wait_time_ms[wait], wait_names[wait]);
+    } else {
+        LOGW("Gave up on the %s response after %d ms.", wait_names[wait], wait_time_ms[wait]);
+    }
+    return done;
+}
+
+uint32_t volf_wait_get_time_ms(volf_wait_t wait) {
+    return wait_time_ms[wait];
+}
+
+void volf_wait_clear_time(volf_wait_t wait) {
+    wait_time_ms[wait] = 0;
+}
@@ -0,0 +1,40 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_WAIT_H
+#define VOLF_WAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "aws_iot_mqtt_client_interface.h"
+
+/** The shadow responses a wake waits for. */
+typedef enum {
+    VOLF_WAIT_SHADOW_GET,
+    VOLF_WAIT_SENSOR_UPDATE,
+    VOLF_WAIT_ERROR_LOG_UPDATE,
+    NUM_VOLF_WAITS
+} volf_wait_t;
+
+/** Creates the event group the waits are signalled through. Safe to call more than once. */
+void volf_wait_init();
+
+/** Clears the wait's event and starts its clock. Call right before sending the request. */
+void volf_wait_start(volf_wait_t wait);
+
+/** Completes the wait. Called from the response callback, whatever the response was. */
+void volf_wait_signal(volf_wait_t wait);
+
+/**
+ * Yields the client in short slices until the wait is signalled or timeout_ms have passed since volf_wait_start(),
+ * then records how long it took. Returns false if the wait timed out or the client failed to yield.
+ */
+bool volf_wait_for(AWS_IoT_Client *client, volf_wait_t wait, uint32_t timeout_ms);
+
+/** Duration of the last completed wait of this kind in milliseconds, kept across deep sleep. 0 if there was none. */
+uint32_t volf_wait_get_time_ms(volf_wait_t wait);
+
+/** Forgets the duration of the last wait of this kind, once it has been reported. */
+void volf_wait_clear_time(volf_wait_t wait);
+
+#endif //VOLF_WAIT_H
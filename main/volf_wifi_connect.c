@@ -1,16 +1,23 @@
 // © Christopher Morrissey <cmorriss@gmail.com>
 // SPDX-License-Identifier: GPL-3.0-only
 
+#define LOG_MODULE LOG_MODULE_WIFI
+
 #include <string.h>
 #include "volf_wifi_connect.h"
 #include "volf_log.h"
 #include "volf_error.h"
+#include "volf_profile.h"
+#include "volf_ap_select.h"
 #include "sdkconfig.h"
 #include "esp_event.h"
 #include "esp_wifi.h"
 #include "esp_wifi_default.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "nvs.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -18,12 +25,86 @@
 
 #define NR_OF_IP_ADDRESSES_TO_WAIT_FOR (s_active_interfaces)
 
-#define CONFIG_WIFI_SSID "dadiator"
-#define CONFIG_WIFI_PASSWORD "chr0nika"
+#define NVS_NAME_WIFI "volf.wifi"
+#define AP_HISTORY_KEY "aps"
+#define CREDENTIALS_KEY "creds"
+
+/* Dwell time per channel of the scan for known APs. */
+#define SCAN_MIN_TIME_MS 50
+#define SCAN_MAX_TIME_MS 120
+/* Full scans without a known AP before the wake is retried, each after twice the delay of the one before. */
+#define MAX_FULL_SCANS 4
+#define RESCAN_DELAY_MS 500
+
+#define BSSID_FORMAT "%02x:%02x:%02x:%02x:%02x:%02x"
+#define BSSID_ARGS(b) (b)[0], (b)[1], (b)[2], (b)[3], (b)[4], (b)[5]
+
+#define FAST_CONNECT_MAGIC 0x46434331
+#define FAST_CONNECT_TIMEOUT_MS 3000
+/* Force a full DHCP exchange periodically so the cached lease doesn't go stale. */
+#define FAST_CONNECT_MAX_REUSE 24
+
+/**
+ * Connection details from the last successful full connect. This lives in RTC memory so it survives deep sleep,
+ * allowing the next wake to skip the scan and the DHCP exchange. A restart clears it, so any failure that leads to a
+ * RETRY automatically falls back to the full connect path.
+ */
+struct fast_connect_cache {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t credential;
+    uint8_t uses;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns_info;
+};
+
+/* The networks set by volf_wifi_set_credentials(), as stored in NVS. */
+struct stored_credentials {
+    uint8_t count;
+    struct volf_wifi_credential credentials[VOLF_WIFI_MAX_CREDENTIALS];
+};
+
+/**
+ * Joined when no networks are stored in NVS, so a freshly flashed sensor can reach the shadow that sets them.
+ */
+static const struct volf_wifi_credential default_credentials[] = {
+        {"dadiator", "chr0nika"},
+};
+
+#define NUM_DEFAULT_CREDENTIALS (sizeof(default_credentials) / sizeof(default_credentials[0]))
+
+/**
+ * The networks a sensor may join. Every AP broadcasting one of these SSIDs is a candidate, the scan results are ranked
+ * by volf_ap_rank() to pick the one to connect through. Loaded when connecting.
+ */
+static struct volf_wifi_credential credentials[VOLF_WIFI_MAX_CREDENTIALS];
+static size_t s_num_credentials = 0;
 
 static int s_active_interfaces = 0;
 static xSemaphoreHandle s_semph_get_ip_addrs;
 static esp_ip4_addr_t s_ip_addr;
+static esp_netif_t *s_netif = NULL;
+
+RTC_DATA_ATTR static struct fast_connect_cache s_fast_connect_cache;
+static bool s_fast_connect = false;
+static bool s_used_fast_connect = false;
+static int64_t s_connect_start_us;
+static uint32_t s_connect_time_ms;
+static uint16_t s_reconnects = 0;
+
+/* Loaded from NVS when connecting, saved once connected. Only touched by the event handlers until then. */
+static struct volf_ap_history s_ap_history;
+static wifi_ap_record_t s_scan_records[VOLF_AP_MAX_CANDIDATES];
+static struct volf_ap_candidate s_candidates[VOLF_AP_MAX_CANDIDATES];
+static size_t s_num_candidates = 0;
+static size_t s_candidate = 0;
+static uint8_t s_scan_channel = 0;
+static uint8_t s_full_scans = 0;
+static esp_timer_handle_t s_rescan_timer = NULL;
+static int64_t s_attempt_start_us;
+static uint32_t s_attempt_time_ms;
+static bool s_connected = false;
 
 static esp_netif_t* wifi_start(void);
 static void wifi_stop(void);
@@ -42,7 +123,9 @@ static bool is_our_netif(const char *prefix, esp_netif_t *netif)
 /* set up connection, Wi-Fi and/or Ethernet */
 static void start(void)
 {
-    wifi_start();
+    s_connect_start_us = esp_timer_get_time();
+    volf_profile_begin(PROFILE_WIFI_ASSOCIATE);
+    s_netif = wifi_start();
     s_active_interfaces++;
     s_semph_get_ip_addrs = xSemaphoreCreateCounting(NR_OF_IP_ADDRESSES_TO_WAIT_FOR, 0);
 }
@@ -54,6 +137,13 @@ static void stop(void)
     s_active_interfaces--;
 }
 
+static void on_wifi_connected(void *arg, esp_event_base_t event_base,
+                              int32_t event_id, void *event_data)
+{
+    volf_profile_end(PROFILE_WIFI_ASSOCIATE);
+    volf_profile_begin(PROFILE_IP_ACQUIRE);
+}
+
 static void on_got_ip(void *arg, esp_event_base_t event_base,
                       int32_t event_id, void *event_data)
 {
@@ -64,9 +154,302 @@ static void on_got_ip(void *arg, esp_event_base_t event_base,
     }
     LOGI("Got IPv4 event: Interface \"%s\" address: " IPSTR, esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
     memcpy(&s_ip_addr, &event->ip_info.ip, sizeof(s_ip_addr));
+    s_connect_time_ms = (uint32_t) ((esp_timer_get_time() - s_connect_start_us) / 1000);
+    s_attempt_time_ms = (uint32_t) ((esp_timer_get_time() - s_attempt_start_us) / 1000);
+    s_connected = true;
+    volf_profile_end(PROFILE_IP_ACQUIRE);
     xSemaphoreGive(s_semph_get_ip_addrs);
 }
 
+static bool fast_connect_cache_valid(void)
+{
+    return s_fast_connect_cache.magic == FAST_CONNECT_MAGIC && s_fast_connect_cache.uses < FAST_CONNECT_MAX_REUSE
+           && s_fast_connect_cache.credential < s_num_credentials;
+}
+
+static void fast_connect_candidate(struct volf_ap_candidate *ap)
+{
+    memset(ap, 0, sizeof(*ap));
+    memcpy(ap->bssid, s_fast_connect_cache.bssid, sizeof(ap->bssid));
+    ap->channel = s_fast_connect_cache.channel;
+    ap->credential = s_fast_connect_cache.credential;
+}
+
+static void fast_connect_cache_invalidate(void)
+{
+    memset(&s_fast_connect_cache, 0, sizeof(s_fast_connect_cache));
+}
+
+static void fast_connect_cache_store(esp_netif_t *netif)
+{
+    wifi_ap_record_t ap_info;
+
+    if (s_fast_connect) {
+        struct volf_ap_candidate ap;
+
+        fast_connect_candidate(&ap);
+        ap.rssi = volf_wifi_get_rssi();
+        if (volf_ap_should_rescan(&s_ap_history, &ap)) {
+            LOGI("Fast connect AP is weak at %d dBm, scanning for a stronger one on the next wake.", ap.rssi);
+            fast_connect_cache_invalidate();
+            return;
+        }
+        s_fast_connect_cache.uses++;
+        return;
+    }
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK
+        || esp_netif_get_ip_info(netif, &s_fast_connect_cache.ip_info) != ESP_OK
+        || esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &s_fast_connect_cache.dns_info) != ESP_OK) {
+        LOGW("Unable to read connection details, fast connect disabled for the next wake.");
+        fast_connect_cache_invalidate();
+        return;
+    }
+
+    memcpy(s_fast_connect_cache.bssid, ap_info.bssid, sizeof(s_fast_connect_cache.bssid));
+    s_fast_connect_cache.channel = ap_info.primary;
+    s_fast_connect_cache.credential = s_candidates[s_candidate].credential;
+    s_fast_connect_cache.uses = 0;
+    s_fast_connect_cache.magic = FAST_CONNECT_MAGIC;
+    LOGI("Cached connection details for fast connect, channel %d.", s_fast_connect_cache.channel);
+}
+
+static void load_ap_history(void)
+{
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(s_ap_history);
+    esp_err_t err;
+
+    memset(&s_ap_history, 0, sizeof(s_ap_history));
+    err = nvs_open(NVS_NAME_WIFI, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return;
+    }
+    err = nvs_get_blob(nvs_handle, AP_HISTORY_KEY, &s_ap_history, &size);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK || size != sizeof(s_ap_history)) {
+        memset(&s_ap_history, 0, sizeof(s_ap_history));
+    }
+}
+
+static void load_credentials(void)
+{
+    struct stored_credentials stored;
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(stored);
+    esp_err_t err;
+
+    err = nvs_open(NVS_NAME_WIFI, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs_handle, CREDENTIALS_KEY, &stored, &size);
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK || size != sizeof(stored) || stored.count == 0 || stored.count > VOLF_WIFI_MAX_CREDENTIALS) {
+        memcpy(credentials, default_credentials, sizeof(default_credentials));
+        s_num_credentials = NUM_DEFAULT_CREDENTIALS;
+        return;
+    }
+    memcpy(credentials, stored.credentials, sizeof(credentials));
+    s_num_credentials = stored.count;
+    for (int i = 0; i < s_num_credentials; i++) {
+        credentials[i].ssid[sizeof(credentials[i].ssid) - 1] = 0;
+        credentials[i].password[sizeof(credentials[i].password) - 1] = 0;
+    }
+    LOGI("Loaded %d Wi-Fi networks.", (int) s_num_credentials);
+}
+
+static void save_ap_history(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    err = nvs_open(NVS_NAME_WIFI, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        volf_handle_error(CONTINUE, "save_ap_history", err);
+        return;
+    }
+    err = nvs_set_blob(nvs_handle, AP_HISTORY_KEY, &s_ap_history, sizeof(s_ap_history));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    volf_handle_error(CONTINUE, "save_ap_history", err);
+    nvs_close(nvs_handle);
+}
+
+static void set_wifi_config(const struct volf_ap_candidate *ap)
+{
+    wifi_config_t wifi_config = {
+        .sta = {
+            .bssid_set = true,
+            .channel = ap->channel,
+        },
+    };
+    strlcpy((char *) wifi_config.sta.ssid, credentials[ap->credential].ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char *) wifi_config.sta.password, credentials[ap->credential].password,
+            sizeof(wifi_config.sta.password));
+    memcpy(wifi_config.sta.bssid, ap->bssid, sizeof(wifi_config.sta.bssid));
+    volf_handle_error(RETRY, "esp_wifi_set_config", esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+}
+
+/* Scans the given channel, or all channels for 0. on_scan_done() picks the AP to connect through. */
+static void start_scan(uint8_t channel)
+{
+    wifi_scan_config_t scan_config = {
+        .channel = channel,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active = {
+            .min = SCAN_MIN_TIME_MS,
+            .max = SCAN_MAX_TIME_MS,
+        },
+    };
+
+    s_num_candidates = 0;
+    s_scan_channel = channel;
+    if (channel != 0) {
+        LOGI("Scanning channel %d for known APs.", channel);
+    } else {
+        s_full_scans++;
+        LOGI("Scanning all channels for known APs, scan %d of %d.", s_full_scans, MAX_FULL_SCANS);
+    }
+    volf_handle_error(RETRY, "esp_wifi_scan_start", esp_wifi_scan_start(&scan_config, false));
+}
+
+static void on_rescan_timer(void *arg)
+{
+    start_scan(0);
+}
+
+/**
+ * Scans all channels again, right away after a single channel scan and with a doubling delay after a full one. Once
+ * MAX_FULL_SCANS found no AP to connect through, the wake is retried rather than scanning until the battery is flat.
+ */
+static void rescan(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = on_rescan_timer,
+        .name = "wifi_rescan",
+    };
+    uint32_t delay_ms;
+
+    if (s_full_scans >= MAX_FULL_SCANS) {
+        LOGE("No known AP to connect through after %d scans.", s_full_scans);
+        volf_handle_error(RETRY, "wifi_rescan", ESP_ERR_NOT_FOUND);
+        return;
+    }
+    if (s_full_scans == 0) {
+        start_scan(0);
+        return;
+    }
+    delay_ms = RESCAN_DELAY_MS << (s_full_scans - 1);
+    LOGI("Scanning again in %d ms.", delay_ms);
+    if (s_rescan_timer == NULL) {
+        volf_handle_error(RETRY, "esp_timer_create", esp_timer_create(&timer_args, &s_rescan_timer));
+    }
+    volf_handle_error(RETRY, "esp_timer_start_once", esp_timer_start_once(s_rescan_timer, delay_ms * 1000ULL));
+}
+
+static void connect_candidate(size_t index)
+{
+    const struct volf_ap_candidate *ap = &s_candidates[index];
+
+    s_candidate = index;
+    LOGI("Connecting to %s through " BSSID_FORMAT " on channel %d at %d dBm.", credentials[ap->credential].ssid,
+         BSSID_ARGS(ap->bssid), ap->channel, ap->rssi);
+    set_wifi_config(ap);
+    s_attempt_start_us = esp_timer_get_time();
+    volf_handle_error(RETRY, "esp_wifi_connect", esp_wifi_connect());
+}
+
+static int find_credential(const uint8_t *ssid)
+{
+    for (int i = 0; i < s_num_credentials; i++) {
+        if (strcmp((const char *) ssid, credentials[i].ssid) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void on_scan_done(void *arg, esp_event_base_t event_base,
+                         int32_t event_id, void *event_data)
+{
+    uint16_t num_records = VOLF_AP_MAX_CANDIDATES;
+    size_t count = 0;
+
+    if (esp_wifi_scan_get_ap_records(&num_records, s_scan_records) != ESP_OK) {
+        num_records = 0;
+    }
+    for (int i = 0; i < num_records; i++) {
+        int credential = find_credential(s_scan_records[i].ssid);
+        if (credential < 0) {
+            continue;
+        }
+        memcpy(s_candidates[count].bssid, s_scan_records[i].bssid, sizeof(s_candidates[count].bssid));
+        s_candidates[count].channel = s_scan_records[i].primary;
+        s_candidates[count].rssi = s_scan_records[i].rssi;
+        s_candidates[count].credential = credential;
+        count++;
+    }
+    s_num_candidates = volf_ap_rank(&s_ap_history, s_candidates, count);
+
+    if (s_num_candidates == 0) {
+        // A single channel scan only looked where the last AP was, try everywhere before giving up on this scan.
+        if (s_scan_channel != 0) {
+            LOGI("No known AP on channel %d.", s_scan_channel);
+        } else {
+            LOGW("No known AP found.");
+        }
+        rescan();
+        return;
+    }
+    LOGI("Found %d known APs out of %d.", (int) s_num_candidates, num_records);
+    connect_candidate(0);
+}
+
+static void apply_fast_connect(esp_netif_t *netif)
+{
+    struct volf_ap_candidate ap;
+
+    fast_connect_candidate(&ap);
+
+    volf_handle_error(CONTINUE, "esp_netif_dhcpc_stop", esp_netif_dhcpc_stop(netif));
+    volf_handle_error(RETRY, "esp_netif_set_ip_info", esp_netif_set_ip_info(netif, &s_fast_connect_cache.ip_info));
+    volf_handle_error(CONTINUE, "esp_netif_set_dns_info",
+                      esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &s_fast_connect_cache.dns_info));
+    set_wifi_config(&ap);
+}
+
+/* Called once the fast connect attempt has failed, switches back to scanning and DHCP. */
+static void fast_connect_fallback(void)
+{
+    struct volf_ap_candidate ap;
+
+    LOGW("Fast connect failed, falling back to full connect.");
+    fast_connect_candidate(&ap);
+    volf_ap_record(&s_ap_history, &ap, false, 0);
+    s_fast_connect = false;
+    s_used_fast_connect = false;
+    fast_connect_cache_invalidate();
+
+    volf_handle_error(RETRY, "esp_netif_dhcpc_start", esp_netif_dhcpc_start(s_netif));
+    start_scan(ap.channel);
+}
+
+/* Remembers how connecting went so the next full connect ranks the APs with it. */
+static void record_connection(void)
+{
+    struct volf_ap_candidate ap;
+
+    if (s_used_fast_connect) {
+        // Without the DHCP exchange the connect time doesn't compare with a full connect.
+        fast_connect_candidate(&ap);
+        volf_ap_record(&s_ap_history, &ap, true, 0);
+    } else {
+        volf_ap_record(&s_ap_history, &s_candidates[s_candidate], true, s_attempt_time_ms);
+    }
+    save_ap_history();
+}
+
 esp_err_t volf_wifi_connect(void)
 {
     if (s_semph_get_ip_addrs != NULL) {
@@ -76,8 +459,19 @@ esp_err_t volf_wifi_connect(void)
     volf_handle_error(CONTINUE, "esp_register_shutdown_handler", esp_register_shutdown_handler(&stop));
     LOGI("Waiting for IP(s)");
     for (int i=0; i<NR_OF_IP_ADDRESSES_TO_WAIT_FOR; ++i) {
+        if (s_fast_connect && xSemaphoreTake(s_semph_get_ip_addrs, FAST_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS) == pdTRUE) {
+            continue;
+        }
+        if (s_fast_connect) {
+            // The disconnect event triggers the fallback to the full connect path.
+            esp_wifi_disconnect();
+        }
         xSemaphoreTake(s_semph_get_ip_addrs, portMAX_DELAY);
     }
+    record_connection();
+    fast_connect_cache_store(s_netif);
+    s_fast_connect = false;
+    LOGI("Connected in %d ms (fast connect %s)", s_connect_time_ms, s_used_fast_connect ? "used" : "not used");
     // iterate over active interfaces, and print out IPs of "our" netifs
     esp_netif_t *netif = NULL;
     esp_netif_ip_info_t ip;
@@ -96,6 +490,23 @@ esp_err_t volf_wifi_connect(void)
 static void on_wifi_disconnect(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
 {
+    s_reconnects++;
+    if (s_fast_connect) {
+        fast_connect_fallback();
+        return;
+    }
+    if (!s_connected && s_num_candidates > 0) {
+        const struct volf_ap_candidate *ap = &s_candidates[s_candidate];
+
+        LOGW("Unable to connect through " BSSID_FORMAT ".", BSSID_ARGS(ap->bssid));
+        volf_ap_record(&s_ap_history, ap, false, 0);
+        if (s_candidate + 1 < s_num_candidates) {
+            connect_candidate(s_candidate + 1);
+        } else {
+            rescan();
+        }
+        return;
+    }
     LOGI("Wi-Fi disconnected, trying to reconnect...");
     esp_err_t err = esp_wifi_connect();
     if (err == ESP_ERR_WIFI_NOT_STARTED) {
@@ -120,20 +531,27 @@ static esp_netif_t* wifi_start(void)
     esp_wifi_set_default_wifi_sta_handlers();
 
     volf_handle_error(CONTINUE, "esp_event_handler_register:on_wifi_disconnect", esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL));
+    volf_handle_error(CONTINUE, "esp_event_handler_register:on_wifi_connected", esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connected, NULL));
     volf_handle_error(RETRY, "esp_event_handler_register:on_got_ip", esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, NULL));
+    volf_handle_error(RETRY, "esp_event_handler_register:on_scan_done", esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &on_scan_done, NULL));
 
     volf_handle_error(CONTINUE, "esp_wifi_set_storage", esp_wifi_set_storage(WIFI_STORAGE_RAM));
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = CONFIG_WIFI_SSID,
-            .password = CONFIG_WIFI_PASSWORD,
-        },
-    };
-    LOGI("Connecting to %s...", wifi_config.sta.ssid);
     volf_handle_error(RETRY, "esp_wifi_set_mode", esp_wifi_set_mode(WIFI_MODE_STA));
-    volf_handle_error(RETRY, "esp_wifi_set_config", esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+    load_credentials();
+    load_ap_history();
+    if (fast_connect_cache_valid()) {
+        LOGI("Using fast connect on channel %d.", s_fast_connect_cache.channel);
+        s_fast_connect = true;
+        s_used_fast_connect = true;
+        apply_fast_connect(netif);
+    }
     volf_handle_error(RETRY, "esp_wifi_start", esp_wifi_start());
-    volf_handle_error(RETRY, "esp_wifi_connect", esp_wifi_connect());
+    if (s_fast_connect) {
+        volf_handle_error(RETRY, "esp_wifi_connect", esp_wifi_connect());
+    } else {
+        // The AP connected through last is most likely still the best, scan its channel alone first.
+        start_scan(volf_ap_last_channel(&s_ap_history));
+    }
     return netif;
 }
 
@@ -141,7 +559,9 @@ static void wifi_stop(void)
 {
     esp_netif_t *wifi_netif = get_netif_from_desc("sta");
     volf_handle_error(CONTINUE, "esp_event_handler_unregister:on_wifi_disconnect", esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect));
+    volf_handle_error(CONTINUE, "esp_event_handler_unregister:on_wifi_connected", esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connected));
     volf_handle_error(CONTINUE, "esp_event_handler_unregister:on_get_ip", esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip));
+    volf_handle_error(CONTINUE, "esp_event_handler_unregister:on_scan_done", esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &on_scan_done));
     esp_err_t err = esp_wifi_stop();
     if (err == ESP_ERR_WIFI_NOT_INIT) {
         return;
@@ -166,3 +586,85 @@ static esp_netif_t *get_netif_from_desc(const char *desc)
     free(expected_desc);
     return netif;
 }
+
+esp_netif_t *get_esp_netif(void)
+{
+    return s_netif;
+}
+
+uint32_t volf_wifi_get_connect_time_ms(void)
+{
+    return s_connect_time_ms;
+}
+
+bool volf_wifi_used_fast_connect(void)
+{
+    return s_used_fast_connect;
+}
+
+int8_t volf_wifi_get_rssi(void)
+{
+    wifi_ap_record_t ap_info;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return 0;
+    }
+    return ap_info.rssi;
+}
+
+uint16_t volf_wifi_get_reconnect_count(void)
+{
+    return s_reconnects;
+}
+
+esp_err_t volf_wifi_set_credentials(const struct volf_wifi_credential *new_credentials, size_t count)
+{
+    struct stored_credentials stored;
+    struct stored_credentials current;
+    nvs_handle_t nvs_handle;
+    size_t size = sizeof(current);
+    esp_err_t err;
+
+    if (count > VOLF_WIFI_MAX_CREDENTIALS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Zeroed past the strings so an unchanged set compares equal to the stored one.
+    memset(&stored, 0, sizeof(stored));
+    stored.count = (uint8_t) count;
+    for (int i = 0; i < count; i++) {
+        if (strlcpy(stored.credentials[i].ssid, new_credentials[i].ssid, sizeof(stored.credentials[i].ssid))
+            >= sizeof(stored.credentials[i].ssid)
+            || strlcpy(stored.credentials[i].password, new_credentials[i].password,
+                       sizeof(stored.credentials[i].password)) >= sizeof(stored.credentials[i].password)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    err = nvs_open(NVS_NAME_WIFI, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (nvs_get_blob(nvs_handle, CREDENTIALS_KEY, &current, &size) != ESP_OK || size != sizeof(current)) {
+        current.count = 0;
+    }
+    // The shadow repeats the networks in every delta, only a change is written to flash.
+    if (count == 0 ? current.count == 0 : memcmp(&stored, &current, sizeof(stored)) == 0) {
+        nvs_close(nvs_handle);
+        return ESP_OK;
+    }
+    if (count == 0) {
+        err = nvs_erase_key(nvs_handle, CREDENTIALS_KEY);
+    } else {
+        err = nvs_set_blob(nvs_handle, CREDENTIALS_KEY, &stored, sizeof(stored));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    if (err == ESP_OK) {
+        // The cached credential is an index into the old networks.
+        LOGI("Stored %d Wi-Fi networks for the next connect.", (int) count);
+        fast_connect_cache_invalidate();
+    }
+    return err;
+}
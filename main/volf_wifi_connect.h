@@ -10,6 +10,14 @@ extern "C" {
 #include "esp_err.h"
 #include "esp_netif.h"
 
+#define VOLF_WIFI_MAX_CREDENTIALS 4
+
+/** A network the sensor may join, both strings are NUL terminated. */
+struct volf_wifi_credential {
+    char ssid[33];
+    char password[65];
+};
+
 esp_err_t volf_wifi_connect(void);
 esp_err_t volf_wifi_disconnect(void);
 
@@ -18,6 +26,32 @@ esp_err_t volf_wifi_disconnect(void);
  */
 esp_netif_t *get_esp_netif(void);
 
+/**
+ * @brief Returns the time taken from starting Wi-Fi until an IP address was available, in milliseconds
+ */
+uint32_t volf_wifi_get_connect_time_ms(void);
+
+/**
+ * @brief Returns true if the cached BSSID, channel and IP lease from the previous wake were used to connect
+ */
+bool volf_wifi_used_fast_connect(void);
+
+/**
+ * @brief Returns the signal strength of the access point in dBm, or 0 if not connected
+ */
+int8_t volf_wifi_get_rssi(void);
+
+/**
+ * @brief Returns the number of times the station was disconnected and had to connect again
+ */
+uint16_t volf_wifi_get_reconnect_count(void);
+
+/**
+ * @brief Stores the networks to join from the next connect on, in NVS, from the shadow or provisioning. A count of 0
+ * goes back to the networks built into the firmware. Nothing is written when the networks are unchanged.
+ */
+esp_err_t volf_wifi_set_credentials(const struct volf_wifi_credential *credentials, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,40 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdio.h>
+#include "volf_cbor_decode.h"
+
+#define MAX_CBOR_SIZE 4096
+#define MAX_JSON_SIZE 16384
+
+/**
+ * Reads a CBOR telemetry payload from a file, or stdin if no file is given, and prints the equivalent shadow JSON.
+ */
+int main(int argc, char **argv) {
+    static uint8_t cbor[MAX_CBOR_SIZE];
+    static char json[MAX_JSON_SIZE];
+    FILE *in = stdin;
+    size_t len;
+    int rc;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [payload.cbor]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    len = fread(cbor, 1, sizeof(cbor), in);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    rc = volf_cbor_to_json(cbor, len, json, sizeof(json));
+    if (rc != CBOR_DECODE_OK) {
+        fprintf(stderr, "Unable to decode payload: error %d\n", rc);
+        return 1;
+    }
+    printf("%s\n", json);
+    return 0;
+}
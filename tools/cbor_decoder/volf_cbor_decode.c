@@ -0,0 +1,317 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "volf_cbor_decode.h"
+
+#define CBOR_SAMPLES_KEY 0
+#define CBOR_SAMPLE_AGE_KEY 0
+#define CBOR_PHASES_KEY 255
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+#define MAJOR_UINT 0
+#define MAJOR_NEGATIVE_INT 1
+#define MAJOR_ARRAY 4
+#define MAJOR_MAP 5
+#define MAJOR_TAG 6
+#define MAJOR_SIMPLE 7
+
+#define SIMPLE_FALSE 20
+#define SIMPLE_TRUE 21
+
+/* Must match the ids in reading_fields in main/sensors/sensor_reading.c. */
+static const char *field_names[] = {
+        [1] = "version",
+        [2] = "sleepDuration",
+        [3] = "deepSleep",
+        [4] = "wifiConnectMs",
+        [5] = "fastConnect",
+        [6] = "tlsHandshakeMs",
+        [7] = "tlsResumed",
+        [8] = "batteryVoltage",
+        [9] = "batteryPercent",
+        [10] = "batteryLowVoltage",
+        [11] = "batteryHighVoltage",
+        [12] = "moistureVoltage",
+        [13] = "moisturePercent",
+        [14] = "moistureLowVoltage",
+        [15] = "moistureHighVoltage",
+        [16] = "temperature",
+        [17] = "humidity",
+        [18] = "acCurrent1",
+        [19] = "acCurrent2",
+        [20] = "acCurrent3",
+        [21] = "acCurrent4",
+        [22] = "sensorMs",
+        [23] = "networkMs",
+        [24] = "awakeMs",
+        [25] = "skippedTransmits",
+        [26] = "skippedAwakeMs",
+        [27] = "temperature2",
+        [28] = "temperature3",
+        [29] = "temperature4",
+        [30] = "shadowGetMs",
+        [31] = "shadowUpdateMs",
+        [32] = "runtimeHours",
+};
+
+#define NUM_FIELD_IDS (sizeof(field_names) / sizeof(field_names[0]))
+
+struct decoder {
+    const uint8_t *cbor;
+    size_t len;
+    size_t pos;
+    char *json;
+    size_t json_size;
+    size_t json_len;
+};
+
+static int emit(struct decoder *d, const char *format, ...) {
+    va_list args;
+    int written;
+
+    va_start(args, format);
+    written = vsnprintf(d->json + d->json_len, d->json_size - d->json_len, format, args);
+    va_end(args);
+    if (written < 0 || (size_t) written >= d->json_size - d->json_len) {
+        return CBOR_DECODE_OUTPUT_FULL;
+    }
+    d->json_len += written;
+    return CBOR_DECODE_OK;
+}
+
+static int read_head(struct decoder *d, uint8_t *major, uint64_t *value) {
+    uint8_t info;
+    size_t num_bytes;
+
+    if (d->pos >= d->len) {
+        return CBOR_DECODE_TRUNCATED;
+    }
+    *major = d->cbor[d->pos] >> 5;
+    info = d->cbor[d->pos] & 0x1f;
+    d->pos++;
+
+    if (info < 24) {
+        *value = info;
+        return CBOR_DECODE_OK;
+    }
+    if (info > 27) {
+        return CBOR_DECODE_UNSUPPORTED;
+    }
+    num_bytes = (size_t) 1 << (info - 24);
+    if (d->pos + num_bytes > d->len) {
+        return CBOR_DECODE_TRUNCATED;
+    }
+    *value = 0;
+    for (size_t i = 0; i < num_bytes; i++) {
+        *value = (*value << 8) | d->cbor[d->pos++];
+    }
+    return CBOR_DECODE_OK;
+}
+
+static int read_int(struct decoder *d, int64_t *value) {
+    uint8_t major;
+    uint64_t raw;
+    int rc;
+
+    if ((rc = read_head(d, &major, &raw)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    if (major == MAJOR_UINT) {
+        *value = (int64_t) raw;
+    } else if (major == MAJOR_NEGATIVE_INT) {
+        *value = -1 - (int64_t) raw;
+    } else {
+        return CBOR_DECODE_UNSUPPORTED;
+    }
+    return CBOR_DECODE_OK;
+}
+
+static int decode_value(struct decoder *d) {
+    uint8_t major;
+    uint64_t raw;
+    int64_t exponent;
+    int64_t mantissa;
+    double value;
+    int rc;
+
+    if ((rc = read_head(d, &major, &raw)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+
+    switch (major) {
+        case MAJOR_UINT:
+            return emit(d, "%llu", (unsigned long long) raw);
+        case MAJOR_NEGATIVE_INT:
+            return emit(d, "%lld", -1 - (long long) raw);
+        case MAJOR_SIMPLE:
+            if (raw == SIMPLE_FALSE || raw == SIMPLE_TRUE) {
+                return emit(d, raw == SIMPLE_TRUE ? "true" : "false");
+            }
+            return CBOR_DECODE_UNSUPPORTED;
+        case MAJOR_TAG:
+            if (raw != CBOR_TAG_DECIMAL_FRACTION) {
+                return CBOR_DECODE_UNSUPPORTED;
+            }
+            if ((rc = read_head(d, &major, &raw)) != CBOR_DECODE_OK) {
+                return rc;
+            }
+            if (major != MAJOR_ARRAY || raw != 2) {
+                return CBOR_DECODE_UNSUPPORTED;
+            }
+            if ((rc = read_int(d, &exponent)) != CBOR_DECODE_OK || (rc = read_int(d, &mantissa)) != CBOR_DECODE_OK) {
+                return rc;
+            }
+            if (exponent > 0 || exponent < -18) {
+                return CBOR_DECODE_UNSUPPORTED;
+            }
+            value = (double) mantissa;
+            for (int64_t i = 0; i > exponent; i--) {
+                value /= 10;
+            }
+            return emit(d, "%.*f", (int) -exponent, value);
+        default:
+            return CBOR_DECODE_UNSUPPORTED;
+    }
+}
+
+static int decode_reading(struct decoder *d, bool is_sample);
+
+static int decode_samples(struct decoder *d) {
+    uint8_t major;
+    uint64_t count;
+    int rc;
+
+    if ((rc = read_head(d, &major, &count)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    if (major != MAJOR_ARRAY) {
+        return CBOR_DECODE_UNSUPPORTED;
+    }
+    if ((rc = emit(d, "[")) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (i > 0 && (rc = emit(d, ",")) != CBOR_DECODE_OK) {
+            return rc;
+        }
+        if ((rc = decode_reading(d, true)) != CBOR_DECODE_OK) {
+            return rc;
+        }
+    }
+    return emit(d, "]");
+}
+
+/**
+ * Decodes an array of arrays of integers, the phase timings of each wake.
+ */
+static int decode_phases(struct decoder *d) {
+    uint8_t major;
+    uint64_t num_wakes;
+    uint64_t num_values;
+    int rc;
+
+    if ((rc = read_head(d, &major, &num_wakes)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    if (major != MAJOR_ARRAY) {
+        return CBOR_DECODE_UNSUPPORTED;
+    }
+    if ((rc = emit(d, "[")) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    for (uint64_t i = 0; i < num_wakes; i++) {
+        if ((rc = read_head(d, &major, &num_values)) != CBOR_DECODE_OK) {
+            return rc;
+        }
+        if (major != MAJOR_ARRAY) {
+            return CBOR_DECODE_UNSUPPORTED;
+        }
+        if ((rc = emit(d, i > 0 ? ",[" : "[")) != CBOR_DECODE_OK) {
+            return rc;
+        }
+        for (uint64_t j = 0; j < num_values; j++) {
+            if (j > 0 && (rc = emit(d, ",")) != CBOR_DECODE_OK) {
+                return rc;
+            }
+            if ((rc = decode_value(d)) != CBOR_DECODE_OK) {
+                return rc;
+            }
+        }
+        if ((rc = emit(d, "]")) != CBOR_DECODE_OK) {
+            return rc;
+        }
+    }
+    return emit(d, "]");
+}
+
+/**
+ * Decodes a map of field id to value. Key 0 holds the samples array at the top level and the age within a sample,
+ * key 255 the phase timings.
+ */
+static int decode_reading(struct decoder *d, bool is_sample) {
+    uint8_t major;
+    uint64_t num_pairs;
+    uint64_t key;
+    int rc;
+
+    if ((rc = read_head(d, &major, &num_pairs)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    if (major != MAJOR_MAP) {
+        return CBOR_DECODE_UNSUPPORTED;
+    }
+    if ((rc = emit(d, "{")) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    for (uint64_t i = 0; i < num_pairs; i++) {
+        if (i > 0 && (rc = emit(d, ",")) != CBOR_DECODE_OK) {
+            return rc;
+        }
+        if ((rc = read_head(d, &major, &key)) != CBOR_DECODE_OK) {
+            return rc;
+        }
+        if (major != MAJOR_UINT) {
+            return CBOR_DECODE_UNSUPPORTED;
+        }
+
+        if (key == CBOR_SAMPLE_AGE_KEY && is_sample) {
+            rc = emit(d, "\"age\":");
+            rc = rc == CBOR_DECODE_OK ? decode_value(d) : rc;
+        } else if (key == CBOR_PHASES_KEY && !is_sample) {
+            rc = emit(d, "\"phases\":");
+            rc = rc == CBOR_DECODE_OK ? decode_phases(d) : rc;
+        } else if (key == CBOR_SAMPLES_KEY) {
+            rc = emit(d, "\"samples\":");
+            rc = rc == CBOR_DECODE_OK ? decode_samples(d) : rc;
+        } else if (key < NUM_FIELD_IDS && field_names[key] != NULL) {
+            rc = emit(d, "\"%s\":", field_names[key]);
+            rc = rc == CBOR_DECODE_OK ? decode_value(d) : rc;
+        } else {
+            rc = CBOR_DECODE_UNKNOWN_FIELD;
+        }
+        if (rc != CBOR_DECODE_OK) {
+            return rc;
+        }
+    }
+    return emit(d, "}");
+}
+
+int volf_cbor_to_json(const uint8_t *cbor, size_t len, char *json, size_t json_size) {
+    struct decoder d = {cbor, len, 0, json, json_size, 0};
+    int rc;
+
+    if (json_size == 0) {
+        return CBOR_DECODE_OUTPUT_FULL;
+    }
+    json[0] = '\0';
+    if ((rc = emit(&d, "{\"state\":{\"reported\":")) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    if ((rc = decode_reading(&d, false)) != CBOR_DECODE_OK) {
+        return rc;
+    }
+    return emit(&d, "}}");
+}
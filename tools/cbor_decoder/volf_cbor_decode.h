@@ -0,0 +1,23 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef VOLF_CBOR_DECODE_H
+#define VOLF_CBOR_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CBOR_DECODE_OK 0
+#define CBOR_DECODE_TRUNCATED -1
+#define CBOR_DECODE_UNSUPPORTED -2
+#define CBOR_DECODE_UNKNOWN_FIELD -3
+#define CBOR_DECODE_OUTPUT_FULL -4
+
+/**
+ * Converts a CBOR telemetry payload published by the sensor back into the JSON shadow document it would have sent,
+ * {"state": {"reported": {...}}}, written as a NUL terminated string into json. Returns CBOR_DECODE_OK or one of the
+ * CBOR_DECODE_* errors.
+ */
+int volf_cbor_to_json(const uint8_t *cbor, size_t len, char *json, size_t json_size);
+
+#endif //VOLF_CBOR_DECODE_H
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+# © Christopher Morrissey <cmorriss@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-only
+
+"""
+Makes the firmware patches applied by main/volf_patch.c, either a delta from the firmware a sensor runs or a
+compressed full image for sensors the delta doesn't apply to. See main/volf_patch.h for the format.
+
+Put the patches next to the full images on the update server, named as main/volf_ota_update.c asks for them:
+
+    volf_delta_gen.py --from iot_wifi_sensor_v12.bin iot_wifi_sensor_v13.bin iot_wifi_sensor_v13_from_v12.vdlt
+    volf_delta_gen.py iot_wifi_sensor_v13.bin iot_wifi_sensor_v13.vdlt
+
+Every patch is applied back onto the source after writing it, to check it reproduces the image.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+# Must match main/volf_patch.h.
+MAGIC = b"VDLT"
+FORMAT_VERSION = 1
+TYPE_FULL = 0
+TYPE_DELTA = 1
+HEADER_FORMAT = "<4sBBHI32sI32s"
+CHUNK_HEADER_FORMAT = "<HH"
+CHUNK_SIZE = 4096
+OP_COPY = 1
+OP_INSERT = 2
+COPY_FORMAT = "<BII"
+INSERT_FORMAT = "<BH"
+
+# Matching.
+BLOCK = 16
+MIN_COPY = 24
+MAX_CANDIDATES = 8
+
+# Must match main/volf_lz.c.
+LZ_MIN_MATCH = 4
+LZ_HASH_BITS = 10
+LZ_LAST_LITERALS = 5
+LZ_MATCH_FIND_LIMIT = 12
+LZ_MAX_OFFSET = 65535
+
+
+def image_sha256(image):
+    """The digest ESP-IDF appends to an image, which esp_partition_get_sha256() returns for an app partition."""
+    digest = hashlib.sha256(image[:-32]).digest()
+    if digest != image[-32:]:
+        sys.exit("The image has no appended SHA-256, build it with the default image hash settings.")
+    return digest
+
+
+def lz_write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz_write_sequence(out, literals, offset, match_len):
+    literal_len = len(literals)
+    match_code = match_len - LZ_MIN_MATCH if match_len else 0
+    out.append((min(literal_len, 15) << 4) | (min(match_code, 15) if match_len else 0))
+    if literal_len >= 15:
+        lz_write_length(out, literal_len - 15)
+    out += literals
+    if match_len:
+        out += struct.pack("<H", offset)
+        if match_code >= 15:
+            lz_write_length(out, match_code - 15)
+
+
+def lz_compress(src):
+    """Same algorithm as volf_lz_compress(), in the LZ4 block format."""
+    table = [0] * (1 << LZ_HASH_BITS)
+    out = bytearray()
+    ip = 0
+    anchor = 0
+    while len(src) > LZ_MATCH_FIND_LIMIT and ip < len(src) - LZ_MATCH_FIND_LIMIT:
+        value = struct.unpack_from("<I", src, ip)[0]
+        h = ((value * 2654435761) & 0xFFFFFFFF) >> (32 - LZ_HASH_BITS)
+        ref = table[h]
+        table[h] = ip
+        if ref >= ip or ip - ref > LZ_MAX_OFFSET or src[ref:ref + 4] != src[ip:ip + 4]:
+            ip += 1
+            continue
+        match_len = LZ_MIN_MATCH
+        while ip + match_len < len(src) - LZ_LAST_LITERALS and src[ref + match_len] == src[ip + match_len]:
+            match_len += 1
+        lz_write_sequence(out, src[anchor:ip], ip - ref, match_len)
+        ip += match_len
+        anchor = ip
+    lz_write_sequence(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+
+def lz_read_length(data, ip, length):
+    while True:
+        byte = data[ip]
+        ip += 1
+        length += byte
+        if byte != 255:
+            return ip, length
+
+
+def lz_decompress(data):
+    out = bytearray()
+    ip = 0
+    while ip < len(data):
+        token = data[ip]
+        ip += 1
+        length = token >> 4
+        if length == 15:
+            ip, length = lz_read_length(data, ip, length)
+        out += data[ip:ip + length]
+        ip += length
+        if ip >= len(data):
+            break
+        offset = data[ip] | data[ip + 1] << 8
+        ip += 2
+        length = token & 15
+        if length == 15:
+            ip, length = lz_read_length(data, ip, length)
+        for _ in range(length + LZ_MIN_MATCH):
+            out.append(out[-offset])
+    return bytes(out)
+
+
+def index_source(source):
+    index = {}
+    for pos in range(0, len(source) - BLOCK + 1):
+        candidates = index.setdefault(source[pos:pos + BLOCK], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(pos)
+    return index
+
+
+def match_length(source, src_pos, target, tgt_pos):
+    """Length of the common run, compared in slices before narrowing down byte by byte."""
+    length = 0
+    step = 256
+    limit = min(len(source) - src_pos, len(target) - tgt_pos)
+    while step > 0:
+        while length + step <= limit and \
+                source[src_pos + length:src_pos + length + step] == target[tgt_pos + length:tgt_pos + length + step]:
+            length += step
+        step //= 4
+    return length
+
+
+def diff(source, target):
+    """Returns COPY (source offset, length) and INSERT (bytes) operations that turn source into target."""
+    index = index_source(source)
+    ops = []
+    insert = bytearray()
+    pos = 0
+    next_source = 0
+
+    while pos < len(target):
+        best_len = 0
+        best_src = 0
+        # Code that didn't move usually continues where the last copy ended.
+        candidates = [next_source] + index.get(target[pos:pos + BLOCK], [])
+        for src in candidates:
+            length = match_length(source, src, target, pos)
+            if length > best_len:
+                best_len, best_src = length, src
+        if best_len < MIN_COPY:
+            insert.append(target[pos])
+            pos += 1
+            continue
+        if insert:
+            ops.append(bytes(insert))
+            insert = bytearray()
+        ops.append((best_src, best_len))
+        pos += best_len
+        next_source = best_src + best_len
+    if insert:
+        ops.append(bytes(insert))
+    return ops
+
+
+def encode_ops(ops, chunk_size):
+    """Serializes the operations into chunks of whole operations, splitting inserts to fit."""
+    chunks = []
+    chunk = bytearray()
+    max_insert = chunk_size - struct.calcsize(INSERT_FORMAT)
+
+    def add(encoded):
+        nonlocal chunk
+        if len(chunk) + len(encoded) > chunk_size:
+            chunks.append(bytes(chunk))
+            chunk = bytearray()
+        chunk += encoded
+
+    for op in ops:
+        if isinstance(op, tuple):
+            add(struct.pack(COPY_FORMAT, OP_COPY, op[0], op[1]))
+            continue
+        for start in range(0, len(op), max_insert):
+            part = op[start:start + max_insert]
+            room = chunk_size - len(chunk) - struct.calcsize(INSERT_FORMAT)
+            if 0 < room < len(part):
+                add(struct.pack(INSERT_FORMAT, OP_INSERT, room) + part[:room])
+                part = part[room:]
+            add(struct.pack(INSERT_FORMAT, OP_INSERT, len(part)) + part)
+    if chunk:
+        chunks.append(bytes(chunk))
+    return chunks
+
+
+def make_patch(source, target):
+    patch_type = TYPE_DELTA if source is not None else TYPE_FULL
+    ops = diff(source, target) if source is not None else [target]
+    header = struct.pack(HEADER_FORMAT, MAGIC, FORMAT_VERSION, patch_type, CHUNK_SIZE,
+                         len(source) if source is not None else 0,
+                         image_sha256(source) if source is not None else bytes(32),
+                         len(target), image_sha256(target))
+    out = bytearray(header)
+    for chunk in encode_ops(ops, CHUNK_SIZE):
+        compressed = lz_compress(chunk)
+        out += struct.pack(CHUNK_HEADER_FORMAT, len(chunk), len(compressed)) + compressed
+    return bytes(out), ops
+
+
+def apply_patch(source, patch):
+    """Applies a patch the way main/volf_patch.c does, to check it."""
+    header_size = struct.calcsize(HEADER_FORMAT)
+    magic, version, patch_type, chunk_size, source_size, _, target_size, _ = \
+        struct.unpack_from(HEADER_FORMAT, patch)
+    if magic != MAGIC or version != FORMAT_VERSION:
+        raise ValueError("not a patch")
+    target = bytearray()
+    pos = header_size
+    while pos < len(patch):
+        raw_len, compressed_len = struct.unpack_from(CHUNK_HEADER_FORMAT, patch, pos)
+        pos += struct.calcsize(CHUNK_HEADER_FORMAT)
+        raw = lz_decompress(patch[pos:pos + compressed_len])
+        pos += compressed_len
+        if len(raw) != raw_len or raw_len > chunk_size:
+            raise ValueError("corrupt chunk")
+        op_pos = 0
+        while op_pos < len(raw):
+            if raw[op_pos] == OP_COPY:
+                _, offset, length = struct.unpack_from(COPY_FORMAT, raw, op_pos)
+                target += source[offset:offset + length]
+                op_pos += struct.calcsize(COPY_FORMAT)
+            else:
+                _, length = struct.unpack_from(INSERT_FORMAT, raw, op_pos)
+                op_pos += struct.calcsize(INSERT_FORMAT)
+                target += raw[op_pos:op_pos + length]
+                op_pos += length
+    if len(target) != target_size:
+        raise ValueError("patch wrote %d bytes, expected %d" % (len(target), target_size))
+    return bytes(target)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Makes firmware patches for delta OTA updates.")
+    parser.add_argument("--from", dest="source", help="image the sensors run, omit for a compressed full image")
+    parser.add_argument("target", help="new image")
+    parser.add_argument("output", help="patch to write")
+    args = parser.parse_args()
+
+    source = open(args.source, "rb").read() if args.source else None
+    target = open(args.target, "rb").read()
+    patch, ops = make_patch(source, target)
+    if apply_patch(source, patch) != target:
+        sys.exit("The patch doesn't reproduce the image, not writing it.")
+    with open(args.output, "wb") as f:
+        f.write(patch)
+
+    copied = sum(op[1] for op in ops if isinstance(op, tuple))
+    print("%s: %d bytes, %.1f%% of the %d byte image, %d bytes copied from the running image."
+          % (args.output, len(patch), 100.0 * len(patch) / len(target), len(target), copied))
+
+
+if __name__ == "__main__":
+    main()
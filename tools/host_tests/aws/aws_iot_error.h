@@ -0,0 +1,22 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef AWS_IOT_ERROR_H
+#define AWS_IOT_ERROR_H
+
+/** The return codes of the AWS IoT SDK that the firmware's network code returns, with the SDK's values. */
+typedef enum {
+    SUCCESS = 0,
+    FAILURE = -1,
+    NULL_VALUE_ERROR = -2,
+    SSL_CONNECTION_ERROR = -4,
+    NETWORK_MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED = -16,
+    NETWORK_X509_ROOT_CRT_PARSE_ERROR = -19,
+    NETWORK_X509_DEVICE_CRT_PARSE_ERROR = -20,
+    NETWORK_PK_PRIVATE_KEY_PARSE_ERROR = -21,
+    NETWORK_ERR_NET_SOCKET_FAILED = -22,
+    NETWORK_ERR_NET_UNKNOWN_HOST = -23,
+    NETWORK_ERR_NET_CONNECT_FAILED = -24,
+} IoT_Error_t;
+
+#endif //AWS_IOT_ERROR_H
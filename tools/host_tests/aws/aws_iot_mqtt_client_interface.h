@@ -0,0 +1,14 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef AWS_IOT_MQTT_CLIENT_INTERFACE_H
+#define AWS_IOT_MQTT_CLIENT_INTERFACE_H
+
+#include "network_interface.h"
+
+/** The MQTT client of the AWS IoT SDK, only its network stack. */
+typedef struct {
+    Network networkStack;
+} AWS_IoT_Client;
+
+#endif //AWS_IOT_MQTT_CLIENT_INTERFACE_H
@@ -0,0 +1,51 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef NETWORK_INTERFACE_H
+#define NETWORK_INTERFACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "aws_iot_error.h"
+
+/**
+ * The network layer of the AWS IoT SDK with the TLSDataParams of its ESP-IDF port, down to the members the firmware
+ * uses. The certificates and key are PEM strings, as the port takes them.
+ */
+typedef struct {
+    const char *pRootCALocation;
+    const char *pDeviceCertLocation;
+    const char *pDevicePrivateKeyLocation;
+    const char *pDestinationURL;
+    uint16_t DestinationPort;
+    uint32_t timeout_ms;
+    bool ServerVerificationFlag;
+} TLSConnectParams;
+
+typedef struct {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    uint32_t flags;
+    mbedtls_x509_crt cacert;
+    mbedtls_x509_crt clicert;
+    mbedtls_pk_context pkey;
+    mbedtls_net_context server_fd;
+} TLSDataParams;
+
+typedef struct Network Network;
+
+struct Network {
+    IoT_Error_t (*connect)(Network *network, TLSConnectParams *params);
+    TLSConnectParams tlsConnectParams;
+    TLSDataParams tlsDataParams;
+};
+
+#endif //NETWORK_INTERFACE_H
@@ -0,0 +1,134 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "idf_shim.h"
+#include "volf_crash_log.h"
+#include "volf_error.h"
+#include "volf_journal.h"
+#include "volf_log.h"
+
+/**
+ * Times appending to and loading the error journal, on the errlog partition and in the NVS blob used without it, and
+ * counts the flash written per error through volf_handle_error() and volf_flush_errors() for wakes with a few errors.
+ * The flash and NVS are in memory, so the times are the journal's own cost, its CRCs and copies, not the flash's. NVS
+ * bytes are the blob sizes set, NVS adds its own entry headers on top.
+ */
+
+#define JOURNAL_PARTITION_LABEL "errlog"
+#define APPENDS 100000
+#define NVS_APPENDS 10000
+#define LOADS 10000
+#define WAKES 1000
+#define BATCH_SIZE 12
+
+static int loaded_records;
+
+void volf_log_write(esp_log_level_t level, volf_log_module_t module, const char *format, ...) {
+    (void) level;
+    (void) module;
+    (void) format;
+}
+
+void volf_crash_log_mark_failed(void) {
+}
+
+static void count_record(const struct volf_journal_record *record) {
+    (void) record;
+    loaded_records++;
+}
+
+static void fill_record(struct volf_journal_record *record, uint32_t i) {
+    memset(record, 0, sizeof(*record));
+    record->type = JOURNAL_RECORD_CONTEXT;
+    record->error = CONTINUE;
+    record->log = 1;
+    record->attempt = 1;
+    record->runtime = i;
+    snprintf(record->context, sizeof(record->context), "esp_wifi_connect(%u)", (unsigned) i);
+}
+
+static void bench_append(const char *backend, int appends, size_t batch_size) {
+    struct volf_journal_record records[BATCH_SIZE];
+    long long start;
+    long long elapsed;
+    uint32_t bytes;
+
+    appends -= appends % (int) batch_size;
+    loaded_records = 0;
+    volf_journal_load(count_record);
+    memset(&shim_flash_stats, 0, sizeof(shim_flash_stats));
+    start = host_test_now_ns();
+    for (int i = 0; i < appends; i += (int) batch_size) {
+        for (size_t j = 0; j < batch_size; j++) {
+            fill_record(&records[j], (uint32_t) (i + j));
+        }
+        volf_journal_append(records, batch_size);
+    }
+    elapsed = host_test_now_ns() - start;
+    bytes = shim_flash_stats.bytes_written + shim_flash_stats.nvs_bytes_written;
+    printf("%-9s append %2d at a time %8.0f records/s  %6.1f bytes written per record  %5.2f erases per 100\n",
+           backend, (int) batch_size, appends * 1e9 / elapsed, (double) bytes / appends,
+           100.0 * shim_flash_stats.sectors_erased / appends);
+}
+
+static void bench_load(const char *backend) {
+    long long start;
+    long long elapsed;
+    int records;
+
+    loaded_records = 0;
+    volf_journal_load(count_record);
+    records = loaded_records;
+    start = host_test_now_ns();
+    for (int i = 0; i < LOADS; i++) {
+        volf_journal_load(count_record);
+    }
+    elapsed = host_test_now_ns() - start;
+    printf("%-9s load %d records    %8.0f records/s  %8.1f us per load\n", backend, records,
+           (double) records * LOADS * 1e9 / elapsed, elapsed / 1e3 / LOADS);
+}
+
+/** Wakes with errors_per_wake CONTINUE errors each, flushed before sleeping as main.c does. */
+static void bench_errors(const char *backend, int errors_per_wake) {
+    uint32_t bytes;
+
+    memset(&shim_flash_stats, 0, sizeof(shim_flash_stats));
+    for (int wake = 0; wake < WAKES; wake++) {
+        volf_error_init();
+        for (int i = 0; i < errors_per_wake; i++) {
+            volf_handle_error(CONTINUE, "esp_wifi_connect", 0x3004 + i);
+        }
+        volf_flush_errors();
+        if (wake % 3 == 2) {
+            // Every third wake publishes and clears the errors, keeping the journal short.
+            volf_clear_errors();
+            volf_flush_errors();
+        }
+    }
+    bytes = shim_flash_stats.bytes_written + shim_flash_stats.nvs_bytes_written;
+    printf("%-9s %d errors per wake  %6.1f bytes written per error  %5.2f erases per 100 errors\n", backend,
+           errors_per_wake, (double) bytes / (WAKES * errors_per_wake),
+           100.0 * shim_flash_stats.sectors_erased / (WAKES * errors_per_wake));
+}
+
+static void run(const char *backend, bool partition) {
+    shim_reset();
+    if (!partition) {
+        shim_hide_partition(JOURNAL_PARTITION_LABEL);
+    }
+    bench_append(backend, partition ? APPENDS : NVS_APPENDS, 1);
+    bench_append(backend, partition ? APPENDS : NVS_APPENDS, BATCH_SIZE);
+    bench_load(backend);
+    for (int errors_per_wake = 1; errors_per_wake <= MAX_CONTINUE_CONTEXTS; errors_per_wake += 2) {
+        bench_errors(backend, errors_per_wake);
+    }
+}
+
+int main() {
+    run("partition", true);
+    run("nvs", false);
+    return 0;
+}
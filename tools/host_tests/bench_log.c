@@ -0,0 +1,105 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "volf_crash_log.h"
+#include "volf_log.h"
+
+/**
+ * Times a LOGI call on the hot path: dropped by its module's level, formatted as text into the ring buffer and
+ * encoded as a binary entry, against formatting and writing synchronously with a malloc'ed format string as
+ * volf_log_write() used to. The drain, which runs in a low priority task on the device, is timed apart. The log goes
+ * to /dev/null, the results to the original stdout.
+ */
+
+#define CALLS 1000000
+/* Calls between drains, few enough that the ring never fills and drops entries. */
+#define BATCH 32
+
+static FILE *out;
+
+void volf_crash_log_init(void) {
+}
+
+void volf_crash_log_append(const uint8_t *entry, size_t len, bool binary) {
+    (void) entry;
+    (void) len;
+    (void) binary;
+}
+
+/** volf_log_write() before the ring buffer, with esp_log_writev() writing the line out right away. */
+static void old_log_write(const char *format, ...) {
+    va_list args;
+    char runtime_str[12];
+    char *new_format;
+
+    va_start(args, format);
+    sprintf(runtime_str, "%d", (int) (host_test_now_ns() / 1000000));
+    new_format = malloc(strlen(runtime_str) + strlen(format) + 4);
+    sprintf(new_format, "(%s) %s", runtime_str, format);
+    vprintf(new_format, args);
+    va_end(args);
+    free(new_format);
+}
+
+static void report(const char *name, long long call_ns, long long drain_ns) {
+    fprintf(out, "%-32s %7.1f ns per call", name, (double) call_ns / CALLS);
+    if (drain_ns >= 0) {
+        fprintf(out, "  %7.1f ns per entry drained", (double) drain_ns / CALLS);
+    }
+    fprintf(out, "\n");
+}
+
+static void bench_ring(const char *name) {
+    long long call_ns = 0;
+    long long drain_ns = 0;
+    long long start;
+
+    for (int i = 0; i < CALLS; i += BATCH) {
+        start = host_test_now_ns();
+        for (int j = i; j < i + BATCH; j++) {
+            LOGI("Connected in %d ms (fast connect %s), rssi %d.", j, "used", -62);
+        }
+        call_ns += host_test_now_ns() - start;
+        start = host_test_now_ns();
+        volf_log_flush();
+        drain_ns += host_test_now_ns() - start;
+    }
+    report(name, call_ns, drain_ns);
+}
+
+int main() {
+    long long start;
+
+    // The log itself goes nowhere, the results to the original stdout.
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+
+    volf_log_set_level(LOG_MODULE_MAIN, ESP_LOG_WARN);
+    start = host_test_now_ns();
+    for (int i = 0; i < CALLS; i++) {
+        LOGI("Connected in %d ms (fast connect %s), rssi %d.", i, "used", -62);
+    }
+    report("filtered by level", host_test_now_ns() - start, -1);
+
+    volf_log_set_level(LOG_MODULE_MAIN, ESP_LOG_INFO);
+    bench_ring("ring buffer, text");
+    volf_log_set_binary(true);
+    bench_ring("ring buffer, binary");
+    volf_log_set_binary(false);
+
+    start = host_test_now_ns();
+    for (int i = 0; i < CALLS; i++) {
+        old_log_write(FORMAT_LOG_MSG("Connected in %d ms (fast connect %s), rssi %d.\n", I), i, "used", -62);
+    }
+    report("malloc and vprintf (before)", host_test_now_ns() - start, -1);
+    fclose(out);
+    return 0;
+}
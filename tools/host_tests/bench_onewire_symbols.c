@@ -0,0 +1,103 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "host_test.h"
+#include "onewire_bus.h"
+#include "onewire_symbols.h"
+
+/**
+ * Compares reading a DS18B20 scratchpad (reset, SKIP ROM, READ SCRATCHPAD and 9 bytes) through the RMT items with the
+ * busy-wait driver it replaced, and times encoding and decoding the items on the host. Only the host times are
+ * measured. The busy-wait figures are estimates summed from the driver's delays, the RMT bus time is summed from the
+ * encoded items, and no interrupts are masked for the RMT by design, none of them are device measurements.
+ */
+
+#define SKIP_ROM 0xCC
+#define READ_SCRATCHPAD 0xBE
+#define SCRATCHPAD_SIZE 9
+#define NUM_SLOTS (16 + 8 * SCRATCHPAD_SIZE)
+#define ITERATIONS 200000
+
+/* The ets_delay_us() calls of the busy-wait driver, interrupts were masked for the slot and reset delays. */
+#define BUSY_RESET_US (480 + 70 + 410)
+#define BUSY_SLOT_US 70
+#define BUSY_BYTE_WRITE_GAP_US 100
+#define BUSY_BIT_READ_GAP_US 15
+
+static size_t encode_transaction(uint32_t *tx) {
+    const uint8_t commands[2] = {SKIP_ROM, READ_SCRATCHPAD};
+    uint8_t read_slots[SCRATCHPAD_SIZE];
+    size_t num_tx = 0;
+
+    memset(read_slots, 0xFF, sizeof(read_slots));
+    num_tx += onewire_encode_reset(tx + num_tx);
+    num_tx += onewire_encode_bits(commands, 16, tx + num_tx);
+    num_tx += onewire_encode_bits(read_slots, 8 * SCRATCHPAD_SIZE, tx + num_tx);
+    return num_tx;
+}
+
+static uint32_t bus_time_us(const uint32_t *items, size_t num_items) {
+    uint32_t total = 0;
+
+    for (size_t i = 0; i < num_items; i++) {
+        total += (items[i] & 0x7FFF) + ((items[i] >> 16) & 0x7FFF);
+    }
+    return total;
+}
+
+int main() {
+    static const uint8_t scratchpad[SCRATCHPAD_SIZE] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x1C};
+    uint32_t tx[1 + NUM_SLOTS];
+    uint32_t rx[2 + NUM_SLOTS + 1];
+    uint8_t commands[2];
+    uint8_t received[SCRATCHPAD_SIZE];
+    struct onewire_decoder decoder;
+    struct onewire_bus bus = {
+            .present = true,
+            .presence_us = 120,
+            .command_slots = 16,
+            .device_bits = scratchpad,
+            .num_device_bits = 8 * SCRATCHPAD_SIZE,
+    };
+    size_t num_tx = encode_transaction(tx);
+    size_t num_rx = bus_respond(&bus, tx, num_tx, rx);
+    uint32_t busy_masked_us = BUSY_RESET_US + NUM_SLOTS * BUSY_SLOT_US;
+    uint32_t busy_cpu_us = busy_masked_us + 2 * BUSY_BYTE_WRITE_GAP_US
+                           + 8 * SCRATCHPAD_SIZE * BUSY_BIT_READ_GAP_US;
+    long long encode_ns = 0;
+    long long decode_ns = 0;
+    long long start;
+    bool presence;
+    int failures = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        start = host_test_now_ns();
+        encode_transaction(tx);
+        encode_ns += host_test_now_ns() - start;
+
+        start = host_test_now_ns();
+        onewire_decoder_init(&decoder, rx, num_rx);
+        if (!onewire_decode_reset(&decoder, &presence) || !onewire_decode_bits(&decoder, commands, 16)
+            || !onewire_decode_bits(&decoder, received, 8 * SCRATCHPAD_SIZE)) {
+            failures++;
+        }
+        decode_ns += host_test_now_ns() - start;
+    }
+    if (failures > 0 || !presence || memcmp(received, scratchpad, sizeof(scratchpad)) != 0) {
+        fprintf(stderr, "bench_onewire_symbols: the transaction didn't decode\n");
+        return 1;
+    }
+
+    printf("Scratchpad read, %zu items sent, %zu received\n", num_tx, num_rx);
+    printf("                      bus time    CPU busy     interrupts masked\n");
+    printf("  busy-wait driver    %6u us*  %6u us*    %6u us*\n", busy_cpu_us, busy_cpu_us, busy_masked_us);
+    printf("  RMT items           %6u us*  %6.2f us**   none***\n", bus_time_us(tx, num_tx),
+           (double) (encode_ns + decode_ns) / ITERATIONS / 1000);
+    printf("  encode %.0f ns, decode %.0f ns per transaction on the host\n", (double) encode_ns / ITERATIONS,
+           (double) decode_ns / ITERATIONS);
+    printf("  *   estimated, the busy-wait driver's ets_delay_us() calls or the RMT item durations, not measured\n");
+    printf("  **  measured, host encode + decode, the RMT sends and receives the items without the CPU\n");
+    printf("  *** by design, the RMT driver doesn't mask interrupts, not measured on a device\n");
+    return 0;
+}
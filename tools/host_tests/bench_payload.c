@@ -0,0 +1,382 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cJSON.h"
+#include "host_test.h"
+#include "iot_wifi_sensor.h"
+#include "volf_batch.h"
+#include "volf_payload.h"
+#include "volf_profile.h"
+
+/**
+ * Compares the size, encode time and heap use of the reported shadow documents as a cJSON tree, printed formatted as
+ * the sensor payload used to be and unformatted, with create_sensor_payload() and create_telemetry_payload(), which
+ * now split the same content between the shadow and the telemetry topic, and create_error_log_payload() writing into
+ * a fixed buffer, and with the CBOR encoding of create_sensor_payload_cbor(). Measured for a single reading, for one
+ * with a full batch of samples and the phase timings of the wakes since the last publish, and for the error logs.
+ *
+ * malloc, realloc and free are wrapped by the linker, so every allocation on the way is counted, cJSON's and any
+ * the firmware modules would make. Needs the cJSON sources of ESP-IDF, set CJSON_DIR if IDF_PATH isn't set.
+ */
+
+#define ITERATIONS 20000
+#define PAYLOAD_SIZE 8192
+
+static struct sensor_config config;
+static struct volf_profile_wake wakes[PROFILE_HISTORY_SIZE];
+static uint8_t num_wakes = 0;
+static struct volf_errors errors;
+
+static int allocations;
+static size_t heap_used;
+static size_t heap_peak;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void count_allocation(void *ptr) {
+    if (ptr != NULL) {
+        allocations++;
+        heap_used += malloc_usable_size(ptr);
+        if (heap_used > heap_peak) {
+            heap_peak = heap_used;
+        }
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+
+    count_allocation(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    heap_used -= ptr != NULL ? malloc_usable_size(ptr) : 0;
+    ptr = __real_realloc(ptr, size);
+    count_allocation(ptr);
+    return ptr;
+}
+
+void __wrap_free(void *ptr) {
+    heap_used -= ptr != NULL ? malloc_usable_size(ptr) : 0;
+    __real_free(ptr);
+}
+
+void volf_log_write(esp_log_level_t level, volf_log_module_t module, const char *format, ...) {
+    (void) level;
+    (void) module;
+    (void) format;
+}
+
+/* The sensors are read by the firmware only, the readings here are made up. */
+uint32_t read_battery_voltage() {
+    return 3950;
+}
+
+uint32_t convert_battery_voltage_to_pct(uint32_t voltage, uint32_t low_voltage, uint32_t high_voltage) {
+    return (voltage - low_voltage) * 100 / (high_voltage - low_voltage);
+}
+
+uint32_t read_soil_moisture_voltage() {
+    return 1712;
+}
+
+uint32_t convert_moisture_voltage_to_pct(uint32_t voltage, uint32_t low_voltage, uint32_t high_voltage) {
+    return (high_voltage - voltage) * 100 / (high_voltage - low_voltage);
+}
+
+uint8_t read_temperatures(uint8_t resolution, float temps[MAX_TEMPERATURE_PROBES]) {
+    (void) resolution;
+    temps[0] = 68.7f;
+    temps[1] = 71.2f;
+    return 2;
+}
+
+void read_ac_currents(uint8_t adc_channels, uint32_t currents[ADC1_CHANNEL_MAX]) {
+    (void) adc_channels;
+    memset(currents, 0, ADC1_CHANNEL_MAX * sizeof(currents[0]));
+}
+
+void sht40_read_humidity_and_temperature(float *humidity, float *temperature) {
+    *humidity = 48.3f;
+    *temperature = 69.1f;
+}
+
+/* Phase timings of a typical wake instead of volf_profile.c, which times the host. */
+void volf_profile_begin(profile_phase_t phase) {
+    (void) phase;
+}
+
+void volf_profile_end(profile_phase_t phase) {
+    (void) phase;
+}
+
+uint8_t volf_profile_count() {
+    return num_wakes;
+}
+
+const struct volf_profile_wake *volf_profile_get(uint8_t index) {
+    return &wakes[index];
+}
+
+static void add_reading_to_cjson(cJSON *object, const struct sensor_reading *reading, bool sampled_only) {
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        if (!reading_has(reading, field) || (sampled_only && !reading_fields[field].sampled)) {
+            continue;
+        }
+        if (reading_fields[field].type == FIELD_TYPE_BOOL) {
+            cJSON_AddBoolToObject(object, reading_fields[field].name, reading->values[field] != 0);
+        } else {
+            cJSON_AddNumberToObject(object, reading_fields[field].name, reading->values[field]);
+        }
+    }
+}
+
+/** The single document the firmware used to report, built as a cJSON tree and printed the way it used to. */
+static char *create_cjson_payload(const struct sensor_reading *reading, bool formatted) {
+    cJSON *payload = cJSON_CreateObject();
+    cJSON *reported = cJSON_AddObjectToObject(cJSON_AddObjectToObject(payload, "state"), "reported");
+    cJSON *samples;
+    cJSON *sample;
+    cJSON *phases;
+    cJSON *phase;
+    const struct sensor_reading *batched;
+    const struct volf_profile_wake *wake;
+    char *printed;
+
+    add_reading_to_cjson(reported, reading, false);
+    if (volf_batch_count() > 0) {
+        samples = cJSON_AddArrayToObject(reported, "samples");
+        for (uint8_t i = 0; i < volf_batch_count(); i++) {
+            batched = volf_batch_get(i);
+            sample = cJSON_CreateObject();
+            cJSON_AddNumberToObject(sample, "age", (uint32_t) time(NULL) - batched->timestamp);
+            add_reading_to_cjson(sample, batched, true);
+            cJSON_AddItemToArray(samples, sample);
+        }
+    }
+    if (volf_profile_count() > 0) {
+        phases = cJSON_AddArrayToObject(reported, "phases");
+        for (uint8_t i = 0; i < volf_profile_count(); i++) {
+            wake = volf_profile_get(i);
+            phase = cJSON_CreateArray();
+            cJSON_AddItemToArray(phase, cJSON_CreateNumber(wake->wake));
+            cJSON_AddItemToArray(phase, cJSON_CreateNumber(wake->rssi));
+            cJSON_AddItemToArray(phase, cJSON_CreateNumber(wake->reconnects));
+            for (int p = 0; p < NUM_PROFILE_PHASES; p++) {
+                cJSON_AddItemToArray(phase, cJSON_CreateNumber(wake->start_us[p]));
+                cJSON_AddItemToArray(phase, cJSON_CreateNumber(wake->duration_us[p]));
+            }
+            cJSON_AddItemToArray(phases, phase);
+        }
+    }
+    printed = formatted ? cJSON_Print(payload) : cJSON_PrintUnformatted(payload);
+    cJSON_Delete(payload);
+    return printed;
+}
+
+/** convert_error_logs_to_json() as it was in main.c before create_error_log_payload(), without its NULL checks. */
+static char *create_cjson_error_log_payload(bool formatted) {
+    cJSON *payload = cJSON_CreateObject();
+    cJSON *reported = cJSON_AddObjectToObject(cJSON_AddObjectToObject(payload, "state"), "reported");
+    cJSON *error_logs = cJSON_AddArrayToObject(reported, "els");
+    cJSON *error_log;
+    cJSON *publish_attempts;
+    cJSON *publish_attempt;
+    cJSON *continue_contexts;
+    const struct volf_publish_attempt *attempt;
+    char *printed;
+
+    for (int i = 0; i < errors.num_error_logs; i++) {
+        error_log = cJSON_CreateObject();
+        cJSON_AddItemToArray(error_logs, error_log);
+        publish_attempts = cJSON_AddArrayToObject(error_log, "pas");
+        for (int j = 0; j < errors.error_logs[i].num_publish_attempts; j++) {
+            attempt = &errors.error_logs[i].publish_attempts[j];
+            publish_attempt = cJSON_CreateObject();
+            cJSON_AddItemToArray(publish_attempts, publish_attempt);
+            cJSON_AddNumberToObject(publish_attempt, "r", attempt->runtime);
+            cJSON_AddStringToObject(publish_attempt, "rc", attempt->retry_context);
+            cJSON_AddStringToObject(publish_attempt, "ac", attempt->abort_context);
+            continue_contexts = cJSON_AddArrayToObject(publish_attempt, "cc");
+            for (int k = 0; k < attempt->num_continue_contexts; k++) {
+                cJSON_AddItemToArray(continue_contexts, cJSON_CreateString(attempt->continue_contexts[k]));
+            }
+        }
+    }
+    printed = formatted ? cJSON_Print(payload) : cJSON_PrintUnformatted(payload);
+    cJSON_Delete(payload);
+    return printed;
+}
+
+/** A wake that kept failing to publish: every error log full, with a few CONTINUE errors per attempt. */
+static void fill_errors() {
+    struct volf_publish_attempt *attempt;
+
+    errors.num_error_logs = MAX_ERROR_LOGS;
+    for (int i = 0; i < MAX_ERROR_LOGS; i++) {
+        errors.error_logs[i].num_publish_attempts = MAX_PUBLISH_ATTEMPTS;
+        for (int j = 0; j < MAX_PUBLISH_ATTEMPTS; j++) {
+            attempt = &errors.error_logs[i].publish_attempts[j];
+            attempt->runtime = 4000 + 1000 * i + 10 * j;
+            strcpy(attempt->retry_context, j < MAX_PUBLISH_ATTEMPTS - 1 ? "aws_iot_shadow_connect(-28)" : "");
+            strcpy(attempt->abort_context, j == MAX_PUBLISH_ATTEMPTS - 1 ? "publish_sensor_payload(-28)" : "");
+            attempt->num_continue_contexts = 2;
+            strcpy(attempt->continue_contexts[0], "esp_wifi_connect(12308)");
+            strcpy(attempt->continue_contexts[1], "volf_tls_session_load(4354)");
+        }
+    }
+}
+
+static void take_reading(struct sensor_reading *reading) {
+    reading_init(reading);
+    read_sensors(&config, reading);
+    reading_add_config(&config, reading);
+    reading_set(reading, READING_WIFI_CONNECT_MS, 412);
+    reading_set(reading, READING_FAST_CONNECT, true);
+    reading_set(reading, READING_TLS_HANDSHAKE_MS, 236);
+    reading_set(reading, READING_TLS_RESUMED, true);
+    reading_set(reading, READING_AWAKE_MS, 1873);
+}
+
+static void report(const char *name, size_t len, long long elapsed_ns) {
+    printf("  %-22s %5d bytes  %7.2f us  %4d allocations  %6d bytes peak heap\n", name, (int) len,
+           elapsed_ns / 1e3 / ITERATIONS, allocations, (int) heap_peak);
+}
+
+static void reset_heap_counts() {
+    allocations = 0;
+    heap_used = 0;
+    heap_peak = 0;
+}
+
+/** Times ITERATIONS documents built by build, counting the allocations and peak heap of the last one. */
+static void bench_cjson(const char *name, char *(*build)(const struct sensor_reading *, bool),
+                        const struct sensor_reading *reading, bool formatted) {
+    long long start = host_test_now_ns();
+    long long elapsed;
+    size_t len;
+    char *printed;
+
+    for (int i = 1; i < ITERATIONS; i++) {
+        cJSON_free(build(reading, formatted));
+    }
+    reset_heap_counts();
+    printed = build(reading, formatted);
+    elapsed = host_test_now_ns() - start;
+    len = strlen(printed);
+    cJSON_free(printed);
+    report(name, len, elapsed);
+}
+
+static char *build_sensor_cjson(const struct sensor_reading *reading, bool formatted) {
+    return create_cjson_payload(reading, formatted);
+}
+
+static char *build_error_log_cjson(const struct sensor_reading *reading, bool formatted) {
+    (void) reading;
+    return create_cjson_error_log_payload(formatted);
+}
+
+/** Both documents of a publish, the telemetry written after the shadow update, their lengths added. */
+static size_t write_sensor_payloads(const struct sensor_reading *reading, char *buf, size_t size) {
+    size_t len = create_sensor_payload(reading, buf, size);
+
+    return len == 0 ? 0 : len + create_telemetry_payload(reading, buf + len, size - len);
+}
+
+static size_t write_error_log(const struct sensor_reading *reading, char *buf, size_t size) {
+    (void) reading;
+    return create_error_log_payload(&errors, buf, size);
+}
+
+static void bench_writer(size_t (*write)(const struct sensor_reading *, char *, size_t),
+                         const struct sensor_reading *reading) {
+    static char buf[PAYLOAD_SIZE];
+    long long start = host_test_now_ns();
+    long long elapsed;
+    size_t len;
+
+    for (int i = 1; i < ITERATIONS; i++) {
+        write(reading, buf, sizeof(buf));
+    }
+    reset_heap_counts();
+    len = write(reading, buf, sizeof(buf));
+    elapsed = host_test_now_ns() - start;
+    report("volf_json_writer", len, elapsed);
+}
+
+static void bench_cbor(const struct sensor_reading *reading) {
+    static uint8_t buf[PAYLOAD_SIZE];
+    long long start = host_test_now_ns();
+    long long elapsed;
+    size_t len;
+
+    for (int i = 1; i < ITERATIONS; i++) {
+        create_sensor_payload_cbor(&config, reading, buf, sizeof(buf));
+    }
+    reset_heap_counts();
+    len = create_sensor_payload_cbor(&config, reading, buf, sizeof(buf));
+    elapsed = host_test_now_ns() - start;
+    report("CBOR", len, elapsed);
+}
+
+static void bench(const char *name, const struct sensor_reading *reading) {
+    printf("%s\n", name);
+    bench_cjson("cJSON formatted", build_sensor_cjson, reading, true);
+    bench_cjson("cJSON unformatted", build_sensor_cjson, reading, false);
+    bench_writer(write_sensor_payloads, reading);
+    bench_cbor(reading);
+}
+
+int main() {
+    struct sensor_reading reading;
+
+    config.has_battery = true;
+    config.moisture_sensor = true;
+    config.temperature_sensor = true;
+    config.deep_sleep = true;
+    config.sleep_duration = 900;
+    config.battery_low_voltage = 3300;
+    config.battery_high_voltage = 4200;
+    config.moisture_low_voltage = 1100;
+    config.moisture_high_voltage = 2800;
+    config.temperature_resolution = 12;
+    for (int field = 0; field < NUM_READING_FIELDS; field++) {
+        config.field_precision[field] = reading_fields[field].default_precision;
+    }
+
+    take_reading(&reading);
+    bench("Single reading", &reading);
+
+    for (int i = 0; i < MAX_BATCH_SIZE; i++) {
+        take_reading(&reading);
+        reading.timestamp -= (MAX_BATCH_SIZE - i) * config.sleep_duration;
+        volf_batch_add(&reading);
+    }
+    for (int i = 0; i < PROFILE_HISTORY_SIZE; i++) {
+        wakes[i].wake = 1000 + i;
+        wakes[i].rssi = -61;
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            wakes[i].start_us[phase] = 150000 * phase;
+            wakes[i].duration_us[phase] = 80000 + 1000 * phase + i;
+        }
+    }
+    num_wakes = PROFILE_HISTORY_SIZE;
+    take_reading(&reading);
+    bench("With a full batch and phase timings", &reading);
+
+    fill_errors();
+    printf("Error logs, %d logs of %d publish attempts\n", MAX_ERROR_LOGS, MAX_PUBLISH_ATTEMPTS);
+    bench_cjson("cJSON unformatted", build_error_log_cjson, NULL, false);
+    bench_writer(write_error_log, NULL);
+    return 0;
+}
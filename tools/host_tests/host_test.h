@@ -0,0 +1,64 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Checks for the host tests. A failed check prints where it failed and the test carries on, main() returns
+ * host_test_result() so make check stops at a failing test.
+ */
+
+static int host_test_checks = 0;
+static int host_test_failures = 0;
+
+#define CHECK(cond) do { \
+    host_test_checks++; \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_INT(actual, expected) do { \
+    long long actual_ = (long long) (actual); \
+    long long expected_ = (long long) (expected); \
+    host_test_checks++; \
+    if (actual_ != expected_) { \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, expected_); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) do { \
+    double actual_ = (double) (actual); \
+    double expected_ = (double) (expected); \
+    host_test_checks++; \
+    if (actual_ < expected_ - (tolerance) || actual_ > expected_ + (tolerance)) { \
+        fprintf(stderr, "%s:%d: %s is %g, expected %g +- %g\n", __FILE__, __LINE__, #actual, actual_, expected_, \
+                (double) (tolerance)); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+static inline int host_test_result(const char *name) {
+    if (host_test_failures > 0) {
+        fprintf(stderr, "%s: %d of %d checks failed\n", name, host_test_failures, host_test_checks);
+        return 1;
+    }
+    printf("%s: %d checks passed\n", name, host_test_checks);
+    return 0;
+}
+
+/** Monotonic time in nanoseconds, for the benchmarks. */
+static inline long long host_test_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+#endif //HOST_TEST_H
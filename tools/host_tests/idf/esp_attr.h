@@ -0,0 +1,12 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+/* Plain memory on the host, it lasts as long as the test, like RTC memory lasts across restarts and deep sleep. */
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#endif //ESP_ATTR_H
@@ -0,0 +1,9 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_IMAGE_FORMAT_H
+#define ESP_IMAGE_FORMAT_H
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+#endif //ESP_IMAGE_FORMAT_H
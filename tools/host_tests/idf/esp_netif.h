@@ -0,0 +1,9 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+typedef struct esp_netif_obj esp_netif_t;
+
+#endif //ESP_NETIF_H
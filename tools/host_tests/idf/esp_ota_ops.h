@@ -0,0 +1,21 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_OTA_OPS_H
+#define ESP_OTA_OPS_H
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define ESP_ERR_OTA_BASE 0x1500
+#define ESP_ERR_OTA_VALIDATE_FAILED (ESP_ERR_OTA_BASE + 0x03)
+#define ESP_BOOTLOADER_OFFSET 0x1000
+#define ESP_PARTITION_TABLE_OFFSET 0x8000
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+
+/** Verifies the image in the partition, its magic byte and appended SHA-256, before booting from it. */
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#endif //ESP_OTA_OPS_H
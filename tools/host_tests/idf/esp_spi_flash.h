@@ -0,0 +1,9 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_SPI_FLASH_H
+#define ESP_SPI_FLASH_H
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif //ESP_SPI_FLASH_H
@@ -0,0 +1,17 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+/** Accepted and never called, the host tests don't restart through esp_restart() into a shutdown. */
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+
+/** Left to the test, which decides what a restart means for it. */
+void esp_restart(void) __attribute__((noreturn));
+
+#endif //ESP_SYSTEM_H
@@ -0,0 +1,12 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+/** Microseconds on a monotonic clock. */
+int64_t esp_timer_get_time(void);
+
+#endif //ESP_TIMER_H
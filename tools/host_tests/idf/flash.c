@@ -0,0 +1,180 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include <openssl/evp.h>
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_spi_flash.h"
+#include "idf_shim.h"
+
+#define HASH_LEN 32
+#define APP_PARTITION_SIZE 0x100000
+#define ERRLOG_PARTITION_SIZE 0x4000
+
+static const esp_partition_t partitions[] = {
+        {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x110000, APP_PARTITION_SIZE, "ota_0", false},
+        {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x210000, APP_PARTITION_SIZE, "ota_1", false},
+        {ESP_PARTITION_TYPE_DATA, 0x99, 0x310000, ERRLOG_PARTITION_SIZE, "errlog", false},
+};
+
+#define NUM_PARTITIONS (sizeof(partitions) / sizeof(partitions[0]))
+
+static uint8_t ota_0[APP_PARTITION_SIZE];
+static uint8_t ota_1[APP_PARTITION_SIZE];
+static uint8_t errlog[ERRLOG_PARTITION_SIZE];
+static uint8_t *const contents[NUM_PARTITIONS] = {ota_0, ota_1, errlog};
+
+/* The end of the image last written from the start of each partition, to find its appended SHA-256. */
+static uint32_t image_end[NUM_PARTITIONS];
+static int boot = 0;
+static bool hidden[NUM_PARTITIONS];
+
+struct shim_flash_stats shim_flash_stats;
+void (*shim_before_set_boot)(void) = NULL;
+
+static int index_of(const esp_partition_t *partition) {
+    for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+        if (partition == &partitions[i]) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+void shim_reset(void) {
+    for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+        memset(contents[i], 0xFF, partitions[i].size);
+        image_end[i] = 0;
+        hidden[i] = false;
+    }
+    shim_nvs_erase_all();
+    boot = 0;
+    shim_before_set_boot = NULL;
+    memset(&shim_flash_stats, 0, sizeof(shim_flash_stats));
+}
+
+void shim_hide_partition(const char *label) {
+    for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+        if (strcmp(partitions[i].label, label) == 0) {
+            hidden[i] = true;
+        }
+    }
+}
+
+void shim_flash_image(const esp_partition_t *partition, const uint8_t *image, size_t len) {
+    int i = index_of(partition);
+
+    memcpy(contents[i], image, len);
+    image_end[i] = len;
+}
+
+const uint8_t *shim_partition_data(const esp_partition_t *partition) {
+    return contents[index_of(partition)];
+}
+
+const esp_partition_t *shim_boot_partition(void) {
+    return &partitions[boot];
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+        if (!hidden[i] && (type == ESP_PARTITION_TYPE_ANY || partitions[i].type == type)
+            && (subtype == ESP_PARTITION_SUBTYPE_ANY || partitions[i].subtype == subtype)
+            && (label == NULL || strcmp(partitions[i].label, label) == 0)) {
+            return &partitions[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    int i = index_of(partition);
+
+    if (i < 0 || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, contents[i] + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    const uint8_t *data = src;
+    int i = index_of(partition);
+
+    if (i < 0 || dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t j = 0; j < size; j++) {
+        uint8_t *byte = &contents[i][dst_offset + j];
+
+        if ((*byte & data[j]) != data[j]) {
+            shim_flash_stats.unerased_writes++;
+        }
+        *byte &= data[j];
+    }
+    if (dst_offset + size > image_end[i]) {
+        image_end[i] = dst_offset + size;
+    }
+    shim_flash_stats.bytes_written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    int i = index_of(partition);
+
+    if (i < 0 || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(contents[i] + offset, 0xFF, size);
+    if (offset == 0) {
+        image_end[i] = 0;
+    }
+    shim_flash_stats.sectors_erased += size / SPI_FLASH_SEC_SIZE;
+    return ESP_OK;
+}
+
+/** The digest of the image, everything but the SHA-256 appended to it. */
+esp_err_t esp_partition_get_sha256(const esp_partition_t *partition, uint8_t *sha_256) {
+    int i = index_of(partition);
+
+    if (i < 0 || image_end[i] < HASH_LEN) {
+        // Like the bootloader, which isn't in a partition here.
+        memset(sha_256, 0, HASH_LEN);
+        return ESP_OK;
+    }
+    EVP_Digest(contents[i], image_end[i] - HASH_LEN, sha_256, NULL, EVP_sha256(), NULL);
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return &partitions[boot];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    (void) start_from;
+    return &partitions[boot == 0 ? 1 : 0];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    uint8_t sha_256[HASH_LEN];
+    int i = index_of(partition);
+
+    if (shim_before_set_boot != NULL) {
+        shim_before_set_boot();
+    }
+    if (i < 0 || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_partition_get_sha256(partition, sha_256);
+    if (image_end[i] <= HASH_LEN || contents[i][0] != ESP_IMAGE_HEADER_MAGIC
+        || memcmp(sha_256, contents[i] + image_end[i] - HASH_LEN, HASH_LEN) != 0) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    boot = i;
+    return ESP_OK;
+}
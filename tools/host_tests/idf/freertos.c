@@ -0,0 +1,195 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;
+};
+
+struct task_start {
+    TaskFunction_t code;
+    void *param;
+};
+
+static void *run_task(void *param) {
+    struct task_start start = *(struct task_start *) param;
+
+    free(param);
+    start.code(start.param);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id) {
+    struct task_start *start = malloc(sizeof(*start));
+    pthread_t thread;
+
+    (void) name;
+    (void) stack_depth;
+    (void) priority;
+    (void) core_id;
+    if (start == NULL) {
+        return pdFAIL;
+    }
+    start->code = code;
+    start->param = param;
+    if (pthread_create(&thread, NULL, run_task, start) != 0) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task != NULL) {
+        *created_task = NULL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+    return xTaskCreatePinnedToCore(code, name, stack_depth, param, priority, created_task, 0);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    (void) task;
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec delay = {ticks / 1000, (long) (ticks % 1000) * 1000000};
+
+    nanosleep(&delay, NULL);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct queue *queue = calloc(1, sizeof(*queue));
+    pthread_condattr_t attr;
+
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size + 1);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    return queue;
+}
+
+/** Waits for the queue to change, returns false once the ticks passed. Called with the lock held. */
+static bool wait_for_change(struct queue *queue, TickType_t ticks_to_wait, const struct timespec *deadline) {
+    if (ticks_to_wait == portMAX_DELAY) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+        return true;
+    }
+    return ticks_to_wait > 0 && pthread_cond_timedwait(&queue->changed, &queue->lock, deadline) != ETIMEDOUT;
+}
+
+static struct timespec deadline_after(TickType_t ticks) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (ticks != portMAX_DELAY) {
+        deadline.tv_sec += ticks / 1000;
+        deadline.tv_nsec += (long) (ticks % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    return deadline;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t sent = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (!wait_for_change(queue, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count < queue->length) {
+        if (queue->item_size > 0) {
+            memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->item_size, item,
+                   queue->item_size);
+        }
+        queue->count++;
+        sent = pdTRUE;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t received = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (!wait_for_change(queue, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count > 0) {
+        if (queue->item_size > 0) {
+            memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        }
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        received = pdTRUE;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return received;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+
+    if (mutex != NULL) {
+        xSemaphoreGive(mutex);
+    }
+    return mutex;
+}
@@ -0,0 +1,19 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+#include "queue.h"
+
+/* As in FreeRTOS, a semaphore is a queue of items without data. */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive(semaphore, NULL, ticks_to_wait)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+
+#endif //FREERTOS_SEMPHR_H
@@ -0,0 +1,9 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef FREERTOS_TIMERS_H
+#define FREERTOS_TIMERS_H
+
+#include "FreeRTOS.h"
+
+#endif //FREERTOS_TIMERS_H
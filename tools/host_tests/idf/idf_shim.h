@@ -0,0 +1,54 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef IDF_SHIM_H
+#define IDF_SHIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+/**
+ * Just enough of ESP-IDF, on the host, to run the firmware modules that talk to flash, NVS and the network: FreeRTOS
+ * tasks and queues on POSIX threads, NVS and the partitions in memory, and the HTTP client on OpenSSL. The flash
+ * behaves like NOR flash, erasing sets whole sectors to 0xFF and writing can only clear bits.
+ *
+ * The state lives in memory the test keeps across its simulated restarts, like the real flash does.
+ */
+
+/** Flash activity since the last shim_reset(). */
+struct shim_flash_stats {
+    uint32_t bytes_written;
+    uint32_t sectors_erased;
+    /* Bytes written over ones that weren't erased, which corrupts them on real flash. */
+    uint32_t unerased_writes;
+    uint32_t nvs_writes;
+    uint32_t nvs_bytes_written;
+};
+
+extern struct shim_flash_stats shim_flash_stats;
+
+/** Called by esp_ota_set_boot_partition() before it does anything, e.g. to cut the power at that point. */
+extern void (*shim_before_set_boot)(void);
+
+/** Erases all partitions and NVS, boots from ota_0 and clears the stats. */
+void shim_reset(void);
+
+/** Leaves the partition out of esp_partition_find_first() until the next shim_reset(). */
+void shim_hide_partition(const char *label);
+
+/** Puts the image at the start of the partition, as if flashed over the serial port. */
+void shim_flash_image(const esp_partition_t *partition, const uint8_t *image, size_t len);
+
+const uint8_t *shim_partition_data(const esp_partition_t *partition);
+
+/** The partition set by esp_ota_set_boot_partition(), ota_0 after a reset. */
+const esp_partition_t *shim_boot_partition(void);
+
+/** Erases NVS alone, as erasing its partition would. */
+void shim_nvs_erase_all(void);
+
+bool shim_nvs_has(const char *name, const char *key);
+
+#endif //IDF_SHIM_H
@@ -0,0 +1,16 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <openssl/evp.h>
+#include "mbedtls/base64.h"
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen) {
+    size_t needed = (slen + 2) / 3 * 4 + 1;
+
+    if (dlen < needed) {
+        *olen = needed;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    *olen = (size_t) EVP_EncodeBlock(dst, src, (int) slen);
+    return 0;
+}
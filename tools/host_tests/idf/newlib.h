@@ -0,0 +1,12 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef NEWLIB_H
+#define NEWLIB_H
+
+#include <stddef.h>
+
+/** Functions of the ESP-IDF C library that older glibc lacks, included ahead of every file with -include. */
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#endif //NEWLIB_H
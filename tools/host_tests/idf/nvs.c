@@ -0,0 +1,160 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include "nvs.h"
+#include "idf_shim.h"
+
+#define MAX_NAMESPACES 16
+#define MAX_ENTRIES 64
+#define MAX_NAME_SIZE 16
+#define MAX_BLOB_SIZE 4096
+
+struct entry {
+    bool used;
+    nvs_handle_t handle;
+    char key[MAX_NAME_SIZE];
+    size_t length;
+    uint8_t value[MAX_BLOB_SIZE];
+};
+
+/* A handle is the index of its namespace plus one. */
+static char namespaces[MAX_NAMESPACES][MAX_NAME_SIZE];
+static struct entry entries[MAX_ENTRIES];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct entry *find(nvs_handle_t handle, const char *key) {
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        if (entries[i].used && entries[i].handle == handle && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static nvs_handle_t find_namespace(const char *name) {
+    for (int i = 0; i < MAX_NAMESPACES; i++) {
+        if (strcmp(namespaces[i], name) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void shim_nvs_erase_all(void) {
+    pthread_mutex_lock(&lock);
+    memset(namespaces, 0, sizeof(namespaces));
+    memset(entries, 0, sizeof(entries));
+    pthread_mutex_unlock(&lock);
+}
+
+bool shim_nvs_has(const char *name, const char *key) {
+    nvs_handle_t handle = find_namespace(name);
+
+    return handle != 0 && find(handle, key) != NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&lock);
+    *out_handle = find_namespace(name);
+    if (*out_handle == 0 && open_mode == NVS_READONLY) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (*out_handle == 0) {
+        err = ESP_ERR_NO_MEM;
+        for (int i = 0; i < MAX_NAMESPACES; i++) {
+            if (namespaces[i][0] == 0) {
+                strncpy(namespaces[i], name, MAX_NAME_SIZE - 1);
+                *out_handle = i + 1;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    (void) handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void) handle;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    struct entry *entry;
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&lock);
+    entry = find(handle, key);
+    if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value == NULL) {
+        *length = entry->length;
+    } else if (*length < entry->length) {
+        *length = entry->length;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    struct entry *entry;
+    esp_err_t err = ESP_OK;
+
+    if (length > MAX_BLOB_SIZE) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    pthread_mutex_lock(&lock);
+    entry = find(handle, key);
+    for (int i = 0; entry == NULL && i < MAX_ENTRIES; i++) {
+        if (!entries[i].used) {
+            entry = &entries[i];
+            entry->used = true;
+            entry->handle = handle;
+            strncpy(entry->key, key, MAX_NAME_SIZE - 1);
+        }
+    }
+    if (entry == NULL) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        memcpy(entry->value, value, length);
+        entry->length = length;
+        shim_flash_stats.nvs_writes++;
+        shim_flash_stats.nvs_bytes_written += length;
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value) {
+    size_t length = sizeof(*out_value);
+
+    return nvs_get_blob(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    struct entry *entry;
+
+    pthread_mutex_lock(&lock);
+    entry = find(handle, key);
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(*entry));
+    }
+    pthread_mutex_unlock(&lock);
+    return entry != NULL ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
@@ -0,0 +1,47 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "newlib.h"
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+
+    if (size > 0) {
+        size_t copied = len < size - 1 ? len : size - 1;
+
+        memcpy(dst, src, copied);
+        dst[copied] = 0;
+    }
+    return len;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    static __thread char name[16];
+
+    snprintf(name, sizeof(name), "0x%x", code);
+    return name;
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) {
+    (void) type;
+    return ESP_OK;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    (void) handle;
+    return ESP_OK;
+}
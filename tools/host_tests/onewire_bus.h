@@ -0,0 +1,87 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef ONEWIRE_BUS_H
+#define ONEWIRE_BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "onewire_symbols.h"
+
+/**
+ * Stands in for the RMT receiver on a bus with one device. Turns the items sent by the master into the pulses the
+ * receiver would see: a device answering the reset with a presence pulse and holding the bus low in the slots where it
+ * sends a 0.
+ */
+
+#define BUS_PRESENCE_WAIT_US 30
+#define BUS_DEVICE_0_LOW_US 30
+
+struct onewire_bus {
+    /* Whether a device answers resets. */
+    bool present;
+    /* Low time of the presence pulse. */
+    uint32_t presence_us;
+    /* Slots after each reset the master uses to send a command, the device reads these. */
+    size_t command_slots;
+    /* Bits the device sends in the following read slots, least significant bit of each byte first. */
+    const uint8_t *device_bits;
+    size_t num_device_bits;
+    size_t next_bit;
+};
+
+static size_t bus_pulse(uint32_t *items, size_t pulse, bool level, uint32_t duration) {
+    uint32_t half = (duration & 0x7FFF) | ((uint32_t) level << 15);
+
+    if (pulse % 2 == 0) {
+        items[pulse / 2] = half;
+    } else {
+        items[pulse / 2] |= half << 16;
+    }
+    return pulse + 1;
+}
+
+/**
+ * Writes what the receiver sees for the sent items into rx, ended by a zero duration like the RMT driver does.
+ * Returns the number of rx items, rx must have room for the sent items, one more per reset and the end.
+ */
+static size_t bus_respond(struct onewire_bus *bus, const uint32_t *tx, size_t num_tx, uint32_t *rx) {
+    size_t pulse = 0;
+    size_t slot = 0;
+
+    for (size_t i = 0; i < num_tx; i++) {
+        uint32_t low = tx[i] & 0x7FFF;
+        uint32_t release = (tx[i] >> 16) & 0x7FFF;
+
+        if (low >= ONEWIRE_RESET_LOW_US) {
+            pulse = bus_pulse(rx, pulse, false, low);
+            if (bus->present) {
+                pulse = bus_pulse(rx, pulse, true, BUS_PRESENCE_WAIT_US);
+                pulse = bus_pulse(rx, pulse, false, bus->presence_us);
+                pulse = bus_pulse(rx, pulse, true, release - BUS_PRESENCE_WAIT_US - bus->presence_us);
+            } else {
+                pulse = bus_pulse(rx, pulse, true, release);
+            }
+            slot = 0;
+            continue;
+        }
+        // A short slot after the command is a read slot, the device pulls the bus low for a 0.
+        if (slot++ >= bus->command_slots && low < ONEWIRE_READ_0_MIN_LOW_US
+            && bus->next_bit < bus->num_device_bits) {
+            bool bit = (bus->device_bits[bus->next_bit / 8] >> (bus->next_bit % 8)) & 1;
+            bus->next_bit++;
+            if (!bit) {
+                pulse = bus_pulse(rx, pulse, false, BUS_DEVICE_0_LOW_US);
+                pulse = bus_pulse(rx, pulse, true, low + release - BUS_DEVICE_0_LOW_US);
+                continue;
+            }
+        }
+        pulse = bus_pulse(rx, pulse, false, low);
+        pulse = bus_pulse(rx, pulse, true, release);
+    }
+    pulse = bus_pulse(rx, pulse, false, 0);
+    return (pulse + 1) / 2;
+}
+
+#endif //ONEWIRE_BUS_H
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# © Christopher Morrissey <cmorriss@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-only
+
+"""
+Stands in for the OTA update server in the host tests. Serves the files in a directory over HTTPS with ETags and
+"Range: bytes=<start>-" requests, the way main/volf_ota_update.c resumes a download.
+
+    ota_server.py <dir> <cert> <key>
+
+Prints "port <n>" once it listens. Each line of <dir>/drops is a byte count, the next response with a body sends only
+that many bytes of it and drops the connection, a count of -1 sends it all. Every request is appended to
+<dir>/requests as "<file> <first byte requested or -> <status> <body bytes sent>", before the body is sent.
+"""
+
+import hashlib
+import http.server
+import os
+import re
+import ssl
+import sys
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def log_message(self, format, *args):
+        pass
+
+    def next_drop(self):
+        path = os.path.join(self.server.dir, "drops")
+        if not os.path.exists(path):
+            return -1
+        with open(path) as f:
+            lines = f.read().split()
+        if not lines:
+            return -1
+        with open(path, "w") as f:
+            f.write("\n".join(lines[1:]))
+        return int(lines[0])
+
+    def log_request_line(self, name, start, status, sent):
+        with open(os.path.join(self.server.dir, "requests"), "a") as f:
+            f.write("%s %s %d %d\n" % (name, "-" if start is None else start, status, sent))
+
+    def do_GET(self):
+        name = os.path.basename(self.path)
+        path = os.path.join(self.server.dir, name)
+        match = re.fullmatch(r"bytes=(\d+)-", self.headers.get("Range", ""))
+        start = int(match.group(1)) if match else None
+
+        if not os.path.isfile(path) or name in ("drops", "requests"):
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            self.log_request_line(name, start, 404, 0)
+            return
+
+        with open(path, "rb") as f:
+            data = f.read()
+        etag = '"%s"' % hashlib.sha1(data).hexdigest()
+        if start is not None and start >= len(data):
+            self.send_response(416)
+            self.send_header("Content-Range", "bytes */%d" % len(data))
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            self.log_request_line(name, start, 416, 0)
+            return
+
+        if start is None:
+            status, body = 200, data
+        else:
+            status, body = 206, data[start:]
+        self.send_response(status)
+        self.send_header("ETag", etag)
+        self.send_header("Content-Length", str(len(body)))
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(data) - 1, len(data)))
+        self.end_headers()
+
+        drop = self.next_drop()
+        if 0 <= drop < len(body):
+            body = body[:drop]
+            # Closing the socket without a TLS close_notify, like a connection lost halfway.
+            self.close_connection = True
+        self.log_request_line(name, start, status, len(body))
+        try:
+            self.wfile.write(body)
+            self.wfile.flush()
+        except (ConnectionError, ssl.SSLError):
+            # The client stops reading a body it doesn't want, e.g. a range of an image that changed.
+            pass
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+    server.dir = sys.argv[1]
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(sys.argv[2], sys.argv[3])
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("port %d" % server.server_address[1], flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,190 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string.h>
+#include "host_test.h"
+#include "volf_ap_select.h"
+
+static struct volf_ap_candidate ap(uint8_t id, uint8_t channel, int8_t rssi) {
+    struct volf_ap_candidate candidate = {
+            .bssid = {0x24, 0x0a, 0xc4, 0x00, 0x00, id},
+            .channel = channel,
+            .rssi = rssi,
+    };
+    return candidate;
+}
+
+static void record_attempts(struct volf_ap_history *history, const struct volf_ap_candidate *candidate,
+                            int attempts, int successes, uint32_t connect_ms) {
+    for (int i = 0; i < attempts; i++) {
+        volf_ap_record(history, candidate, i < successes, i < successes ? connect_ms : 0);
+    }
+}
+
+static void test_score() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate unknown = ap(1, 6, -60);
+    struct volf_ap_candidate fast = ap(2, 6, -60);
+    struct volf_ap_candidate failing = ap(3, 6, -60);
+    struct volf_ap_candidate slow = ap(4, 6, -60);
+
+    record_attempts(&history, &fast, 1, 1, 600);
+    record_attempts(&history, &failing, 3, 0, 0);
+    record_attempts(&history, &slow, 1, 1, 60000);
+
+    // Unknown APs are assumed to take 2 s to connect, 10 dB.
+    CHECK_NEAR(volf_ap_score(&history, &unknown), -70, 0.01);
+    CHECK_NEAR(volf_ap_score(&history, &fast), -63, 0.01);
+    // No successes in 3 attempts, 3/4 of the 30 dB failure penalty.
+    CHECK_NEAR(volf_ap_score(&history, &failing), -60 - 22.5 - 10, 0.01);
+    // The connect time penalty stops at 10 dB.
+    CHECK_NEAR(volf_ap_score(&history, &slow), -70, 0.01);
+}
+
+static void test_rank() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate candidates[VOLF_AP_MAX_CANDIDATES + 4];
+    struct volf_ap_candidate unreliable = ap(1, 1, -50);
+
+    candidates[0] = ap(2, 6, -80);
+    candidates[1] = ap(3, 11, -55);
+    candidates[2] = ap(4, 1, -70);
+    CHECK_INT(volf_ap_rank(&history, candidates, 3), 3);
+    CHECK_INT(candidates[0].bssid[5], 3);
+    CHECK_INT(candidates[1].bssid[5], 4);
+    CHECK_INT(candidates[2].bssid[5], 2);
+
+    // An AP seen twice in a scan is only tried once.
+    candidates[0] = ap(2, 6, -80);
+    candidates[1] = ap(3, 11, -55);
+    candidates[2] = ap(2, 6, -60);
+    CHECK_INT(volf_ap_rank(&history, candidates, 3), 2);
+    CHECK_INT(candidates[0].bssid[5], 3);
+    CHECK_INT(candidates[1].bssid[5], 2);
+
+    // The strongest AP loses to a weaker one when it keeps failing.
+    record_attempts(&history, &unreliable, 6, 0, 0);
+    candidates[0] = unreliable;
+    candidates[1] = ap(5, 1, -65);
+    CHECK_INT(volf_ap_rank(&history, candidates, 2), 2);
+    CHECK_INT(candidates[0].bssid[5], 5);
+    CHECK_INT(candidates[1].bssid[5], 1);
+
+    // Only VOLF_AP_MAX_CANDIDATES are looked at.
+    for (int i = 0; i < VOLF_AP_MAX_CANDIDATES + 4; i++) {
+        candidates[i] = ap((uint8_t) (10 + i), 1, (int8_t) (-90 + i));
+    }
+    CHECK_INT(volf_ap_rank(&history, candidates, VOLF_AP_MAX_CANDIDATES + 4), VOLF_AP_MAX_CANDIDATES);
+    CHECK_INT(candidates[0].bssid[5], 10 + VOLF_AP_MAX_CANDIDATES - 1);
+    CHECK_INT(candidates[VOLF_AP_MAX_CANDIDATES - 1].bssid[5], 10);
+
+    CHECK_INT(volf_ap_rank(&history, candidates, 0), 0);
+}
+
+static void test_record() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate first = ap(1, 6, -60);
+    struct volf_ap_candidate other;
+
+    volf_ap_record(&history, &first, true, 1000);
+    CHECK_INT(history.seq, 1);
+    CHECK_INT(history.aps[0].attempts, 1);
+    CHECK_INT(history.aps[0].successes, 1);
+    CHECK_INT(history.aps[0].connect_ms, 1000);
+    CHECK_INT(history.aps[0].channel, 6);
+
+    // A quarter of the way towards the newest connect time.
+    volf_ap_record(&history, &first, true, 2000);
+    CHECK_INT(history.aps[0].connect_ms, 1250);
+    // Failures and fast connects, which report 0, leave it alone.
+    volf_ap_record(&history, &first, false, 0);
+    volf_ap_record(&history, &first, true, 0);
+    CHECK_INT(history.aps[0].connect_ms, 1250);
+    CHECK_INT(history.aps[0].attempts, 4);
+    CHECK_INT(history.aps[0].successes, 3);
+
+    // The AP may move to another channel.
+    first.channel = 11;
+    volf_ap_record(&history, &first, true, 0);
+    CHECK_INT(history.aps[0].channel, 11);
+
+    // Old attempts fade out once the window is full.
+    record_attempts(&history, &first, 11, 0, 0);
+    CHECK_INT(history.aps[0].attempts, 16);
+    CHECK_INT(history.aps[0].successes, 4);
+    volf_ap_record(&history, &first, true, 0);
+    CHECK_INT(history.aps[0].attempts, 9);
+    CHECK_INT(history.aps[0].successes, 3);
+
+    // A connect time that doesn't fit is kept as the longest one.
+    other = ap(2, 1, -70);
+    volf_ap_record(&history, &other, true, 100000);
+    CHECK_INT(history.aps[1].connect_ms, UINT16_MAX);
+}
+
+static void test_record_full_history() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate candidate;
+
+    for (int i = 0; i < VOLF_AP_HISTORY_SIZE; i++) {
+        candidate = ap((uint8_t) i, 1, -60);
+        volf_ap_record(&history, &candidate, true, 1000);
+    }
+    // AP 0 was tried most recently, so AP 1 is replaced.
+    candidate = ap(0, 1, -60);
+    volf_ap_record(&history, &candidate, true, 1000);
+    candidate = ap(100, 1, -60);
+    volf_ap_record(&history, &candidate, false, 0);
+
+    CHECK_INT(history.aps[1].bssid[5], 100);
+    CHECK_INT(history.aps[1].attempts, 1);
+    CHECK_INT(history.aps[1].successes, 0);
+    CHECK_INT(history.aps[1].connect_ms, 0);
+    CHECK_INT(history.aps[0].attempts, 2);
+}
+
+static void test_last_channel() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate first = ap(1, 6, -60);
+    struct volf_ap_candidate second = ap(2, 11, -60);
+    struct volf_ap_candidate failing = ap(3, 1, -60);
+
+    CHECK_INT(volf_ap_last_channel(&history), 0);
+    volf_ap_record(&history, &failing, false, 0);
+    CHECK_INT(volf_ap_last_channel(&history), 0);
+    volf_ap_record(&history, &first, true, 1000);
+    volf_ap_record(&history, &second, true, 1000);
+    CHECK_INT(volf_ap_last_channel(&history), 11);
+    // An AP that has never connected isn't where to look first.
+    volf_ap_record(&history, &failing, false, 0);
+    CHECK_INT(volf_ap_last_channel(&history), 11);
+    volf_ap_record(&history, &first, true, 1000);
+    CHECK_INT(volf_ap_last_channel(&history), 6);
+}
+
+static void test_should_rescan() {
+    struct volf_ap_history history = {0};
+    struct volf_ap_candidate weak = ap(1, 6, VOLF_AP_WEAK_RSSI - 1);
+    struct volf_ap_candidate strong = ap(1, 6, VOLF_AP_WEAK_RSSI);
+    struct volf_ap_candidate other = ap(2, 11, -50);
+
+    volf_ap_record(&history, &weak, true, 1000);
+    CHECK(!volf_ap_should_rescan(&history, &strong));
+    // No other AP has worked, so a scan would find the same one.
+    CHECK(!volf_ap_should_rescan(&history, &weak));
+    volf_ap_record(&history, &other, false, 0);
+    CHECK(!volf_ap_should_rescan(&history, &weak));
+    volf_ap_record(&history, &other, true, 1000);
+    CHECK(volf_ap_should_rescan(&history, &weak));
+    CHECK(!volf_ap_should_rescan(&history, &strong));
+}
+
+int main() {
+    test_score();
+    test_rank();
+    test_record();
+    test_record_full_history();
+    test_last_channel();
+    test_should_rescan();
+    return host_test_result("test_ap_select");
+}
@@ -0,0 +1,148 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "host_test.h"
+#include "volf_energy.h"
+
+/* Matches SLEEP_UA in volf_energy.c, a budget at or below it can't pay for any wakes. */
+#define SLEEP_UA 50.0f
+
+static struct volf_energy_budget typical_budget() {
+    struct volf_energy_budget budget = {
+            .capacity_mah = 2000,
+            .battery_percent = 100,
+            .target_life_days = 365,
+            .min_sleep_duration = 60,
+            .max_sleep_duration = 3600,
+            .critical_battery_percent = 10,
+    };
+    return budget;
+}
+
+static void test_wake_charge() {
+    struct volf_energy_wake idle = {.awake_ms = 3600000};
+    struct volf_energy_wake radio = {.awake_ms = 3600, .radio_ms = 3600};
+    struct volf_energy_wake sensors = {.sensor_ms = 3600, .moisture_sensor = true, .temperature_sensor = true,
+                                       .sht40_sensor = true, .current_sensor = true};
+
+    // An hour awake at 40 mA.
+    CHECK_NEAR(volf_energy_wake_charge(&idle), 40000, 0.5);
+    // 3.6 seconds at 40 + 100 mA.
+    CHECK_NEAR(volf_energy_wake_charge(&radio), 140, 0.01);
+    // Sensors only count while they are read, 5 + 1.5 + 0.5 + 3 mA.
+    CHECK_NEAR(volf_energy_wake_charge(&sensors), 10, 0.01);
+}
+
+static void test_record_wake() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_wake first = {.awake_ms = 3600};
+    struct volf_energy_wake second = {.awake_ms = 7200};
+
+    volf_energy_record_wake(&model, &first);
+    CHECK(model.valid);
+    CHECK_NEAR(model.wake_uah, 40, 0.01);
+    CHECK_INT(model.awake_ms, 3600);
+
+    // A quarter of the way towards the newest wake.
+    volf_energy_record_wake(&model, &second);
+    CHECK_NEAR(model.wake_uah, 50, 0.01);
+    CHECK_INT(model.awake_ms, 4500);
+}
+
+static void test_meets_target() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_budget budget = typical_budget();
+    uint32_t duration = volf_energy_sleep_duration(&model, &budget);
+
+    CHECK(duration > budget.min_sleep_duration);
+    CHECK(duration < budget.max_sleep_duration);
+    // Between the clamps the duration makes the charge last the target life, give or take the rounding.
+    CHECK_NEAR(volf_energy_runtime_hours(&model, &budget, duration), budget.target_life_days * 24.0, 24);
+    CHECK(volf_energy_runtime_hours(&model, &budget, duration + 60) > budget.target_life_days * 24.0);
+    CHECK(volf_energy_runtime_hours(&model, &budget, duration - 60) < budget.target_life_days * 24.0);
+}
+
+static void test_clamps() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_budget budget = typical_budget();
+
+    // A big battery and a short target would wake more often than the min allows.
+    budget.capacity_mah = 100000;
+    budget.target_life_days = 30;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.min_sleep_duration);
+
+    // A small battery and a long target would sleep longer than the max allows.
+    budget.capacity_mah = 500;
+    budget.target_life_days = 365;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.max_sleep_duration);
+
+    // No target is treated as a single day rather than dividing by zero.
+    budget = typical_budget();
+    budget.target_life_days = 0;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.min_sleep_duration);
+}
+
+static void test_critical_floor() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_budget budget = typical_budget();
+
+    // Plenty of charge for the min duration, but at or below the critical level the max is used regardless.
+    budget.capacity_mah = 100000;
+    budget.target_life_days = 1;
+    budget.battery_percent = budget.critical_battery_percent;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.max_sleep_duration);
+    budget.battery_percent = 0;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.max_sleep_duration);
+    budget.battery_percent = -5;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.max_sleep_duration);
+    budget.battery_percent = budget.critical_battery_percent + 0.5f;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), budget.min_sleep_duration);
+}
+
+static void test_budget_boundary() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_budget budget = typical_budget();
+
+    // 1200 mAh over 1000 days is exactly the sleep current, nothing is left for waking.
+    budget.capacity_mah = 1200;
+    budget.target_life_days = 1000;
+    budget.max_sleep_duration = UINT32_MAX;
+    CHECK_NEAR(budget.capacity_mah * 1000.0 / (budget.target_life_days * 24.0), SLEEP_UA, 0.001);
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), UINT32_MAX);
+    budget.target_life_days = 1001;
+    CHECK_INT(volf_energy_sleep_duration(&model, &budget), UINT32_MAX);
+
+    // Just above it the wakes are paid for by sleeping very long, but not forever.
+    budget.target_life_days = 990;
+    CHECK(volf_energy_sleep_duration(&model, &budget) > 100000);
+    CHECK(volf_energy_sleep_duration(&model, &budget) < UINT32_MAX);
+}
+
+static void test_measured_model() {
+    struct volf_energy_model model = {0};
+    struct volf_energy_budget budget = typical_budget();
+    struct volf_energy_wake cheap = {.awake_ms = 500};
+    struct volf_energy_wake costly = {.awake_ms = 10000, .radio_ms = 9000};
+    uint32_t cheap_duration;
+
+    volf_energy_record_wake(&model, &cheap);
+    cheap_duration = volf_energy_sleep_duration(&model, &budget);
+    CHECK(cheap_duration < volf_energy_sleep_duration(&(struct volf_energy_model) {0}, &budget));
+
+    // Costlier wakes have to be spread further apart.
+    for (int i = 0; i < 20; i++) {
+        volf_energy_record_wake(&model, &costly);
+    }
+    CHECK(volf_energy_sleep_duration(&model, &budget) > cheap_duration);
+}
+
+int main() {
+    test_wake_charge();
+    test_record_wake();
+    test_meets_target();
+    test_clamps();
+    test_critical_floor();
+    test_budget_boundary();
+    test_measured_model();
+    return host_test_result("test_energy");
+}
@@ -0,0 +1,144 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "onewire_bus.h"
+#include "onewire_symbols.h"
+
+/* A ROM search aside, the longest read is the 9 byte scratchpad. */
+#define MAX_BYTES 9
+
+static void test_encode_reset() {
+    uint32_t items[1];
+
+    CHECK_INT(onewire_encode_reset(items), 1);
+    // Low for the reset pulse in the first half, released in the second.
+    CHECK_INT(items[0] & 0x7FFF, ONEWIRE_RESET_LOW_US);
+    CHECK_INT((items[0] >> 15) & 1, 0);
+    CHECK_INT((items[0] >> 16) & 0x7FFF, ONEWIRE_RESET_RELEASE_US);
+    CHECK_INT(items[0] >> 31, 1);
+}
+
+static void test_encode_bits() {
+    const uint8_t data[] = {0xCC, 0x01};
+    const uint8_t expected_bits[] = {0, 0, 1, 1, 0, 0, 1, 1, 1, 0};
+    uint32_t items[10];
+
+    CHECK_INT(onewire_encode_bits(data, 10, items), 10);
+    for (int i = 0; i < 10; i++) {
+        uint32_t low = items[i] & 0x7FFF;
+        uint32_t release = (items[i] >> 16) & 0x7FFF;
+
+        CHECK_INT(low, expected_bits[i] ? ONEWIRE_WRITE_1_LOW_US : ONEWIRE_WRITE_0_LOW_US);
+        CHECK_INT(release, expected_bits[i] ? ONEWIRE_WRITE_1_RELEASE_US : ONEWIRE_WRITE_0_RELEASE_US);
+        CHECK_INT((items[i] >> 15) & 1, 0);
+        CHECK_INT(items[i] >> 31, 1);
+    }
+}
+
+static void test_reset_presence(bool present, uint32_t presence_us, bool expected) {
+    struct onewire_bus bus = {.present = present, .presence_us = presence_us};
+    struct onewire_decoder decoder;
+    uint32_t tx[1];
+    uint32_t rx[4];
+    size_t num_rx;
+    bool presence = !expected;
+
+    num_rx = bus_respond(&bus, tx, onewire_encode_reset(tx), rx);
+    onewire_decoder_init(&decoder, rx, num_rx);
+    CHECK(onewire_decode_reset(&decoder, &presence));
+    CHECK_INT(presence, expected);
+}
+
+/** A transaction like reading a scratchpad: reset, a command byte, then reading the bytes the device sends. */
+static void test_transaction(const uint8_t *device_bytes, size_t num_bytes) {
+    const uint8_t command = 0xBE;
+    uint8_t read_slots[MAX_BYTES];
+    uint8_t received[MAX_BYTES];
+    uint8_t sent_command;
+    uint32_t tx[1 + 8 + 8 * MAX_BYTES];
+    uint32_t rx[2 * (1 + 8 + 8 * MAX_BYTES) + 1];
+    size_t num_tx = 0;
+    size_t num_rx;
+    struct onewire_bus bus = {
+            .present = true,
+            .presence_us = 120,
+            .command_slots = 8,
+            .device_bits = device_bytes,
+            .num_device_bits = num_bytes * 8,
+    };
+    struct onewire_decoder decoder;
+    bool presence;
+
+    memset(read_slots, 0xFF, sizeof(read_slots));
+    num_tx += onewire_encode_reset(tx + num_tx);
+    num_tx += onewire_encode_bits(&command, 8, tx + num_tx);
+    num_tx += onewire_encode_bits(read_slots, num_bytes * 8, tx + num_tx);
+    CHECK_INT(num_tx, 1 + 8 + num_bytes * 8);
+    num_rx = bus_respond(&bus, tx, num_tx, rx);
+
+    onewire_decoder_init(&decoder, rx, num_rx);
+    CHECK(onewire_decode_reset(&decoder, &presence));
+    CHECK(presence);
+    // The master sees its own command on the bus.
+    CHECK(onewire_decode_bits(&decoder, &sent_command, 8));
+    CHECK_INT(sent_command, command);
+    CHECK(onewire_decode_bits(&decoder, received, num_bytes * 8));
+    CHECK(memcmp(received, device_bytes, num_bytes) == 0);
+    // The received data ends with the transaction.
+    CHECK(!onewire_decode_bits(&decoder, received, 1));
+}
+
+static void test_truncated() {
+    const uint8_t data[2] = {0x5A, 0xA5};
+    uint8_t received[2];
+    uint32_t tx[16];
+    uint32_t rx[33];
+    struct onewire_bus bus = {.device_bits = data, .num_device_bits = 16};
+    struct onewire_decoder decoder;
+    bool presence;
+    size_t num_rx;
+
+    memset(received, 0xFF, sizeof(received));
+    onewire_encode_bits(received, 16, tx);
+    num_rx = bus_respond(&bus, tx, 16, rx);
+    // Only the pulses of the first 12 slots arrived.
+    onewire_decoder_init(&decoder, rx, 12);
+    CHECK(!onewire_decode_bits(&decoder, received, 16));
+    // Without a reset pulse the reset decodes the first slot and finds no device.
+    onewire_decoder_init(&decoder, rx, num_rx);
+    CHECK(onewire_decode_reset(&decoder, &presence));
+    CHECK(!presence);
+}
+
+static void test_random_transactions() {
+    uint8_t data[MAX_BYTES];
+
+    srand(12);
+    for (int round = 0; round < 200; round++) {
+        size_t num_bytes = 1 + rand() % MAX_BYTES;
+
+        for (size_t i = 0; i < num_bytes; i++) {
+            data[i] = rand();
+        }
+        test_transaction(data, num_bytes);
+    }
+}
+
+int main() {
+    test_encode_reset();
+    test_encode_bits();
+    test_reset_presence(true, 120, true);
+    test_reset_presence(true, 60, true);
+    test_reset_presence(false, 0, false);
+    // Too short to be a presence pulse.
+    test_reset_presence(true, 10, false);
+    test_transaction((const uint8_t[]) {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x1C}, 9);
+    test_transaction((const uint8_t[]) {0x00}, 1);
+    test_transaction((const uint8_t[]) {0xFF}, 1);
+    test_truncated();
+    test_random_transactions();
+    return host_test_result("test_onewire_symbols");
+}
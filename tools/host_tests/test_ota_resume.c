@@ -0,0 +1,459 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "host_test.h"
+#include "idf_shim.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "volf_error.h"
+#include "volf_log.h"
+#include "volf_ota_update.h"
+
+/**
+ * Runs install_ota_update() against ota_server.py, which drops connections partway through the download, with patches
+ * made by tools/delta_ota and full images. Every RETRY, restart and power loss ends a wake, the flash and NVS are kept for the next one like on the device.
+ */
+
+#define NODE "node"
+#define DESIRED_VERSION 13
+#define HASH_LEN 32
+#define SECTOR_SIZE 4096
+/* Matches PROGRESS_SAVE_INTERVAL in volf_ota_update.c. */
+#define SAVE_INTERVAL (16 * SECTOR_SIZE)
+#define MAX_IMAGE_SIZE (512 * 1024)
+#define MAX_REQUESTS 32
+#define NVS_NAME_OTA "volf.ota"
+#define OTA_PROGRESS_KEY "progress"
+
+#define IMAGE_NAME "iot_wifi_sensor_v13.bin"
+#define FULL_PATCH_NAME "iot_wifi_sensor_v13.vdlt"
+#define DELTA_PATCH_NAME "iot_wifi_sensor_v13_from_v12.vdlt"
+
+typedef enum {
+    WAKE_RETURNED,
+    WAKE_RETRY,
+    WAKE_RESTART,
+    WAKE_POWER_LOSS
+} wake_outcome_t;
+
+struct request {
+    char name[64];
+    /* First byte asked for with a Range header, -1 without one. */
+    long start;
+    int status;
+    long sent;
+};
+
+/* Filled in with the certificate of the test server, as the build embeds the one of the real server. */
+uint8_t ca_cert_pem[8192] asm("_binary_ca_cert_pem_start");
+uint8_t ca_cert_pem_end[1] asm("_binary_ca_cert_pem_end");
+
+static char dir[] = "/tmp/volf_ota_test.XXXXXX";
+static pid_t server_pid;
+static jmp_buf restart;
+static uint8_t running_image[MAX_IMAGE_SIZE];
+static size_t running_image_size;
+
+void volf_log_write(esp_log_level_t level, volf_log_module_t module, const char *format, ...) {
+    va_list args;
+
+    (void) level;
+    (void) module;
+    if (getenv("HOST_TEST_VERBOSE") != NULL) {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+void volf_handle_error(volf_error_t error, char *context, int associated_rc) {
+    (void) context;
+    if (associated_rc != ESP_OK && error != CONTINUE) {
+        longjmp(restart, WAKE_RETRY);
+    }
+}
+
+void esp_restart(void) {
+    longjmp(restart, WAKE_RESTART);
+}
+
+static void power_loss(void) {
+    shim_before_set_boot = NULL;
+    longjmp(restart, WAKE_POWER_LOSS);
+}
+
+/** Runs a wake that finds the desired version newer than its own, until it restarts. */
+static wake_outcome_t wake() {
+    wake_outcome_t outcome = setjmp(restart);
+
+    if (outcome == WAKE_RETURNED) {
+        install_ota_update(NODE, DESIRED_VERSION);
+    }
+    return outcome;
+}
+
+static void path_of(char *path, size_t size, const char *name) {
+    snprintf(path, size, "%s/%s", dir, name);
+}
+
+static void write_file(const char *name, const void *data, size_t len) {
+    char path[128];
+    FILE *file;
+
+    path_of(path, sizeof(path), name);
+    file = fopen(path, "wb");
+    fwrite(data, 1, len, file);
+    fclose(file);
+}
+
+static void remove_file(const char *name) {
+    char path[128];
+
+    path_of(path, sizeof(path), name);
+    unlink(path);
+}
+
+/** Flips the bits of one byte of a file on the server. */
+static void corrupt_file(const char *name, long offset) {
+    char path[128];
+    FILE *file;
+    int byte;
+
+    path_of(path, sizeof(path), name);
+    file = fopen(path, "r+b");
+    fseek(file, offset, SEEK_SET);
+    byte = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(~byte & 0xFF, file);
+    fclose(file);
+}
+
+static void set_drops(const char *drops) {
+    write_file("drops", drops, strlen(drops));
+}
+
+static int read_requests(struct request *requests) {
+    char path[128];
+    char start[16];
+    FILE *file;
+    int count = 0;
+
+    path_of(path, sizeof(path), "requests");
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    while (count < MAX_REQUESTS && fscanf(file, "%63s %15s %d %ld", requests[count].name, start,
+                                          &requests[count].status, &requests[count].sent) == 4) {
+        requests[count].start = strcmp(start, "-") == 0 ? -1 : atol(start);
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/** A firmware image of the size, compressible like a real one, with the SHA-256 the build appends. */
+static void make_image(uint8_t *image, size_t size, uint32_t seed) {
+    uint32_t state = seed;
+
+    for (size_t i = 0; i < size - HASH_LEN; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        image[i] = (i / 64) % 4 == 0 ? (uint8_t) state : (uint8_t) (i / 64);
+    }
+    image[0] = 0xE9;
+    EVP_Digest(image, size - HASH_LEN, image + size - HASH_LEN, NULL, EVP_sha256(), NULL);
+}
+
+/** Makes a patch of the image on the server with tools/delta_ota, a delta from the source if there is one. */
+static void make_patch(const char *image_name, const char *patch_name, const char *source_name) {
+    char command[512];
+    char image_path[128];
+    char source_path[128];
+    char patch_path[128];
+
+    path_of(image_path, sizeof(image_path), image_name);
+    path_of(source_path, sizeof(source_path), source_name != NULL ? source_name : "");
+    path_of(patch_path, sizeof(patch_path), patch_name);
+    snprintf(command, sizeof(command), "python3 %s/../delta_ota/volf_delta_gen.py %s%s %s %s >/dev/null",
+             HOST_TESTS_DIR, source_name != NULL ? "--from " : "", source_name != NULL ? source_path : "",
+             image_path, patch_path);
+    CHECK(system(command) == 0);
+}
+
+static bool start_server() {
+    char command[512];
+    char path[128];
+    char line[64];
+    int out[2];
+    int port = 0;
+    FILE *file;
+    size_t len;
+
+    if (mkdtemp(dir) == NULL) {
+        return false;
+    }
+    snprintf(command, sizeof(command), "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+                                       "-days 1 -subj /CN=otaupdates.home -keyout %s/key.pem -out %s/cert.pem "
+                                       "2>/dev/null", dir, dir);
+    if (system(command) != 0) {
+        return false;
+    }
+    path_of(path, sizeof(path), "cert.pem");
+    file = fopen(path, "r");
+    len = fread(ca_cert_pem, 1, sizeof(ca_cert_pem) - 1, file);
+    ca_cert_pem[len] = 0;
+    fclose(file);
+
+    if (pipe(out) != 0) {
+        return false;
+    }
+    server_pid = fork();
+    if (server_pid == 0) {
+        char cert[128];
+        char key[128];
+
+        path_of(cert, sizeof(cert), "cert.pem");
+        path_of(key, sizeof(key), "key.pem");
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        execlp("python3", "python3", HOST_TESTS_DIR "/ota_server.py", dir, cert, key, (char *) NULL);
+        _exit(1);
+    }
+    close(out[1]);
+    file = fdopen(out[0], "r");
+    if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "port %d", &port) != 1) {
+        return false;
+    }
+    fclose(file);
+    snprintf(line, sizeof(line), "%d", port);
+    setenv("HOST_TEST_HTTPS_PORT", line, 1);
+    return true;
+}
+
+static void stop_server() {
+    char command[160];
+
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    system(command);
+}
+
+/** A device running the current version, and a server without any files. */
+static void reset() {
+    shim_reset();
+    shim_flash_image(esp_ota_get_running_partition(), running_image, running_image_size);
+    remove_file(IMAGE_NAME);
+    remove_file(FULL_PATCH_NAME);
+    remove_file(DELTA_PATCH_NAME);
+    remove_file("drops");
+    remove_file("requests");
+}
+
+static void check_installed(const uint8_t *image, size_t size) {
+    const esp_partition_t *boot = shim_boot_partition();
+
+    CHECK(strcmp(boot->label, "ota_1") == 0);
+    CHECK(memcmp(shim_partition_data(boot), image, size) == 0);
+    CHECK(!shim_nvs_has(NVS_NAME_OTA, OTA_PROGRESS_KEY));
+    CHECK_INT(shim_flash_stats.unerased_writes, 0);
+}
+
+static void check_request(const struct request *request, const char *name, long start, int status) {
+    CHECK(strcmp(request->name, name) == 0);
+    CHECK_INT(request->start, start);
+    CHECK_INT(request->status, status);
+}
+
+static void test_resume_after_drops() {
+    static uint8_t image[300000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(image, sizeof(image), 1);
+    write_file(IMAGE_NAME, image, sizeof(image));
+    set_drops("100000 150000");
+
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK(shim_nvs_has(NVS_NAME_OTA, OTA_PROGRESS_KEY));
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+
+    // No patches on the server, the image is resumed from the last sector saved before each drop.
+    CHECK_INT(read_requests(requests), 5);
+    check_request(&requests[0], DELTA_PATCH_NAME, -1, 404);
+    check_request(&requests[1], FULL_PATCH_NAME, -1, 404);
+    check_request(&requests[2], IMAGE_NAME, -1, 200);
+    CHECK_INT(requests[2].sent, 100000);
+    check_request(&requests[3], IMAGE_NAME, SAVE_INTERVAL, 206);
+    CHECK_INT(requests[3].sent, 150000);
+    check_request(&requests[4], IMAGE_NAME, 3 * SAVE_INTERVAL, 206);
+    CHECK_INT(requests[4].sent, sizeof(image) - 3 * SAVE_INTERVAL);
+}
+
+static void test_complete_before_boot() {
+    // Ends at a sector boundary, so the last progress saved is the whole image.
+    static uint8_t image[2 * SAVE_INTERVAL];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(image, sizeof(image), 2);
+    write_file(IMAGE_NAME, image, sizeof(image));
+    shim_before_set_boot = power_loss;
+
+    CHECK_INT(wake(), WAKE_POWER_LOSS);
+    CHECK(shim_nvs_has(NVS_NAME_OTA, OTA_PROGRESS_KEY));
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+
+    // The second wake verifies the image without asking the server for anything past its end.
+    CHECK_INT(read_requests(requests), 3);
+    check_request(&requests[2], IMAGE_NAME, -1, 200);
+    CHECK_INT(requests[2].sent, sizeof(image));
+}
+
+static void test_image_replaced() {
+    static uint8_t first[200000];
+    static uint8_t second[180000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(first, sizeof(first), 3);
+    make_image(second, sizeof(second), 4);
+    write_file(IMAGE_NAME, first, sizeof(first));
+    set_drops("100000");
+
+    CHECK_INT(wake(), WAKE_RETRY);
+    write_file(IMAGE_NAME, second, sizeof(second));
+    // The range comes from a different image, so the download starts over.
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(second, sizeof(second));
+
+    CHECK_INT(read_requests(requests), 5);
+    check_request(&requests[3], IMAGE_NAME, SAVE_INTERVAL, 206);
+    check_request(&requests[4], IMAGE_NAME, -1, 200);
+    CHECK_INT(requests[4].sent, sizeof(second));
+}
+
+static void test_delta_patch() {
+    static uint8_t image[200000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(image, sizeof(image), 5);
+    write_file(IMAGE_NAME, image, sizeof(image));
+    make_patch(IMAGE_NAME, DELTA_PATCH_NAME, "running.bin");
+
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+    CHECK_INT(read_requests(requests), 1);
+    check_request(&requests[0], DELTA_PATCH_NAME, -1, 200);
+}
+
+static void test_foreign_delta() {
+    static uint8_t other[150000];
+    static uint8_t image[200000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(other, sizeof(other), 6);
+    make_image(image, sizeof(image), 7);
+    write_file("other.bin", other, sizeof(other));
+    write_file(IMAGE_NAME, image, sizeof(image));
+    make_patch(IMAGE_NAME, DELTA_PATCH_NAME, "other.bin");
+    set_drops("-1 100000");
+
+    // The delta is for other firmware, rejecting it falls back to the full image, which the next wake resumes.
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+    CHECK_INT(read_requests(requests), 4);
+    check_request(&requests[0], DELTA_PATCH_NAME, -1, 200);
+    check_request(&requests[1], FULL_PATCH_NAME, -1, 404);
+    check_request(&requests[2], IMAGE_NAME, -1, 200);
+    check_request(&requests[3], IMAGE_NAME, SAVE_INTERVAL, 206);
+}
+
+static void test_corrupt_delta() {
+    static uint8_t image[200000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(image, sizeof(image), 9);
+    write_file(IMAGE_NAME, image, sizeof(image));
+    make_patch(IMAGE_NAME, DELTA_PATCH_NAME, "running.bin");
+    // The first byte of the target SHA-256 in the patch header, so the patched image fails its check.
+    corrupt_file(DELTA_PATCH_NAME, 48);
+    set_drops("-1 100000");
+
+    // The delta applies but fails its SHA-256 check, the same wake falls back to the full image and the next wake
+    // resumes that rather than trying the delta again.
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK(shim_nvs_has(NVS_NAME_OTA, OTA_PROGRESS_KEY));
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+    CHECK_INT(read_requests(requests), 3);
+    check_request(&requests[0], DELTA_PATCH_NAME, -1, 200);
+    check_request(&requests[1], IMAGE_NAME, -1, 200);
+    check_request(&requests[2], IMAGE_NAME, SAVE_INTERVAL, 206);
+}
+
+static void test_patch_interrupted() {
+    static uint8_t image[300000];
+    struct request requests[MAX_REQUESTS];
+
+    reset();
+    make_image(image, sizeof(image), 8);
+    write_file(IMAGE_NAME, image, sizeof(image));
+    make_patch(IMAGE_NAME, FULL_PATCH_NAME, NULL);
+    set_drops("20000 100000");
+
+    // The patch can't be resumed, so the same wake falls back to the full image and later wakes resume that.
+    CHECK_INT(wake(), WAKE_RETRY);
+    CHECK_INT(wake(), WAKE_RESTART);
+    check_installed(image, sizeof(image));
+    CHECK_INT(read_requests(requests), 4);
+    check_request(&requests[0], DELTA_PATCH_NAME, -1, 404);
+    check_request(&requests[1], FULL_PATCH_NAME, -1, 200);
+    CHECK_INT(requests[1].sent, 20000);
+    check_request(&requests[2], IMAGE_NAME, -1, 200);
+    check_request(&requests[3], IMAGE_NAME, SAVE_INTERVAL, 206);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    if (!start_server()) {
+        fprintf(stderr, "test_ota_resume: unable to start ota_server.py, it needs python3 and openssl\n");
+        stop_server();
+        return 1;
+    }
+    running_image_size = 150000;
+    make_image(running_image, running_image_size, 12);
+    write_file("running.bin", running_image, running_image_size);
+
+    test_resume_after_drops();
+    test_complete_before_boot();
+    test_image_replaced();
+    test_delta_patch();
+    test_foreign_delta();
+    test_corrupt_delta();
+    test_patch_interrupted();
+
+    stop_server();
+    return host_test_result("test_ota_resume");
+}
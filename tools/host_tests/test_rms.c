@@ -0,0 +1,121 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <math.h>
+#include "host_test.h"
+#include "volf_rms.h"
+
+/* The rates read_ac_currents() samples at, 4 channels sharing 20 kHz. */
+#define SAMPLE_RATE_HZ 5000
+#define MAINS_HZ 60
+/* Matches MAINS_CYCLES in ac_current_sensor.c. */
+#define CYCLES 6
+
+static uint32_t sine_sample(uint32_t i, double offset, double amplitude, double phase) {
+    return (uint32_t) lround(offset + amplitude * sin(2.0 * M_PI * MAINS_HZ * i / SAMPLE_RATE_HZ + phase));
+}
+
+static void test_empty() {
+    struct volf_rms rms;
+
+    volf_rms_init(&rms, 10);
+    CHECK_INT(volf_rms_result(&rms), 0);
+    CHECK_INT(volf_rms_mean(&rms), 0);
+    CHECK(!volf_rms_full(&rms));
+}
+
+static void test_dc() {
+    struct volf_rms rms;
+
+    volf_rms_init(&rms, 1000);
+    for (int i = 0; i < 1000; i++) {
+        volf_rms_add(&rms, 1650);
+    }
+    CHECK(volf_rms_full(&rms));
+    // The DC offset is subtracted, leaving nothing.
+    CHECK_INT(volf_rms_result(&rms), 0);
+    CHECK_INT(volf_rms_mean(&rms), 1650);
+}
+
+static void test_limit() {
+    struct volf_rms rms;
+
+    volf_rms_init(&rms, 4);
+    for (int i = 0; i < 4; i++) {
+        volf_rms_add(&rms, i % 2 == 0 ? 100 : 300);
+    }
+    // Samples past the limit are ignored.
+    volf_rms_add(&rms, 100000);
+    CHECK_INT(rms.count, 4);
+    CHECK_INT(volf_rms_result(&rms), 100);
+}
+
+static void test_rounding() {
+    struct volf_rms rms;
+
+    // The mean is 1.5, sqrt((3 * 1.5^2 + 4.5^2) / 4) = 2.6.
+    volf_rms_init(&rms, 4);
+    volf_rms_add(&rms, 0);
+    volf_rms_add(&rms, 0);
+    volf_rms_add(&rms, 0);
+    volf_rms_add(&rms, 6);
+    CHECK_INT(volf_rms_result(&rms), 3);
+    CHECK_INT(volf_rms_mean(&rms), 2);
+
+    // The mean is 1, sqrt((1^2 + 1^2 + 2^2) / 3) = sqrt(2) rounds down.
+    volf_rms_init(&rms, 3);
+    volf_rms_add(&rms, 0);
+    volf_rms_add(&rms, 0);
+    volf_rms_add(&rms, 3);
+    CHECK_INT(volf_rms_result(&rms), 1);
+}
+
+static void test_window() {
+    // 83.3 samples per cycle, rounding that first would leave 498 samples, 2 short of 6 whole cycles.
+    CHECK_INT(volf_rms_window(SAMPLE_RATE_HZ, MAINS_HZ, CYCLES), 500);
+    // 3 channels sharing 20 kHz.
+    CHECK_INT(volf_rms_window(20000 / 3, MAINS_HZ, CYCLES), 666);
+    CHECK_INT(volf_rms_window(20000, 50, 2), 800);
+    CHECK_INT(volf_rms_window(40, 60, 5), 3);
+}
+
+static void test_sine(double offset, double amplitude, double phase) {
+    uint32_t window = volf_rms_window(SAMPLE_RATE_HZ, MAINS_HZ, CYCLES);
+    double expected = amplitude / sqrt(2);
+    struct volf_rms rms;
+
+    volf_rms_init(&rms, window);
+    for (uint32_t i = 0; !volf_rms_full(&rms); i++) {
+        volf_rms_add(&rms, sine_sample(i, offset, amplitude, phase));
+    }
+    // The samples are rounded to whole millivolts, which leaves a small error.
+    CHECK_NEAR(volf_rms_result(&rms), expected, expected * 0.002 + 1);
+    CHECK_NEAR(volf_rms_mean(&rms), offset, amplitude * 0.01 + 1);
+}
+
+static void test_long_window() {
+    struct volf_rms rms;
+    uint32_t window = 10000000;
+
+    // Far more full scale samples than a window ever holds, the sums must not overflow.
+    volf_rms_init(&rms, window);
+    for (uint32_t i = 0; i < window; i++) {
+        volf_rms_add(&rms, i % 2 == 0 ? 0 : 3300);
+    }
+    CHECK_INT(volf_rms_result(&rms), 1650);
+    CHECK_INT(volf_rms_mean(&rms), 1650);
+}
+
+int main() {
+    test_empty();
+    test_dc();
+    test_limit();
+    test_rounding();
+    test_window();
+    test_sine(1000, 1000, 0);
+    test_sine(1650, 800, 0);
+    test_sine(1650, 800, M_PI / 3);
+    test_sine(3000, 50, 1);
+    test_long_window();
+    return host_test_result("test_rms");
+}
@@ -0,0 +1,348 @@
+// © Christopher Morrissey <cmorriss@gmail.com>
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "volf_log.h"
+#include "volf_tls_session.h"
+
+/**
+ * Connects through volf_tls_session_install()'s connect function to tls_broker.py with mbedTLS, as each wake does
+ * before aws_iot_shadow_connect(), and sends an MQTT CONNECT over the session. The saved session lives in memory for
+ * the whole test, like it lives in RTC memory across deep sleep. Needs the mbedTLS 2.x that ESP-IDF 4.x ships.
+ */
+
+#define MAX_PEM_SIZE 4096
+#define MAX_CONNECTIONS 32
+#define TIMEOUT_MS 5000
+/* Reads time out after TLS_READ_TIMEOUT_MS once connected. */
+#define MAX_READ_ATTEMPTS 500
+
+static char dir[] = "/tmp/volf_tls_test.XXXXXX";
+static pid_t broker_pid;
+static uint16_t broker_port;
+static char server_cert[MAX_PEM_SIZE];
+static char client_cert[MAX_PEM_SIZE];
+static char client_key[MAX_PEM_SIZE];
+
+void volf_log_write(esp_log_level_t level, volf_log_module_t module, const char *format, ...) {
+    va_list args;
+
+    (void) level;
+    (void) module;
+    if (getenv("HOST_TEST_VERBOSE") != NULL) {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+static void path_of(char *path, size_t size, const char *name) {
+    snprintf(path, size, "%s/%s", dir, name);
+}
+
+static void write_file(const char *name, const char *data) {
+    char path[128];
+    FILE *file;
+
+    path_of(path, sizeof(path), name);
+    file = fopen(path, "w");
+    fputs(data, file);
+    fclose(file);
+}
+
+static bool read_pem(const char *name, char *pem) {
+    char path[128];
+    FILE *file;
+    size_t len;
+
+    path_of(path, sizeof(path), name);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    len = fread(pem, 1, MAX_PEM_SIZE - 1, file);
+    pem[len] = 0;
+    fclose(file);
+    return len > 0;
+}
+
+/** The broker's log of the connections since the last reset(), one word per connection and "mqtt" or "-" after it. */
+static int read_connections(char connections[MAX_CONNECTIONS][16]) {
+    char path[128];
+    char mqtt[8];
+    FILE *file;
+    int count = 0;
+
+    path_of(path, sizeof(path), "connections");
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    while (count < MAX_CONNECTIONS && fscanf(file, "%15s", connections[count]) == 1) {
+        if (strcmp(connections[count], "dropped") != 0 && fscanf(file, "%7s", mqtt) == 1 && strcmp(mqtt, "-") == 0) {
+            strcat(connections[count], "-");
+        }
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static bool make_cert(const char *name, const char *subject) {
+    char command[512];
+
+    snprintf(command, sizeof(command), "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+                                       "-days 1 -subj /CN=%s -keyout %s/%s-key.pem -out %s/%s-cert.pem 2>/dev/null",
+             subject, dir, name, dir, name);
+    return system(command) == 0;
+}
+
+static bool start_broker() {
+    char line[64];
+    int out[2];
+    int port = 0;
+    FILE *file;
+
+    if (mkdtemp(dir) == NULL || !make_cert("server", "localhost") || !make_cert("client", "node")) {
+        return false;
+    }
+    if (!read_pem("server-cert.pem", server_cert) || !read_pem("client-cert.pem", client_cert)
+        || !read_pem("client-key.pem", client_key)) {
+        return false;
+    }
+
+    if (pipe(out) != 0) {
+        return false;
+    }
+    broker_pid = fork();
+    if (broker_pid == 0) {
+        char cert[128];
+        char key[128];
+        char client[128];
+
+        path_of(cert, sizeof(cert), "server-cert.pem");
+        path_of(key, sizeof(key), "server-key.pem");
+        path_of(client, sizeof(client), "client-cert.pem");
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        execlp("python3", "python3", HOST_TESTS_DIR "/tls_broker.py", dir, cert, key, client, (char *) NULL);
+        _exit(1);
+    }
+    close(out[1]);
+    file = fdopen(out[0], "r");
+    if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "port %d", &port) != 1) {
+        return false;
+    }
+    fclose(file);
+    broker_port = (uint16_t) port;
+    return true;
+}
+
+static void stop_broker() {
+    char command[160];
+
+    if (broker_pid > 0) {
+        kill(broker_pid, SIGTERM);
+        waitpid(broker_pid, NULL, 0);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    system(command);
+}
+
+/** A port nothing listens on, bound and closed again. */
+static uint16_t closed_port() {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    getsockname(sock, (struct sockaddr *) &addr, &len);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+/** Sends an MQTT CONNECT and returns true once the CONNACK accepting it is read. */
+static bool mqtt_connect(mbedtls_ssl_context *ssl) {
+    static const unsigned char connect[] = {0x10, 16, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60, 0, 4,
+                                            'n', 'o', 'd', 'e'};
+    static const unsigned char connack[] = {0x20, 0x02, 0x00, 0x00};
+    unsigned char reply[sizeof(connack)];
+    size_t len = 0;
+    int ret;
+
+    if (mbedtls_ssl_write(ssl, connect, sizeof(connect)) != sizeof(connect)) {
+        return false;
+    }
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS && len < sizeof(reply); attempt++) {
+        ret = mbedtls_ssl_read(ssl, reply + len, sizeof(reply) - len);
+        if (ret > 0) {
+            len += ret;
+        } else if (ret != MBEDTLS_ERR_SSL_TIMEOUT && ret != MBEDTLS_ERR_SSL_WANT_READ) {
+            return false;
+        }
+    }
+    return len == sizeof(reply) && memcmp(reply, connack, sizeof(connack)) == 0;
+}
+
+/** Frees what the connect function left set up, as the port's disconnect and destroy functions do. */
+static void disconnect(TLSDataParams *tls) {
+    mbedtls_ssl_close_notify(&tls->ssl);
+    mbedtls_net_free(&tls->server_fd);
+    mbedtls_x509_crt_free(&tls->clicert);
+    mbedtls_x509_crt_free(&tls->cacert);
+    mbedtls_pk_free(&tls->pkey);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+}
+
+/** A wake's connect to the broker on the port, an MQTT CONNECT over it if it succeeds, then the disconnect. */
+static IoT_Error_t wake_connect(uint16_t port) {
+    AWS_IoT_Client client;
+    TLSConnectParams params = {
+            .pRootCALocation = server_cert,
+            .pDeviceCertLocation = client_cert,
+            .pDevicePrivateKeyLocation = client_key,
+            .pDestinationURL = "localhost",
+            .DestinationPort = port,
+            .timeout_ms = TIMEOUT_MS,
+            .ServerVerificationFlag = true,
+    };
+    IoT_Error_t rc;
+
+    memset(&client, 0, sizeof(client));
+    volf_tls_session_install(&client);
+    rc = client.networkStack.connect(&client.networkStack, &params);
+    if (rc == SUCCESS) {
+        CHECK(mqtt_connect(&client.networkStack.tlsDataParams.ssl));
+        disconnect(&client.networkStack.tlsDataParams);
+    }
+    return rc;
+}
+
+/** A device without a saved session, and a broker with a fresh log. */
+static void reset() {
+    char path[128];
+
+    volf_tls_session_clear();
+    path_of(path, sizeof(path), "connections");
+    unlink(path);
+    path_of(path, sizeof(path), "script");
+    unlink(path);
+}
+
+static void check_connections(int count, const char *expected[]) {
+    char connections[MAX_CONNECTIONS][16];
+
+    CHECK_INT(read_connections(connections), count);
+    for (int i = 0; i < count; i++) {
+        CHECK(strcmp(connections[i], expected[i]) == 0);
+    }
+}
+
+static void test_resumed_after_full_handshake() {
+    uint32_t full_ms;
+
+    reset();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(!volf_tls_session_resumed());
+    full_ms = volf_tls_get_handshake_time_ms();
+
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(volf_tls_session_resumed());
+    // Without the certificates and key exchange.
+    CHECK(volf_tls_get_handshake_time_ms() <= full_ms);
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(volf_tls_session_resumed());
+    check_connections(3, (const char *[]) {"full", "resumed", "resumed"});
+}
+
+static void test_cleared() {
+    reset();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    volf_tls_session_clear();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(!volf_tls_session_resumed());
+    check_connections(2, (const char *[]) {"full", "full"});
+}
+
+static void test_broker_forgot_session() {
+    reset();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    write_file("script", "forget");
+
+    // The broker turns down the saved session within the handshake, which carries on as a full one.
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(!volf_tls_session_resumed());
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(volf_tls_session_resumed());
+    check_connections(3, (const char *[]) {"full", "full", "resumed"});
+}
+
+static void test_resume_dropped() {
+    reset();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    write_file("script", "drop");
+
+    // A failed connect with the saved session drops it and is retried with a full handshake right away.
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(!volf_tls_session_resumed());
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(volf_tls_session_resumed());
+    check_connections(4, (const char *[]) {"full", "dropped", "full", "resumed"});
+}
+
+static void test_full_handshake_dropped() {
+    reset();
+    write_file("script", "drop");
+
+    // Without a saved session there is nothing to fall back to, the wake handles the error.
+    CHECK_INT(wake_connect(broker_port), SSL_CONNECTION_ERROR);
+    CHECK(!volf_tls_session_resumed());
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(!volf_tls_session_resumed());
+    check_connections(2, (const char *[]) {"dropped", "full"});
+}
+
+static void test_broker_unreachable() {
+    reset();
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+
+    CHECK_INT(wake_connect(closed_port()), NETWORK_ERR_NET_CONNECT_FAILED);
+    CHECK(!volf_tls_session_resumed());
+    // Only the session the broker turned down is dropped, not one the network never got to.
+    CHECK_INT(wake_connect(broker_port), SUCCESS);
+    CHECK(volf_tls_session_resumed());
+    check_connections(2, (const char *[]) {"full", "resumed"});
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    if (!start_broker()) {
+        fprintf(stderr, "test_tls_session: unable to start tls_broker.py, it needs python3 and openssl\n");
+        stop_broker();
+        return 1;
+    }
+
+    test_resumed_after_full_handshake();
+    test_cleared();
+    test_broker_forgot_session();
+    test_resume_dropped();
+    test_full_handshake_dropped();
+    test_broker_unreachable();
+
+    stop_broker();
+    return host_test_result("test_tls_session");
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# © Christopher Morrissey <cmorriss@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-only
+
+"""
+Stands in for the AWS IoT broker in the host tests. Accepts TLS 1.2 connections from a client with a certificate,
+resuming sessions by session ID or ticket like the broker, and answers an MQTT CONNECT with a CONNACK.
+
+    tls_broker.py <dir> <cert> <key> <client cert>
+
+Prints "port <n>" once it listens. Each line of <dir>/script is what to do with the next connection: "drop" closes it
+before the handshake, "forget" starts a new TLS context first, without the sessions and ticket key of the old one,
+like a broker the client reaches through another host. Every connection is appended to <dir>/connections as
+"dropped", or as "full" or "resumed" followed by "mqtt" once a CONNACK was sent or "-" without a CONNECT.
+"""
+
+import os
+import socket
+import ssl
+import sys
+
+CONNECT = 0x10
+CONNACK = b"\x20\x02\x00\x00"
+
+
+def new_context(cert, key, client_cert):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(cert, key)
+    context.load_verify_locations(client_cert)
+    context.verify_mode = ssl.CERT_REQUIRED
+    return context
+
+
+def next_action(dir):
+    path = os.path.join(dir, "script")
+    if not os.path.exists(path):
+        return None
+    with open(path) as f:
+        lines = f.read().split()
+    if not lines:
+        return None
+    with open(path, "w") as f:
+        f.write("\n".join(lines[1:]))
+    return lines[0]
+
+
+def log_connection(dir, line):
+    with open(os.path.join(dir, "connections"), "a") as f:
+        f.write(line + "\n")
+
+
+def read_exactly(conn, size):
+    data = b""
+    while len(data) < size:
+        chunk = conn.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_connect(conn):
+    """Reads one MQTT packet, returns True if it was a CONNECT."""
+    header = read_exactly(conn, 1)
+    if header is None:
+        return False
+    length = 0
+    shift = 0
+    while True:
+        byte = read_exactly(conn, 1)
+        if byte is None:
+            return False
+        length |= (byte[0] & 0x7F) << shift
+        shift += 7
+        if byte[0] & 0x80 == 0:
+            break
+    return read_exactly(conn, length) is not None and header[0] == CONNECT
+
+
+def serve(conn, dir):
+    resumed = "resumed" if conn.session_reused else "full"
+    try:
+        if not read_connect(conn):
+            log_connection(dir, resumed + " -")
+            return
+        # Logged before the CONNACK, so the client finds it in the log once it has its reply.
+        log_connection(dir, resumed + " mqtt")
+        conn.sendall(CONNACK)
+        while conn.recv(1024):
+            pass
+    except (ConnectionError, ssl.SSLError):
+        pass
+
+
+def main():
+    if len(sys.argv) != 5:
+        sys.exit(__doc__)
+    dir, cert, key, client_cert = sys.argv[1:]
+    context = new_context(cert, key, client_cert)
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(4)
+    print("port %d" % listener.getsockname()[1], flush=True)
+
+    while True:
+        sock, _ = listener.accept()
+        action = next_action(dir)
+        if action == "drop":
+            log_connection(dir, "dropped")
+            sock.close()
+            continue
+        if action == "forget":
+            context = new_context(cert, key, client_cert)
+        try:
+            conn = context.wrap_socket(sock, server_side=True)
+        except (ConnectionError, ssl.SSLError, OSError):
+            sock.close()
+            continue
+        with conn:
+            serve(conn, dir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+# © Christopher Morrissey <cmorriss@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-only
+
+"""
+Turns the binary log entries written by a sensor with binaryLog enabled back into the usual text lines.
+
+A binary entry is a line holding the marker followed by the entry in base64. The entry starts with the address of the
+format string and the runtime in milliseconds, followed by the raw arguments, see encode_binary() in main/volf_log.c.
+The format strings are read from the ELF the sensor runs, build/iot_wifi_sensor.elf, which needs pyelftools
+(pip install pyelftools). Lines without the marker are copied unchanged, so a whole UART capture can be decoded.
+
+With --crash-log the inputs are payloads published on volf/<thing>/crashlog instead, see main/volf_crash_log.h. Both
+the text and the binary entries they hold are written out as text.
+
+Usage: volf_log_decode.py firmware.elf [capture ...]   (reads stdin without captures)
+       volf_log_decode.py --crash-log firmware.elf payload ...
+"""
+
+import argparse
+import base64
+import binascii
+import fileinput
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+from elftools.elf.constants import SH_FLAGS
+
+# Must match main/volf_log.c.
+BINARY_LOG_MARKER = "#VL:"
+HEADER_FORMAT = "<II"
+# Must match main/volf_crash_log.h.
+CRASH_LOG_PAYLOAD_MAGIC = b"VCL1"
+CRASH_LOG_HEADER_FORMAT = "<4sH"
+RECORD_BINARY = 0x1
+
+CONVERSION = re.compile(r"%(?P<flags>[-+ #0]*)(?P<width>\*|\d*)(?:\.(?P<precision>\*|\d*))?"
+                        r"(?P<length>hh|h|ll|l|j|z|t|L)?(?P<type>[diuxXocpfFeEgGaAsn%])")
+FLOAT_TYPES = "fFeEgGaA"
+
+
+class FormatStrings:
+    """Reads NUL terminated strings from the allocated sections of an ELF by address."""
+
+    def __init__(self, elf_path):
+        self.sections = []
+        self.cache = {}
+        with open(elf_path, "rb") as f:
+            elf = ELFFile(f)
+            for section in elf.iter_sections():
+                if section["sh_flags"] & SH_FLAGS.SHF_ALLOC and section["sh_type"] == "SHT_PROGBITS":
+                    self.sections.append((section["sh_addr"], section.data()))
+
+    def get(self, address):
+        if address not in self.cache:
+            self.cache[address] = self._read(address)
+        return self.cache[address]
+
+    def _read(self, address):
+        for start, data in self.sections:
+            if start <= address < start + len(data):
+                end = data.find(b"\0", address - start)
+                return data[address - start:end if end >= 0 else len(data)].decode("utf-8", "replace")
+        return None
+
+
+def read_value(conversion, data, offset):
+    """Returns the argument for one conversion and the offset after it, or None if the entry ends first."""
+    kind = conversion["type"]
+    if kind == "s":
+        if offset >= len(data) or offset + 1 + data[offset] > len(data):
+            return None, len(data)
+        size = data[offset]
+        return data[offset + 1:offset + 1 + size].decode("utf-8", "replace"), offset + 1 + size
+    if kind in FLOAT_TYPES:
+        fmt = "<d"
+    elif conversion["length"] in ("ll", "j"):
+        fmt = "<q"
+    else:
+        fmt = "<i"
+    if offset + struct.calcsize(fmt) > len(data):
+        return None, len(data)
+    value = struct.unpack_from(fmt, data, offset)[0]
+    if kind in "uxXop" and value < 0:
+        value += 1 << (8 * struct.calcsize(fmt))
+    return value, offset + struct.calcsize(fmt)
+
+
+def format_one(conversion, value, width, precision):
+    """Formats a single C conversion with Python's printf style formatting."""
+    kind = conversion["type"]
+    spec = "%" + conversion["flags"]
+    spec += str(width) if width is not None else ""
+    spec += "." + str(precision) if precision is not None else ""
+    if value is None:
+        return (spec + "s") % "?"
+    if kind == "p":
+        return (spec + "s") % ("0x%x" % value)
+    if kind in "aA":
+        return (spec + "s") % float.hex(value)
+    if kind == "c":
+        return (spec + "c") % chr(value & 0xFF)
+    return (spec + {"i": "d", "u": "d"}.get(kind, kind)) % value
+
+
+def format_entry(format_string, data, offset):
+    out = []
+    last = 0
+    for conversion in CONVERSION.finditer(format_string):
+        out.append(format_string[last:conversion.start()])
+        last = conversion.end()
+        if conversion["type"] == "%":
+            out.append("%")
+            continue
+        width = conversion["width"] or None
+        precision = conversion["precision"]
+        if width == "*":
+            width, offset = read_value({"type": "d", "length": None}, data, offset)
+        if precision == "*":
+            precision, offset = read_value({"type": "d", "length": None}, data, offset)
+        if conversion["type"] == "n":
+            continue
+        value, offset = read_value(conversion, data, offset)
+        out.append(format_one(conversion, value, width, precision))
+    out.append(format_string[last:])
+    return "".join(out)
+
+
+def decode_entry(strings, data):
+    """Returns the text of a binary entry, or None if it is too short to be one."""
+    if len(data) < struct.calcsize(HEADER_FORMAT):
+        return None
+    address, runtime = struct.unpack_from(HEADER_FORMAT, data)
+    format_string = strings.get(address)
+    if format_string is None:
+        return "(%d) <unknown format string at 0x%08x, does the ELF match the firmware?>\n" % (runtime, address)
+    return "(%d) %s" % (runtime, format_entry(format_string, data, struct.calcsize(HEADER_FORMAT)))
+
+
+def decode_line(strings, line):
+    try:
+        data = base64.b64decode(line[len(BINARY_LOG_MARKER):].strip(), validate=True)
+    except binascii.Error:
+        return line
+    return decode_entry(strings, data) or line
+
+
+def read_length(data, ip, length):
+    """Adds the bytes of a length that didn't fit in the token."""
+    while True:
+        byte = data[ip]
+        ip += 1
+        length += byte
+        if byte != 255:
+            return ip, length
+
+
+def lz_decompress(data):
+    """Decompresses the LZ4 block format written by main/volf_lz.c."""
+    out = bytearray()
+    ip = 0
+    while ip < len(data):
+        token = data[ip]
+        ip += 1
+        length = token >> 4
+        if length == 15:
+            ip, length = read_length(data, ip, length)
+        out += data[ip:ip + length]
+        ip += length
+        if ip >= len(data):
+            break
+        offset = data[ip] | data[ip + 1] << 8
+        ip += 2
+        length = token & 15
+        if length == 15:
+            ip, length = read_length(data, ip, length)
+        if offset == 0 or offset > len(out):
+            raise ValueError("corrupt compressed data, match offset %d at %d bytes" % (offset, len(out)))
+        for _ in range(length + 4):
+            out.append(out[-offset])
+    return bytes(out)
+
+
+def decode_crash_log(strings, payload):
+    header_size = struct.calcsize(CRASH_LOG_HEADER_FORMAT)
+    magic, size = struct.unpack_from(CRASH_LOG_HEADER_FORMAT, payload)
+    if magic != CRASH_LOG_PAYLOAD_MAGIC:
+        raise ValueError("not a crash log payload")
+    records = lz_decompress(payload[header_size:])
+    if len(records) != size:
+        raise ValueError("crash log holds %d bytes, expected %d" % (len(records), size))
+    ip = 0
+    while ip + 2 <= len(records):
+        flags, length = records[ip], records[ip + 1]
+        entry = records[ip + 2:ip + 2 + length]
+        ip += 2 + length
+        if flags & RECORD_BINARY:
+            yield decode_entry(strings, entry) or "<truncated binary entry>\n"
+        else:
+            yield entry.decode("utf-8", "replace")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes binary log entries and crash logs of the sensors.")
+    parser.add_argument("--crash-log", action="store_true", help="inputs are crash log payloads")
+    parser.add_argument("elf", help="ELF of the firmware that wrote the log")
+    parser.add_argument("inputs", nargs="*", help="UART captures or crash log payloads, stdin without any")
+    args = parser.parse_args()
+
+    strings = FormatStrings(args.elf)
+    if args.crash_log:
+        for path in args.inputs or ["-"]:
+            with (open(path, "rb") if path != "-" else sys.stdin.buffer) as f:
+                for line in decode_crash_log(strings, f.read()):
+                    sys.stdout.write(line)
+        return
+    for line in fileinput.input(args.inputs):
+        marker = line.find(BINARY_LOG_MARKER)
+        if marker >= 0:
+            line = decode_line(strings, line[marker:])
+        sys.stdout.write(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# © Christopher Morrissey <cmorriss@gmail.com>
+# SPDX-License-Identifier: GPL-3.0-only
+
+"""
+Turns the "phases" history uploaded by the sensors into per-phase percentiles.
+
+Input is one JSON document per line, either the shadow update or the decoded CBOR telemetry as published by the
+sensor ({"state": {"reported": {...}}}) or just the reported object. An optional "thingName" key on the document keeps
+the wakes of different sensors apart. The same wake can be uploaded more than once if a publish wasn't acknowledged, so
+wakes are counted once per sensor.
+
+Usage: phase_percentiles.py [file ...]   (reads stdin without files)
+"""
+
+import fileinput
+import json
+import sys
+
+# Must match profile_phase_t in main/volf_profile.h.
+PHASES = [
+    "boot",
+    "nvsInit",
+    "wifiAssociate",
+    "ipAcquire",
+    "connect",
+    "shadow",
+    "readBattery",
+    "readMoisture",
+    "readTemperature",
+    "readSht40",
+    "readCurrent",
+    "publish",
+    "sleep",
+]
+# The sleep phase is a point in time, its start is how long the wake was awake.
+POINT_PHASES = {"sleep"}
+HEADER_SIZE = 3
+PERCENTILES = [50, 90, 99]
+
+
+def percentile(values, pct):
+    """Nearest rank percentile of sorted values."""
+    rank = max(1, -(-len(values) * pct // 100))
+    return values[rank - 1]
+
+
+def wakes_from_document(doc):
+    reported = doc.get("state", {}).get("reported", doc)
+    return reported.get("phases", [])
+
+
+def collect(lines):
+    seen = set()
+    durations = {phase: [] for phase in PHASES}
+    rssi = []
+    reconnects = []
+
+    for line in lines:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            doc = json.loads(line)
+        except ValueError:
+            print("Skipping a line that isn't JSON.", file=sys.stderr)
+            continue
+        thing = doc.get("thingName")
+        for wake in wakes_from_document(doc):
+            if len(wake) < HEADER_SIZE + 2 * len(PHASES) or (thing, wake[0]) in seen:
+                continue
+            seen.add((thing, wake[0]))
+            if wake[1] != 0:
+                rssi.append(wake[1])
+            reconnects.append(wake[2])
+            for i, phase in enumerate(PHASES):
+                start = wake[HEADER_SIZE + 2 * i]
+                duration = wake[HEADER_SIZE + 2 * i + 1]
+                if start == 0 and duration == 0:
+                    continue
+                durations[phase].append(start if phase in POINT_PHASES else duration)
+    return len(seen), durations, rssi, reconnects
+
+
+def print_row(name, count, values, scale):
+    values = sorted(values)
+    cells = ["{:>10.1f}".format(percentile(values, pct) / scale) for pct in PERCENTILES]
+    cells.append("{:>10.1f}".format(values[-1] / scale))
+    print("{:<16}{:>8}{}".format(name, count, "".join(cells)))
+
+
+def main():
+    num_wakes, durations, rssi, reconnects = collect(fileinput.input(sys.argv[1:]))
+    if num_wakes == 0:
+        print("No phase timings found.", file=sys.stderr)
+        return 1
+
+    print("{} wakes, times in ms".format(num_wakes))
+    print("{:<16}{:>8}{}{:>10}".format("phase", "wakes", "".join("{:>10}".format("p%d" % p) for p in PERCENTILES),
+                                       "max"))
+    for phase in PHASES:
+        if durations[phase]:
+            print_row("awake" if phase in POINT_PHASES else phase, len(durations[phase]), durations[phase], 1000.0)
+    if rssi:
+        # Higher is better for RSSI, so the percentiles are of the negated values: p90 is the 10th percentile signal.
+        print_row("rssi (-dBm)", len(rssi), [-value for value in rssi], 1)
+    print_row("reconnects", len(reconnects), reconnects, 1)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())